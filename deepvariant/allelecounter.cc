@@ -50,6 +50,7 @@
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "third_party/nucleus/io/sam_record_view.h"
 #include "third_party/nucleus/protos/cigar.pb.h"
 #include "third_party/nucleus/protos/position.pb.h"
 #include "third_party/nucleus/util/utils.h"
@@ -59,10 +60,6 @@ namespace learning {
 namespace genomics {
 namespace deepvariant {
 
-// Separator string that will appear between the fragment name and read number
-// the string key constructed from a Read with ReadKey().
-static constexpr char kFragmentNameReadNumberSeparator[] = "/";
-
 using absl::string_view;
 
 using absl::StrCat;
@@ -198,20 +195,20 @@ int TotalAlleleCounts(const std::vector<AlleleCount>& allele_counts,
 // There is a separate bool output `is_low_quality`, which will be set to
 // true if all the bases in read from offset to offset+len is lower than
 // the quality threshold to be used for generating alleles for our counts.
-bool CanBasesBeUsed(const nucleus::genomics::v1::Read& read, int offset,
-                    int len, const AlleleCounterOptions& options,
+bool CanBasesBeUsed(const CountedRead& read, int offset, int len,
+                    const AlleleCounterOptions& options,
                     bool& is_low_quality) {
-  CHECK_LE(offset + len, read.aligned_quality_size());
+  CHECK_LE(offset + len, read.quality_size);
 
   const int min_base_quality = options.read_requirements().min_base_quality();
   int indel_base_quality = 0;
   for (int i = 0; i < len; i++) {
-    indel_base_quality += read.aligned_quality(offset + i);
-    if (read.aligned_quality(offset + i) < min_base_quality &&
-        options.keep_legacy_behavior()) {
+    const int base_quality = read.quality(offset + i);
+    indel_base_quality += base_quality;
+    if (base_quality < min_base_quality && options.keep_legacy_behavior()) {
       return false;
     }
-    if (!nucleus::IsCanonicalBase(read.aligned_sequence()[offset + i])) {
+    if (!nucleus::IsCanonicalBase(read.aligned_sequence[offset + i])) {
       return false;
     }
   }
@@ -239,24 +236,16 @@ int AlleleIndex(const std::vector<AlleleCount>& allele_counts, int64_t pos) {
 }
 
 void AlleleCounter::Init() {
-  // Initialize our counts vector of AlleleCounts with proper position and
-  // reference base information. Initially the alleles repeated field is empty.
+  // Initialize our per-position tables. Initially there are no observations
+  // at any position.
   const int64_t len = IntervalLength();
-  counts_.reserve(len);
   // Set candidate positions relative to the interval.
   for (auto& candidate_position : candidate_positions_) {
     candidate_position -= interval_.start();
   }
-  auto full_interval_offset = interval_.start() - reads_interval_.start();
-  for (int i = 0; i < len; ++i) {
-    AlleleCount allele_count;
-    const int64_t pos = interval_.start() + i;
-    *(allele_count.mutable_position()) =
-        nucleus::MakePosition(interval_.reference_name(), pos);
-    allele_count.set_ref_base(ref_bases_.substr(i + full_interval_offset, 1));
-    allele_count.set_track_ref_reads(options_.track_ref_reads());
-    counts_.push_back(allele_count);
-  }
+  ref_supporting_read_counts_.assign(len, 0);
+  first_observation_.assign(len, kNoObservation);
+  last_observation_.assign(len, kNoObservation);
 }
 
 // AlleleCounter objects are passed to Python by pointers. We need to return
@@ -265,6 +254,28 @@ AlleleCounter* AlleleCounter::InitFromAlleleCounts(
     const std::vector<AlleleCount>& allele_counts) {
   auto allele_counter = new AlleleCounter();
   allele_counter->counts_.assign(allele_counts.begin(), allele_counts.end());
+  allele_counter->counts_materialized_ = true;
+  // Mirror the protos in the columnar tables so that the columnar accessors
+  // agree with Counts(). Sample ids are not known here, which is fine since
+  // the protos never have to be rebuilt.
+  const int len = allele_counts.size();
+  allele_counter->ref_supporting_read_counts_.assign(len, 0);
+  allele_counter->first_observation_.assign(len, kNoObservation);
+  allele_counter->last_observation_.assign(len, kNoObservation);
+  for (int i = 0; i < len; ++i) {
+    allele_counter->ref_supporting_read_counts_[i] =
+        allele_counts[i].ref_supporting_read_count();
+    for (const auto& entry : allele_counts[i].read_alleles()) {
+      const int32_t read_id =
+          allele_counter->read_registry_->RegisterKey(entry.first);
+      const int32_t allele_id = allele_counter->InternAllele(
+          entry.second.bases(), entry.second.type(), entry.second.count(),
+          entry.second.is_low_quality());
+      allele_counter->AddObservation(i, read_id, allele_id,
+                                     /*sample_id=*/-1,
+                                     /*check_duplicates=*/false);
+    }
+  }
   return allele_counter;
 }
 
@@ -314,7 +325,8 @@ string AlleleCounter::RefBases(const int64_t rel_start, const int64_t len) {
   }
 }
 
-string AlleleCounter::GetPrevBase(const Read& read, const int read_offset,
+string AlleleCounter::GetPrevBase(const CountedRead& read,
+                                  const int read_offset,
                                   const int interval_offset) {
   CHECK_GE(read_offset, 0) << "read_offset should be 0 or greater";
   if (read_offset == 0) {
@@ -326,11 +338,11 @@ string AlleleCounter::GetPrevBase(const Read& read, const int read_offset,
   } else {
     // In all other cases we actually take our previous base from the read
     // itself.
-    return read.aligned_sequence().substr(read_offset - 1, 1);
+    return string(read.aligned_sequence.substr(read_offset - 1, 1));
   }
 }
 
-ReadAllele AlleleCounter::MakeIndelReadAllele(const Read& read,
+ReadAllele AlleleCounter::MakeIndelReadAllele(const CountedRead& read,
                                               const int interval_offset,
                                               const int ref_offset,
                                               const int read_offset,
@@ -366,8 +378,8 @@ ReadAllele AlleleCounter::MakeIndelReadAllele(const Read& read,
         // know that, and the read's cigar reflect true differences of the read
         // to the alignment at the start of the contig.  Nasty, I know.
         VLOG(2) << "Deletion spans off the chromosome for read: "
-                << read.ShortDebugString() << " at cigar "
-                << cigar.ShortDebugString() << " with interval "
+                << read.fragment_name << "/" << read.read_number
+                << " at cigar " << cigar.ShortDebugString() << " with interval "
                 << Interval().ShortDebugString() << " with interval_offset "
                 << interval_offset << " and read_offset " << read_offset;
         return ReadAllele();
@@ -383,11 +395,11 @@ ReadAllele AlleleCounter::MakeIndelReadAllele(const Read& read,
       break;
     case CigarUnit::INSERT:
       type = AlleleType::INSERTION;
-      bases = read.aligned_sequence().substr(read_offset, op_len);
+      bases = string(read.aligned_sequence.substr(read_offset, op_len));
       break;
     case CigarUnit::CLIP_SOFT:
       type = AlleleType::SOFT_CLIP;
-      bases = read.aligned_sequence().substr(read_offset, op_len);
+      bases = string(read.aligned_sequence.substr(read_offset, op_len));
       break;
     default:
       LOG(FATAL) << "Unexpected cigar operation: " << cigar.DebugString();
@@ -397,8 +409,85 @@ ReadAllele AlleleCounter::MakeIndelReadAllele(const Read& read,
                     is_low_quality_read_allele);
 }
 
-void AlleleCounter::AddReadAlleles(const Read& read, absl::string_view sample,
+int32_t AlleleCounter::InternAllele(absl::string_view bases,
+                                    const AlleleType type, const int count,
+                                    const bool is_low_quality) {
+  auto [it, is_inserted] = allele_ids_.try_emplace(
+      AlleleKey(string(bases), type, count, is_low_quality),
+      allele_table_.size());
+  if (is_inserted) {
+    allele_table_.push_back(MakeAllele(bases, type, count, is_low_quality));
+  }
+  return it->second;
+}
+
+bool AlleleCounter::MarkReadSeen(int32_t read_id) {
+  // Ids handed to Add() must come from read_registry(), which bounds them.
+  CHECK_GE(read_id, 0) << "Invalid read id " << read_id;
+  if (read_id >= static_cast<int32_t>(read_seen_.size())) {
+    CHECK_LT(read_id, read_registry_->size())
+        << "Read id " << read_id << " is not from this counter's registry";
+    read_seen_.resize(read_registry_->size(), false);
+  }
+  const bool is_new = !read_seen_[read_id];
+  read_seen_[read_id] = true;
+  return is_new;
+}
+
+int32_t AlleleCounter::InternSample(absl::string_view sample) {
+  // There are only a handful of samples, so a linear scan is fastest.
+  for (int32_t i = 0; i < samples_.size(); ++i) {
+    if (samples_[i] == sample) {
+      return i;
+    }
+  }
+  samples_.push_back(string(sample));
+  return samples_.size() - 1;
+}
+
+void AlleleCounter::AddObservation(int offset, int32_t read_id,
+                                   int32_t allele_id, int32_t sample_id,
+                                   bool check_duplicates) {
+  // Naively, there should never be multiple counts for the same read key.
+  // We detect such a situation here but only write out a warning. It would
+  // be better to have a stronger response (FATAL), but unfortunately we see
+  // data in the wild that we need to process that has duplicates. As with a
+  // map keyed by read, the last observation wins.
+  if (check_duplicates) {
+    for (int32_t i = first_observation_[offset]; i != kNoObservation;
+         i = observations_[i].next) {
+      ReadAlleleObservation& observation = observations_[i];
+      if (observation.read_id == read_id && !observation.superseded) {
+        observation.superseded = true;
+        // Not thread safe.
+        static int counter = 0;
+        if (counter++ < 1) {
+          VLOG(2) << "Found duplicate read: " << read_registry_->Key(read_id)
+                  << " at offset " << offset;
+        }
+      }
+    }
+  }
+
+  const int32_t index = observations_.size();
+  observations_.push_back(
+      {read_id, allele_id, sample_id, kNoObservation, /*superseded=*/false});
+  if (last_observation_[offset] == kNoObservation) {
+    first_observation_[offset] = index;
+  } else {
+    observations_[last_observation_[offset]].next = index;
+  }
+  last_observation_[offset] = index;
+}
+
+void AlleleCounter::AddReadAlleles(const CountedRead& read, int32_t read_id,
+                                   absl::string_view sample,
                                    const std::vector<ReadAllele>& to_add) {
+  // The read id is only needed if the read carries an allele we have to
+  // track, so if it is not known yet the read is registered at most once, on
+  // first use.
+  int32_t sample_id = -1;
+  bool is_new_read = true;
   for (size_t i = 0; i < to_add.size(); ++i) {
     const ReadAllele& to_add_i = to_add[i];
 
@@ -420,12 +509,15 @@ void AlleleCounter::AddReadAlleles(const Read& read, absl::string_view sample,
       continue;
     }
 
-    AlleleCount& allele_count = counts_[to_add_i.position()];
+    const int offset = to_add_i.position();
 
     if (to_add_i.type() == AlleleType::REFERENCE) {
       if (!to_add_i.is_low_quality()) {
-        const int prev_count = allele_count.ref_supporting_read_count();
-        allele_count.set_ref_supporting_read_count(prev_count + 1);
+        ++ref_supporting_read_counts_[offset];
+        if (counts_materialized_) {
+          counts_[offset].set_ref_supporting_read_count(
+              ref_supporting_read_counts_[offset]);
+        }
       }
     }
 
@@ -435,31 +527,34 @@ void AlleleCounter::AddReadAlleles(const Read& read, absl::string_view sample,
     if (to_add_i.type() != AlleleType::REFERENCE ||
         (options_.track_ref_reads() &&
          std::binary_search(candidate_positions_.begin(),
-                            candidate_positions_.end(), to_add_i.position()))) {
-      auto* read_alleles = allele_count.mutable_read_alleles();
-      auto* sample_alleles = allele_count.mutable_sample_alleles();
-      const string key = ReadKey(read);
-      const Allele allele = MakeAllele(to_add_i.bases(), to_add_i.type(), 1,
-                                       to_add_i.is_low_quality());
-
-      // Naively, there should never be multiple counts for the same read key.
-      // We detect such a situation here but only write out a warning. It would
-      // be better to have a stronger response (FATAL), but unfortunately we see
-      // data in the wild that we need to process that has duplicates.
-      if (read_alleles->count(key)) {
-        // Not thread safe.
-        static int counter = 0;
-        if (counter++ < 1) {
-          VLOG(2) << "Found duplicate read: " << key << " at "
-                  << allele_count.position().ShortDebugString();
+                            candidate_positions_.end(), offset))) {
+      if (sample_id < 0) {
+        if (read_id == ReadRegistry::kUnknownReadId) {
+          read_id =
+              read_registry_->Register(read.fragment_name, read.read_number);
         }
+        is_new_read = MarkReadSeen(read_id);
+        sample_id = InternSample(sample);
+      }
+      const int32_t allele_id =
+          InternAllele(to_add_i.bases(), to_add_i.type(), 1,
+                       to_add_i.is_low_quality());
+      // A read contributes at most one allele per position, so previous
+      // observations can only collide with ours if the read key was seen
+      // before.
+      AddObservation(offset, read_id, allele_id, sample_id,
+                     /*check_duplicates=*/!is_new_read);
+
+      if (counts_materialized_) {
+        // Keep the already built protos in sync.
+        AlleleCount& allele_count = counts_[offset];
+        const Allele& allele = allele_table_[allele_id];
+        (*allele_count.mutable_read_alleles())[read_registry_->Key(read_id)] = allele;
+        // Update sample to allele map. This may allows us to determine set of
+        // samples that support each allele.
+        *(*allele_count.mutable_sample_alleles())[samples_[sample_id]]
+             .add_alleles() = allele;
       }
-
-      (*read_alleles)[key] = allele;
-      // Update sample to allele map. This may allows us to determine set of
-      // samples that support each allele.
-      Allele* new_allele = (*sample_alleles)[std::string(sample)].add_alleles();
-      *new_allele = allele;
     }
   }
 }
@@ -788,10 +883,24 @@ void AlleleCounter::NormalizeAndAdd(
   Add(read, sample, &input_output_cigar, read_shift);
 }
 
+void AlleleCounter::SetReadRegistry(ReadRegistry* read_registry) {
+  CHECK(read_registry != nullptr);
+  CHECK(observations_.empty()) << "SetReadRegistry() called after Add()";
+  owned_read_registry_.reset();
+  read_registry_ = read_registry;
+}
+
 void AlleleCounter::Add(const nucleus::genomics::v1::Read& read,
                         absl::string_view sample,
                         const std::vector<CigarUnit>* cigar_to_use,
                         int read_shift) {
+  Add(read, ReadRegistry::kUnknownReadId, sample, cigar_to_use, read_shift);
+}
+
+void AlleleCounter::Add(const nucleus::genomics::v1::Read& read,
+                        int32_t read_id, absl::string_view sample,
+                        const std::vector<CigarUnit>* cigar_to_use,
+                        int read_shift) {
   // Make sure our incoming read has a mapping quality above our min. threshold.
   if (read.alignment().mapping_quality() <
       options_.read_requirements().min_mapping_quality()) {
@@ -799,20 +908,66 @@ void AlleleCounter::Add(const nucleus::genomics::v1::Read& read,
   }
 
   const LinearAlignment& aln = read.alignment();
-  std::vector<ReadAllele> to_add;
-  to_add.reserve(read.aligned_quality_size());
-  int read_offset = 0;
-  int ref_interval_offset =
-      aln.position().position() + read_shift - ReadsInterval().start();
-  int interval_offset =
-      aln.position().position() + read_shift - Interval().start();
-  const string_view read_seq(read.aligned_sequence());
-  std::vector<CigarUnit> cigar;
+  CountedRead counted_read;
+  counted_read.fragment_name = read.fragment_name();
+  counted_read.read_number = read.read_number();
+  counted_read.position = aln.position().position();
+  counted_read.aligned_sequence = read.aligned_sequence();
+  counted_read.proto_quality = read.aligned_quality().data();
+  counted_read.quality_size = read.aligned_quality_size();
   if (cigar_to_use != nullptr) {
-    cigar.assign(cigar_to_use->begin(), cigar_to_use->end());
+    AddCountedRead(counted_read, read_id, sample, *cigar_to_use, read_shift);
   } else {
-    cigar.assign(aln.cigar().begin(), aln.cigar().end());
+    const std::vector<CigarUnit> cigar(aln.cigar().begin(), aln.cigar().end());
+    AddCountedRead(counted_read, read_id, sample, cigar, read_shift);
   }
+}
+
+void AlleleCounter::Add(const nucleus::SamRecordView& record,
+                        absl::string_view sample, int32_t read_id) {
+  // Unmapped records have no alignment, just like the Read protos built from
+  // them, so they are counted with a mapping quality of 0 and no cigar.
+  const bool has_alignment = record.has_alignment();
+  const int mapping_quality = has_alignment ? record.mapping_quality() : 0;
+  // Make sure our incoming read has a mapping quality above our min. threshold.
+  if (mapping_quality < options_.read_requirements().min_mapping_quality()) {
+    return;
+  }
+
+  record.DecodeSequence(&record_bases_);
+  record_cigar_.clear();
+  if (has_alignment) {
+    for (uint32_t op : record.cigar()) {
+      CigarUnit& cigar_unit = record_cigar_.emplace_back();
+      cigar_unit.set_operation(nucleus::SamRecordView::CigarOperation(op));
+      cigar_unit.set_operation_length(nucleus::SamRecordView::CigarLength(op));
+    }
+  }
+
+  CountedRead counted_read;
+  counted_read.fragment_name = record.fragment_name();
+  counted_read.read_number = record.read_number();
+  counted_read.position = has_alignment && !record.reference_name().empty()
+                              ? record.position()
+                              : 0;
+  counted_read.aligned_sequence = record_bases_;
+  counted_read.record = &record;
+  counted_read.quality_size = record.quality_length();
+  AddCountedRead(counted_read, read_id, sample, record_cigar_,
+                 /*read_shift=*/0);
+}
+
+void AlleleCounter::AddCountedRead(const CountedRead& read, int32_t read_id,
+                                   absl::string_view sample,
+                                   const std::vector<CigarUnit>& cigar,
+                                   int read_shift) {
+  std::vector<ReadAllele> to_add;
+  to_add.reserve(read.quality_size);
+  int read_offset = 0;
+  int ref_interval_offset =
+      read.position + read_shift - ReadsInterval().start();
+  int interval_offset = read.position + read_shift - Interval().start();
+  const string_view read_seq(read.aligned_sequence);
 
   for (const auto& cigar_elt : cigar) {
     const int op_len = cigar_elt.operation_length();
@@ -874,13 +1029,87 @@ void AlleleCounter::Add(const nucleus::genomics::v1::Read& read,
     }
   }
 
-  AddReadAlleles(read, sample, to_add);
+  AddReadAlleles(read, read_id, sample, to_add);
   ++n_reads_counted_;
 }
 
 string AlleleCounter::ReadKey(const Read& read) {
-  return StrCat(read.fragment_name(), kFragmentNameReadNumberSeparator,
-                read.read_number());
+  return ReadRegistry::ReadKey(read);
+}
+
+string AlleleCounter::RefBaseAt(int offset) const {
+  const int64_t full_interval_offset =
+      interval_.start() - reads_interval_.start();
+  return ref_bases_.substr(offset + full_interval_offset, 1);
+}
+
+void AlleleCounter::BuildAlleleCount(int offset,
+                                     AlleleCount* allele_count) const {
+  nucleus::genomics::v1::Position* position = allele_count->mutable_position();
+  position->set_reference_name(interval_.reference_name());
+  position->set_position(interval_.start() + offset);
+  allele_count->set_ref_base(RefBaseAt(offset));
+  allele_count->set_ref_supporting_read_count(
+      ref_supporting_read_counts_[offset]);
+  allele_count->set_track_ref_reads(options_.track_ref_reads());
+
+  auto* read_alleles = allele_count->mutable_read_alleles();
+  auto* sample_alleles = allele_count->mutable_sample_alleles();
+  // Superseded observations are overwritten in read_alleles by the later
+  // observation of the same read, but are kept in sample_alleles.
+  for (int32_t i = first_observation_[offset]; i != kNoObservation;
+       i = observations_[i].next) {
+    const ReadAlleleObservation& observation = observations_[i];
+    const Allele& allele = allele_table_[observation.allele_id];
+    (*read_alleles)[read_registry_->Key(observation.read_id)] = allele;
+    *(*sample_alleles)[samples_[observation.sample_id]].add_alleles() = allele;
+  }
+}
+
+const std::vector<AlleleCount>& AlleleCounter::Counts() const {
+  if (!counts_materialized_) {
+    counts_.clear();
+    counts_.resize(NumPositions());
+    for (int i = 0; i < NumPositions(); ++i) {
+      BuildAlleleCount(i, &counts_[i]);
+    }
+    counts_materialized_ = true;
+  }
+  return counts_;
+}
+
+AlleleCount AlleleCounter::CountAt(int offset) const {
+  CHECK_GE(offset, 0);
+  CHECK_LT(offset, NumPositions());
+  if (counts_materialized_) {
+    return counts_[offset];
+  }
+  AlleleCount allele_count;
+  BuildAlleleCount(offset, &allele_count);
+  return allele_count;
+}
+
+int AlleleCounter::TotalReadCount(int offset, bool include_low_quality) const {
+  int total_read_count = ref_supporting_read_counts_[offset];
+  ForEachReadAllele(offset, [&](const Allele& allele) {
+    if ((include_low_quality || !allele.is_low_quality()) &&
+        allele.type() != AlleleType::REFERENCE) {
+      ++total_read_count;
+    }
+  });
+  return total_read_count;
+}
+
+bool AlleleCounter::HasNonRefAlleles(int offset) const {
+  for (int32_t i = first_observation_[offset]; i != kNoObservation;
+       i = observations_[i].next) {
+    if (!observations_[i].superseded &&
+        allele_table_[observations_[i].allele_id].type() !=
+            AlleleType::REFERENCE) {
+      return true;
+    }
+  }
+  return false;
 }
 
 std::vector<AlleleCountSummary> AlleleCounter::SummaryCounts(
@@ -888,19 +1117,26 @@ std::vector<AlleleCountSummary> AlleleCounter::SummaryCounts(
   std::vector<AlleleCountSummary> summaries;
   CHECK_GE(left_padding, 0);
   CHECK_GE(right_padding, 0);
-  CHECK_LT(left_padding + right_padding, counts_.size());
-  summaries.reserve(counts_.size() - left_padding - right_padding);
-  for (int i = left_padding; i < counts_.size() - right_padding; i++) {
-    const AlleleCount& allele_count = counts_[i];
+  CHECK_LT(left_padding + right_padding, NumPositions());
+  summaries.reserve(NumPositions() - left_padding - right_padding);
+  for (int i = left_padding; i < NumPositions() - right_padding; i++) {
     AlleleCountSummary summary;
-    summary.set_reference_name(allele_count.position().reference_name());
-    summary.set_position(allele_count.position().position());
-    summary.set_ref_base(allele_count.ref_base());
-    summary.set_ref_supporting_read_count(
-        allele_count.ref_supporting_read_count());
-    summary.set_total_read_count(TotalAlleleCounts(allele_count));
-    summary.set_ref_nonconfident_read_count(
-        allele_count.ref_nonconfident_read_count());
+    if (ref_ == nullptr) {
+      // Counters created by InitFromAlleleCounts only know their positions
+      // through the protos they were created from.
+      const AlleleCount& allele_count = counts_[i];
+      summary.set_reference_name(allele_count.position().reference_name());
+      summary.set_position(allele_count.position().position());
+      summary.set_ref_base(allele_count.ref_base());
+      summary.set_ref_nonconfident_read_count(
+          allele_count.ref_nonconfident_read_count());
+    } else {
+      summary.set_reference_name(interval_.reference_name());
+      summary.set_position(interval_.start() + i);
+      summary.set_ref_base(RefBaseAt(i));
+    }
+    summary.set_ref_supporting_read_count(RefSupportingReadCount(i));
+    summary.set_total_read_count(TotalReadCount(i));
     summaries.push_back(summary);
   }
   return summaries;
@@ -40,13 +40,18 @@
 friend class test_case_name##_##test_name##_Test
 #endif
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/read_registry.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/string_view.h"
 #include "third_party/nucleus/io/reference.h"
+#include "third_party/nucleus/io/sam_record_view.h"
 #include "third_party/nucleus/protos/cigar.pb.h"
 #include "third_party/nucleus/protos/position.pb.h"
 #include "third_party/nucleus/protos/range.pb.h"
@@ -138,6 +143,24 @@ class ReadAllele {
   bool low_quality_allele_ = false;
 };
 
+// The fields of a read that AlleleCounter needs to count its alleles. It
+// points into either a Read proto or a nucleus::SamRecordView, so that both
+// are counted by the same code without copying the read.
+struct CountedRead {
+  absl::string_view fragment_name;
+  int read_number = 0;
+  int64_t position = 0;
+  absl::string_view aligned_sequence;
+  // Base qualities come from proto_quality if set, otherwise from record.
+  const int32_t* proto_quality = nullptr;
+  const nucleus::SamRecordView* record = nullptr;
+  int quality_size = 0;
+
+  int quality(int i) const {
+    return proto_quality != nullptr ? proto_quality[i] : record->quality(i);
+  }
+};
+
 // Workhorse class to compute AlleleCounts over an interval on the genome.
 //
 // AlleleCounter works roughly as follows:
@@ -182,6 +205,15 @@ class ReadAllele {
 // with multiple reads, which is a very attractive property of the AlleleCount
 // representation.
 //
+// Internally the counter doesn't keep one AlleleCount proto per position.
+// Reads are interned to dense integer ids, distinct alleles are stored once in
+// an allele table, and each position only holds a reference support counter
+// and a list of (read id, allele id, sample id) observations. The AlleleCount
+// protos are built lazily the first time Counts() is called. Callers that only
+// need counts, such as SummaryCounts() or the window selector, should use the
+// columnar accessors (RefSupportingReadCount(), TotalReadCount(),
+// ForEachReadAllele(), ...) which never build protos.
+//
 // Note that this code can diverge from the left-alignment requirement of VCF /
 // variant protos when the input read cigars are themselves not  left aligned.
 // For example, suppose we have:
@@ -267,6 +299,22 @@ class AlleleCounter {
                nullptr,
            int read_shift = 0);
 
+  // Same as Add() above, for a read whose id in read_registry() is already
+  // known, which saves building and hashing its ReadKey(). Dies if read_id is
+  // not an id of read_registry().
+  void Add(const nucleus::genomics::v1::Read& read, int32_t read_id,
+           absl::string_view sample,
+           const std::vector<nucleus::genomics::v1::CigarUnit>* cigar_to_use =
+               nullptr,
+           int read_shift = 0);
+
+  // Same as Add() above for an htslib record, e.g. one returned by
+  // nucleus::SamReader::QueryViews(). The record is counted in place: its
+  // bases are only decoded if it passes the mapping quality threshold and no
+  // Read proto is built.
+  void Add(const nucleus::SamRecordView& record, absl::string_view sample,
+           int32_t read_id = ReadRegistry::kUnknownReadId);
+
   // Wrapper around Add() that normalize the input read first and then calls
   // Add().
   void NormalizeAndAdd(
@@ -297,6 +345,15 @@ class AlleleCounter {
     Add(*(wrapped.p_), sample, nullptr);
   }
 
+  // Makes this AlleleCounter assign read ids from read_registry, so that they
+  // are shared with other components using the same registry. By default each
+  // AlleleCounter owns its registry. read_registry must outlive this object,
+  // and this must be called before any read is added.
+  void SetReadRegistry(ReadRegistry* read_registry);
+
+  // Gets the registry holding the ids of the reads added to this counter.
+  const ReadRegistry& read_registry() const { return *read_registry_; }
+
   // Gets the options in use by this AlleleCounter
   const AlleleCounterOptions& Options() const { return options_; }
 
@@ -322,9 +379,14 @@ class AlleleCounter {
   // basepair in our interval, filled in according to the reads that have been
   // added via calls to Add*() routines.
   //
-  // Calling this routine finalizes the AlleleCounts(), so that subsequent calls
-  // to Add*() will fail.
-  const std::vector<AlleleCount>& Counts() const { return counts_; }
+  // The AlleleCount protos are built on the first call. Reads added after
+  // that are applied to both the columnar tables and the returned protos, so
+  // the returned reference stays up to date.
+  const std::vector<AlleleCount>& Counts() const;
+
+  // Builds the AlleleCount at offset (0 being the first position of the
+  // interval) without building the protos for the rest of the interval.
+  AlleleCount CountAt(int offset) const;
 
   // Similar to Counts() function but returns a lighter-weight summary proto.
   //
@@ -337,17 +399,101 @@ class AlleleCounter {
   // How many reads have been added to this counter?
   int NCountedReads() const { return n_reads_counted_; }
 
+  // Columnar accessors. These read the per-position tables directly and never
+  // build AlleleCount protos. offset is relative to the first position of
+  // Counts(), and must be in [0, NumPositions()).
+
+  // Returns the number of positions tracked, which is Counts().size().
+  int NumPositions() const { return ref_supporting_read_counts_.size(); }
+
+  // Same as Counts()[offset].ref_supporting_read_count().
+  int RefSupportingReadCount(int offset) const {
+    return ref_supporting_read_counts_[offset];
+  }
+
+  // Same as TotalAlleleCounts(Counts()[offset], include_low_quality).
+  int TotalReadCount(int offset, bool include_low_quality = false) const;
+
+  // Returns true if at least one read carries a non-reference allele at offset.
+  bool HasNonRefAlleles(int offset) const;
+
+  // Calls fn(const Allele&) for each value of Counts()[offset].read_alleles().
+  template <typename Fn>
+  void ForEachReadAllele(int offset, Fn&& fn) const {
+    for (int32_t i = first_observation_[offset]; i != kNoObservation;
+         i = observations_[i].next) {
+      if (!observations_[i].superseded) {
+        fn(allele_table_[observations_[i].allele_id]);
+      }
+    }
+  }
+
+  // Same as ForEachReadAllele() above, but calls fn(int32_t read_id,
+  // const Allele&) with the read_registry() id of the read each allele is
+  // keyed by in read_alleles().
+  template <typename Fn>
+  void ForEachReadAlleleWithId(int offset, Fn&& fn) const {
+    for (int32_t i = first_observation_[offset]; i != kNoObservation;
+         i = observations_[i].next) {
+      if (!observations_[i].superseded) {
+        fn(observations_[i].read_id, allele_table_[observations_[i].allele_id]);
+      }
+    }
+  }
+
   // Constructs a unique string key for this read. The key is the concatenation
   // of fragment_name, "/", and read_number.
   string ReadKey(const nucleus::genomics::v1::Read& read);
 
  private:
+  // Marks the end of an observation list.
+  static constexpr int32_t kNoObservation = -1;
+
+  // A single read allele at a single position. Observations at the same
+  // position form a singly linked list through next, in insertion order.
+  struct ReadAlleleObservation {
+    int32_t read_id;
+    int32_t allele_id;
+    int32_t sample_id;
+    int32_t next;
+    // Set when a later read with the same ReadKey() replaced this observation
+    // in read_alleles. It still counts towards sample_alleles.
+    bool superseded;
+  };
+
+  // Key of the allele table: bases, type, count and is_low_quality.
+  using AlleleKey = std::tuple<string, int, int, bool>;
+
   // This constructor is used for unit testing only.
   AlleleCounter();
 
   // Initialize allele counter.
   void Init();
 
+  // Returns the id of the allele with the given fields (see MakeAllele),
+  // adding it to the allele table if needed.
+  int32_t InternAllele(absl::string_view bases, AlleleType type, int count,
+                       bool is_low_quality);
+
+  // Records that read_id was added to this counter. Returns true if it is the
+  // first time.
+  bool MarkReadSeen(int32_t read_id);
+
+  // Returns the dense id of sample, adding it if needed.
+  int32_t InternSample(absl::string_view sample);
+
+  // Appends an observation at offset. If check_duplicates is true, any
+  // previous observation at offset from the same read id is superseded.
+  void AddObservation(int offset, int32_t read_id, int32_t allele_id,
+                      int32_t sample_id, bool check_duplicates);
+
+  // Builds the AlleleCount for offset from the columnar tables into the empty
+  // allele_count.
+  void BuildAlleleCount(int offset, AlleleCount* allele_count) const;
+
+  // Returns the reference base at offset.
+  string RefBaseAt(int offset) const;
+
   // Helper function to get the reference bases between offsets rel_start
   // (inclusive) and rel_end (exclusive). The offsets are both relative to our
   // interval, so rel_start = 0 means the first base in our interval.  Because
@@ -373,7 +519,7 @@ class AlleleCounter {
   // Gets the base before read_offset in read, or if that would be before the
   // start of the read (i.e., read_offset == 0) then return the previous base on
   // the reference genome (at interval_offset - 1).
-  string GetPrevBase(const nucleus::genomics::v1::Read& read, int read_offset,
+  string GetPrevBase(const CountedRead& read, int read_offset,
                      int interval_offset);
 
   // Creates a ReadAllele for an indel (type based on cigar) from read starting
@@ -384,12 +530,18 @@ class AlleleCounter {
   // implied allele isn't valid for some reason (e.g., bases are too low
   // quality).
   ReadAllele MakeIndelReadAllele(
-      const nucleus::genomics::v1::Read& read, int interval_offset,
-      int ref_offset, int read_offset,
-      const nucleus::genomics::v1::CigarUnit& cigar);
+      const CountedRead& read, int interval_offset, int ref_offset,
+      int read_offset, const nucleus::genomics::v1::CigarUnit& cigar);
+
+  // Shared implementation of the Add() overloads, counting the alleles of read
+  // aligned with cigar.
+  void AddCountedRead(
+      const CountedRead& read, int32_t read_id, absl::string_view sample,
+      const std::vector<nucleus::genomics::v1::CigarUnit>& cigar,
+      int read_shift);
 
   // Adds the ReadAlleles in to_add to our AlleleCounts.
-  void AddReadAlleles(const nucleus::genomics::v1::Read& read,
+  void AddReadAlleles(const CountedRead& read, int32_t read_id,
                       absl::string_view sample,
                       const std::vector<ReadAllele>& to_add);
 
@@ -447,8 +599,42 @@ class AlleleCounter {
   // The number of reads we've added to this interval.
   int n_reads_counted_ = 0;
 
+  // Number of reference supporting reads, one per position in our interval.
+  std::vector<int> ref_supporting_read_counts_;
+
+  // Index in observations_ of the first and last observation of each position,
+  // or kNoObservation.
+  std::vector<int32_t> first_observation_;
+  std::vector<int32_t> last_observation_;
+
+  // All read allele observations across our interval.
+  std::vector<ReadAlleleObservation> observations_;
+
+  // Distinct alleles observed, indexed by allele id.
+  std::vector<Allele> allele_table_;
+  absl::flat_hash_map<AlleleKey, int32_t> allele_ids_;
+
+  // Registry handing out read ids. It is owned by this counter unless a
+  // shared one is set with SetReadRegistry().
+  std::unique_ptr<ReadRegistry> owned_read_registry_ =
+      std::make_unique<ReadRegistry>();
+  ReadRegistry* read_registry_ = owned_read_registry_.get();
+
+  // Whether each read id was added to this counter, indexed by read id.
+  std::vector<bool> read_seen_;
+
+  // Buffers reused across Add(SamRecordView) calls for the decoded bases and
+  // the unpacked cigar of the record.
+  string record_bases_;
+  std::vector<nucleus::genomics::v1::CigarUnit> record_cigar_;
+
+  // Sample names, indexed by sample id.
+  std::vector<string> samples_;
+
   // Our AlleleCount objects, one for each base in our interval, in order.
-  std::vector<AlleleCount> counts_;
+  // Built lazily by Counts().
+  mutable std::vector<AlleleCount> counts_;
+  mutable bool counts_materialized_ = false;
 
   // The reference bases covering our interval;
   const string ref_bases_;
@@ -40,6 +40,7 @@
 #include <vector>
 
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/read_registry.h"
 #include "deepvariant/utils.h"
 #include <gmock/gmock-generated-matchers.h>
 #include <gmock/gmock-matchers.h>
@@ -49,7 +50,10 @@
 #include "absl/container/node_hash_map.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "htslib/sam.h"
 #include "third_party/nucleus/io/reference.h"
+#include "third_party/nucleus/io/sam_record_view.h"
+#include "third_party/nucleus/io/sam_utils.h"
 #include "third_party/nucleus/protos/cigar.pb.h"
 #include "third_party/nucleus/protos/position.pb.h"
 #include "third_party/nucleus/protos/reference.pb.h"
@@ -74,7 +78,9 @@ using nucleus::genomics::v1::ReferenceSequence;
 using ::testing::Contains;
 using ::testing::Eq;
 using ::testing::IsEmpty;
+using ::testing::Key;
 using ::testing::SizeIs;
+using ::testing::UnorderedElementsAre;
 using ::testing::UnorderedPointwise;
 
 class AlleleCounterTest : public ::testing::Test {
@@ -966,6 +972,155 @@ TEST_F(AlleleCounterTest, TestAlleleIndex) {
   EXPECT_EQ(pos_6, -1);
 }
 
+TEST_F(AlleleCounterTest, TestColumnarAccessorsMatchCounts) {
+  std::unique_ptr<AlleleCounter> counter = MakeCounter("chr1", 1, 4);
+  AddNReads(1, 1, "C", counter.get());
+  AddNReads(1, 2, "T", counter.get());
+  AddNReads(2, 3, "C", counter.get());
+  AddNReads(3, 2, "A", counter.get());
+
+  ASSERT_EQ(counter->NumPositions(), 3);
+  EXPECT_EQ(counter->TotalReadCount(0), 3);
+  EXPECT_EQ(counter->TotalReadCount(1), 3);
+  EXPECT_EQ(counter->TotalReadCount(2), 2);
+  EXPECT_TRUE(counter->HasNonRefAlleles(0));
+  EXPECT_FALSE(counter->HasNonRefAlleles(1));
+  EXPECT_FALSE(counter->HasNonRefAlleles(2));
+
+  const std::vector<AlleleCount>& counts = counter->Counts();
+  for (int i = 0; i < counter->NumPositions(); ++i) {
+    EXPECT_THAT(counter->CountAt(i), EqualsProto(counts[i]));
+    EXPECT_EQ(counter->RefSupportingReadCount(i),
+              counts[i].ref_supporting_read_count());
+  }
+
+  // Reads added after Counts() was materialized are reflected in both views.
+  AddNReads(3, 1, "G", counter.get());
+  EXPECT_TRUE(counter->HasNonRefAlleles(2));
+  EXPECT_EQ(counter->TotalReadCount(2), 3);
+  EXPECT_EQ(counter->Counts()[2].read_alleles_size(), 1);
+  EXPECT_THAT(counter->CountAt(2), EqualsProto(counter->Counts()[2]));
+}
+
+TEST_F(AlleleCounterTest, TestSharedReadRegistry) {
+  ReadRegistry registry;
+  std::unique_ptr<AlleleCounter> counter1 = MakeCounter("chr1", 1, 4);
+  std::unique_ptr<AlleleCounter> counter2 = MakeCounter("chr1", 1, 4);
+  counter1->SetReadRegistry(&registry);
+  counter2->SetReadRegistry(&registry);
+
+  const Read read1 = MakeRead("chr1", 1, "T", {"1M"});
+  const Read read2 = MakeRead("chr1", 1, "G", {"1M"});
+  const int32_t read2_id = registry.Register(read2);
+
+  counter1->Add(read1, "sample_1");
+  counter2->Add(read2, read2_id, "sample_2");
+  counter2->Add(read1, "sample_2");
+
+  EXPECT_EQ(registry.size(), 2);
+  EXPECT_EQ(&counter1->read_registry(), &registry);
+  EXPECT_THAT(counter1->Counts()[0].read_alleles(),
+              UnorderedElementsAre(Key(ReadRegistry::ReadKey(read1))));
+  EXPECT_THAT(counter2->Counts()[0].read_alleles(),
+              UnorderedElementsAre(Key(ReadRegistry::ReadKey(read1)),
+                                   Key(ReadRegistry::ReadKey(read2))));
+}
+
+TEST_F(AlleleCounterTest, TestForEachReadAlleleWithId) {
+  ReadRegistry registry;
+  std::unique_ptr<AlleleCounter> counter = MakeCounter("chr1", 1, 4);
+  counter->SetReadRegistry(&registry);
+
+  const Read read1 = MakeRead("chr1", 1, "T", {"1M"});
+  const Read read2 = MakeRead("chr1", 1, "G", {"1M"});
+  counter->Add(read1, "sample");
+  counter->Add(read2, registry.Register(read2), "sample");
+
+  const auto& read_alleles = counter->Counts()[0].read_alleles();
+  int num_alleles = 0;
+  counter->ForEachReadAlleleWithId(
+      0, [&](int32_t read_id, const Allele& allele) {
+        ASSERT_TRUE(read_alleles.contains(registry.Key(read_id)));
+        EXPECT_THAT(allele,
+                    EqualsProto(read_alleles.at(registry.Key(read_id))));
+        ++num_alleles;
+      });
+  EXPECT_EQ(num_alleles, read_alleles.size());
+}
+
+TEST_F(AlleleCounterTest, TestRejectsForeignReadId) {
+  ReadRegistry registry;
+  std::unique_ptr<AlleleCounter> counter = MakeCounter("chr1", 1, 4);
+  counter->SetReadRegistry(&registry);
+  const Read read = MakeRead("chr1", 1, "T", {"1M"});
+  EXPECT_DEATH(counter->Add(read, /*read_id=*/3, "sample"),
+               "not from this counter's registry");
+}
+
+// Packs read into record, resolving its contig with header.
+void ReadToBamRecord(sam_hdr_t* header, const Read& read, bam1_t* record) {
+  std::vector<uint32_t> cigar;
+  for (const auto& cigar_unit : read.alignment().cigar()) {
+    cigar.push_back(bam_cigar_gen(
+        cigar_unit.operation_length(),
+        nucleus::kProtoToHtslibCigar[cigar_unit.operation()]));
+  }
+  const string quality(read.aligned_quality().begin(),
+                       read.aligned_quality().end());
+  const int tid = bam_name2id(
+      header, read.alignment().position().reference_name().c_str());
+  ASSERT_GE(bam_set1(record, read.fragment_name().size(),
+                     read.fragment_name().c_str(), /*flag=*/0, tid,
+                     read.alignment().position().position(),
+                     read.alignment().mapping_quality(), cigar.size(),
+                     cigar.data(), /*mtid=*/-1, /*mpos=*/-1, /*isize=*/0,
+                     read.aligned_sequence().size(),
+                     read.aligned_sequence().c_str(), quality.c_str(),
+                     /*l_aux=*/0),
+            0);
+}
+
+TEST_F(AlleleCounterTest, TestAddSamRecordViewMatchesRead) {
+  std::vector<Read> reads = {
+      MakeRead(chr_, start_, "TCCGT", {"5M"}),
+      MakeRead(chr_, start_, "TCAGT", {"5M"}),
+      MakeRead(chr_, start_ - 2, "AATCCGTAA", {"9M"}),
+      MakeRead(chr_, start_, "TCAAACGT", {"2M", "3I", "3M"}),
+      MakeRead(chr_, start_, "TCGT", {"1M", "1D", "3M"}),
+      MakeRead(chr_, start_, "AAATCCGT", {"3S", "5M"}),
+      MakeRead(chr_, start_, "TCNGT", {"5M"}),
+      MakeRead(chr_, start_, "TCTGT", {"5M"}),
+      MakeRead(chr_, start_, "TCGGT", {"5M"}),
+  };
+  // A low quality SNP and a read below the mapping quality threshold.
+  reads[7].set_aligned_quality(2, min_base_quality() - 1);
+  reads[8].mutable_alignment()->set_mapping_quality(0);
+  options_.mutable_read_requirements()->set_min_mapping_quality(1);
+
+  const string header_text = "@SQ\tSN:chrM\tLN:100\n@SQ\tSN:chr1\tLN:76\n";
+  sam_hdr_t* header = sam_hdr_parse(header_text.size(), header_text.c_str());
+  ASSERT_NE(header, nullptr);
+  bam1_t* record = bam_init1();
+
+  std::unique_ptr<AlleleCounter> read_counter = MakeCounter();
+  std::unique_ptr<AlleleCounter> view_counter = MakeCounter();
+  for (const Read& read : reads) {
+    read_counter->Add(read, "sample");
+    ReadToBamRecord(header, read, record);
+    view_counter->Add(nucleus::SamRecordView(header, record), "sample");
+  }
+  bam_destroy1(record);
+  sam_hdr_destroy(header);
+
+  EXPECT_EQ(view_counter->NCountedReads(),
+            read_counter->NCountedReads());
+  ASSERT_EQ(view_counter->Counts().size(), read_counter->Counts().size());
+  for (int i = 0; i < read_counter->Counts().size(); ++i) {
+    EXPECT_THAT(view_counter->Counts()[i],
+                EqualsProto(read_counter->Counts()[i]));
+  }
+}
+
 //
 
 TEST_F(AlleleCounterTest, TestAlleleSamplSupport_one_read_per_sample) {
@@ -33,6 +33,7 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <tuple>
@@ -64,12 +65,54 @@ std::string ReadKey(const nucleus::genomics::v1::Read& read) {
   return absl::StrCat(read.fragment_name(), "/", read.read_number());
 }
 
+namespace {
+
+std::vector<const DeepVariantCall*> CandidatePointers(
+    const std::vector<DeepVariantCall>& candidates) {
+  std::vector<const DeepVariantCall*> pointers;
+  pointers.reserve(candidates.size());
+  for (const DeepVariantCall& candidate : candidates) {
+    pointers.push_back(&candidate);
+  }
+  return pointers;
+}
+
+}  // namespace
+
 nucleus::StatusOr<std::vector<int>> DirectPhasing::PhaseReads(
     const std::vector<DeepVariantCall>& candidates,
     const std::vector<
         nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads) {
+  return PhaseReadsInternal(CandidatePointers(candidates), reads, nullptr);
+}
+
+nucleus::StatusOr<std::vector<int>> DirectPhasing::PhaseReads(
+    const std::vector<DeepVariantCall>& candidates,
+    const std::vector<
+        nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads,
+    const std::vector<int32_t>& read_ids) {
+  CHECK_EQ(reads.size(), read_ids.size());
+  return PhaseReadsInternal(CandidatePointers(candidates), reads, &read_ids);
+}
+
+nucleus::StatusOr<std::vector<int>> DirectPhasing::PhaseReads(
+    const std::vector<DeepVariantCall*>& candidates,
+    const std::vector<
+        nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads,
+    const std::vector<int32_t>& read_ids) {
+  CHECK_EQ(reads.size(), read_ids.size());
+  return PhaseReadsInternal(
+      std::vector<const DeepVariantCall*>(candidates.begin(), candidates.end()),
+      reads, &read_ids);
+}
+
+nucleus::StatusOr<std::vector<int>> DirectPhasing::PhaseReadsInternal(
+    const std::vector<const DeepVariantCall*>& candidates,
+    const std::vector<
+        nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads,
+    const std::vector<int32_t>* read_ids) {
   // Build graph from candidates.
-  Build(candidates, reads);
+  Build(candidates, reads, read_ids);
   // Iterate positions in order. Calculate the score for each combination of
   // allele pairs.
   for (int i = 0; i < positions_.size(); i++) {
@@ -137,7 +180,7 @@ nucleus::StatusOr<std::vector<int>> DirectPhasing::PhaseReads(
   // Phases are assigned to reads based on a set of alleles the read overlap.
   // If read overlaps more alleles of phase 1 then it is assigned a phase 1.
   // There 3 possible assignments: 0, 1, 2 where 0 is "phase unassigned".
-  return AssignPhasesToReads(reads);
+  return AssignPhasesToReads(reads, read_ids);
 }
 
 bool DirectPhasing::CompareVertexPairByBases(
@@ -245,8 +288,8 @@ std::vector<PhasedVariant> DirectPhasing::GetPhasedVariants() const {
 
 std::vector<int> DirectPhasing::AssignPhasesToReads(
     const std::vector<
-        nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads)
-    const {
+        nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads,
+    const std::vector<int32_t>* read_ids) const {
   // Assign phase reads
   // 1. For each read find all allele the read overlaps.
   // 2. Assign the phase to the read based on the majority phase of all
@@ -254,7 +297,9 @@ std::vector<int> DirectPhasing::AssignPhasesToReads(
   // Each read is assigned a phase (1,2) or 0 if phase cannot be determined.
   std::vector<int> phases(reads.size(), 0);
   for (int i = 0; i < reads.size(); i++) {
-    ReadIndex read_index = read_to_index_.at(ReadKey(*reads[i].p_));
+    ReadIndex read_index = read_ids != nullptr
+                               ? read_id_to_index_[(*read_ids)[i]]
+                               : read_to_index_.at(ReadKey(*reads[i].p_));
 
     // Calculate the number of alleles of each phase the read overlaps.
     if (read_to_alleles_.contains(read_index)) {
@@ -291,6 +336,17 @@ void DirectPhasing::InitializeReadMaps(
   }
 }
 
+void DirectPhasing::InitializeReadIdMaps(const std::vector<int32_t>& read_ids) {
+  const int32_t max_read_id =
+      read_ids.empty() ? -1 : *std::max_element(read_ids.begin(),
+                                                read_ids.end());
+  read_id_to_index_.assign(max_read_id + 1, -1);
+  // As with read names, the last read wins if ids are repeated.
+  for (size_t index = 0; index < read_ids.size(); ++index) {
+    read_id_to_index_[read_ids[index]] = index;
+  }
+}
+
 // From <starting_score> we know the originating vertex. We need to find all the
 // reads that support a connection between originating vertex in
 // <starting_score> and a new <vertex>. In addition we count reads that start
@@ -389,14 +445,32 @@ std::vector<ReadSupportInfo> DirectPhasing::ReadSupportFromProto(
   return read_support_infos;
 }
 
+std::vector<ReadSupportInfo> DirectPhasing::ReadSupportFromIds(
+    const DeepVariantCall::SupportingReadIds& read_support) const {
+  std::vector<ReadSupportInfo> read_support_infos;
+  read_support_infos.reserve(read_support.read_ids_size());
+  for (int i = 0; i < read_support.read_ids_size(); ++i) {
+    const int32_t read_id = read_support.read_ids(i);
+    const bool is_low_quality = read_support.is_low_quality(i);
+    if (read_id < read_id_to_index_.size() && read_id_to_index_[read_id] >= 0 &&
+        !is_low_quality) {
+      read_support_infos.push_back(
+          ReadSupportInfo{.read_index = static_cast<ReadIndex>(
+                              read_id_to_index_[read_id]),
+                          .is_low_quality = is_low_quality});
+    }
+  }
+  return read_support_infos;
+}
+
 DirectPhasing::Vertex DirectPhasing::AddVertex(
     int64_t position, AlleleType allele_type, absl::string_view bases,
-    const google::protobuf::RepeatedPtrField<DeepVariantCall_ReadSupport>& reads) {
+    std::vector<ReadSupportInfo> read_support) {
   Vertex v = boost::add_vertex(
       VertexInfo{AlleleInfo{.type = allele_type,
                             .position = position,
                             .bases = std::string(bases),
-                            .read_support = ReadSupportFromProto(reads)}},
+                            .read_support = std::move(read_support)}},
       graph_);
   return v;
 }
@@ -449,8 +523,10 @@ void DirectPhasing::AddCandidate(const DeepVariantCall& candidate) {
       candidate.ref_support_ext().read_infos();
   // Add REF allele.
   if (ref_reads.size() >= kMinRefAlleleDepth) {
-    UpdateReadToAllelesMap(AddVertex(candidate.variant().start(),
-                                     AlleleType::REFERENCE, kRef, ref_reads));
+    UpdateReadToAllelesMap(AddVertex(
+        candidate.variant().start(), AlleleType::REFERENCE, kRef,
+        use_read_ids_ ? ReadSupportFromIds(candidate.ref_support_ids())
+                      : ReadSupportFromProto(ref_reads)));
   }
 
   // Add alt alleles.
@@ -468,9 +544,18 @@ void DirectPhasing::AddCandidate(const DeepVariantCall& candidate) {
         return allele1.first < allele2.first;
       });
   for (const auto& [allele, read_support] : alleles) {
+    std::vector<ReadSupportInfo> read_support_infos;
+    if (use_read_ids_) {
+      const auto it = candidate.allele_support_ids().find(allele);
+      if (it != candidate.allele_support_ids().end()) {
+        read_support_infos = ReadSupportFromIds(it->second);
+      }
+    } else {
+      read_support_infos = ReadSupportFromProto(read_support.read_infos());
+    }
     UpdateReadToAllelesMap(AddVertex(candidate.variant().start(),
                                      AlleleTypeFromCandidate(allele, candidate),
-                                     allele, read_support.read_infos()));
+                                     allele, std::move(read_support_infos)));
   }
 }
 
@@ -504,6 +589,8 @@ void DirectPhasing::Clear() {
   scores_.clear();
   read_to_alleles_.clear();
   read_to_index_.clear();
+  read_id_to_index_.clear();
+  use_read_ids_ = false;
   graph_.clear();
 }
 
@@ -515,16 +602,29 @@ void DirectPhasing::Build(
     const std::vector<DeepVariantCall>& candidates,
     const std::vector<
         nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads) {
+  Build(CandidatePointers(candidates), reads, nullptr);
+}
+
+void DirectPhasing::Build(
+    const std::vector<const DeepVariantCall*>& candidates,
+    const std::vector<
+        nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads,
+    const std::vector<int32_t>* read_ids) {
   Clear();
-  InitializeReadMaps(reads);
+  if (read_ids != nullptr) {
+    use_read_ids_ = true;
+    InitializeReadIdMaps(*read_ids);
+  } else {
+    InitializeReadMaps(reads);
+  }
 
   // Iterate all candidates and create graph nodes.
   // It is assumed that candidates are processed in the position order.
   uint32_t indel_end = 0;
   for (int i = 0; i < candidates.size(); i++) {
-    const auto& candidate = candidates[i];
+    const auto& candidate = *candidates[i];
     if (i > 0) {
-      CHECK_LT(candidates[i - 1].variant().start(),
+      CHECK_LT(candidates[i - 1]->variant().start(),
                candidate.variant().start());
     }
     if (CandidateFilter(candidate, &indel_end)) {
@@ -37,6 +37,7 @@
 friend class test_case_name##_##test_name##_Test
 #endif
 
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -176,6 +177,26 @@ class DirectPhasing {
     return PhaseReads(candidates, reads).ValueOrDie();
   }
 
+  // Same as above, for reads whose ReadRegistry ids are known. read_ids[i] is
+  // the id of reads[i]. Candidates must carry the integer read id sidecar
+  // (allele_support_ids and ref_support_ids) built with the same registry, so
+  // that reads are matched to the alleles they support by id instead of by
+  // read key.
+  nucleus::StatusOr<std::vector<int>> PhaseReads(
+      const std::vector<DeepVariantCall>& candidates,
+      const std::vector<
+          nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads,
+      const std::vector<int32_t>& read_ids);
+
+  // Same as above, for candidates allocated on a region arena by
+  // multi_sample::VariantCaller::CallsFromAlleleCounts(), so that they are
+  // not copied.
+  nucleus::StatusOr<std::vector<int>> PhaseReads(
+      const std::vector<DeepVariantCall*>& candidates,
+      const std::vector<
+          nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads,
+      const std::vector<int32_t>& read_ids);
+
   // Helper function to output graph into graphviz for debugging. This function
   // is exported to Python.
   std::string GraphViz() const;
@@ -187,17 +208,37 @@ class DirectPhasing {
   // Dynamic score for the partition. This score defines the best phasing up to
   // a certain position.
 
+  // Implements both PhaseReads() overloads. read_ids is nullptr if read ids
+  // are not known.
+  nucleus::StatusOr<std::vector<int>> PhaseReadsInternal(
+      const std::vector<const DeepVariantCall*>& candidates,
+      const std::vector<
+          nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads,
+      const std::vector<int32_t>* read_ids);
+
   // Convert Read protos to ReadSupportInfo, filtering low quality reads.
   std::vector<ReadSupportInfo> ReadSupportFromProto(
       const google::protobuf::RepeatedPtrField<DeepVariantCall_ReadSupport>& read_support)
       const;
 
+  // Same as above for the integer read id sidecar of a candidate.
+  std::vector<ReadSupportInfo> ReadSupportFromIds(
+      const DeepVariantCall::SupportingReadIds& read_support) const;
+
   // Build graph from candidates.
   void Build(
       const std::vector<DeepVariantCall>& candidates,
       const std::vector<
           nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads);
 
+  // Same as above. If read_ids is not nullptr, reads are matched by id using
+  // the integer read id sidecar of the candidates.
+  void Build(
+      const std::vector<const DeepVariantCall*>& candidates,
+      const std::vector<
+          nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads,
+      const std::vector<int32_t>* read_ids);
+
   void Build(const std::vector<DeepVariantCall>& candidates,
              const std::vector<nucleus::genomics::v1::Read>& reads);
 
@@ -212,9 +253,12 @@ class DirectPhasing {
       const std::vector<
           nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads);
 
-  Vertex AddVertex(
-      int64_t position, AlleleType allele_type, absl::string_view bases,
-      const google::protobuf::RepeatedPtrField<DeepVariantCall_ReadSupport>& reads);
+  // Same as above for reads identified by their ReadRegistry ids.
+  void InitializeReadIdMaps(const std::vector<int32_t>& read_ids);
+
+  Vertex AddVertex(int64_t position, AlleleType allele_type,
+                   absl::string_view bases,
+                   std::vector<ReadSupportInfo> read_support);
 
   // Add edge to the graph using the provided weight.
   Edge AddEdge(const Vertex& in_vertex, const Vertex& out_vertex, float weight);
@@ -257,8 +301,8 @@ class DirectPhasing {
   // input <reads>.
   std::vector<int> AssignPhasesToReads(
       const std::vector<
-          nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads)
-      const;
+          nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads,
+      const std::vector<int32_t>* read_ids) const;
 
   bool CompareVertexPairByBases(const Vertex& v1_1, const Vertex& v1_2,
     const Vertex& v2_1, const Vertex& v2_2) const;
@@ -290,6 +334,11 @@ class DirectPhasing {
   // Map read name to read id.
   absl::flat_hash_map<std::string, ReadIndex> read_to_index_;
 
+  // Map ReadRegistry id to read id, or -1 for ids of reads that are not
+  // phased. Only used when reads are matched by id.
+  std::vector<int> read_id_to_index_;
+  bool use_read_ids_ = false;
+
   // Graph Vizualization
   VertexIndexMap IndexMap() const;
 
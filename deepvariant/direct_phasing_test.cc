@@ -34,6 +34,7 @@
 #include <sys/types.h>
 
 #include <algorithm>
+#include <cstdint>
 #include <iterator>
 #include <sstream>
 #include <string>
@@ -43,6 +44,7 @@
 #include <vector>
 
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/read_registry.h"
 #include <gmock/gmock-generated-matchers.h>
 #include <gmock/gmock-matchers.h>
 #include <gmock/gmock-more-matchers.h>
@@ -51,6 +53,7 @@
 #include "absl/strings/str_cat.h"
 #include "third_party/nucleus/protos/variants.pb.h"
 #include "third_party/nucleus/testing/test_utils.h"
+#include "google/protobuf/arena.h"
 
 namespace learning {
 namespace genomics {
@@ -735,6 +738,77 @@ TEST(DirectPhasingTest, PhaseReadFullyConnectedGraph) {
   }
 }
 
+// Fills the integer read id sidecar of candidate from its read names.
+void AddReadIdSidecar(const ReadRegistry& registry,
+                      DeepVariantCall* candidate) {
+  for (const auto& [allele, support] : candidate->allele_support_ext()) {
+    auto& support_ids = (*candidate->mutable_allele_support_ids())[allele];
+    for (const auto& read_info : support.read_infos()) {
+      support_ids.add_read_ids(registry.Find(read_info.read_name()));
+      support_ids.add_is_low_quality(read_info.is_low_quality());
+    }
+  }
+  for (const auto& read_info : candidate->ref_support_ext().read_infos()) {
+    candidate->mutable_ref_support_ids()->add_read_ids(
+        registry.Find(read_info.read_name()));
+    candidate->mutable_ref_support_ids()->add_is_low_quality(
+        read_info.is_low_quality());
+  }
+}
+
+TEST(DirectPhasingTest, PhaseReadWithReadIds) {
+  DirectPhasing direct_phasing;
+
+  // Create test candidates.
+  std::vector<DeepVariantCall> candidates = {
+      MakeCandidate(100, 101,
+                    {{"A", {"read1/0", "read2/0", "read3/0"}},  // SUB allele
+                     {"C", {"read4/0", "read5/0", "read6/0"}}}  // SUB allele
+                    ),
+      MakeCandidate(105, 106,
+                    {{"C", {"read4/0", "read5/0", "read1/0"}},
+                     {"G", {"read2/0", "read3/0", "read6/0"}}}),
+      MakeCandidate(110, 111,
+                    {{"T", {"read1/0", "read2/0", "read3/0"}},  // SUB allele
+                     {"G", {"read4/0", "read5/0", "read6/0"}}}  // SUB allele
+                    )};
+
+  std::vector<nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>> reads =
+      CreateTestReads(6);
+
+  // Register an unrelated read first so that read ids differ from indices.
+  ReadRegistry registry;
+  registry.RegisterKey("other/0");
+  const std::vector<int32_t> read_ids = registry.RegisterAll(reads);
+  for (auto& candidate : candidates) {
+    AddReadIdSidecar(registry, &candidate);
+  }
+
+  nucleus::StatusOr<std::vector<int>> phases =
+      direct_phasing.PhaseReads(candidates, reads, read_ids);
+  EXPECT_TRUE(phases.ok());
+  EXPECT_THAT(phases.ValueOrDie(), ElementsAreArray({1, 1, 1, 2, 2, 2}));
+  // Matching reads by key gives the same phases.
+  EXPECT_THAT(direct_phasing.PhaseReads(candidates, reads).ValueOrDie(),
+              ElementsAreArray(phases.ValueOrDie()));
+  // So do candidates allocated on an arena.
+  google::protobuf::Arena arena;
+  std::vector<DeepVariantCall*> arena_candidates;
+  for (const auto& candidate : candidates) {
+    arena_candidates.push_back(
+        google::protobuf::Arena::CreateMessage<DeepVariantCall>(&arena));
+    *arena_candidates.back() = candidate;
+  }
+  EXPECT_THAT(
+      direct_phasing.PhaseReads(arena_candidates, reads, read_ids).ValueOrDie(),
+      ElementsAreArray(phases.ValueOrDie()));
+
+  // Release memory.
+  for (auto read : reads) {
+    delete read.p_;
+  }
+}
+
 TEST(DirectPhasingTest, PhaseReadUnorderedInputFail) {
   DirectPhasing direct_phasing;
 
@@ -0,0 +1,276 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/gvcf_block_builder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/nucleus/util/math.h"
+#include "third_party/nucleus/util/utils.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using nucleus::genomics::v1::Variant;
+using nucleus::genomics::v1::VariantCall;
+
+namespace {
+
+constexpr char kCanonicalDnaBases[] = "ACGT";
+constexpr char kExtendedIupacCodes[] = "ACGTRYSWKMBDHVN";
+constexpr char kGvcfAltAllele[] = "<*>";
+
+// Same as genomics_math.normalize_log10_probs.
+std::array<double, 3> NormalizeLog10Probs(const std::array<double, 3>& probs) {
+  const double max_prob = *std::max_element(probs.begin(), probs.end());
+  double sum = 0;
+  for (double p : probs) sum += std::pow(10.0, p - max_prob);
+  const double lse = max_prob + std::log10(sum);
+  std::array<double, 3> normalized;
+  for (int i = 0; i < 3; ++i) {
+    normalized[i] = std::min(probs[i] - lse, 0.0);
+  }
+  return normalized;
+}
+
+}  // namespace
+
+GvcfBlockBuilder::GvcfBlockBuilder(const VariantCallerOptions& options,
+                                   bool use_cache_table,
+                                   int max_cache_coverage)
+    : options_(options), max_cache_coverage_(max_cache_coverage) {
+  QCHECK_EQ(options_.ploidy(), 2)
+      << "ploidy=" << options_.ploidy() << " but we only support ploidy=2";
+  if (use_cache_table) {
+    QCHECK_GE(max_cache_coverage_, 0);
+    table_.reserve((max_cache_coverage_ + 1) * (max_cache_coverage_ + 2) / 2);
+    for (int n_total = 0; n_total <= max_cache_coverage_; ++n_total) {
+      for (int n_ref = 0; n_ref <= n_total; ++n_ref) {
+        table_.push_back(ComputeReferenceConfidence(n_ref, n_total));
+      }
+    }
+  }
+}
+
+GvcfBlockBuilder::ReferenceConfidence
+GvcfBlockBuilder::ComputeReferenceConfidence(int n_ref, int n_total) const {
+  CHECK_GE(n_ref, 0);
+  CHECK_GE(n_total, n_ref);
+  std::array<double, 3> log10_probs;
+  if (n_total == 0) {
+    // No coverage: all likelihoods are log10 of 1/3.
+    log10_probs = NormalizeLog10Probs({-1.0, -1.0, -1.0});
+  } else {
+    const double log_10 = std::log(10.0);
+    const double p_error = options_.p_error();
+    const int n_alts = n_total - n_ref;
+    const double logp = std::log(p_error) / log_10;
+    const double log1p = std::log1p(-p_error) / log_10;
+    const double log10_p_ref = n_ref * log1p + n_alts * logp;
+    const double log10_p_het = -n_total * std::log(options_.ploidy()) / log_10;
+    const double log10_p_hom_alt = n_ref * logp + n_alts * log1p;
+    log10_probs =
+        NormalizeLog10Probs({log10_p_ref, log10_p_het, log10_p_hom_alt});
+  }
+  const double gq =
+      nucleus::Log10PTrueToPhred(log10_probs[0], options_.max_gq());
+  return {static_cast<int>(
+              std::min(std::floor(gq), static_cast<double>(options_.max_gq()))),
+          log10_probs};
+}
+
+GvcfBlockBuilder::ReferenceConfidence GvcfBlockBuilder::GetReferenceConfidence(
+    int n_ref, int n_total) const {
+  CHECK_GE(n_ref, 0);
+  CHECK_GE(n_total, n_ref);
+  if (table_.empty()) {
+    return ComputeReferenceConfidence(n_ref, n_total);
+  }
+  if (n_total > max_cache_coverage_) {
+    // Keep the fraction of reference reads, rounding up.
+    const double ratio = n_ref / (1.0 * n_total);
+    n_ref = static_cast<int>(std::ceil(ratio * max_cache_coverage_));
+    n_total = max_cache_coverage_;
+  }
+  return table_[n_total * (n_total + 1) / 2 + n_ref];
+}
+
+int GvcfBlockBuilder::GetReferenceConfidencePython(
+    int n_ref, int n_total, std::vector<double>* likelihoods) const {
+  const ReferenceConfidence confidence = GetReferenceConfidence(n_ref, n_total);
+  likelihoods->assign(confidence.likelihoods.begin(),
+                      confidence.likelihoods.end());
+  return confidence.gq;
+}
+
+int GvcfBlockBuilder::QuantizeGq(int raw_gq) const {
+  if (raw_gq < 1) return 0;
+  const int binsize = options_.gq_resolution();
+  return (raw_gq - 1) / binsize * binsize + 1;
+}
+
+void GvcfBlockBuilder::EndBlock() {
+  if (!in_block_) return;
+  in_block_ = false;
+  // statistics.median, truncated to an integer.
+  const size_t n = block_depths_.size();
+  auto middle = block_depths_.begin() + n / 2;
+  std::nth_element(block_depths_.begin(), middle, block_depths_.end());
+  block_.med_dp = *middle;
+  if (n % 2 == 0) {
+    const int lower = *std::max_element(block_depths_.begin(), middle);
+    block_.med_dp = (lower + block_.med_dp) / 2;
+  }
+  blocks_.push_back(std::move(block_));
+}
+
+::nucleus::Status GvcfBlockBuilder::Add(const AlleleCountSummary& summary) {
+  const std::string& ref_base = summary.ref_base();
+  const bool canonical =
+      ref_base.size() == 1 && absl::StrContains(kCanonicalDnaBases, ref_base);
+  if (!canonical) {
+    if (ref_base.size() != 1 ||
+        !absl::StrContains(kExtendedIupacCodes, ref_base)) {
+      return ::nucleus::InvalidArgument(absl::StrCat(
+          "Invalid reference base=", ref_base,
+          " found during gvcf calculation"));
+    }
+    // An ambiguous reference base: no GQ or likelihoods, and no block.
+    EndBlock();
+    return ::nucleus::Status();
+  }
+
+  const int n_total = summary.total_read_count();
+  const ReferenceConfidence confidence =
+      GetReferenceConfidence(summary.ref_supporting_read_count(), n_total);
+  const int quantized_gq = QuantizeGq(confidence.gq);
+  const bool has_valid_gl =
+      *std::max_element(confidence.likelihoods.begin(),
+                        confidence.likelihoods.end()) ==
+      confidence.likelihoods[0];
+
+  if (in_block_ && has_valid_gl && quantized_gq == block_quantized_gq_ &&
+      summary.reference_name() == block_.reference_name) {
+    block_.end = summary.position() + 1;
+    block_.gq = std::min(block_.gq, confidence.gq);
+    block_.min_dp = std::min(block_.min_dp, n_total);
+    block_depths_.push_back(n_total);
+    return ::nucleus::Status();
+  }
+
+  EndBlock();
+  GvcfBlock block;
+  block.reference_name = summary.reference_name();
+  block.start = summary.position();
+  block.end = summary.position() + 1;
+  block.ref_base = ref_base[0];
+  block.called = has_valid_gl;
+  block.gq = confidence.gq;
+  block.min_dp = n_total;
+  block.med_dp = n_total;
+  block.likelihoods = confidence.likelihoods;
+  if (has_valid_gl) {
+    // Sites whose likelihoods contradict 0/0 are never merged, so only
+    // called blocks can grow.
+    in_block_ = true;
+    block_ = std::move(block);
+    block_quantized_gq_ = quantized_gq;
+    block_depths_.assign(1, n_total);
+  } else {
+    blocks_.push_back(std::move(block));
+  }
+  return ::nucleus::Status();
+}
+
+std::vector<GvcfBlock> GvcfBlockBuilder::TakeBlocks() {
+  EndBlock();
+  std::vector<GvcfBlock> blocks;
+  blocks.swap(blocks_);
+  return blocks;
+}
+
+std::vector<Variant> GvcfBlockBuilder::ToVariants(
+    const std::vector<GvcfBlock>& blocks, bool include_med_dp) const {
+  std::vector<Variant> variants(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const GvcfBlock& block = blocks[i];
+    Variant& variant = variants[i];
+    variant.set_reference_name(block.reference_name);
+    variant.set_reference_bases(std::string(1, block.ref_base));
+    variant.add_alternate_bases(kGvcfAltAllele);
+    variant.set_start(block.start);
+    variant.set_end(block.end);
+    VariantCall* call = variant.add_calls();
+    call->set_call_set_name(options_.sample_name());
+    const int allele = block.called ? 0 : -1;
+    call->add_genotype(allele);
+    call->add_genotype(allele);
+    for (double likelihood : block.likelihoods) {
+      call->add_genotype_likelihood(likelihood);
+    }
+    nucleus::SetInfoField("GQ", block.gq, call);
+    nucleus::SetInfoField("MIN_DP", block.min_dp, call);
+    if (include_med_dp) {
+      nucleus::SetInfoField("MED_DP", block.med_dp, call);
+    }
+  }
+  return variants;
+}
+
+::nucleus::StatusOr<std::vector<Variant>> GvcfBlockBuilder::MakeGvcfs(
+    const std::vector<AlleleCountSummary>& summaries, bool include_med_dp) {
+  for (const AlleleCountSummary& summary : summaries) {
+    ::nucleus::Status status = Add(summary);
+    if (!status.ok()) {
+      TakeBlocks();
+      return status;
+    }
+  }
+  return ToVariants(TakeBlocks(), include_med_dp);
+}
+
+::nucleus::StatusOr<std::vector<Variant>>
+GvcfBlockBuilder::MakeGvcfsFromAlleleCounter(
+    const AlleleCounter& allele_counter, int left_padding, int right_padding,
+    bool include_med_dp) {
+  return MakeGvcfs(allele_counter.SummaryCounts(left_padding, right_padding),
+                   include_med_dp);
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_GVCF_BLOCK_BUILDER_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_GVCF_BLOCK_BUILDER_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "deepvariant/allelecounter.h"
+#include "deepvariant/protos/deepvariant.pb.h"
+#include "third_party/nucleus/core/status.h"
+#include "third_party/nucleus/core/statusor.h"
+#include "third_party/nucleus/protos/variants.pb.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+// A gVCF reference block: a run of sites sharing a quantized GQ.
+struct GvcfBlock {
+  std::string reference_name;
+  int64_t start = 0;
+  int64_t end = 0;
+  // Reference base of the first site.
+  char ref_base = 'N';
+  // False for a single site whose likelihoods don't favor 0/0. Such sites
+  // are written with a ./. genotype.
+  bool called = true;
+  // Smallest raw GQ over the block.
+  int gq = 0;
+  int min_dp = 0;
+  int med_dp = 0;
+  // Normalized log10 likelihoods of 0/0, 0/<*> and <*>/<*> at the first site.
+  std::array<double, 3> likelihoods = {0, 0, 0};
+};
+
+// Builds gVCF reference blocks from AlleleCountSummary records.
+//
+// This is the native implementation of VariantCaller.make_gvcfs: each site
+// gets a reference model GQ and likelihoods, and consecutive sites with the
+// same GQ, quantized to options.gq_resolution(), are merged into one block.
+// Blocks are kept as compact GvcfBlock structs, so Variant protos are only
+// built for blocks, not for each site.
+class GvcfBlockBuilder {
+ public:
+  // If use_cache_table is true, the reference model is precomputed for up to
+  // max_cache_coverage reads, and sites with higher coverage are rescaled to
+  // max_cache_coverage reads. Dies unless options.ploidy() is 2.
+  GvcfBlockBuilder(const VariantCallerOptions& options, bool use_cache_table,
+                   int max_cache_coverage);
+
+  // GvcfBlockBuilder is neither copyable nor movable.
+  GvcfBlockBuilder(const GvcfBlockBuilder&) = delete;
+  GvcfBlockBuilder& operator=(const GvcfBlockBuilder&) = delete;
+
+  // The reference model at a site with n_ref reference supporting reads out of
+  // n_total reads.
+  struct ReferenceConfidence {
+    int gq;
+    std::array<double, 3> likelihoods;
+  };
+  ReferenceConfidence GetReferenceConfidence(int n_ref, int n_total) const;
+
+  // Python wrapper around GetReferenceConfidence, returning the GQ and
+  // writing the likelihoods into *likelihoods.
+  int GetReferenceConfidencePython(int n_ref, int n_total,
+                                   std::vector<double>* likelihoods) const;
+
+  // Adds the next site, in coordinate order. Sites with an IUPAC reference
+  // base other than A, C, G or T are skipped. Returns an error for any other
+  // reference base.
+  ::nucleus::Status Add(const AlleleCountSummary& summary);
+
+  // Ends the current block, and returns the blocks built since the last call.
+  std::vector<GvcfBlock> TakeBlocks();
+
+  // Converts blocks to gVCF Variant protos for options.sample_name(), with
+  // MED_DP only if include_med_dp is true.
+  std::vector<nucleus::genomics::v1::Variant> ToVariants(
+      const std::vector<GvcfBlock>& blocks, bool include_med_dp) const;
+
+  // Same as VariantCaller.make_gvcfs: Add()s summaries and returns the
+  // resulting blocks as Variant protos.
+  ::nucleus::StatusOr<std::vector<nucleus::genomics::v1::Variant>> MakeGvcfs(
+      const std::vector<AlleleCountSummary>& summaries, bool include_med_dp);
+
+  // Same as MakeGvcfs() above, for the SummaryCounts() of allele_counter
+  // without left_padding and right_padding positions.
+  ::nucleus::StatusOr<std::vector<nucleus::genomics::v1::Variant>>
+  MakeGvcfsFromAlleleCounter(const AlleleCounter& allele_counter,
+                             int left_padding, int right_padding,
+                             bool include_med_dp);
+
+ private:
+  ReferenceConfidence ComputeReferenceConfidence(int n_ref, int n_total) const;
+  int QuantizeGq(int raw_gq) const;
+  void EndBlock();
+
+  const VariantCallerOptions options_;
+  const int max_cache_coverage_;
+  // table_[n_total * (n_total + 1) / 2 + n_ref], empty without a cache table.
+  std::vector<ReferenceConfidence> table_;
+
+  std::vector<GvcfBlock> blocks_;
+  // The block being extended, if in_block_, its quantized GQ, and the depth
+  // of each of its sites.
+  bool in_block_ = false;
+  GvcfBlock block_;
+  int block_quantized_gq_ = 0;
+  std::vector<int> block_depths_;
+};
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_GVCF_BLOCK_BUILDER_H_
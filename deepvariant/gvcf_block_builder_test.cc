@@ -0,0 +1,334 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/gvcf_block_builder.h"
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "deepvariant/allelecounter.h"
+#include "deepvariant/protos/deepvariant.pb.h"
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/platform/test.h"
+#include "third_party/nucleus/io/reference.h"
+#include "third_party/nucleus/protos/variants.pb.h"
+#include "third_party/nucleus/testing/protocol-buffer-matchers.h"
+#include "third_party/nucleus/testing/test_utils.h"
+#include "third_party/nucleus/util/utils.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using nucleus::EqualsProto;
+using nucleus::genomics::v1::Variant;
+using ::testing::DoubleNear;
+using ::testing::ElementsAre;
+using ::testing::HasSubstr;
+
+VariantCallerOptions MakeOptions(int gq_resolution = 1) {
+  VariantCallerOptions options;
+  options.set_sample_name("sample");
+  options.set_p_error(0.01);
+  options.set_max_gq(100);
+  options.set_gq_resolution(gq_resolution);
+  options.set_ploidy(2);
+  return options;
+}
+
+AlleleCountSummary MakeSummary(int64_t position, int n_ref, int n_total,
+                               const std::string& ref_base = "A") {
+  AlleleCountSummary summary;
+  summary.set_reference_name("chr1");
+  summary.set_position(position);
+  summary.set_ref_base(ref_base);
+  summary.set_ref_supporting_read_count(n_ref);
+  summary.set_total_read_count(n_total);
+  return summary;
+}
+
+int InfoInt(const Variant& variant, const std::string& key) {
+  return variant.calls(0).info().at(key).values(0).int_value();
+}
+
+TEST(GvcfBlockBuilderTest, ZeroCoverageHasUniformLikelihoods) {
+  GvcfBlockBuilder builder(MakeOptions(), false, 0);
+  const auto confidence = builder.GetReferenceConfidence(0, 0);
+  EXPECT_EQ(confidence.gq, 1);
+  EXPECT_THAT(confidence.likelihoods,
+              ElementsAre(DoubleNear(-0.47712125472, 1e-9),
+                          DoubleNear(-0.47712125472, 1e-9),
+                          DoubleNear(-0.47712125472, 1e-9)));
+}
+
+TEST(GvcfBlockBuilderTest, CacheTableMatchesDirectComputation) {
+  GvcfBlockBuilder raw(MakeOptions(), false, 0);
+  GvcfBlockBuilder cached(MakeOptions(), true, 20);
+  for (int n_total = 0; n_total <= 20; ++n_total) {
+    for (int n_ref = 0; n_ref <= n_total; ++n_ref) {
+      const auto expected = raw.GetReferenceConfidence(n_ref, n_total);
+      const auto actual = cached.GetReferenceConfidence(n_ref, n_total);
+      EXPECT_EQ(actual.gq, expected.gq);
+      EXPECT_EQ(actual.likelihoods, expected.likelihoods);
+    }
+  }
+  // Coverage above the table is rescaled, rounding reference support up.
+  const auto rescaled = cached.GetReferenceConfidence(31, 40);
+  const auto expected = raw.GetReferenceConfidence(16, 20);
+  EXPECT_EQ(rescaled.gq, expected.gq);
+  EXPECT_EQ(rescaled.likelihoods, expected.likelihoods);
+}
+
+TEST(GvcfBlockBuilderTest, RescalesReadCountsAboveTheCacheTable) {
+  struct TestCase {
+    int n_ref;
+    int n_total;
+    int expected_n_ref;
+    int expected_n_total;
+  };
+  const std::vector<TestCase> test_cases = {
+      // Counts up to max_cache_coverage are used without modification.
+      {0, 10, 0, 10}, {5, 10, 5, 10}, {10, 100, 10, 100}, {100, 100, 100, 100},
+      // Counts above max_cache_coverage keep their fraction of reference
+      // reads, rounding up.
+      {0, 200, 0, 100}, {0, 10000, 0, 100}, {1, 200, 1, 100},
+      {1, 100000, 1, 100}, {2, 200, 1, 100}, {3, 200, 2, 100},
+      {4, 200, 2, 100}, {50, 200, 25, 100}, {200, 200, 100, 100},
+      {99, 100, 99, 100}};
+  GvcfBlockBuilder raw(MakeOptions(), false, 0);
+  GvcfBlockBuilder cached(MakeOptions(), true, 100);
+  for (const TestCase& test_case : test_cases) {
+    const auto actual =
+        cached.GetReferenceConfidence(test_case.n_ref, test_case.n_total);
+    const auto expected = raw.GetReferenceConfidence(
+        test_case.expected_n_ref, test_case.expected_n_total);
+    EXPECT_EQ(actual.gq, expected.gq);
+    EXPECT_EQ(actual.likelihoods, expected.likelihoods);
+  }
+}
+
+TEST(GvcfBlockBuilderTest, HandlesLargeReferenceCounts) {
+  GvcfBlockBuilder builder(MakeOptions(), false, 0);
+  for (int n_ref : {1000, 10000, 100000, 1000000}) {
+    for (double n_alt_fraction : {0.0, 0.01, 0.02}) {
+      const int n_alt = static_cast<int>(n_alt_fraction * n_ref);
+      const auto confidence =
+          builder.GetReferenceConfidence(n_ref, n_ref + n_alt);
+      for (double likelihood : confidence.likelihoods) {
+        EXPECT_TRUE(std::isfinite(likelihood));
+      }
+      EXPECT_EQ(confidence.gq, 100);
+    }
+  }
+}
+
+TEST(GvcfBlockBuilderTest, PythonWrapperMatchesReferenceConfidence) {
+  GvcfBlockBuilder builder(MakeOptions(), true, 20);
+  const auto expected = builder.GetReferenceConfidence(18, 30);
+  std::vector<double> likelihoods;
+  EXPECT_EQ(builder.GetReferenceConfidencePython(18, 30, &likelihoods),
+            expected.gq);
+  EXPECT_THAT(likelihoods, ElementsAre(expected.likelihoods[0],
+                                       expected.likelihoods[1],
+                                       expected.likelihoods[2]));
+}
+
+TEST(GvcfBlockBuilderDeathTest, RejectsInvalidReadCounts) {
+  GvcfBlockBuilder builder(MakeOptions(), true, 20);
+  EXPECT_DEATH(builder.GetReferenceConfidence(-1, 10), "");
+  EXPECT_DEATH(builder.GetReferenceConfidence(11, 10), "");
+}
+
+TEST(GvcfBlockBuilderDeathTest, RejectsNonDiploidPloidy) {
+  for (int ploidy : {1, 3}) {
+    VariantCallerOptions options = MakeOptions();
+    options.set_ploidy(ploidy);
+    EXPECT_DEATH(GvcfBlockBuilder(options, false, 0),
+                 absl::StrCat("ploidy=", ploidy,
+                              " but we only support ploidy=2"));
+  }
+}
+
+TEST(GvcfBlockBuilderTest, MergesSitesWithTheSameGq) {
+  GvcfBlockBuilder builder(MakeOptions(), false, 0);
+  std::vector<AlleleCountSummary> summaries = {
+      MakeSummary(10, 20, 20), MakeSummary(11, 20, 20),
+      MakeSummary(12, 20, 20), MakeSummary(13, 21, 21)};
+  const auto variants = builder.MakeGvcfs(summaries, true);
+  ASSERT_TRUE(variants.ok());
+  const std::vector<Variant>& gvcfs = variants.ValueOrDie();
+  ASSERT_EQ(gvcfs.size(), 2);
+
+  const Variant& block = gvcfs[0];
+  EXPECT_EQ(block.reference_name(), "chr1");
+  EXPECT_EQ(block.reference_bases(), "A");
+  EXPECT_THAT(block.alternate_bases(), ElementsAre("<*>"));
+  EXPECT_EQ(block.start(), 10);
+  EXPECT_EQ(block.end(), 13);
+  EXPECT_EQ(block.calls(0).call_set_name(), "sample");
+  EXPECT_THAT(block.calls(0).genotype(), ElementsAre(0, 0));
+  EXPECT_EQ(InfoInt(block, "GQ"),
+            builder.GetReferenceConfidence(20, 20).gq);
+  EXPECT_EQ(InfoInt(block, "MIN_DP"), 20);
+  EXPECT_EQ(InfoInt(block, "MED_DP"), 20);
+  EXPECT_EQ(gvcfs[1].start(), 13);
+  EXPECT_EQ(gvcfs[1].end(), 14);
+}
+
+TEST(GvcfBlockBuilderTest, MergesWithinGqResolution) {
+  GvcfBlockBuilder builder(MakeOptions(100), false, 0);
+  std::vector<AlleleCountSummary> summaries = {
+      MakeSummary(0, 10, 10), MakeSummary(1, 30, 30), MakeSummary(2, 11, 11),
+      MakeSummary(3, 12, 12)};
+  const auto variants = builder.MakeGvcfs(summaries, false);
+  ASSERT_TRUE(variants.ok());
+  const std::vector<Variant>& gvcfs = variants.ValueOrDie();
+  ASSERT_EQ(gvcfs.size(), 1);
+  EXPECT_EQ(gvcfs[0].start(), 0);
+  EXPECT_EQ(gvcfs[0].end(), 4);
+  EXPECT_EQ(InfoInt(gvcfs[0], "GQ"),
+            builder.GetReferenceConfidence(10, 10).gq);
+  EXPECT_EQ(InfoInt(gvcfs[0], "MIN_DP"), 10);
+  EXPECT_EQ(gvcfs[0].calls(0).info().count("MED_DP"), 0);
+  // The likelihoods are the ones of the first site.
+  const auto first = builder.GetReferenceConfidence(10, 10);
+  EXPECT_THAT(gvcfs[0].calls(0).genotype_likelihood(),
+              ElementsAre(first.likelihoods[0], first.likelihoods[1],
+                          first.likelihoods[2]));
+}
+
+TEST(GvcfBlockBuilderTest, MedianDepthOfEvenSizedBlock) {
+  GvcfBlockBuilder builder(MakeOptions(100), false, 0);
+  const std::vector<int> depths = {30, 10, 15, 40};
+  for (int i = 0; i < depths.size(); ++i) {
+    ASSERT_TRUE(builder.Add(MakeSummary(i, depths[i], depths[i])).ok());
+  }
+  const std::vector<GvcfBlock> blocks = builder.TakeBlocks();
+  ASSERT_EQ(blocks.size(), 1);
+  EXPECT_EQ(blocks[0].min_dp, 10);
+  EXPECT_EQ(blocks[0].med_dp, 22);
+  EXPECT_TRUE(builder.TakeBlocks().empty());
+}
+
+TEST(GvcfBlockBuilderTest, UncallsSitesWithContradictoryLikelihoods) {
+  GvcfBlockBuilder builder(MakeOptions(100), false, 0);
+  std::vector<AlleleCountSummary> summaries = {
+      MakeSummary(0, 0, 10), MakeSummary(1, 0, 10), MakeSummary(2, 10, 10)};
+  const auto variants = builder.MakeGvcfs(summaries, true);
+  ASSERT_TRUE(variants.ok());
+  const std::vector<Variant>& gvcfs = variants.ValueOrDie();
+  ASSERT_EQ(gvcfs.size(), 3);
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(gvcfs[i].start(), i);
+    EXPECT_EQ(gvcfs[i].end(), i + 1);
+    EXPECT_THAT(gvcfs[i].calls(0).genotype(), ElementsAre(-1, -1));
+    EXPECT_EQ(InfoInt(gvcfs[i], "MIN_DP"), 10);
+    EXPECT_EQ(InfoInt(gvcfs[i], "MED_DP"), 10);
+  }
+  EXPECT_THAT(gvcfs[2].calls(0).genotype(), ElementsAre(0, 0));
+}
+
+TEST(GvcfBlockBuilderTest, AmbiguousReferenceBasesSplitBlocks) {
+  GvcfBlockBuilder builder(MakeOptions(), false, 0);
+  std::vector<AlleleCountSummary> summaries = {
+      MakeSummary(0, 10, 10), MakeSummary(1, 10, 10, "N"),
+      MakeSummary(2, 10, 10, "R"), MakeSummary(3, 10, 10, "C")};
+  const auto variants = builder.MakeGvcfs(summaries, false);
+  ASSERT_TRUE(variants.ok());
+  const std::vector<Variant>& gvcfs = variants.ValueOrDie();
+  ASSERT_EQ(gvcfs.size(), 2);
+  EXPECT_EQ(gvcfs[0].start(), 0);
+  EXPECT_EQ(gvcfs[0].end(), 1);
+  EXPECT_EQ(gvcfs[1].start(), 3);
+  EXPECT_EQ(gvcfs[1].reference_bases(), "C");
+}
+
+TEST(GvcfBlockBuilderTest, RejectsInvalidReferenceBases) {
+  for (const std::string base : {"X", ">", "!"}) {
+    GvcfBlockBuilder builder(MakeOptions(), false, 0);
+    const auto variants =
+        builder.MakeGvcfs({MakeSummary(0, 10, 10), MakeSummary(1, 10, 10, base)},
+                          false);
+    ASSERT_FALSE(variants.ok());
+    EXPECT_THAT(variants.status().error_message(),
+                HasSubstr("Invalid reference base=" + base));
+  }
+}
+
+TEST(GvcfBlockBuilderTest, MakesGvcfsFromAlleleCounter) {
+  const std::string fasta_path = nucleus::GetTestData("test.fasta");
+  std::unique_ptr<nucleus::IndexedFastaReader> ref =
+      std::move(nucleus::IndexedFastaReader::FromFile(
+                    fasta_path, absl::StrCat(fasta_path, ".fai"))
+                    .ValueOrDie());
+  AlleleCounter allele_counter(ref.get(), nucleus::MakeRange("chrM", 0, 10),
+                               std::vector<int>(), AlleleCounterOptions());
+  // chrM starts with GATCACAGGT; the reads carry a T>C SNP at position 3.
+  for (int i = 0; i < 4; ++i) {
+    nucleus::genomics::v1::Read read =
+        nucleus::MakeRead("chrM", 0, i % 2 ? "GATCACAGGT" : "GATTACAGGT",
+                          {"10M"});
+    read.set_fragment_name(absl::StrCat("read_", i));
+    allele_counter.Add(read, "sample");
+  }
+
+  GvcfBlockBuilder builder(MakeOptions(), true, 100);
+  const auto variants =
+      builder.MakeGvcfsFromAlleleCounter(allele_counter, 2, 3, true);
+  ASSERT_TRUE(variants.ok());
+  const std::vector<Variant>& gvcfs = variants.ValueOrDie();
+
+  GvcfBlockBuilder expected_builder(MakeOptions(), true, 100);
+  const auto expected_variants =
+      expected_builder.MakeGvcfs(allele_counter.SummaryCounts(2, 3), true);
+  ASSERT_TRUE(expected_variants.ok());
+  const std::vector<Variant>& expected = expected_variants.ValueOrDie();
+  ASSERT_EQ(gvcfs.size(), expected.size());
+  for (size_t i = 0; i < gvcfs.size(); ++i) {
+    EXPECT_THAT(gvcfs[i], EqualsProto(expected[i]));
+  }
+  // Padding positions are left out, and the heterozygous site is uncalled.
+  ASSERT_EQ(gvcfs.size(), 3);
+  EXPECT_EQ(gvcfs.front().start(), 2);
+  EXPECT_EQ(gvcfs[1].start(), 3);
+  EXPECT_THAT(gvcfs[1].calls(0).genotype(), ElementsAre(-1, -1));
+  EXPECT_EQ(gvcfs.back().end(), 7);
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -28,7 +28,10 @@
 # POSSIBILITY OF SUCH DAMAGE.
 """Core functionality for step one of DeepVariant: Making examples."""
 
+import bisect
 import collections
+import hashlib
+import heapq
 import itertools
 import json
 import os
@@ -61,6 +64,8 @@ from deepvariant.labeler import variant_labeler
 from deepvariant.protos import deepvariant_pb2
 from deepvariant.python import allelecounter
 from deepvariant.python import direct_phasing
+from deepvariant.python import parallel_region_processor
+from deepvariant.python import region_processor as region_processor_native
 from deepvariant.realigner import realigner
 from deepvariant.vendor import timer
 from google.protobuf import text_format
@@ -115,6 +120,28 @@ MAX_PARTITION_LEN = 1000000
 # Non DNA regions larger than this value are excluded from processing.
 MIN_NON_DNA_REGION = 300000
 
+# Width, in bp, of the windows in which the reads' index is summarized when
+# estimating the cost of regions for --partition_plan. This is the resolution of
+# the BAI linear index.
+COST_WINDOW_SIZE = 16384
+
+# Estimated cost of processing one non-N reference base, in compressed read
+# bytes, so that regions without reads still carry some cost.
+COST_PER_BASE = 1.0
+
+# Regions of Ns at least this long are not counted in the cost of regions.
+COST_MIN_N_REGION = 1000
+
+# How often, and for how long, tasks other than task 0 wait for task 0 to write
+# the --partition_plan.
+PARTITION_PLAN_POLL_SECONDS = 5
+PARTITION_PLAN_TIMEOUT_SECONDS = 3600
+
+# No partition may cost more than 1/MIN_PARTITIONS_PER_SHARD of the average
+# shard, unless that would make it shorter than MIN_SPLIT_PARTITION_SIZE bp.
+MIN_PARTITIONS_PER_SHARD = 64
+MIN_SPLIT_PARTITION_SIZE = 100
+
 # ---------------------------------------------------------------------------
 # Selecting variants of specific types (e.g., SNPs)
 # ---------------------------------------------------------------------------
@@ -532,21 +559,34 @@ def validate_reference_contig_coverage(
 
 
 def find_ref_n_regions(
-    ref_reader: genomics_reader.GenomicsReader, min_region_len: int
+    ref_reader: genomics_reader.GenomicsReader,
+    min_region_len: int,
+    regions: Optional[ranges.RangeSet] = None,
 ) -> List[range_pb2.Range]:
   """Returns List[nucleus.genomics.v1.Range] regions containing Ns.
 
   Args:
     ref_reader: genomics_reader.GenomicsReader. Nucleus Fasta reader.
     min_region_len: int. Only regions larger than min_region_len are returned.
+    regions: optional RangeSet. If set, only the bases in regions are scanned,
+      and the regions of Ns are clipped to them.
 
   Returns:
     A List of nucleus.genomics.v1.Range containing regions of Ns in the
     reference.
   """
+  if regions is None:
+    # ref_reader returns tuples of contig_name and vector of bases.
+    sequences = (
+        (ref_name, 0, bases) for ref_name, bases in ref_reader.iterate()
+    )
+  else:
+    sequences = (
+        (region.reference_name, region.start, ref_reader.query(region))
+        for region in regions
+    )
   ref_n_regions = []
-  # ref_reader returns tuples of contig_name and vector of bases.
-  for ref_name, bases in ref_reader.iterate():
+  for ref_name, offset, bases in sequences:
     i = min_region_len - 1
     while i < len(bases):
       b = bases[i]
@@ -562,8 +602,12 @@ def find_ref_n_regions(
           j += 1
         end = j
         if end - start >= min_region_len:
-          logging.info('Excluding %s:%d-%d', ref_name, start, end)
-          ref_n_regions.append(ranges.make_range(ref_name, start, end))
+          logging.info(
+              'Excluding %s:%d-%d', ref_name, offset + start, offset + end
+          )
+          ref_n_regions.append(
+              ranges.make_range(ref_name, offset + start, offset + end)
+          )
         i = end
       else:
         i += min_region_len - 1
@@ -788,6 +832,256 @@ def regions_to_process(
     return partitioned
 
 
+def _region_cost_fn(
+    interval: range_pb2.Range,
+    window_bytes: np.ndarray,
+    n_regions: List[range_pb2.Range],
+):
+  """Returns a function estimating the cost of [start, end) within interval.
+
+  The cost of a region is COST_PER_BASE for each of its non-N bases, plus the
+  compressed read bytes of the index windows it overlaps, in proportion to the
+  overlap.
+
+  Args:
+    interval: nucleus.genomics.v1.Range. The interval the windows tile.
+    window_bytes: np.array of the compressed read bytes in each window of
+      COST_WINDOW_SIZE bp of interval.
+    n_regions: List of nucleus.genomics.v1.Range. The regions of Ns on the
+      contig of interval, sorted by start.
+
+  Returns:
+    A function of (start, end) returning the estimated cost as a float.
+  """
+  n_starts = [r.start for r in n_regions]
+
+  def cost(start: int, end: int) -> float:
+    total = COST_PER_BASE * (end - start)
+    i = max(bisect.bisect_right(n_starts, start) - 1, 0)
+    while i < len(n_regions) and n_regions[i].start < end:
+      overlap = min(end, n_regions[i].end) - max(start, n_regions[i].start)
+      if overlap > 0:
+        total -= COST_PER_BASE * overlap
+      i += 1
+    first = (start - interval.start) // COST_WINDOW_SIZE
+    last = (end - 1 - interval.start) // COST_WINDOW_SIZE
+    for k in range(first, last + 1):
+      window_start = interval.start + k * COST_WINDOW_SIZE
+      window_end = min(interval.end, window_start + COST_WINDOW_SIZE)
+      overlap = min(end, window_end) - max(start, window_start)
+      total += window_bytes[k] * overlap / (window_end - window_start)
+    return total
+
+  return cost
+
+
+def cost_balanced_partitions(
+    regions: ranges.RangeSet,
+    partition_size: int,
+    num_shards: int,
+    reads_filenames: Sequence[str],
+    ref_path: Optional[str] = None,
+    ref_n_regions: Optional[List[range_pb2.Range]] = None,
+) -> List[List[Tuple[range_pb2.Range, float]]]:
+  """Partitions regions and balances their estimated cost across shards.
+
+  regions is first partitioned into pieces no bigger than partition_size bp,
+  like regions_to_process does. The cost of each piece is estimated from the
+  BAM indices of reads_filenames, without reading any reads, and from
+  ref_n_regions (see _region_cost_fn). Pieces costing more than
+  1/MIN_PARTITIONS_PER_SHARD of a shard's share of the total are halved, down
+  to MIN_SPLIT_PARTITION_SIZE bp, so no single piece dominates a shard. The
+  pieces are then assigned, costliest first, to the shard with the least
+  cost so far.
+
+  The result only depends on the arguments, so the plan is reproducible.
+
+  Args:
+    regions: RangeSet. The regions to process.
+    partition_size: The maximum size to make any region when partitioning.
+    num_shards: int > 0. The number of shards to balance the regions over.
+    reads_filenames: The indexed SAM/BAM/CRAM files of the reads. CRAM indices
+      carry no sizes, so their reads do not contribute to the cost.
+    ref_path: optional str. The reference to decode CRAM files with.
+    ref_n_regions: optional List of nucleus.genomics.v1.Range containing Ns.
+
+  Returns:
+    A list of num_shards lists of (nucleus.genomics.v1.Range, cost) tuples.
+    Each list is in genomic order.
+  """
+  readers = [
+      sam.NativeSamReader(reads_filename, ref_path=ref_path)
+      for reads_filename in reads_filenames
+      if reads_filename
+  ]
+  n_regions_by_contig = collections.defaultdict(list)
+  for n_region in sorted(ref_n_regions or [], key=lambda r: r.start):
+    n_regions_by_contig[n_region.reference_name].append(n_region)
+
+  pieces = []
+  for interval in regions:
+    n_windows = -(-(interval.end - interval.start) // COST_WINDOW_SIZE)
+    window_bytes = np.zeros(n_windows, dtype=np.int64)
+    for reader in readers:
+      window_bytes += reader.compressed_bytes_per_window(
+          interval, COST_WINDOW_SIZE
+      )
+    cost_fn = _region_cost_fn(
+        interval, window_bytes, n_regions_by_contig[interval.reference_name]
+    )
+    for start in range(interval.start, interval.end, partition_size):
+      end = min(interval.end, start + partition_size)
+      pieces.append((interval.reference_name, start, end, cost_fn))
+  for reader in readers:
+    reader.__exit__(None, None, None)
+
+  costs = [cost_fn(start, end) for _, start, end, cost_fn in pieces]
+  max_cost = sum(costs) / (num_shards * MIN_PARTITIONS_PER_SHARD)
+  partitions = []
+  for (refname, start, end, cost_fn), cost in zip(pieces, costs):
+    # Splits depth-first, so the halves stay in genomic order.
+    stack = [(start, end, cost)]
+    while stack:
+      start, end, cost = stack.pop()
+      if cost > max_cost and end - start >= 2 * MIN_SPLIT_PARTITION_SIZE:
+        mid = (start + end) // 2
+        stack.append((mid, end, cost_fn(mid, end)))
+        stack.append((start, mid, cost_fn(start, mid)))
+      else:
+        partitions.append((ranges.make_range(refname, start, end), cost))
+
+  # Longest processing time first. Ties are broken by genomic order and shard
+  # number, so the plan is deterministic.
+  shard_loads = [(0.0, shard) for shard in range(num_shards)]
+  assignments = [[] for _ in range(num_shards)]
+  for i in sorted(range(len(partitions)), key=lambda i: (-partitions[i][1], i)):
+    load, shard = heapq.heappop(shard_loads)
+    assignments[shard].append(i)
+    heapq.heappush(shard_loads, (load + partitions[i][1], shard))
+  return [[partitions[i] for i in sorted(indices)] for indices in assignments]
+
+
+def partition_plan_fingerprint(
+    regions: ranges.RangeSet,
+    contigs: Sequence[reference_pb2.ContigInfo],
+    partition_size: int,
+    reads_filenames: Sequence[str],
+    ref_path: str,
+) -> str:
+  """Returns a fingerprint of the inputs of a partition plan.
+
+  A plan is only valid for the regions, contigs, partition size, reads and
+  reference it was computed from, so write_partition_plan records this
+  fingerprint and read_partition_plan rejects plans whose fingerprint differs.
+
+  Args:
+    regions: RangeSet. The regions the plan partitions.
+    contigs: Sequence of ContigInfo protos of the contigs to process.
+    partition_size: The maximum size of any region when partitioning.
+    reads_filenames: The SAM/BAM/CRAM files of the reads.
+    ref_path: str. The path of the reference.
+
+  Returns:
+    A hex string.
+  """
+  fingerprint = hashlib.sha256()
+  for contig in contigs:
+    fingerprint.update(
+        'contig\t{}\t{}\n'.format(contig.name, contig.n_bases).encode()
+    )
+  for region in regions:
+    fingerprint.update(
+        'region\t{}\t{}\t{}\n'.format(
+            region.reference_name, region.start, region.end
+        ).encode()
+    )
+  fingerprint.update('partition_size\t{}\n'.format(partition_size).encode())
+  for reads_filename in reads_filenames:
+    fingerprint.update('reads\t{}\n'.format(reads_filename).encode())
+  fingerprint.update('ref\t{}\n'.format(ref_path).encode())
+  return fingerprint.hexdigest()
+
+
+def write_partition_plan(
+    path: str,
+    plan: List[List[Tuple[range_pb2.Range, float]]],
+    fingerprint: str,
+) -> None:
+  """Writes plan, as made by cost_balanced_partitions, to a TSV file.
+
+  The file is written to a temporary path first and then renamed, so tasks
+  reading path concurrently never see a partial plan.
+
+  Args:
+    path: str. The path to write the plan to.
+    plan: A list of lists of (nucleus.genomics.v1.Range, cost) per shard.
+    fingerprint: str. The partition_plan_fingerprint of the plan's inputs.
+  """
+  tmp_path = epath.Path(path + '.tmp')
+  with tmp_path.open('w') as f:
+    f.write('#num_shards\t{}\n'.format(len(plan)))
+    f.write('#fingerprint\t{}\n'.format(fingerprint))
+    f.write('#shard\tcontig\tstart\tend\tcost\n')
+    for shard, partitions in enumerate(plan):
+      for region, cost in partitions:
+        f.write(
+            '{}\t{}\t{}\t{}\t{:.1f}\n'.format(
+                shard, region.reference_name, region.start, region.end, cost
+            )
+        )
+  tmp_path.rename(path)
+
+
+def read_partition_plan(
+    path: str, num_shards: int, fingerprint: str
+) -> List[List[range_pb2.Range]]:
+  """Reads the regions of each shard from a plan made by write_partition_plan.
+
+  Args:
+    path: str. The path of the plan.
+    num_shards: int > 0. The number of shards the plan must have been made for.
+    fingerprint: str. The partition_plan_fingerprint the plan must have been
+      made for.
+
+  Returns:
+    A list of num_shards lists of nucleus.genomics.v1.Range, in plan order.
+
+  Raises:
+    ValueError: if the plan was made for a different number of shards or
+      different inputs.
+  """
+  plan = None
+  plan_fingerprint = None
+  with epath.Path(path).open() as f:
+    for line in f:
+      fields = line.rstrip('\n').split('\t')
+      if fields[0] == '#num_shards':
+        if int(fields[1]) != num_shards:
+          raise ValueError(
+              'Partition plan {} is for {} shards, not {}.'.format(
+                  path, fields[1], num_shards
+              )
+          )
+        plan = [[] for _ in range(num_shards)]
+      elif fields[0] == '#fingerprint':
+        plan_fingerprint = fields[1]
+      elif not line.startswith('#'):
+        if plan is None:
+          raise ValueError('Partition plan {} has no #num_shards.'.format(path))
+        plan[int(fields[0])].append(
+            ranges.make_range(fields[1], int(fields[2]), int(fields[3]))
+        )
+  if plan is None:
+    raise ValueError('Partition plan {} has no #num_shards.'.format(path))
+  if plan_fingerprint != fingerprint:
+    raise ValueError(
+        'Partition plan {} was made for different regions, contigs, '
+        '--partition_size, reads or reference. Delete it to compute a new '
+        'plan.'.format(path)
+    )
+  return plan
+
+
 def fetch_vcf_positions(
     vcf_paths: List[str],
     contigs: Sequence[reference_pb2.ContigInfo],
@@ -1125,7 +1419,8 @@ class OutputsWriter:
       self._add_writer('sitelist', epath.Path(sitelist_fname).open('w'))
       writer = self._writers['sitelist']
 
-  def _add_suffix(self, file_path, suffix):
+  @staticmethod
+  def _add_suffix(file_path, suffix):
     """Adds suffix to file name if a suffix is given."""
     if not suffix:
       return file_path
@@ -1145,6 +1440,13 @@ class OutputsWriter:
   def write_gvcfs(self, *gvcfs):
     self._write('gvcfs', *gvcfs)
 
+  def write_serialized_examples(self, *examples: bytes):
+    """Writes examples that are already serialized tf.Example protos."""
+    writer = self._writers['examples']
+    if writer:
+      for example in examples:
+        writer.write(example)
+
   def write_candidates(self, *candidates):
     self._write('candidates', *candidates)
 
@@ -1259,6 +1561,7 @@ class RegionProcessor:
     self.pic = None
     self.labeler = None
     self.population_vcf_readers = None
+    self.native_processor = None
     if self.options.phase_reads:
       # One instance of DirectPhasing per lifetime of make_examples.
       self.direct_phasing_cpp = self._make_direct_phasing_obj()
@@ -1345,7 +1648,15 @@ class RegionProcessor:
     if self.initialized:
       raise ValueError('Cannot initialize this object twice')
 
-    self.ref_reader = fasta.IndexedFastaReader(self.options.reference_filename)
+    if self.options.packed_reference_filename:
+      self.ref_reader = fasta.PackedReferenceReader(
+          self.options.packed_reference_filename
+      )
+    else:
+      self.ref_reader = fasta.IndexedFastaReader(
+          self.options.reference_filename,
+          max_cached_contigs=self.options.reference_max_cached_contigs,
+      )
 
     for sample in self.samples:
       sample.sam_readers = self._make_sam_readers(
@@ -1390,6 +1701,23 @@ class RegionProcessor:
     if in_training_mode(self.options):
       self.labeler = self._make_labeler_from_options()
 
+    if self.options.native_region_processing:
+      unsupported_option = (
+          region_processor_native.RegionProcessor.unsupported_option(
+              self.options
+          )
+      )
+      if unsupported_option:
+        logging.warning(
+            'native_region_processing does not support %s. Regions are '
+            'processed in Python.',
+            unsupported_option,
+        )
+      else:
+        self.native_processor = region_processor_native.RegionProcessor.create(
+            self.options, self.ref_reader.c_reader
+        )
+
     self.initialized = True
 
   def initialize(self):
@@ -1779,6 +2107,58 @@ class RegionProcessor:
     )
     return candidates_by_sample, gvcfs_by_sample, runtimes
 
+  def process_native(self, region: range_pb2.Range) -> Tuple[
+      Dict[str, Sequence[deepvariant_pb2.DeepVariantCall]],
+      Dict[str, Sequence[variants_pb2.Variant]],
+      Dict[str, Sequence[bytes]],
+      Optional[List[int]],
+      Dict[str, Union[float, int]],
+  ]:
+    """Same as process() followed by writes_examples_in_region(), in C++.
+
+    Only used when native_processor was created, see _initialize().
+
+    Args:
+      region: A nucleus.genomics.v1.Range proto. Specifies the region on the
+        genome we should process.
+
+    Returns:
+      (candidates_by_sample, gvcfs_by_sample, examples_by_sample,
+      example_shape, runtimes), where examples_by_sample is a dict keyed by
+      sample role of serialized tf.Example protos, and example_shape is the
+      shape of their images, or None if the region has no examples.
+    """
+    runtimes = {}
+    before_process = time.time()
+    outputs = self.native_processor.process(region)
+    candidates_by_sample = {}
+    gvcfs_by_sample = {}
+    examples_by_sample = {}
+    example_shape = None
+    for sample_outputs in outputs:
+      candidates_by_sample[sample_outputs.role] = sample_outputs.candidates
+      gvcfs_by_sample[sample_outputs.role] = sample_outputs.gvcfs
+      examples_by_sample[sample_outputs.role] = sample_outputs.examples
+      if example_shape is None and sample_outputs.example_shape:
+        example_shape = list(sample_outputs.example_shape)
+    runtimes['num reads'] = self.native_processor.num_reads()
+    runtimes['num candidates'] = sum(
+        [len(x) for x in candidates_by_sample.values()]
+    )
+    runtimes['num examples'] = sum(
+        [len(x) for x in examples_by_sample.values()]
+    )
+    # The native stages are not timed separately, so the whole region is
+    # reported as finding candidates.
+    runtimes['find candidates'] = trim_runtime(time.time() - before_process)
+    return (
+        candidates_by_sample,
+        gvcfs_by_sample,
+        examples_by_sample,
+        example_shape,
+        runtimes,
+    )
+
   def region_reads_norealign(
       self,
       region: range_pb2.Range,
@@ -2561,6 +2941,112 @@ def load_candidate_positions(candidate_path: Any) -> List[int]:
   return merge_ranges_from_files_sequential(positions)
 
 
+def _check_partition_plan_covers(
+    path: str, plan: List[List[range_pb2.Range]], regions: ranges.RangeSet
+) -> None:
+  """Raises ValueError unless plan covers each base of regions exactly once.
+
+  The fingerprint of a plan catches changed inputs, but a plan that was edited
+  or truncated must not silently skip or repeat regions either.
+
+  Args:
+    path: str. The path of the plan, for the error message.
+    plan: A list of lists of nucleus.genomics.v1.Range per shard.
+    regions: RangeSet. The regions the plan must cover.
+  """
+  planned = [region for shard_regions in plan for region in shard_regions]
+  covered = {
+      (r.reference_name, r.start, r.end) for r in ranges.RangeSet(planned)
+  }
+  expected = {(r.reference_name, r.start, r.end) for r in regions}
+  planned_bp = sum(r.end - r.start for r in planned)
+  expected_bp = sum(r.end - r.start for r in regions)
+  if covered != expected or planned_bp != expected_bp:
+    raise ValueError(
+        'Partition plan {} does not cover the calling regions exactly once. '
+        'Delete it to compute a new plan.'.format(path)
+    )
+
+
+def partition_plan_regions(
+    options: deepvariant_pb2.MakeExamplesOptions,
+    contigs: Sequence[reference_pb2.ContigInfo],
+    calling_regions: ranges.RangeSet,
+) -> List[range_pb2.Range]:
+  """Returns the regions of this task from the plan in options.partition_plan.
+
+  If the plan does not exist yet, task 0 computes it by
+  cost_balanced_partitions and writes it, so later runs reuse it, while the
+  other tasks wait for it to be written.
+
+  Args:
+    options: deepvariant.MakeExamplesOptions proto.
+    contigs: Sequence of ContigInfo protos of the contigs to process.
+    calling_regions: RangeSet. The regions to process within contigs.
+
+  Returns:
+    A list of nucleus.genomics.v1.Range of this task, in genomic order.
+
+  Raises:
+    ValueError: if the plan cannot be used with options, or task 0 does not
+      write it within PARTITION_PLAN_TIMEOUT_SECONDS.
+  """
+  main_sample = options.sample_options[options.main_sample_index]
+  if (
+      options.mode == deepvariant_pb2.MakeExamplesOptions.CANDIDATE_SWEEP
+      or main_sample.candidate_positions
+  ):
+    raise ValueError(
+        '--partition_plan cannot be used with candidate sweep, whose regions '
+        'are partitioned by candidates.'
+    )
+  num_shards = max(options.num_shards, 1)
+  ref_path = options.reference_filename
+  regions = ranges.RangeSet.from_contigs(contigs).intersection(calling_regions)
+  fingerprint = partition_plan_fingerprint(
+      regions,
+      contigs,
+      options.allele_counter_options.partition_size,
+      main_sample.reads_filenames,
+      ref_path,
+  )
+  plan_path = epath.Path(options.partition_plan)
+  if options.task_id != 0:
+    # Only task 0 computes the plan; the other tasks wait for it.
+    deadline = time.time() + PARTITION_PLAN_TIMEOUT_SECONDS
+    while not plan_path.exists():
+      if time.time() > deadline:
+        raise ValueError(
+            'Timed out waiting for task 0 to write partition plan {}.'.format(
+                options.partition_plan
+            )
+        )
+      time.sleep(PARTITION_PLAN_POLL_SECONDS)
+  if plan_path.exists():
+    plan = read_partition_plan(options.partition_plan, num_shards, fingerprint)
+    _check_partition_plan_covers(options.partition_plan, plan, regions)
+    return plan[options.task_id]
+
+  # Ns outside of the regions carry no cost, so only the regions are scanned.
+  with fasta.IndexedFastaReader(ref_path) as ref_reader:
+    ref_n_regions = find_ref_n_regions(
+        ref_reader, COST_MIN_N_REGION, regions=regions
+    )
+  plan = cost_balanced_partitions(
+      regions,
+      options.allele_counter_options.partition_size,
+      num_shards,
+      main_sample.reads_filenames,
+      ref_path=ref_path if options.use_ref_for_cram else None,
+      ref_n_regions=ref_n_regions,
+  )
+  write_partition_plan(options.partition_plan, plan, fingerprint)
+  logging_with_options(
+      options, 'Wrote partition plan to %s' % options.partition_plan
+  )
+  return [region for region, _ in plan[options.task_id]]
+
+
 def processing_regions_from_options(
     options: deepvariant_pb2.MakeExamplesOptions,
 ) -> Tuple[List[range_pb2.Range], Optional[ranges.RangeSet]]:
@@ -2652,14 +3138,17 @@ def processing_regions_from_options(
         'happens if you use "chr20" for a BAM where contig names '
         'don\'t have "chr"s (or vice versa).'
     )
-  regions = regions_to_process(
-      contigs=contigs,
-      partition_size=options.allele_counter_options.partition_size,
-      calling_regions=calling_regions,
-      task_id=options.task_id,
-      num_shards=options.num_shards,
-      candidates=candidate_positions,
-  )
+  if options.partition_plan:
+    regions = partition_plan_regions(options, contigs, calling_regions)
+  else:
+    regions = regions_to_process(
+        contigs=contigs,
+        partition_size=options.allele_counter_options.partition_size,
+        calling_regions=calling_regions,
+        task_id=options.task_id,
+        num_shards=options.num_shards,
+        candidates=candidate_positions,
+    )
 
   region_list = list(regions)
   # When using VcfCandidateImporter, it is safe to skip regions without
@@ -2730,8 +3219,144 @@ def _write_example_and_update_stats(
     types[example_type] += 1
 
 
+def make_examples_runner_in_process(
+    options: deepvariant_pb2.MakeExamplesOptions,
+):
+  """Runs all tasks of options in this process, on options.num_threads threads.
+
+  Each task writes the same outputs as make_examples_runner() would for its
+  task_id, except for runtime_by_region and read phases, which are not
+  supported.
+
+  Args:
+    options: deepvariant.MakeExamplesOptions whose output filenames are
+      filespecs, as set by make_examples_options when num_threads is positive.
+  """
+  resource_monitor = resources.ResourceMonitor().start()
+  unsupported_option = (
+      parallel_region_processor.ParallelRegionProcessor.unsupported_option(
+          options
+      )
+  )
+  if unsupported_option:
+    raise ValueError(
+        '{} is not supported with num_threads.'.format(unsupported_option)
+    )
+  samples_that_need_writers = [
+      sample
+      for sample in options.sample_options
+      if not sample.skip_output_generation
+  ]
+  if not samples_that_need_writers:
+    raise ValueError(
+        'At least one sample should have skip_output_generation=False.'
+    )
+
+  def add_suffix(filename, suffix):
+    if not filename:
+      return ''
+    return OutputsWriter._add_suffix(filename, suffix)  # pylint: disable=protected-access
+
+  # Same regions and files as make_examples_runner() for each task.
+  tasks_options = []
+  shards = []
+  for task_id in range(max(options.num_shards, 1)):
+    task_options = deepvariant_pb2.MakeExamplesOptions()
+    task_options.CopyFrom(options)
+    task_options.task_id = task_id
+    (
+        _,
+        task_options.examples_filename,
+        task_options.candidates_filename,
+        task_options.gvcf_filename,
+        task_options.run_info_filename,
+    ) = sharded_file_utils.resolve_filespecs(
+        task_id,
+        options.examples_filename,
+        options.candidates_filename,
+        options.gvcf_filename,
+        options.run_info_filename,
+    )
+    regions, _ = processing_regions_from_options(task_options)
+    shard = parallel_region_processor.Shard()
+    shard.regions = list(regions)
+    output_files = []
+    for sample in samples_that_need_writers:
+      suffix = None if len(samples_that_need_writers) == 1 else sample.role
+      files = parallel_region_processor.ShardOutputFiles()
+      files.role = sample.role
+      files.examples_filename = add_suffix(
+          task_options.examples_filename, suffix
+      )
+      files.candidates_filename = add_suffix(
+          task_options.candidates_filename, suffix
+      )
+      files.gvcf_filename = add_suffix(task_options.gvcf_filename, suffix)
+      output_files.append(files)
+    shard.output_files = output_files
+    tasks_options.append(task_options)
+    shards.append(shard)
+
+  logging.info(
+      'Making examples of %d tasks on %d threads',
+      len(shards),
+      options.num_threads,
+  )
+  running_timer = timer.TimerStart()
+  processor = parallel_region_processor.ParallelRegionProcessor.create(
+      options, options.num_threads
+  )
+  shards_stats = processor.run(shards)
+  logging.info(
+      'Made examples of %d tasks in %0.2fs, %d regions were processed by '
+      'another thread than the one of their task',
+      len(shards),
+      running_timer.Stop(),
+      processor.num_stolen_regions(),
+  )
+
+  example_channels = pileup_image.PileupImageCreator(
+      options=options.pic_options, ref_reader=None, samples=[]
+  ).get_channels()
+  for task_options, stats in zip(tasks_options, shards_stats):
+    if task_options.run_info_filename:
+      run_info = deepvariant_pb2.MakeExamplesRunInfo(
+          options=task_options,
+          resource_metrics=resource_monitor.metrics(),
+          stats=deepvariant_pb2.MakeExamplesStats(
+              num_examples=stats.num_examples
+          ),
+      )
+      write_make_examples_run_info(
+          run_info, path=task_options.run_info_filename
+      )
+    example_info_filename = dv_utils.get_example_info_json_filename(
+        task_options.examples_filename, task_options.task_id
+    )
+    if example_info_filename is not None:
+      with epath.Path(example_info_filename).open('w') as fout:
+        json.dump(
+            {
+                'version': dv_vcf_constants.DEEP_VARIANT_VERSION,
+                'shape': list(stats.example_shape) or None,
+                'channels': example_channels,
+            },
+            fout,
+        )
+    logging_with_options(
+        task_options,
+        'Found %s candidate variants' % stats.num_candidates,
+    )
+    logging_with_options(
+        task_options, 'Created %s examples' % stats.num_examples
+    )
+
+
 def make_examples_runner(options: deepvariant_pb2.MakeExamplesOptions):
   """Runs examples creation stage of deepvariant."""
+  if options.num_threads > 0:
+    make_examples_runner_in_process(options)
+    return
   resource_monitor = resources.ResourceMonitor().start()
   before_initializing_inputs = time.time()
 
@@ -2834,9 +3459,19 @@ def make_examples_runner(options: deepvariant_pb2.MakeExamplesOptions):
           )
       continue
 
-    (candidates_by_sample, gvcfs_by_sample, runtimes) = (
-        region_processor.process(region, region_n)
-    )
+    examples_by_sample = None
+    if region_processor.native_processor is not None:
+      (
+          candidates_by_sample,
+          gvcfs_by_sample,
+          examples_by_sample,
+          native_example_shape,
+          runtimes,
+      ) = region_processor.process_native(region)
+    else:
+      (candidates_by_sample, gvcfs_by_sample, runtimes) = (
+          region_processor.process(region, region_n)
+      )
     for sample in samples_that_need_writers:
       role = sample.options.role
       if role not in candidates_by_sample:
@@ -2844,14 +3479,19 @@ def make_examples_runner(options: deepvariant_pb2.MakeExamplesOptions):
       if in_training_mode(options) and options.sample_role_to_train != role:
         continue
       writer = writers_dict[role]
-      region_example_shape = region_processor.writes_examples_in_region(
-          candidates_by_sample[role],
-          region,
-          sample.options.order,
-          writer,
-          n_stats,
-          runtimes,
-      )
+      if examples_by_sample is not None:
+        writer.write_serialized_examples(*examples_by_sample[role])
+        n_stats['n_examples'] += len(examples_by_sample[role])
+        region_example_shape = native_example_shape
+      else:
+        region_example_shape = region_processor.writes_examples_in_region(
+            candidates_by_sample[role],
+            region,
+            sample.options.order,
+            writer,
+            n_stats,
+            runtimes,
+        )
       if example_shape is None and region_example_shape is not None:
         example_shape = region_example_shape
       gvcfs = gvcfs_by_sample[role]
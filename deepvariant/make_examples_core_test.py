@@ -51,6 +51,7 @@ from deepvariant.protos import deepvariant_pb2
 from deepvariant.protos import realigner_pb2
 from deepvariant.realigner import realigner
 from third_party.nucleus.io import fasta
+from third_party.nucleus.io import tfrecord
 from third_party.nucleus.io import vcf
 from third_party.nucleus.protos import reads_pb2
 from third_party.nucleus.protos import reference_pb2
@@ -597,6 +598,22 @@ class MakeExamplesCoreUnitTest(parameterized.TestCase):
         make_examples_core.find_ref_n_regions(ref_reader, min_region_len),
     )
 
+  def test_find_ref_n_regions_within_regions(self):
+    ref_reader = fasta.InMemoryFastaReader([('chr1', 0, 'GATACANNNAAAAANNN')])
+    self.assertEqual(
+        [ranges.make_range('chr1', 6, 9)],
+        make_examples_core.find_ref_n_regions(
+            ref_reader, 3, regions=_from_literals(['chr1:5-12'])
+        ),
+    )
+    # Ns are clipped to the regions, so shorter runs are dropped.
+    self.assertEqual(
+        [ranges.make_range('chr1', 14, 17)],
+        make_examples_core.find_ref_n_regions(
+            ref_reader, 3, regions=_from_literals(['chr1:8-9', 'chr1:13-17'])
+        ),
+    )
+
   @parameterized.parameters(
       dict(includes=[], excludes=[], expected=['1:1-100', '2:1-200']),
       dict(includes=['1'], excludes=[], expected=['1:1-100']),
@@ -708,6 +725,52 @@ class MakeExamplesCoreUnitTest(parameterized.TestCase):
           num_shards=num_shards,
       )
 
+  def test_cost_balanced_partitions(self):
+    regions = _from_literals(['chr20:10,000,001-10,020,000'])
+    plan = make_examples_core.cost_balanced_partitions(
+        regions,
+        partition_size=1000,
+        num_shards=3,
+        reads_filenames=[testdata.CHR20_BAM],
+        ref_n_regions=[ranges.parse_literal('chr20:10,019,001-10,020,000')],
+    )
+    self.assertLen(plan, 3)
+    all_regions = []
+    loads = []
+    for partitions in plan:
+      shard_regions = [region for region, _ in partitions]
+      # Each shard is in genomic order.
+      self.assertEqual(
+          shard_regions, sorted(shard_regions, key=lambda r: r.start)
+      )
+      all_regions.extend(shard_regions)
+      loads.append(sum(cost for _, cost in partitions))
+    # The shards cover the regions exactly once.
+    self.assertCountEqual(ranges.RangeSet(all_regions), regions)
+    self.assertEqual(sum(r.end - r.start for r in all_regions), 20000)
+    # Costly partitions are split, so no shard carries much more than its
+    # share.
+    self.assertLess(max(loads), 1.1 * sum(loads) / 3)
+
+  def test_partition_plan_round_trip(self):
+    plan = [
+        [(ranges.make_range('chr20', 0, 10), 5.0)],
+        [
+            (ranges.make_range('chr20', 10, 20), 2.0),
+            (ranges.make_range('chr21', 0, 10), 3.0),
+        ],
+    ]
+    path = test_utils.test_tmpfile('plan.tsv')
+    make_examples_core.write_partition_plan(path, plan, 'fingerprint')
+    self.assertEqual(
+        make_examples_core.read_partition_plan(path, 2, 'fingerprint'),
+        [[region for region, _ in partitions] for partitions in plan],
+    )
+    with self.assertRaisesRegex(ValueError, 'is for 2 shards, not 3'):
+      make_examples_core.read_partition_plan(path, 3, 'fingerprint')
+    with self.assertRaisesRegex(ValueError, 'was made for different regions'):
+      make_examples_core.read_partition_plan(path, 2, 'other')
+
   @parameterized.parameters(
       # Fetch all positions
       (['chr20:1-20000000'], 221),
@@ -925,6 +988,95 @@ class MakeExamplesCoreUnitTest(parameterized.TestCase):
         ),
     )
 
+  @flagsaver.flagsaver
+  def test_partition_plan_rejects_stale_plans(self):
+    FLAGS.mode = 'calling'
+    FLAGS.ref = testdata.CHR20_FASTA
+    FLAGS.reads = testdata.CHR20_BAM
+    FLAGS.regions = 'chr20:10,000,001-10,020,000'
+    FLAGS.examples = 'examples.tfrecord'
+    FLAGS.partition_plan = test_utils.test_tmpfile('stale_plan.tsv')
+
+    options = make_examples.default_options(add_flags=True)
+    regions, _ = make_examples_core.processing_regions_from_options(options)
+    self.assertTrue(os.path.exists(FLAGS.partition_plan))
+    # The plan is reused for the same inputs.
+    self.assertEqual(
+        regions,
+        make_examples_core.processing_regions_from_options(options)[0],
+    )
+
+    # A plan that no longer covers the calling regions is rejected.
+    with open(FLAGS.partition_plan) as f:
+      lines = f.readlines()
+    with open(FLAGS.partition_plan, 'w') as f:
+      f.writelines(lines[:-1])
+    with self.assertRaisesRegex(ValueError, 'does not cover'):
+      make_examples_core.processing_regions_from_options(options)
+
+    # So is a plan made for other regions.
+    FLAGS.regions = 'chr20:10,000,001-10,010,000'
+    options = make_examples.default_options(add_flags=True)
+    with self.assertRaisesRegex(ValueError, 'was made for different regions'):
+      make_examples_core.processing_regions_from_options(options)
+
+  @flagsaver.flagsaver
+  def test_partition_plan_waits_for_task_zero(self):
+    FLAGS.mode = 'calling'
+    FLAGS.ref = testdata.CHR20_FASTA
+    FLAGS.reads = testdata.CHR20_BAM
+    FLAGS.regions = 'chr20:10,000,001-10,020,000'
+    FLAGS.examples = 'examples.tfrecord@2'
+    FLAGS.partition_plan = test_utils.test_tmpfile('waited_plan.tsv')
+    FLAGS.task = 1
+
+    options = make_examples.default_options(add_flags=True)
+    with mock.patch.multiple(
+        make_examples_core,
+        PARTITION_PLAN_POLL_SECONDS=0,
+        PARTITION_PLAN_TIMEOUT_SECONDS=0,
+    ):
+      with self.assertRaisesRegex(ValueError, 'Timed out waiting for task 0'):
+        make_examples_core.processing_regions_from_options(options)
+    self.assertFalse(os.path.exists(FLAGS.partition_plan))
+
+    FLAGS.task = 0
+    regions_0, _ = make_examples_core.processing_regions_from_options(
+        make_examples.default_options(add_flags=True)
+    )
+    FLAGS.task = 1
+    regions_1, _ = make_examples_core.processing_regions_from_options(options)
+    self.assertCountEqual(
+        ranges.RangeSet(regions_0 + regions_1),
+        _from_literals(['chr20:10,000,001-10,020,000']),
+    )
+
+  @parameterized.parameters(
+      dict(variant_caller='very_sensitive_caller'),
+      dict(variant_caller='vcf_candidate_importer'),
+  )
+  @flagsaver.flagsaver
+  def test_make_examples_runner_without_partition_plan(self, variant_caller):
+    FLAGS.mode = 'calling'
+    FLAGS.ref = testdata.CHR20_FASTA
+    FLAGS.reads = testdata.CHR20_BAM
+    FLAGS.variant_caller = variant_caller
+    if variant_caller == 'vcf_candidate_importer':
+      # Without --gvcf, regions without proposed variants are filtered out.
+      FLAGS.proposed_variants = testdata.VCF_CANDIDATE_IMPORTER_VARIANTS
+      FLAGS.regions = 'chr20:59,777,000-60,000,000'
+      FLAGS.realign_reads = False
+    else:
+      FLAGS.regions = 'chr20:10,006,000-10,007,612'
+    FLAGS.examples = test_utils.test_tmpfile(
+        'no_partition_plan.{}.tfrecord.gz'.format(variant_caller)
+    )
+    self.assertEmpty(FLAGS.partition_plan)
+
+    options = make_examples.default_options(add_flags=True)
+    make_examples_core.make_examples_runner(options)
+    self.assertNotEmpty(list(tfrecord.read_tfrecords(FLAGS.examples)))
+
   @flagsaver.flagsaver
   def test_incorrect_empty_regions(self):
     FLAGS.mode = 'calling'
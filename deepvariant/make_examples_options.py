@@ -86,6 +86,47 @@ flags.DEFINE_bool(
         ' specify --nouse_ref_for_cram.'
     ),
 )
+flags.DEFINE_integer(
+    'ref_max_cached_contigs',
+    0,
+    (
+        'If positive, each reference contig is decoded once in full and up to'
+        ' this many contigs are kept in memory, instead of re-reading small'
+        ' chunks of the --ref FASTA. Regions are processed in contig order, so'
+        ' 1 or 2 is usually enough.'
+    ),
+)
+flags.DEFINE_string(
+    'packed_ref',
+    None,
+    (
+        'Optional. A packed copy of --ref written by nucleus pack_reference.'
+        ' If set, reference bases are read from this memory-mapped file, whose'
+        ' pages are shared by all make_examples processes on a host, instead'
+        ' of from the FASTA file. Must be on a local filesystem.'
+    ),
+)
+flags.DEFINE_bool(
+    'native_region_processing',
+    False,
+    (
+        'If True, each region is processed in C++, from querying the reads to'
+        ' encoding the examples. Falls back to the Python path, with a'
+        ' warning, for options the native path does not support, such as'
+        ' realignment or training mode.'
+    ),
+)
+flags.DEFINE_integer(
+    'num_threads',
+    0,
+    (
+        'If positive, all the shards of --examples are made in this process'
+        ' by this many threads, instead of one make_examples process per'
+        ' --task. The threads share the reference and the BAM indexes, and'
+        ' take regions from each other when they run out of work. Requires'
+        ' options supported by --native_region_processing.'
+    ),
+)
 flags.DEFINE_string(
     'examples',
     None,
@@ -581,6 +622,21 @@ _DISCARD_NON_DNA_REGIONS = flags.DEFINE_bool(
         'discarded.'
     ),
 )
+_PARTITION_PLAN = flags.DEFINE_string(
+    'partition_plan',
+    None,
+    (
+        'Optional. Path to a TSV plan assigning regions to shards. If set,'
+        ' regions are split and assigned to shards so that their cost,'
+        ' estimated from the BAM index and the reference Ns, is balanced,'
+        ' instead of round-robin by --partition_size. An existing plan is'
+        ' reused, so runs are reproducible, but only if it was made for the'
+        ' same regions, contigs, --partition_size, reads and reference;'
+        ' otherwise task 0 computes the plan and writes it there, and the'
+        ' other tasks wait for it. Cannot be used with candidate sweep or'
+        ' --candidate_positions.'
+    ),
+)
 
 _OUTPUT_SITELIST = flags.DEFINE_bool(
     'output_sitelist',
@@ -659,6 +715,10 @@ def shared_flags_to_options(
 
     if flags_obj.ref:
       options.reference_filename = flags_obj.ref
+    options.reference_max_cached_contigs = flags_obj.ref_max_cached_contigs
+    if flags_obj.packed_ref:
+      options.packed_reference_filename = flags_obj.packed_ref
+    options.native_region_processing = flags_obj.native_region_processing
     if flags_obj.confident_regions:
       options.confident_regions_filename = flags_obj.confident_regions
     if flags_obj.denovo_regions:
@@ -750,6 +810,18 @@ def shared_flags_to_options(
     options.num_shards = num_shards
     options.runtime_by_region = runtime_by_region
     options.read_phases_output = read_phases_output
+    if flags_obj.num_threads > 0:
+      if flags_obj.task:
+        errors.log_and_raise(
+            '--task cannot be used with --num_threads, which makes all tasks.',
+            errors.CommandLineError,
+        )
+      # The filespecs are resolved for each task by make_examples_runner().
+      options.num_threads = flags_obj.num_threads
+      examples = flags_obj.examples or ''
+      options.examples_filename = examples
+      options.candidates_filename = flags_obj.candidates or ''
+      options.gvcf_filename = flags_obj.gvcf or ''
 
     options.parse_sam_aux_fields = make_examples_core.resolve_sam_aux_fields(
         flags_obj=flags_obj
@@ -841,6 +913,8 @@ def shared_flags_to_options(
     )
 
   options.discard_non_dna_regions = _DISCARD_NON_DNA_REGIONS.value
+  if _PARTITION_PLAN.value:
+    options.partition_plan = _PARTITION_PLAN.value
 
   return options
 
@@ -0,0 +1,358 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/parallel_region_processor.h"
+
+#include <algorithm>
+#include <map>
+#include <thread>  // NOLINT
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/nucleus/io/packed_reference.h"
+#include "third_party/nucleus/io/tfrecord_writer.h"
+#include "third_party/nucleus/protos/fasta.pb.h"
+#include "third_party/nucleus/util/utils.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using nucleus::genomics::v1::Range;
+
+namespace {
+
+// The open files of a ShardOutputFiles.
+struct ShardWriters {
+  std::string role;
+  std::unique_ptr<nucleus::TFRecordWriter> examples;
+  std::unique_ptr<nucleus::TFRecordWriter> candidates;
+  std::unique_ptr<nucleus::TFRecordWriter> gvcfs;
+};
+
+// Opens filename, gzipped if it ends with ".gz", as dv_utils does. Leaves
+// *writer empty if filename is empty.
+nucleus::Status OpenWriter(const std::string& filename,
+                           std::unique_ptr<nucleus::TFRecordWriter>* writer) {
+  if (filename.empty()) {
+    return nucleus::Status();
+  }
+  *writer = nucleus::TFRecordWriter::New(
+      filename, nucleus::EndsWith(filename, ".gz") ? "GZIP" : "");
+  if (*writer == nullptr) {
+    return nucleus::Unknown(absl::StrCat("Could not open ", filename));
+  }
+  return nucleus::Status();
+}
+
+nucleus::Status CloseWriter(const std::string& filename,
+                            nucleus::TFRecordWriter* writer) {
+  if (writer != nullptr && !writer->Close()) {
+    return nucleus::DataLoss(absl::StrCat("Could not close ", filename));
+  }
+  return nucleus::Status();
+}
+
+// The state of a shard while its regions are processed. Outputs of regions
+// that finish before the region the shard writes next wait in pending.
+struct ShardState {
+  std::mutex mutex;
+  std::vector<ShardWriters> writers;
+  int next_index = 0;
+  std::map<int, std::vector<RegionSampleOutputs>> pending;
+  ShardStats stats;
+};
+
+nucleus::Status WriteRegionOutputs(
+    const std::vector<RegionSampleOutputs>& outputs, ShardState* shard) {
+  bool wrote_region = false;
+  for (const RegionSampleOutputs& sample_outputs : outputs) {
+    auto writers =
+        std::find_if(shard->writers.begin(), shard->writers.end(),
+                     [&sample_outputs](const ShardWriters& writers) {
+                       return writers.role == sample_outputs.role;
+                     });
+    if (writers == shard->writers.end()) {
+      continue;
+    }
+    wrote_region = true;
+    bool ok = true;
+    if (writers->examples != nullptr) {
+      for (const std::string& example : sample_outputs.examples) {
+        ok &= writers->examples->WriteRecord(example);
+      }
+    }
+    if (writers->candidates != nullptr) {
+      for (const DeepVariantCall& candidate : sample_outputs.candidates) {
+        ok &= writers->candidates->WriteRecord(candidate.SerializeAsString());
+      }
+    }
+    if (writers->gvcfs != nullptr) {
+      for (const nucleus::genomics::v1::Variant& gvcf : sample_outputs.gvcfs) {
+        ok &= writers->gvcfs->WriteRecord(gvcf.SerializeAsString());
+      }
+    }
+    if (!ok) {
+      return nucleus::DataLoss(
+          absl::StrCat("Could not write the outputs of ", writers->role));
+    }
+    shard->stats.num_candidates += sample_outputs.candidates.size();
+    shard->stats.num_examples += sample_outputs.examples.size();
+    if (shard->stats.example_shape.empty()) {
+      shard->stats.example_shape = sample_outputs.example_shape;
+    }
+  }
+  if (wrote_region) {
+    ++shard->stats.num_regions;
+  }
+  return nucleus::Status();
+}
+
+}  // namespace
+
+RegionWorkQueue::RegionWorkQueue(const std::vector<int>& shard_sizes,
+                                 int num_workers) {
+  CHECK_GT(num_workers, 0);
+  for (int worker = 0; worker < num_workers; ++worker) {
+    workers_.push_back(std::make_unique<WorkerTasks>());
+  }
+  for (int shard = 0; shard < shard_sizes.size(); ++shard) {
+    std::deque<Task>& tasks = workers_[shard % num_workers]->tasks;
+    for (int index = 0; index < shard_sizes[shard]; ++index) {
+      tasks.push_back({shard, index});
+    }
+  }
+}
+
+bool RegionWorkQueue::Next(int worker, Task* task) {
+  {
+    WorkerTasks& own = *workers_[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      *task = own.tasks.front();
+      own.tasks.pop_front();
+      return true;
+    }
+  }
+  // The sizes may change while we look for a victim, so retry until every
+  // worker was seen without tasks.
+  while (true) {
+    int victim = -1;
+    size_t victim_size = 0;
+    for (int other = 0; other < workers_.size(); ++other) {
+      std::lock_guard<std::mutex> lock(workers_[other]->mutex);
+      if (workers_[other]->tasks.size() > victim_size) {
+        victim = other;
+        victim_size = workers_[other]->tasks.size();
+      }
+    }
+    if (victim < 0) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(workers_[victim]->mutex);
+    if (!workers_[victim]->tasks.empty()) {
+      *task = workers_[victim]->tasks.front();
+      workers_[victim]->tasks.pop_front();
+      ++num_stolen_;
+      return true;
+    }
+  }
+}
+
+nucleus::StatusOr<std::unique_ptr<ParallelRegionProcessor>>
+ParallelRegionProcessor::Create(const MakeExamplesOptions& options,
+                                int num_threads) {
+  if (num_threads < 1) {
+    return nucleus::InvalidArgument(
+        absl::StrCat("num_threads must be positive, got ", num_threads));
+  }
+  const std::string unsupported_option = UnsupportedOption(options);
+  if (!unsupported_option.empty()) {
+    return nucleus::InvalidArgument(absl::StrCat(
+        unsupported_option, " is not supported with multiple threads"));
+  }
+
+  auto parallel = std::make_unique<ParallelRegionProcessor>(
+      num_threads, ProcessRegionFn());
+  nucleus::genomics::v1::FastaReaderOptions fasta_options;
+  fasta_options.set_max_cached_contigs(options.reference_max_cached_contigs());
+  for (int worker = 0; worker < num_threads; ++worker) {
+    if (worker == 0 || options.packed_reference_filename().empty()) {
+      nucleus::StatusOr<std::unique_ptr<nucleus::GenomeReference>> ref;
+      if (!options.packed_reference_filename().empty()) {
+        ref = nucleus::PackedReferenceReader::FromFile(
+            options.packed_reference_filename(), fasta_options);
+      } else {
+        ref = nucleus::IndexedFastaReader::FromFile(
+            options.reference_filename(),
+            absl::StrCat(options.reference_filename(), ".fai"), fasta_options);
+      }
+      if (!ref.ok()) {
+        return ref.status();
+      }
+      parallel->refs_.push_back(std::move(ref.ValueOrDie()));
+    }
+    nucleus::StatusOr<std::unique_ptr<RegionProcessor>> region_processor =
+        worker == 0
+            ? RegionProcessor::Create(options, parallel->refs_.back().get())
+            : parallel->region_processors_[0]->Clone(
+                  parallel->refs_.back().get());
+    if (!region_processor.ok()) {
+      return region_processor.status();
+    }
+    parallel->region_processors_.push_back(
+        std::move(region_processor.ValueOrDie()));
+  }
+
+  ParallelRegionProcessor* processor = parallel.get();
+  parallel->process_region_ = [processor](int worker, const Range& region) {
+    return processor->region_processors_[worker]->Process(region);
+  };
+  return parallel;
+}
+
+std::string ParallelRegionProcessor::UnsupportedOption(
+    const MakeExamplesOptions& options) {
+  const std::string unsupported_option =
+      RegionProcessor::UnsupportedOption(options);
+  if (!unsupported_option.empty()) {
+    return unsupported_option;
+  }
+  for (const SampleOptions& sample : options.sample_options()) {
+    if (sample.downsample_fraction() > 0) {
+      return "downsample_fraction";
+    }
+  }
+  if (!options.runtime_by_region().empty()) {
+    return "runtime_by_region";
+  }
+  return "";
+}
+
+ParallelRegionProcessor::ParallelRegionProcessor(int num_threads,
+                                                 ProcessRegionFn process_region)
+    : num_threads_(num_threads), process_region_(std::move(process_region)) {
+  CHECK_GT(num_threads_, 0);
+}
+
+nucleus::StatusOr<std::vector<ShardStats>> ParallelRegionProcessor::Run(
+    const std::vector<Shard>& shards) {
+  std::vector<std::unique_ptr<ShardState>> states;
+  std::vector<int> shard_sizes;
+  for (const Shard& shard : shards) {
+    states.push_back(std::make_unique<ShardState>());
+    shard_sizes.push_back(shard.regions.size());
+    for (const ShardOutputFiles& files : shard.output_files) {
+      ShardWriters writers;
+      writers.role = files.role;
+      NUCLEUS_RETURN_IF_ERROR(
+          OpenWriter(files.examples_filename, &writers.examples));
+      NUCLEUS_RETURN_IF_ERROR(
+          OpenWriter(files.candidates_filename, &writers.candidates));
+      NUCLEUS_RETURN_IF_ERROR(OpenWriter(files.gvcf_filename, &writers.gvcfs));
+      states.back()->writers.push_back(std::move(writers));
+    }
+  }
+
+  RegionWorkQueue queue(shard_sizes, num_threads_);
+  std::mutex status_mutex;
+  nucleus::Status status;
+  std::atomic<bool> failed(false);
+  auto fail = [&](const nucleus::Status& error) {
+    std::lock_guard<std::mutex> lock(status_mutex);
+    if (status.ok()) {
+      status = error;
+    }
+    failed = true;
+  };
+  auto work = [&](int worker) {
+    RegionWorkQueue::Task task;
+    while (!failed && queue.Next(worker, &task)) {
+      nucleus::StatusOr<std::vector<RegionSampleOutputs>> outputs =
+          process_region_(worker, shards[task.shard].regions[task.index]);
+      if (!outputs.ok()) {
+        fail(outputs.status());
+        return;
+      }
+      ShardState& state = *states[task.shard];
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.pending.emplace(task.index, std::move(outputs.ValueOrDie()));
+      for (auto next = state.pending.find(state.next_index);
+           next != state.pending.end();
+           next = state.pending.find(state.next_index)) {
+        const nucleus::Status written =
+            WriteRegionOutputs(next->second, &state);
+        if (!written.ok()) {
+          fail(written);
+          return;
+        }
+        state.pending.erase(next);
+        ++state.next_index;
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int worker = 1; worker < num_threads_; ++worker) {
+    threads.emplace_back(work, worker);
+  }
+  work(0);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  num_stolen_regions_ = queue.NumStolen();
+  LOG(INFO) << "Processed " << shards.size() << " shards on " << num_threads_
+            << " threads, " << num_stolen_regions_ << " regions were stolen";
+
+  std::vector<ShardStats> stats;
+  for (int shard = 0; shard < shards.size(); ++shard) {
+    for (int i = 0; i < shards[shard].output_files.size(); ++i) {
+      const ShardOutputFiles& files = shards[shard].output_files[i];
+      ShardWriters& writers = states[shard]->writers[i];
+      NUCLEUS_RETURN_IF_ERROR(
+          CloseWriter(files.examples_filename, writers.examples.get()));
+      NUCLEUS_RETURN_IF_ERROR(
+          CloseWriter(files.candidates_filename, writers.candidates.get()));
+      NUCLEUS_RETURN_IF_ERROR(
+          CloseWriter(files.gvcf_filename, writers.gvcfs.get()));
+    }
+    stats.push_back(states[shard]->stats);
+  }
+  if (!status.ok()) {
+    return status;
+  }
+  return stats;
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
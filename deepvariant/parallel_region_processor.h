@@ -0,0 +1,166 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_PARALLEL_REGION_PROCESSOR_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_PARALLEL_REGION_PROCESSOR_H_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <vector>
+
+#include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/region_processor.h"
+#include "third_party/nucleus/core/statusor.h"
+#include "third_party/nucleus/io/reference.h"
+#include "third_party/nucleus/protos/range.pb.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+// The output files of one sample role in a shard. Outputs whose filename is
+// empty are not written. Filenames ending in ".gz" are GZIP compressed.
+struct ShardOutputFiles {
+  std::string role;
+  std::string examples_filename;
+  std::string candidates_filename;
+  std::string gvcf_filename;
+};
+
+// A shard of make_examples: the regions of one --task, whose outputs are
+// written in the order of regions.
+struct Shard {
+  std::vector<nucleus::genomics::v1::Range> regions;
+  std::vector<ShardOutputFiles> output_files;
+};
+
+// What was written for a shard.
+struct ShardStats {
+  int64_t num_regions = 0;
+  int64_t num_candidates = 0;
+  int64_t num_examples = 0;
+  // {height, width, channels} of the first example, or empty.
+  std::vector<int> example_shape;
+};
+
+// Hands out the regions of the shards to worker threads. Each worker owns
+// the regions of the shards s with s % num_workers == worker, in order, so
+// that consecutive regions of a shard go to the same worker. A worker whose
+// regions are done steals the next region of the worker with the most regions
+// left. Stealing from the front keeps the stolen region close to the one its
+// shard writes next, which bounds the outputs waiting to be written.
+class RegionWorkQueue {
+ public:
+  struct Task {
+    int shard;
+    int index;
+  };
+
+  // shard_sizes[s] is the number of regions of shard s.
+  RegionWorkQueue(const std::vector<int>& shard_sizes, int num_workers);
+
+  // Sets *task to the next region for worker. Returns false when no region is
+  // left.
+  bool Next(int worker, Task* task);
+
+  // Number of regions processed by a worker that does not own them.
+  int64_t NumStolen() const { return num_stolen_; }
+
+ private:
+  struct WorkerTasks {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<WorkerTasks>> workers_;
+  std::atomic<int64_t> num_stolen_{0};
+};
+
+// Runs make_examples for several shards in one process. Worker threads share
+// the reference and, through SamReader::Clone(), the BAM indexes, and each
+// has its own RegionProcessor. The outputs of each shard are written to its
+// files in the order of its regions, as make_examples --task writes them, so
+// the files are the same as the ones of one make_examples process per shard.
+//
+// Only the options supported by RegionProcessor can be used, and the reads
+// cannot be downsampled: the downsampling of a reader depends on all the
+// reads it returned before, which would depend on the scheduling.
+class ParallelRegionProcessor {
+ public:
+  // Returns the outputs of region, processed by worker.
+  using ProcessRegionFn =
+      std::function<nucleus::StatusOr<std::vector<RegionSampleOutputs>>(
+          int worker, const nucleus::genomics::v1::Range& region)>;
+
+  // Opens the reference and reads of options for num_threads workers. A
+  // packed reference (packed_reference_filename) is shared by all workers;
+  // the IndexedFastaReader of reference_filename is not safe to use from
+  // several threads, so then each worker opens its own.
+  static nucleus::StatusOr<std::unique_ptr<ParallelRegionProcessor>> Create(
+      const MakeExamplesOptions& options, int num_threads);
+
+  // Returns why options cannot be processed in parallel, or an empty string.
+  static std::string UnsupportedOption(const MakeExamplesOptions& options);
+
+  // Processes the regions with process_region on num_threads threads.
+  ParallelRegionProcessor(int num_threads, ProcessRegionFn process_region);
+
+  // Processes the regions of shards and writes their outputs. Returns the
+  // stats of each shard, or the first error of any region or file.
+  nucleus::StatusOr<std::vector<ShardStats>> Run(
+      const std::vector<Shard>& shards);
+
+  int NumThreads() const { return num_threads_; }
+
+  // Number of regions stolen by the last Run().
+  int64_t NumStolenRegions() const { return num_stolen_regions_; }
+
+ private:
+  const int num_threads_;
+  ProcessRegionFn process_region_;
+
+  // Readers owned for process_region_ when built by Create().
+  std::vector<std::unique_ptr<nucleus::GenomeReference>> refs_;
+  std::vector<std::unique_ptr<RegionProcessor>> region_processors_;
+
+  int64_t num_stolen_regions_ = 0;
+};
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_PARALLEL_REGION_PROCESSOR_H_
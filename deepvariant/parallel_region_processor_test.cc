@@ -0,0 +1,224 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/parallel_region_processor.h"
+
+#include <chrono>  // NOLINT
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "deepvariant/protos/deepvariant.pb.h"
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+#include "third_party/nucleus/io/tfrecord_reader.h"
+#include "third_party/nucleus/protos/range.pb.h"
+#include "third_party/nucleus/testing/test_utils.h"
+#include "third_party/nucleus/util/utils.h"
+#include "absl/strings/str_cat.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using nucleus::MakeRange;
+using nucleus::genomics::v1::Range;
+using ::testing::ElementsAre;
+using ::testing::ElementsAreArray;
+using ::testing::IsEmpty;
+using ::testing::UnorderedElementsAreArray;
+
+namespace {
+
+std::vector<std::string> ReadRecords(const std::string& filename) {
+  std::unique_ptr<nucleus::TFRecordReader> reader =
+      nucleus::TFRecordReader::New(filename, "");
+  std::vector<std::string> records;
+  while (reader->GetNext()) {
+    records.push_back(reader->record());
+  }
+  return records;
+}
+
+// Returns one example per region, the region itself, and a candidate whose
+// variant starts at the start of the region. Slower for every other region so
+// that regions finish out of order.
+nucleus::StatusOr<std::vector<RegionSampleOutputs>> FakeProcessRegion(
+    int worker, const Range& region) {
+  if (region.start() % 2 == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  RegionSampleOutputs outputs;
+  outputs.role = "child";
+  outputs.examples.push_back(region.SerializeAsString());
+  outputs.candidates.emplace_back();
+  outputs.candidates.back().mutable_variant()->set_start(region.start());
+  outputs.example_shape = {100, 221, 7};
+  return std::vector<RegionSampleOutputs>{outputs};
+}
+
+Shard MakeShard(const std::string& prefix, int first_start, int num_regions) {
+  Shard shard;
+  for (int i = 0; i < num_regions; ++i) {
+    shard.regions.push_back(MakeRange("chr20", first_start + i, 1000));
+  }
+  shard.output_files.push_back({"child", nucleus::MakeTempFile(prefix + ".ex"),
+                                nucleus::MakeTempFile(prefix + ".cand"), ""});
+  return shard;
+}
+
+TEST(RegionWorkQueueTest, HandsOutOwnRegionsInOrder) {
+  RegionWorkQueue queue({2, 1, 2}, 2);
+  RegionWorkQueue::Task task;
+  std::vector<std::pair<int, int>> tasks;
+  while (queue.Next(0, &task)) {
+    tasks.emplace_back(task.shard, task.index);
+  }
+  // Worker 0 owns shards 0 and 2, then steals shard 1 from worker 1.
+  EXPECT_THAT(tasks, ElementsAre(std::make_pair(0, 0), std::make_pair(0, 1),
+                                 std::make_pair(2, 0), std::make_pair(2, 1),
+                                 std::make_pair(1, 0)));
+  EXPECT_EQ(queue.NumStolen(), 1);
+  EXPECT_FALSE(queue.Next(1, &task));
+}
+
+TEST(RegionWorkQueueTest, StealsFromTheWorkerWithTheMostRegions) {
+  RegionWorkQueue queue({1, 3, 2}, 3);
+  RegionWorkQueue::Task task;
+  ASSERT_TRUE(queue.Next(0, &task));
+  EXPECT_EQ(task.shard, 0);
+  ASSERT_TRUE(queue.Next(0, &task));
+  EXPECT_EQ(task.shard, 1);
+  EXPECT_EQ(task.index, 0);
+  ASSERT_TRUE(queue.Next(2, &task));
+  EXPECT_EQ(task.shard, 2);
+  ASSERT_TRUE(queue.Next(0, &task));
+  EXPECT_EQ(task.shard, 1);
+  EXPECT_EQ(task.index, 1);
+  EXPECT_EQ(queue.NumStolen(), 2);
+}
+
+TEST(ParallelRegionProcessorTest, WritesShardsInRegionOrder) {
+  // Shard 1 has most of the regions, so they are stolen by other threads.
+  std::vector<Shard> shards = {MakeShard("shard0", 0, 3),
+                               MakeShard("shard1", 100, 40),
+                               MakeShard("shard2", 200, 1)};
+  ParallelRegionProcessor processor(4, FakeProcessRegion);
+  nucleus::StatusOr<std::vector<ShardStats>> stats = processor.Run(shards);
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  ASSERT_EQ(stats.ValueOrDie().size(), 3);
+
+  for (int i = 0; i < shards.size(); ++i) {
+    const Shard& shard = shards[i];
+    std::vector<std::string> expected_examples;
+    for (const Range& region : shard.regions) {
+      expected_examples.push_back(region.SerializeAsString());
+    }
+    EXPECT_THAT(ReadRecords(shard.output_files[0].examples_filename),
+                ElementsAreArray(expected_examples));
+    std::vector<std::string> candidates =
+        ReadRecords(shard.output_files[0].candidates_filename);
+    ASSERT_EQ(candidates.size(), shard.regions.size());
+    for (int j = 0; j < candidates.size(); ++j) {
+      DeepVariantCall candidate;
+      ASSERT_TRUE(candidate.ParseFromString(candidates[j]));
+      EXPECT_EQ(candidate.variant().start(), shard.regions[j].start());
+    }
+
+    const ShardStats& shard_stats = stats.ValueOrDie()[i];
+    EXPECT_EQ(shard_stats.num_regions, shard.regions.size());
+    EXPECT_EQ(shard_stats.num_candidates, shard.regions.size());
+    EXPECT_EQ(shard_stats.num_examples, shard.regions.size());
+    EXPECT_THAT(shard_stats.example_shape, ElementsAre(100, 221, 7));
+  }
+  EXPECT_GT(processor.NumStolenRegions(), 0);
+}
+
+TEST(ParallelRegionProcessorTest, SkipsRolesWithoutFiles) {
+  std::vector<Shard> shards = {MakeShard("roles", 0, 2)};
+  shards[0].output_files[0].role = "parent1";
+  ParallelRegionProcessor processor(2, FakeProcessRegion);
+  nucleus::StatusOr<std::vector<ShardStats>> stats = processor.Run(shards);
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_EQ(stats.ValueOrDie()[0].num_regions, 0);
+  EXPECT_THAT(ReadRecords(shards[0].output_files[0].examples_filename),
+              IsEmpty());
+}
+
+TEST(ParallelRegionProcessorTest, ReturnsTheErrorOfARegion) {
+  std::vector<Shard> shards = {MakeShard("error", 0, 20)};
+  ParallelRegionProcessor processor(
+      3, [](int worker, const Range& region)
+             -> nucleus::StatusOr<std::vector<RegionSampleOutputs>> {
+        if (region.start() == 7) {
+          return nucleus::NotFound("region 7");
+        }
+        return FakeProcessRegion(worker, region);
+      });
+  nucleus::StatusOr<std::vector<ShardStats>> stats = processor.Run(shards);
+  EXPECT_FALSE(stats.ok());
+  EXPECT_EQ(stats.status().error_message(), "region 7");
+  // The regions before the failing one were written.
+  std::vector<std::string> examples =
+      ReadRecords(shards[0].output_files[0].examples_filename);
+  ASSERT_LE(examples.size(), 7);
+  for (int i = 0; i < examples.size(); ++i) {
+    EXPECT_EQ(examples[i], shards[0].regions[i].SerializeAsString());
+  }
+}
+
+TEST(ParallelRegionProcessorTest, UnsupportedOption) {
+  MakeExamplesOptions options;
+  options.set_mode(MakeExamplesOptions::CALLING);
+  options.set_variant_caller(MakeExamplesOptions::VERY_SENSITIVE_CALLER);
+  options.mutable_pic_options()->set_alt_aligned_pileup("none");
+  options.mutable_pic_options()->set_multi_allelic_mode(
+      PileupImageOptions::ADD_HET_ALT_IMAGES);
+  options.add_sample_options()->set_role("child");
+  EXPECT_EQ(ParallelRegionProcessor::UnsupportedOption(options), "");
+
+  options.mutable_sample_options(0)->set_downsample_fraction(0.5);
+  EXPECT_EQ(ParallelRegionProcessor::UnsupportedOption(options),
+            "downsample_fraction");
+
+  options.set_realigner_enabled(true);
+  EXPECT_EQ(ParallelRegionProcessor::UnsupportedOption(options),
+            "realigner_enabled");
+}
+
+}  // namespace
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
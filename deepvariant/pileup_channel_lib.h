@@ -41,7 +41,9 @@
 #include <tuple>
 #include <vector>
 
+#include "deepvariant/pileup_channel_simd.h"
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/read_registry.h"
 #include "absl/container/btree_set.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
@@ -143,12 +145,14 @@ inline int BaseColor(char base, const PileupImageOptions& options) {
 
 inline std::vector<std::uint8_t> BaseColorVector(
     const std::string& bases, const PileupImageOptions& options) {
-  std::vector<std::uint8_t> base_colors;
-  base_colors.reserve(bases.size());
-  for (const char base : bases) {
-    int color = BaseColor(base, options);
-    base_colors.push_back(color);
-  }
+  const BaseColors colors = {
+      static_cast<std::uint8_t>(BaseColor('A', options)),
+      static_cast<std::uint8_t>(BaseColor('C', options)),
+      static_cast<std::uint8_t>(BaseColor('G', options)),
+      static_cast<std::uint8_t>(BaseColor('T', options))};
+  std::vector<std::uint8_t> base_colors(bases.size());
+  GetPileupKernels().base_color(bases.data(), bases.size(), colors,
+                                base_colors.data());
   return base_colors;
 }
 
@@ -204,6 +208,47 @@ inline int ReadSupportsAlt(const DeepVariantCall& dv_call, const Read& read,
   return 0;
 }
 
+// Same as above for the read with the given ReadRegistry id, looked up in the
+// integer read id sidecar of dv_call (allele_support_ids).
+inline int ReadSupportsAlt(const DeepVariantCall& dv_call, int32_t read_id,
+                           const std::vector<std::string>& alt_alleles) {
+  const auto& allele_support_ids = dv_call.allele_support_ids();
+  // Iterate over all alts, not just alt_alleles.
+  for (const std::string& alt_allele : dv_call.variant().alternate_bases()) {
+    const auto it = allele_support_ids.find(alt_allele);
+    if (it == allele_support_ids.end()) {
+      continue;
+    }
+    const auto& read_ids = it->second.read_ids();
+    if (std::find(read_ids.begin(), read_ids.end(), read_id) !=
+        read_ids.end()) {
+      return std::find(alt_alleles.begin(), alt_alleles.end(), alt_allele) !=
+                     alt_alleles.end()
+                 ? 1
+                 : 2;
+    }
+  }
+  return 0;
+}
+
+// Returns true if dv_call carries the integer read id sidecar.
+inline bool HasSupportingReadIds(const DeepVariantCall& dv_call) {
+  return !dv_call.allele_support_ids().empty() ||
+         dv_call.ref_support_ids().read_ids_size() > 0;
+}
+
+// Calls one of the above, preferring the integer read id sidecar when both
+// read_id and the sidecar are available.
+inline int ReadSupportsAlt(const DeepVariantCall& dv_call, const Read& read,
+                           int32_t read_id,
+                           const std::vector<std::string>& alt_alleles) {
+  if (read_id != ReadRegistry::kUnknownReadId &&
+      HasSupportingReadIds(dv_call)) {
+    return ReadSupportsAlt(dv_call, read_id, alt_alleles);
+  }
+  return ReadSupportsAlt(dv_call, read, alt_alleles);
+}
+
 // Returns a value based on whether the current read base matched the
 // reference base it was compared to.
 inline int MatchesRefColor(bool base_matches_ref,
@@ -333,15 +378,10 @@ inline std::vector<std::uint8_t> IsHomoPolymer(const Read& read) {
   // Generates a vector indicating homopolymers of 3 or more.
   // ATCGGGAG
   // 00011100
-  std::vector<std::uint8_t> homopolymer(read.aligned_sequence().size());
-  auto seq = read.aligned_sequence();
-  for (int i = 2; i < seq.size(); i++) {
-    if (seq[i] == seq[i - 1] && seq[i - 1] == seq[i - 2]) {
-      homopolymer[i] = 1;
-      homopolymer[i - 1] = 1;
-      homopolymer[i - 2] = 1;
-    }
-  }
+  const std::string& seq = read.aligned_sequence();
+  std::vector<std::uint8_t> homopolymer(seq.size());
+  GetPileupKernels().is_homopolymer(seq.data(), seq.size(),
+                                    homopolymer.data());
   return homopolymer;
 }
 
@@ -349,20 +389,10 @@ inline std::vector<std::uint8_t> HomoPolymerWeighted(const Read& read) {
   // Generates a vector reflecting the number of repeats observed.
   // ATCGGGAA
   // 11133322
-  std::vector<std::uint8_t> homopolymer(read.aligned_sequence().size());
-  auto seq = read.aligned_sequence();
-  homopolymer[0] = 1;
-  int current_weight = 1;
-  for (int i = 1; i <= seq.size(); i++) {
-    if (seq[i] == seq[i - 1]) {
-      current_weight += 1;
-    } else {
-      for (int cw = current_weight; cw >= 1; cw--) {
-        homopolymer[i - cw] = current_weight;
-      }
-      current_weight = 1;
-    }
-  }
+  const std::string& seq = read.aligned_sequence();
+  std::vector<std::uint8_t> homopolymer(seq.size());
+  GetPileupKernels().homopolymer_weighted(seq.data(), seq.size(),
+                                          homopolymer.data());
   return homopolymer;
 }
 
@@ -454,11 +484,13 @@ class OptChannels {
       ch_base_differs_from_ref,
   };
 
-  bool CalculateChannels(const std::vector<std::string>& channels,
-                         const Read& read, const std::string& ref_bases,
-                         const DeepVariantCall& dv_call,
-                         const std::vector<std::string>& alt_alleles,
-                         int image_start_pos) {
+  // read_id is the ReadRegistry id of read, if known. It allows the
+  // read_supports_variant channel to use the read id sidecar of dv_call.
+  bool CalculateChannels(
+      const std::vector<std::string>& channels, const Read& read,
+      const std::string& ref_bases, const DeepVariantCall& dv_call,
+      const std::vector<std::string>& alt_alleles, int image_start_pos,
+      int32_t read_id = ReadRegistry::kUnknownReadId) {
     absl::btree_set<std::string> included_base_level_channels;
 
     /*--------------------------------------
@@ -474,7 +506,8 @@ class OptChannels {
           base_level_channels_set_.end()) {
         included_base_level_channels.insert(channel);
       } else {
-        bool ok = CalculateReadLevelData(channel, read, dv_call, alt_alleles);
+        bool ok = CalculateReadLevelData(channel, read, read_id, dv_call,
+                                         alt_alleles);
         if (!ok) return false;
       }
     }
@@ -550,7 +583,7 @@ class OptChannels {
   // Calculate values for channels that only depend on information at the
   // granularity of an entire read.
   bool CalculateReadLevelData(const std::string& channel, const Read& read,
-                              const DeepVariantCall& dv_call,
+                              int32_t read_id, const DeepVariantCall& dv_call,
                               const std::vector<std::string>& alt_alleles) {
     if (channel == ch_mapping_quality) {
       const int mapping_quality = read.alignment().mapping_quality();
@@ -568,7 +601,7 @@ class OptChannels {
       read_level_data_[channel].assign({static_cast<std::uint8_t>(
           StrandColor(is_forward_strand, options_))});
     } else if (channel == ch_read_supports_variant) {
-      int supports_alt = ReadSupportsAlt(dv_call, read, alt_alleles);
+      int supports_alt = ReadSupportsAlt(dv_call, read, read_id, alt_alleles);
       read_level_data_[channel].assign({static_cast<std::uint8_t>(
           SupportsAltColor(supports_alt, options_))});
     } else if (channel == ch_read_mapping_percent) {
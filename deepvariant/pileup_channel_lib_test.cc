@@ -193,6 +193,27 @@ TEST(ReadSupportsAlt, OtherAlleleSupporting) {
   EXPECT_EQ(rsa, 2);
 }
 
+TEST(ReadSupportsAlt, ReadIdSidecar) {
+  Read read = nucleus::MakeRead("chr1", 1, "GGGCGCTTTT", {"8M"}, "FRAG3");
+  read.set_read_number(1);
+
+  DeepVariantCall dv_call = DeepVariantCall::default_instance();
+  dv_call.mutable_variant()->mutable_alternate_bases()->Add("GGGCGCATT");
+  dv_call.mutable_variant()->mutable_alternate_bases()->Add("GGGCGCAAT");
+  (*dv_call.mutable_allele_support())["GGGCGCATT"].add_read_names("FRAG3/1");
+  (*dv_call.mutable_allele_support_ids())["GGGCGCATT"].add_read_ids(7);
+  (*dv_call.mutable_allele_support_ids())["GGGCGCAAT"].add_read_ids(8);
+
+  EXPECT_EQ(ReadSupportsAlt(dv_call, 7, {"GGGCGCATT"}), 1);
+  EXPECT_EQ(ReadSupportsAlt(dv_call, 8, {"GGGCGCATT"}), 2);
+  EXPECT_EQ(ReadSupportsAlt(dv_call, 9, {"GGGCGCATT"}), 0);
+  // The sidecar is preferred when the read id is known, and the read key is
+  // used otherwise.
+  EXPECT_EQ(ReadSupportsAlt(dv_call, read, 7, {"GGGCGCATT"}), 1);
+  EXPECT_EQ(
+      ReadSupportsAlt(dv_call, read, ReadRegistry::kUnknownReadId, {}), 2);
+}
+
 TEST(MatchesRefColor, BaseMatch) {
   PileupImageOptions options{};
   options.set_reference_matching_read_alpha(1);
@@ -0,0 +1,519 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/pileup_channel_simd.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/log/check.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define DEEPVARIANT_PILEUP_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+namespace {
+
+// Same as kMaxPixelValueAsFloat in pileup_channel_lib.h.
+constexpr float kMaxPixelValue = 254.0;
+
+//--------//
+// Scalar //
+//--------//
+
+inline std::uint8_t ScalarBaseColor(char base, const BaseColors& colors) {
+  switch (base) {
+    case 'A':
+      return colors.a;
+    case 'G':
+      return colors.g;
+    case 'T':
+      return colors.t;
+    case 'C':
+      return colors.c;
+    default:
+      return 0;
+  }
+}
+
+inline std::uint8_t ScalarQualityColor(int qual, int cap) {
+  float capped = static_cast<float>(std::min(cap, qual));
+  return static_cast<int>(kMaxPixelValue * (capped / cap));
+}
+
+// Returns true if seq[i] ends a run of 3 equal bases.
+inline bool EndsHomopolymer(const char* seq, int n, int i) {
+  return i >= 2 && i < n && seq[i] == seq[i - 1] && seq[i - 1] == seq[i - 2];
+}
+
+inline std::uint8_t ScalarIsHomopolymer(const char* seq, int n, int i) {
+  return EndsHomopolymer(seq, n, i) || EndsHomopolymer(seq, n, i + 1) ||
+         EndsHomopolymer(seq, n, i + 2);
+}
+
+void BaseColorScalar(const char* bases, int n, const BaseColors& colors,
+                     std::uint8_t* out) {
+  for (int i = 0; i < n; ++i) {
+    out[i] = ScalarBaseColor(bases[i], colors);
+  }
+}
+
+void QualityColorScalar(const std::int32_t* quals, int n, int cap,
+                        std::uint8_t* out) {
+  for (int i = 0; i < n; ++i) {
+    out[i] = ScalarQualityColor(quals[i], cap);
+  }
+}
+
+void MatchesRefColorScalar(const char* read_bases, const char* ref_bases,
+                           int n, std::uint8_t match_color,
+                           std::uint8_t mismatch_color, std::uint8_t* out) {
+  for (int i = 0; i < n; ++i) {
+    out[i] = read_bases[i] == ref_bases[i] ? match_color : mismatch_color;
+  }
+}
+
+void IsHomopolymerScalar(const char* seq, int n, std::uint8_t* out) {
+  std::fill(out, out + n, 0);
+  for (int i = 2; i < n; i++) {
+    if (seq[i] == seq[i - 1] && seq[i - 1] == seq[i - 2]) {
+      out[i] = 1;
+      out[i - 1] = 1;
+      out[i - 2] = 1;
+    }
+  }
+}
+
+// Sets out[start, end) to the length of the run. Lengths are truncated to
+// 8 bits.
+inline void FillRunLength(int start, int end, std::uint8_t* out) {
+  std::memset(out + start, static_cast<std::uint8_t>(end - start),
+              end - start);
+}
+
+// Fills the run lengths of seq[start, n), given that the run starting at
+// seq[start] is known to continue up to seq[i].
+inline void FillRunLengths(const char* seq, int start, int i, int n,
+                           std::uint8_t* out) {
+  for (; i < n; ++i) {
+    if (seq[i] != seq[i - 1]) {
+      FillRunLength(start, i, out);
+      start = i;
+    }
+  }
+  if (start < n) FillRunLength(start, n, out);
+}
+
+void HomopolymerWeightedScalar(const char* seq, int n, std::uint8_t* out) {
+  FillRunLengths(seq, 0, 1, n, out);
+}
+
+#ifdef DEEPVARIANT_PILEUP_SIMD_X86
+
+//--------//
+// SSE4.1 //
+//--------//
+
+#define DV_TARGET_SSE4 __attribute__((target("sse4.1")))
+
+DV_TARGET_SSE4 void BaseColorSse4(const char* bases, int n,
+                                  const BaseColors& colors, std::uint8_t* out) {
+  const __m128i a = _mm_set1_epi8('A');
+  const __m128i c = _mm_set1_epi8('C');
+  const __m128i g = _mm_set1_epi8('G');
+  const __m128i t = _mm_set1_epi8('T');
+  const __m128i a_color = _mm_set1_epi8(colors.a);
+  const __m128i c_color = _mm_set1_epi8(colors.c);
+  const __m128i g_color = _mm_set1_epi8(colors.g);
+  const __m128i t_color = _mm_set1_epi8(colors.t);
+  if (n < 16) return BaseColorScalar(bases, n, colors, out);
+  for (int i = 0; i < n; i += 16) {
+    // The last block overlaps the previous one instead of leaving a tail.
+    if (i + 16 > n) i = n - 16;
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(bases + i));
+    __m128i color = _mm_and_si128(_mm_cmpeq_epi8(v, a), a_color);
+    color = _mm_or_si128(color, _mm_and_si128(_mm_cmpeq_epi8(v, c), c_color));
+    color = _mm_or_si128(color, _mm_and_si128(_mm_cmpeq_epi8(v, g), g_color));
+    color = _mm_or_si128(color, _mm_and_si128(_mm_cmpeq_epi8(v, t), t_color));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), color);
+  }
+}
+
+// Colors 4 qualities, returned as 32-bit lanes holding the low 8 bits.
+DV_TARGET_SSE4 inline __m128i QualityColor4Sse4(const std::int32_t* quals,
+                                                __m128i cap, __m128 cap_ps,
+                                                __m128 max_pixel) {
+  const __m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(quals));
+  const __m128 capped = _mm_cvtepi32_ps(_mm_min_epi32(cap, q));
+  const __m128i color =
+      _mm_cvttps_epi32(_mm_mul_ps(max_pixel, _mm_div_ps(capped, cap_ps)));
+  return _mm_and_si128(color, _mm_set1_epi32(0xff));
+}
+
+DV_TARGET_SSE4 void QualityColorSse4(const std::int32_t* quals, int n, int cap,
+                                     std::uint8_t* out) {
+  const __m128i cap_epi32 = _mm_set1_epi32(cap);
+  const __m128 cap_ps = _mm_set1_ps(static_cast<float>(cap));
+  const __m128 max_pixel = _mm_set1_ps(kMaxPixelValue);
+  if (n < 16) return QualityColorScalar(quals, n, cap, out);
+  for (int i = 0; i < n; i += 16) {
+    if (i + 16 > n) i = n - 16;
+    const __m128i c0 =
+        QualityColor4Sse4(quals + i, cap_epi32, cap_ps, max_pixel);
+    const __m128i c1 =
+        QualityColor4Sse4(quals + i + 4, cap_epi32, cap_ps, max_pixel);
+    const __m128i c2 =
+        QualityColor4Sse4(quals + i + 8, cap_epi32, cap_ps, max_pixel);
+    const __m128i c3 =
+        QualityColor4Sse4(quals + i + 12, cap_epi32, cap_ps, max_pixel);
+    // All lanes are in [0, 255], so the saturating packs don't saturate.
+    const __m128i packed = _mm_packus_epi16(_mm_packus_epi32(c0, c1),
+                                            _mm_packus_epi32(c2, c3));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+  }
+}
+
+DV_TARGET_SSE4 void MatchesRefColorSse4(const char* read_bases,
+                                        const char* ref_bases, int n,
+                                        std::uint8_t match_color,
+                                        std::uint8_t mismatch_color,
+                                        std::uint8_t* out) {
+  const __m128i match = _mm_set1_epi8(match_color);
+  const __m128i mismatch = _mm_set1_epi8(mismatch_color);
+  if (n < 16) {
+    return MatchesRefColorScalar(read_bases, ref_bases, n, match_color,
+                                 mismatch_color, out);
+  }
+  for (int i = 0; i < n; i += 16) {
+    if (i + 16 > n) i = n - 16;
+    const __m128i read =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(read_bases + i));
+    const __m128i ref =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ref_bases + i));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(out + i),
+        _mm_blendv_epi8(mismatch, match, _mm_cmpeq_epi8(read, ref)));
+  }
+}
+
+DV_TARGET_SSE4 inline __m128i LoadSse4(const char* p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+DV_TARGET_SSE4 void IsHomopolymerSse4(const char* seq, int n,
+                                      std::uint8_t* out) {
+  // out[i] is set if a run of 3 ends at i, i + 1 or i + 2. Blocks load
+  // seq[i - 2, i + 18), the first and last 2 bases are done one at a time.
+  if (n < 20) return IsHomopolymerScalar(seq, n, out);
+  const __m128i one = _mm_set1_epi8(1);
+  for (int i = 2; i < n - 2; i += 16) {
+    if (i + 18 > n) i = n - 18;
+    const __m128i s_m2 = LoadSse4(seq + i - 2);
+    const __m128i s_m1 = LoadSse4(seq + i - 1);
+    const __m128i s_0 = LoadSse4(seq + i);
+    const __m128i s_1 = LoadSse4(seq + i + 1);
+    const __m128i s_2 = LoadSse4(seq + i + 2);
+    // eq_k[j] = seq[i + j + k] == seq[i + j + k - 1].
+    const __m128i eq_m1 = _mm_cmpeq_epi8(s_m1, s_m2);
+    const __m128i eq_0 = _mm_cmpeq_epi8(s_0, s_m1);
+    const __m128i eq_1 = _mm_cmpeq_epi8(s_1, s_0);
+    const __m128i eq_2 = _mm_cmpeq_epi8(s_2, s_1);
+    // ends_k[j] = a run of 3 ends at i + j + k.
+    const __m128i ends_0 = _mm_and_si128(eq_0, eq_m1);
+    const __m128i ends_1 = _mm_and_si128(eq_1, eq_0);
+    const __m128i ends_2 = _mm_and_si128(eq_2, eq_1);
+    const __m128i in_run =
+        _mm_or_si128(ends_0, _mm_or_si128(ends_1, ends_2));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_and_si128(in_run, one));
+  }
+  for (int i : {0, 1, n - 2, n - 1}) {
+    out[i] = ScalarIsHomopolymer(seq, n, i);
+  }
+}
+
+DV_TARGET_SSE4 void HomopolymerWeightedSse4(const char* seq, int n,
+                                            std::uint8_t* out) {
+  // Bit j of starts is set if a run starts at i + j, i.e. seq[i + j] differs
+  // from the base before it.
+  int start = 0;
+  int i = 1;
+  for (; i + 16 <= n; i += 16) {
+    unsigned starts = ~static_cast<unsigned>(_mm_movemask_epi8(
+                          _mm_cmpeq_epi8(LoadSse4(seq + i),
+                                         LoadSse4(seq + i - 1)))) &
+                      0xffffu;
+    while (starts != 0) {
+      const int end = i + __builtin_ctz(starts);
+      FillRunLength(start, end, out);
+      start = end;
+      starts &= starts - 1;
+    }
+  }
+  FillRunLengths(seq, start, i, n, out);
+}
+
+#undef DV_TARGET_SSE4
+
+//------//
+// AVX2 //
+//------//
+
+#define DV_TARGET_AVX2 __attribute__((target("avx2")))
+
+DV_TARGET_AVX2 inline __m256i LoadAvx2(const void* p) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+DV_TARGET_AVX2 inline void StoreAvx2(std::uint8_t* p, __m256i v) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+}
+
+DV_TARGET_AVX2 void BaseColorAvx2(const char* bases, int n,
+                                  const BaseColors& colors, std::uint8_t* out) {
+  const __m256i a = _mm256_set1_epi8('A');
+  const __m256i c = _mm256_set1_epi8('C');
+  const __m256i g = _mm256_set1_epi8('G');
+  const __m256i t = _mm256_set1_epi8('T');
+  const __m256i a_color = _mm256_set1_epi8(colors.a);
+  const __m256i c_color = _mm256_set1_epi8(colors.c);
+  const __m256i g_color = _mm256_set1_epi8(colors.g);
+  const __m256i t_color = _mm256_set1_epi8(colors.t);
+  if (n < 32) return BaseColorSse4(bases, n, colors, out);
+  for (int i = 0; i < n; i += 32) {
+    if (i + 32 > n) i = n - 32;
+    const __m256i v = LoadAvx2(bases + i);
+    __m256i color = _mm256_and_si256(_mm256_cmpeq_epi8(v, a), a_color);
+    color = _mm256_or_si256(
+        color, _mm256_and_si256(_mm256_cmpeq_epi8(v, c), c_color));
+    color = _mm256_or_si256(
+        color, _mm256_and_si256(_mm256_cmpeq_epi8(v, g), g_color));
+    color = _mm256_or_si256(
+        color, _mm256_and_si256(_mm256_cmpeq_epi8(v, t), t_color));
+    StoreAvx2(out + i, color);
+  }
+}
+
+// Colors 8 qualities, returned as 32-bit lanes holding the low 8 bits.
+DV_TARGET_AVX2 inline __m256i QualityColor8Avx2(const std::int32_t* quals,
+                                                __m256i cap, __m256 cap_ps,
+                                                __m256 max_pixel) {
+  const __m256 capped =
+      _mm256_cvtepi32_ps(_mm256_min_epi32(cap, LoadAvx2(quals)));
+  const __m256i color = _mm256_cvttps_epi32(
+      _mm256_mul_ps(max_pixel, _mm256_div_ps(capped, cap_ps)));
+  return _mm256_and_si256(color, _mm256_set1_epi32(0xff));
+}
+
+DV_TARGET_AVX2 void QualityColorAvx2(const std::int32_t* quals, int n, int cap,
+                                     std::uint8_t* out) {
+  const __m256i cap_epi32 = _mm256_set1_epi32(cap);
+  const __m256 cap_ps = _mm256_set1_ps(static_cast<float>(cap));
+  const __m256 max_pixel = _mm256_set1_ps(kMaxPixelValue);
+  // The packs work within 128-bit lanes, this restores the order of the
+  // 4-byte groups.
+  const __m256i unshuffle = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  if (n < 32) return QualityColorSse4(quals, n, cap, out);
+  for (int i = 0; i < n; i += 32) {
+    if (i + 32 > n) i = n - 32;
+    const __m256i c0 =
+        QualityColor8Avx2(quals + i, cap_epi32, cap_ps, max_pixel);
+    const __m256i c1 =
+        QualityColor8Avx2(quals + i + 8, cap_epi32, cap_ps, max_pixel);
+    const __m256i c2 =
+        QualityColor8Avx2(quals + i + 16, cap_epi32, cap_ps, max_pixel);
+    const __m256i c3 =
+        QualityColor8Avx2(quals + i + 24, cap_epi32, cap_ps, max_pixel);
+    // All lanes are in [0, 255], so the saturating packs don't saturate.
+    const __m256i packed = _mm256_packus_epi16(_mm256_packus_epi32(c0, c1),
+                                               _mm256_packus_epi32(c2, c3));
+    StoreAvx2(out + i, _mm256_permutevar8x32_epi32(packed, unshuffle));
+  }
+}
+
+DV_TARGET_AVX2 void MatchesRefColorAvx2(const char* read_bases,
+                                        const char* ref_bases, int n,
+                                        std::uint8_t match_color,
+                                        std::uint8_t mismatch_color,
+                                        std::uint8_t* out) {
+  const __m256i match = _mm256_set1_epi8(match_color);
+  const __m256i mismatch = _mm256_set1_epi8(mismatch_color);
+  if (n < 32) {
+    return MatchesRefColorSse4(read_bases, ref_bases, n, match_color,
+                               mismatch_color, out);
+  }
+  for (int i = 0; i < n; i += 32) {
+    if (i + 32 > n) i = n - 32;
+    const __m256i equal =
+        _mm256_cmpeq_epi8(LoadAvx2(read_bases + i), LoadAvx2(ref_bases + i));
+    StoreAvx2(out + i, _mm256_blendv_epi8(mismatch, match, equal));
+  }
+}
+
+DV_TARGET_AVX2 void IsHomopolymerAvx2(const char* seq, int n,
+                                      std::uint8_t* out) {
+  // Same as IsHomopolymerSse4, 32 bases at a time.
+  if (n < 36) return IsHomopolymerSse4(seq, n, out);
+  const __m256i one = _mm256_set1_epi8(1);
+  for (int i = 2; i < n - 2; i += 32) {
+    if (i + 34 > n) i = n - 34;
+    const __m256i s_m2 = LoadAvx2(seq + i - 2);
+    const __m256i s_m1 = LoadAvx2(seq + i - 1);
+    const __m256i s_0 = LoadAvx2(seq + i);
+    const __m256i s_1 = LoadAvx2(seq + i + 1);
+    const __m256i s_2 = LoadAvx2(seq + i + 2);
+    const __m256i eq_m1 = _mm256_cmpeq_epi8(s_m1, s_m2);
+    const __m256i eq_0 = _mm256_cmpeq_epi8(s_0, s_m1);
+    const __m256i eq_1 = _mm256_cmpeq_epi8(s_1, s_0);
+    const __m256i eq_2 = _mm256_cmpeq_epi8(s_2, s_1);
+    const __m256i ends_0 = _mm256_and_si256(eq_0, eq_m1);
+    const __m256i ends_1 = _mm256_and_si256(eq_1, eq_0);
+    const __m256i ends_2 = _mm256_and_si256(eq_2, eq_1);
+    const __m256i in_run =
+        _mm256_or_si256(ends_0, _mm256_or_si256(ends_1, ends_2));
+    StoreAvx2(out + i, _mm256_and_si256(in_run, one));
+  }
+  for (int i : {0, 1, n - 2, n - 1}) {
+    out[i] = ScalarIsHomopolymer(seq, n, i);
+  }
+}
+
+DV_TARGET_AVX2 void HomopolymerWeightedAvx2(const char* seq, int n,
+                                            std::uint8_t* out) {
+  // Same as HomopolymerWeightedSse4, 32 bases at a time.
+  int start = 0;
+  int i = 1;
+  for (; i + 32 <= n; i += 32) {
+    unsigned starts = ~static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(LoadAvx2(seq + i), LoadAvx2(seq + i - 1))));
+    while (starts != 0) {
+      const int end = i + __builtin_ctz(starts);
+      FillRunLength(start, end, out);
+      start = end;
+      starts &= starts - 1;
+    }
+  }
+  FillRunLengths(seq, start, i, n, out);
+}
+
+#undef DV_TARGET_AVX2
+
+#endif  // DEEPVARIANT_PILEUP_SIMD_X86
+
+const PileupKernels kScalarKernels = {
+    SimdLevel::kScalar,    BaseColorScalar,
+    QualityColorScalar,    MatchesRefColorScalar,
+    IsHomopolymerScalar,   HomopolymerWeightedScalar,
+};
+
+#ifdef DEEPVARIANT_PILEUP_SIMD_X86
+const PileupKernels kSse4Kernels = {
+    SimdLevel::kSse4,      BaseColorSse4,
+    QualityColorSse4,      MatchesRefColorSse4,
+    IsHomopolymerSse4,     HomopolymerWeightedSse4,
+};
+
+const PileupKernels kAvx2Kernels = {
+    SimdLevel::kAvx2,      BaseColorAvx2,
+    QualityColorAvx2,      MatchesRefColorAvx2,
+    IsHomopolymerAvx2,     HomopolymerWeightedAvx2,
+};
+#endif  // DEEPVARIANT_PILEUP_SIMD_X86
+
+}  // namespace
+
+std::string SimdLevelName(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::kScalar:
+      return "scalar";
+    case SimdLevel::kSse4:
+      return "sse4";
+    case SimdLevel::kAvx2:
+      return "avx2";
+  }
+  return "unknown";
+}
+
+SimdLevel DetectSimdLevel() {
+#ifdef DEEPVARIANT_PILEUP_SIMD_X86
+  static const SimdLevel level = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::kAvx2;
+    if (__builtin_cpu_supports("sse4.1")) return SimdLevel::kSse4;
+    return SimdLevel::kScalar;
+  }();
+  return level;
+#else
+  return SimdLevel::kScalar;
+#endif
+}
+
+const PileupKernels& GetPileupKernels(SimdLevel level) {
+  CHECK_LE(static_cast<int>(level), static_cast<int>(DetectSimdLevel()))
+      << SimdLevelName(level) << " is not supported by this CPU";
+  switch (level) {
+#ifdef DEEPVARIANT_PILEUP_SIMD_X86
+    case SimdLevel::kAvx2:
+      return kAvx2Kernels;
+    case SimdLevel::kSse4:
+      return kSse4Kernels;
+#endif
+    default:
+      return kScalarKernels;
+  }
+}
+
+const PileupKernels& GetPileupKernels() {
+  static const PileupKernels& kernels = GetPileupKernels(DetectSimdLevel());
+  return kernels;
+}
+
+std::vector<SimdLevel> SupportedSimdLevels() {
+  std::vector<SimdLevel> levels;
+  for (int level = 0; level <= static_cast<int>(DetectSimdLevel()); ++level) {
+    levels.push_back(static_cast<SimdLevel>(level));
+  }
+  return levels;
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
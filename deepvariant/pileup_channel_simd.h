@@ -0,0 +1,106 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Vectorized kernels for the per-base pileup channel colors.
+//
+// Each kernel has a scalar implementation and, on x86, SSE4.1 and AVX2
+// implementations compiled with function-level target attributes. The best
+// implementation supported by the CPU is picked once at runtime. All
+// implementations give bit-identical output.
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_PILEUP_CHANNEL_SIMD_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_PILEUP_CHANNEL_SIMD_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+enum class SimdLevel { kScalar = 0, kSse4 = 1, kAvx2 = 2 };
+
+// Returns a readable name for level, e.g. "avx2".
+std::string SimdLevelName(SimdLevel level);
+
+// Returns the best SimdLevel supported by this CPU.
+SimdLevel DetectSimdLevel();
+
+// Colors of the four bases, see BaseColor() in pileup_channel_lib.h. Any other
+// base gets color 0.
+struct BaseColors {
+  std::uint8_t a;
+  std::uint8_t c;
+  std::uint8_t g;
+  std::uint8_t t;
+};
+
+// The pileup kernels of one SimdLevel. Each kernel writes n output bytes.
+struct PileupKernels {
+  SimdLevel level;
+
+  // out[i] = color of bases[i].
+  void (*base_color)(const char* bases, int n, const BaseColors& colors,
+                     std::uint8_t* out);
+
+  // out[i] = int(254.0f * (float(min(cap, quals[i])) / cap)), truncated to
+  // 8 bits, as BaseQualityColor() and MappingQualityColor() compute it.
+  void (*quality_color)(const std::int32_t* quals, int n, int cap,
+                        std::uint8_t* out);
+
+  // out[i] = read_bases[i] == ref_bases[i] ? match_color : mismatch_color.
+  void (*matches_ref_color)(const char* read_bases, const char* ref_bases,
+                            int n, std::uint8_t match_color,
+                            std::uint8_t mismatch_color, std::uint8_t* out);
+
+  // out[i] = 1 if seq[i] is part of a run of 3 or more equal bases, else 0.
+  void (*is_homopolymer)(const char* seq, int n, std::uint8_t* out);
+
+  // out[i] = length of the run of equal bases containing seq[i], truncated to
+  // 8 bits.
+  void (*homopolymer_weighted)(const char* seq, int n, std::uint8_t* out);
+};
+
+// Returns the kernels of level. level must be supported by this CPU.
+const PileupKernels& GetPileupKernels(SimdLevel level);
+
+// Returns the kernels of DetectSimdLevel().
+const PileupKernels& GetPileupKernels();
+
+// Returns all SimdLevels supported by this CPU, from kScalar up.
+std::vector<SimdLevel> SupportedSimdLevels();
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_PILEUP_CHANNEL_SIMD_H_
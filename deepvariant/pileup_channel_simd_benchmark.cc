@@ -0,0 +1,189 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Microbenchmarks of the pileup channel kernels at each SimdLevel supported by
+// this CPU, and of encoding a long read with the kernels picked at runtime.
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "deepvariant/pileup_channel_simd.h"
+#include "deepvariant/pileup_image_native.h"
+#include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/read_registry.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+#include "third_party/nucleus/testing/test_utils.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+namespace {
+
+std::string RandomBases(int n) {
+  std::mt19937 gen(n);
+  std::uniform_int_distribution<int> dist(0, 3);
+  std::string bases(n, 'A');
+  for (char& base : bases) base = "ACGT"[dist(gen)];
+  return bases;
+}
+
+std::vector<std::int32_t> RandomQualities(int n) {
+  std::mt19937 gen(n);
+  std::uniform_int_distribution<std::int32_t> dist(0, 60);
+  std::vector<std::int32_t> quals(n);
+  for (auto& q : quals) q = dist(gen);
+  return quals;
+}
+
+// Runs a kernel benchmark for each supported level, on 221 bases (the default
+// pileup width) and on a long read.
+void KernelArgs(benchmark::internal::Benchmark* b) {
+  for (SimdLevel level : SupportedSimdLevels()) {
+    for (int n : {221, 20000}) {
+      b->Args({static_cast<int>(level), n});
+    }
+  }
+}
+
+const PileupKernels& KernelsArg(benchmark::State& state) {
+  const PileupKernels& kernels =
+      GetPileupKernels(static_cast<SimdLevel>(state.range(0)));
+  state.SetLabel(SimdLevelName(kernels.level));
+  return kernels;
+}
+
+void BM_BaseColor(benchmark::State& state) {
+  const PileupKernels& kernels = KernelsArg(state);
+  const std::string bases = RandomBases(state.range(1));
+  std::vector<std::uint8_t> out(bases.size());
+  const BaseColors colors = {250, 30, 180, 100};
+  for (auto _ : state) {
+    kernels.base_color(bases.data(), bases.size(), colors, out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * bases.size());
+}
+BENCHMARK(BM_BaseColor)->Apply(KernelArgs);
+
+void BM_QualityColor(benchmark::State& state) {
+  const PileupKernels& kernels = KernelsArg(state);
+  const std::vector<std::int32_t> quals = RandomQualities(state.range(1));
+  std::vector<std::uint8_t> out(quals.size());
+  for (auto _ : state) {
+    kernels.quality_color(quals.data(), quals.size(), 40, out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * quals.size());
+}
+BENCHMARK(BM_QualityColor)->Apply(KernelArgs);
+
+void BM_MatchesRefColor(benchmark::State& state) {
+  const PileupKernels& kernels = KernelsArg(state);
+  const std::string read = RandomBases(state.range(1));
+  const std::string ref = RandomBases(state.range(1) + 1).substr(1);
+  std::vector<std::uint8_t> out(read.size());
+  for (auto _ : state) {
+    kernels.matches_ref_color(read.data(), ref.data(), read.size(), 50, 254,
+                              out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * read.size());
+}
+BENCHMARK(BM_MatchesRefColor)->Apply(KernelArgs);
+
+void BM_IsHomopolymer(benchmark::State& state) {
+  const PileupKernels& kernels = KernelsArg(state);
+  const std::string seq = RandomBases(state.range(1));
+  std::vector<std::uint8_t> out(seq.size());
+  for (auto _ : state) {
+    kernels.is_homopolymer(seq.data(), seq.size(), out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * seq.size());
+}
+BENCHMARK(BM_IsHomopolymer)->Apply(KernelArgs);
+
+void BM_HomopolymerWeighted(benchmark::State& state) {
+  const PileupKernels& kernels = KernelsArg(state);
+  const std::string seq = RandomBases(state.range(1));
+  std::vector<std::uint8_t> out(seq.size());
+  for (auto _ : state) {
+    kernels.homopolymer_weighted(seq.data(), seq.size(), out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * seq.size());
+}
+BENCHMARK(BM_HomopolymerWeighted)->Apply(KernelArgs);
+
+// Encodes a read of state.range(0) bases spanning a 221 bases window.
+void BM_EncodeRead(benchmark::State& state) {
+  const int read_length = state.range(0);
+  PileupImageOptions options;
+  options.set_width(221);
+  options.set_num_channels(NUM_CHANNELS);
+  options.set_base_color_offset_a_and_g(40);
+  options.set_base_color_offset_t_and_c(30);
+  options.set_base_color_stride(70);
+  options.set_allele_supporting_read_alpha(1.0);
+  options.set_allele_unsupporting_read_alpha(0.6);
+  options.set_reference_matching_read_alpha(0.2);
+  options.set_reference_mismatching_read_alpha(1.0);
+  options.set_positive_strand_color(70);
+  options.set_negative_strand_color(240);
+  options.set_base_quality_cap(40);
+  options.set_mapping_quality_cap(60);
+  PileupImageEncoderNative encoder(options);
+
+  const int window_start = read_length / 2;
+  DeepVariantCall dv_call;
+  dv_call.mutable_variant()->set_start(window_start + 110);
+  dv_call.mutable_variant()->add_alternate_bases("C");
+  const std::string bases = RandomBases(read_length);
+  const std::string ref_bases = bases.substr(window_start, 221);
+  nucleus::genomics::v1::Read read = nucleus::MakeRead(
+      "chr1", 0, bases, {std::to_string(read_length) + "M"}, "read");
+  std::vector<unsigned char> row(221 * encoder.NumPixelChannels());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(encoder.EncodeReadPixels(
+        dv_call, ref_bases, read, ReadRegistry::kUnknownReadId, window_start,
+        {"C"}, row.data()));
+  }
+  state.SetLabel(SimdLevelName(DetectSimdLevel()));
+}
+BENCHMARK(BM_EncodeRead)->Arg(250)->Arg(20000);
+
+}  // namespace
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
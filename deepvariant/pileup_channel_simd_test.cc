@@ -0,0 +1,173 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/pileup_channel_simd.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using ::testing::ElementsAre;
+
+namespace {
+
+constexpr BaseColors kColors = {250, 30, 180, 100};
+
+// Lengths covering empty inputs, partial and full SIMD blocks and the edges of
+// the homopolymer kernels.
+const std::vector<int> kLengths = {0,  1,  2,  3,  15, 16, 17,  18,  19,  20,
+                                   21, 31, 32, 33, 34, 35, 36, 37, 100, 257,
+                                   1000};
+
+std::string RandomBases(std::mt19937* gen, int n, const std::string& alphabet) {
+  std::uniform_int_distribution<int> dist(0, alphabet.size() - 1);
+  std::string bases(n, 'A');
+  for (char& base : bases) base = alphabet[dist(*gen)];
+  return bases;
+}
+
+// A sequence of random runs, some longer than 255 bases.
+std::string RandomRuns(std::mt19937* gen, int n) {
+  std::uniform_int_distribution<int> run_length(1, 300);
+  std::string bases;
+  while (bases.size() < n) {
+    bases.append(run_length(*gen) % 7 == 0 ? run_length(*gen)
+                                           : run_length(*gen) % 5 + 1,
+                 "ACGT"[bases.size() % 4]);
+  }
+  bases.resize(n);
+  return bases;
+}
+
+class PileupChannelSimdTest : public ::testing::TestWithParam<SimdLevel> {
+ protected:
+  const PileupKernels& Scalar() { return GetPileupKernels(SimdLevel::kScalar); }
+  const PileupKernels& Kernels() { return GetPileupKernels(GetParam()); }
+  std::mt19937 gen_{42};
+};
+
+TEST_P(PileupChannelSimdTest, BaseColorMatchesScalar) {
+  for (int n : kLengths) {
+    const std::string bases = RandomBases(&gen_, n, "ACGTNacgt*");
+    std::vector<std::uint8_t> expected(n), actual(n);
+    Scalar().base_color(bases.data(), n, kColors, expected.data());
+    Kernels().base_color(bases.data(), n, kColors, actual.data());
+    EXPECT_EQ(actual, expected) << "n=" << n;
+  }
+}
+
+TEST_P(PileupChannelSimdTest, QualityColorMatchesScalar) {
+  std::uniform_int_distribution<std::int32_t> qual(-100, 300);
+  for (int cap : {1, 20, 40, 60, 93}) {
+    for (int n : kLengths) {
+      std::vector<std::int32_t> quals(n);
+      for (auto& q : quals) q = qual(gen_);
+      std::vector<std::uint8_t> expected(n), actual(n);
+      Scalar().quality_color(quals.data(), n, cap, expected.data());
+      Kernels().quality_color(quals.data(), n, cap, actual.data());
+      EXPECT_EQ(actual, expected) << "n=" << n << " cap=" << cap;
+    }
+  }
+}
+
+TEST_P(PileupChannelSimdTest, MatchesRefColorMatchesScalar) {
+  for (int n : kLengths) {
+    const std::string read = RandomBases(&gen_, n, "ACGT");
+    const std::string ref = RandomBases(&gen_, n, "ACGT");
+    std::vector<std::uint8_t> expected(n), actual(n);
+    Scalar().matches_ref_color(read.data(), ref.data(), n, 50, 254,
+                               expected.data());
+    Kernels().matches_ref_color(read.data(), ref.data(), n, 50, 254,
+                                actual.data());
+    EXPECT_EQ(actual, expected) << "n=" << n;
+  }
+}
+
+TEST_P(PileupChannelSimdTest, HomopolymersMatchScalar) {
+  for (int n : kLengths) {
+    for (const std::string& seq :
+         {RandomBases(&gen_, n, "AC"), RandomRuns(&gen_, n)}) {
+      std::vector<std::uint8_t> expected(n), actual(n);
+      Scalar().is_homopolymer(seq.data(), n, expected.data());
+      Kernels().is_homopolymer(seq.data(), n, actual.data());
+      EXPECT_EQ(actual, expected) << "is_homopolymer " << seq;
+      Scalar().homopolymer_weighted(seq.data(), n, expected.data());
+      Kernels().homopolymer_weighted(seq.data(), n, actual.data());
+      EXPECT_EQ(actual, expected) << "homopolymer_weighted " << seq;
+    }
+  }
+}
+
+TEST_P(PileupChannelSimdTest, Homopolymers) {
+  const std::string seq = "ATCGGGAA";
+  std::vector<std::uint8_t> out(seq.size());
+  Kernels().is_homopolymer(seq.data(), seq.size(), out.data());
+  EXPECT_THAT(out, ElementsAre(0, 0, 0, 1, 1, 1, 0, 0));
+  Kernels().homopolymer_weighted(seq.data(), seq.size(), out.data());
+  EXPECT_THAT(out, ElementsAre(1, 1, 1, 3, 3, 3, 2, 2));
+
+  // Run lengths are truncated to 8 bits.
+  const std::string long_run(300, 'A');
+  out.resize(long_run.size());
+  Kernels().homopolymer_weighted(long_run.data(), long_run.size(), out.data());
+  EXPECT_EQ(out.front(), 300 % 256);
+  EXPECT_EQ(out.back(), 300 % 256);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    AllLevels, PileupChannelSimdTest,
+    ::testing::ValuesIn(SupportedSimdLevels()),
+    [](const ::testing::TestParamInfo<SimdLevel>& info) {
+      return SimdLevelName(info.param);
+    });
+
+TEST(PileupChannelSimd, DetectsALevel) {
+  EXPECT_EQ(GetPileupKernels().level, DetectSimdLevel());
+  EXPECT_EQ(SupportedSimdLevels().front(), SimdLevel::kScalar);
+  EXPECT_EQ(SupportedSimdLevels().back(), DetectSimdLevel());
+}
+
+}  // namespace
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
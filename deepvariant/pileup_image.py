@@ -215,6 +215,7 @@ class PileupImageCreator(object):
   ):
     self._options = options
     self._encoder = pileup_image_native.PileupImageEncoderNative(self._options)
+    self._builder = pileup_image_native.PileupImageBuilder(self._options)
     self._channels_enum = self._encoder.all_channels_enum(
         options.alt_aligned_pileup
     )
@@ -377,7 +378,6 @@ class PileupImageCreator(object):
           )
       )
 
-    image_start_pos = dv_call.variant.start - self.half_width
     if not custom_ref and (
         refbases[self.half_width] != dv_call.variant.reference_bases[0]
     ):
@@ -391,112 +391,77 @@ class PileupImageCreator(object):
           )
       )
 
-    def build_pileup_for_one_sample(
-        reads: List[reads_pb2.Read], sample: sample_lib.Sample
-    ) -> List[np.ndarray]:
-      """Create read pileup image section for one sample."""
-      # We start with n copies of our encoded reference bases.
-      rows = [
-          self._encoder.encode_reference(refbases)
-      ] * self.reference_band_height
-      def _update_hap_index(
-          read: reads_pb2.Read, hp_tag_for_assembly_polishing: int
-      ) -> int:
-        default_hap_idx = 0  # By default, reads with no HP is set to 0.
-        if 'HP' not in read.info:
-          return default_hap_idx
-        read_info_hp = read.info.get('HP')
-        if read_info_hp is None or not read_info_hp.values:
-          return default_hap_idx
-        hp_field = next(iter(read_info_hp.values))
-        if not hp_field.HasField('int_value'):
-          return default_hap_idx
-        hp_value = hp_field.int_value
-        if (
-            hp_tag_for_assembly_polishing > 0
-            and hp_value == hp_tag_for_assembly_polishing
-        ):
-          # For the target HP tag, set it to -1 so it will be sorted on
-          # top of the pileup image.
-          return -1
-        elif hp_value < 0:
-          return 0  # For reads with HP < 0, assume it is not tagged.
-        else:
-          return hp_value
-
-      # Returns tuples of the form (haplotype, position, row),
-      # if the read can be encoded as a valid row to be used in the pileup
-      # image.
-      def _row_helper(
-          read: reads_pb2.Read,
-      ) -> Optional[Tuple[int, int, np.ndarray]]:
-        """A function that returns tuples of (haplotype, position, row)."""
-        read_row = self._encoder.encode_read(
-            dv_call, refbases, read, image_start_pos, alt_alleles
-        )
-        if read_row is None:
-          return None
-        hap_idx = 0  # By default, reads with no HP is set to 0.
-        if self._options.sort_by_haplotypes:
-          hap_idx = _update_hap_index(
-              read, self._options.hp_tag_for_assembly_polishing
-          )
-        return hap_idx, read.alignment.position.position, read_row
-
-      # We add a row for each read in order, down-sampling if the number of
-      # reads is greater than the max reads for each sample. Sort the reads by
-      # their alignment position.
-      random_for_image = np.random.RandomState(self._options.random_seed)
-
-      # Use sample height or default to pic height.
-      if sample.options.pileup_height != 0:
-        pileup_height = sample.options.pileup_height
-      else:
-        pileup_height = self.height
-
-      max_reads = pileup_height - self.reference_band_height
-      reads_indices = list(range(len(reads)))
-      if len(reads) > max_reads:
-        # Shuffle the indices instead of the reads, so that we won't change
-        # the order of the reads list.
-        random_for_image.shuffle(reads_indices)
-      pileup_of_reads = []
-      for reads_index in reads_indices:
-        read = reads[reads_index]
-        if len(pileup_of_reads) == max_reads:
-          break
-        row = _row_helper(read)
-        if row is None:
-          continue
-        pileup_of_reads.append(row)
-      pileup_of_reads = sorted(pileup_of_reads, key=lambda x: (x[0], x[1]))
-
-      rows += [read_row for _, _, read_row in pileup_of_reads]
-
-      # Finally, fill in any missing rows to bring our image to pileup_height
-      # rows with empty (all black) pixels.
-      n_missing_rows = pileup_height - len(rows)
-      if n_missing_rows > 0:
-        # Add values to rows to fill it out with zeros.
-        rows += [self._empty_image_row()] * n_missing_rows
-      return rows
-
-    sample_sections = []
+    # The reference band, read sorting, down-sampling and padding of each
+    # sample section are done natively, directly into the final image.
     if sample_order is None:
       sample_order = range(len(self._samples))
+    reads_in_order = []
+    sample_heights = []
     for i in sample_order:
-      sample = self._samples[i]
-      sample_sections.extend(
-          build_pileup_for_one_sample(reads_for_samples[i], sample)
-      )
+      # Use sample height or default to pic height.
+      pileup_height = self._samples[i].options.pileup_height or self.height
+      reads_in_order.append(reads_for_samples[i])
+      sample_heights.append(pileup_height)
+
+    return self._builder.build_pileup(
+        dv_call,
+        refbases,
+        reads_in_order,
+        sample_heights,
+        list(alt_alleles),
+    )
 
-    # Vertically stack the image rows to create a single
-    # h x w x DEFAULT_NUM_CHANNEL image.
-    return np.vstack(sample_sections)
+  def build_pileups_batch(
+      self,
+      candidates: List[Tuple[deepvariant_pb2.DeepVariantCall, List[str]]],
+      refbases: str,
+      ref_start: int,
+      reads_for_samples: List[List[reads_pb2.Read]],
+      sample_order: Optional[List[int]] = None,
+  ):
+    """Creates the ref-aligned pileup tensors of a batch of candidates.
 
-  def _empty_image_row(self) -> np.ndarray:
-    """Creates an empty image row as an uint8 np.array."""
-    return np.zeros((1, self.width, self.num_channels), dtype=np.uint8)
+    Each read is encoded once for all the candidates using it, and the images
+    are built natively without holding the GIL. The result is the same as
+    calling build_pileup() for each candidate, with its reads from get_reads().
+
+    Args:
+      candidates: A list of (dv_call, alt_alleles) tuples sorted by the start
+        of dv_call.variant.
+      refbases: The reference bases starting at ref_start, covering the window
+        of every candidate.
+      ref_start: The position of the first base of refbases.
+      reads_for_samples: list by sample of all the reads of the region.
+      sample_order: The order of the samples in the images, as in
+        build_pileup().
+
+    Returns:
+      A list of uint8 Tensor images, one per candidate, as in build_pileup().
+    """
+    if len(self._samples) != len(reads_for_samples):
+      raise ValueError(
+          'The number of self._samples ({}) must be the same as the number of '
+          'reads_for_samples ({}).'.format(
+              len(self._samples), len(reads_for_samples)
+          )
+      )
+    if sample_order is None:
+      sample_order = range(len(self._samples))
+    reads_in_order = []
+    sample_heights = []
+    for i in sample_order:
+      pileup_height = self._samples[i].options.pileup_height or self.height
+      reads_in_order.append(list(reads_for_samples[i]))
+      sample_heights.append(pileup_height)
+
+    return self._builder.build_pileups_batch(
+        [dv_call for dv_call, _ in candidates],
+        [list(alt_alleles) for _, alt_alleles in candidates],
+        refbases,
+        ref_start,
+        reads_in_order,
+        sample_heights,
+    )
 
   def create_pileup_images(
       self,
@@ -34,20 +34,29 @@
 #include <math.h>
 
 #include <algorithm>
+#include <cstdint>
 #include <functional>
 #include <iterator>
 #include <memory>
+#include <numeric>
+#include <random>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include "deepvariant/pileup_channel_lib.h"
+#include "deepvariant/pileup_channel_simd.h"
+#include "deepvariant/read_registry.h"
+#include "third_party/nucleus/io/sam_record_view.h"
 #include "third_party/nucleus/protos/cigar.pb.h"
 #include "third_party/nucleus/protos/position.pb.h"
 #include "third_party/nucleus/protos/reads.pb.h"
 #include "third_party/nucleus/protos/struct.pb.h"
 #include "third_party/nucleus/protos/variants.pb.h"
+#include "third_party/nucleus/util/utils.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
+#include "absl/strings/string_view.h"
 
 using nucleus::genomics::v1::CigarUnit;
 using nucleus::genomics::v1::Read;
@@ -95,6 +104,38 @@ inline float ReadAlleleFrequency(const DeepVariantCall& dv_call,
   return 0;
 }
 
+// Same as above using the ReadRegistry id of read. Falls back to the read key
+// if dv_call doesn't carry the integer read id sidecar.
+inline float ReadAlleleFrequency(const DeepVariantCall& dv_call,
+                                 const Read& read, int32_t read_id,
+                                 const std::vector<std::string>& alt_alleles) {
+  if (read_id == ReadRegistry::kUnknownReadId ||
+      !HasSupportingReadIds(dv_call)) {
+    return ReadAlleleFrequency(dv_call, read, alt_alleles);
+  }
+  // Iterate over all alts, not just alt_alleles.
+  for (const string& alt_allele : dv_call.variant().alternate_bases()) {
+    auto it_read = dv_call.allele_support_ids().find(alt_allele);
+    if (it_read == dv_call.allele_support_ids().end()) {
+      continue;
+    }
+    const auto& read_ids = it_read->second.read_ids();
+    const bool alt_in_alt_alleles =
+        std::find(alt_alleles.begin(), alt_alleles.end(), alt_allele) !=
+        alt_alleles.end();
+    // If the read supports an alt we are currently considering, return the
+    // associated allele frequency.
+    if (alt_in_alt_alleles &&
+        std::find(read_ids.begin(), read_ids.end(), read_id) !=
+            read_ids.end()) {
+      auto it = dv_call.allele_frequency().find(alt_allele);
+      return it != dv_call.allele_frequency().end() ? it->second : 0;
+    }
+  }
+  // If cannot find the matching variant, set the frequency to 0.
+  return 0;
+}
+
 int GetHPValueForHPChannel(const Read& read,
                            int hp_tag_for_assembly_polishing) {
   if (!read.info().contains("HP")) {
@@ -161,9 +202,18 @@ int ImageRow::Width() const {
 
 PileupImageEncoderNative::PileupImageEncoderNative(
     const PileupImageOptions& options)
-    : options_(options) {
+    : options_(options),
+      channels_(ToVector(options.channels())),
+      num_pixel_channels_(NUM_CHANNELS + options.use_allele_frequency() +
+                          options.add_hp_channel() +
+                          options.channels_size()),
+      kernels_(GetPileupKernels()) {
   CHECK((options_.width() % 2 == 1) && options_.width() >= 3)
       << "Width must be odd; found " << options_.width();
+  base_colors_ = {static_cast<std::uint8_t>(BaseColor('A')),
+                  static_cast<std::uint8_t>(BaseColor('C')),
+                  static_cast<std::uint8_t>(BaseColor('G')),
+                  static_cast<std::uint8_t>(BaseColor('T'))};
 }
 
 // Gets the pixel color (int) for a base.
@@ -285,63 +335,119 @@ vector<DeepVariantChannelEnum> PileupImageEncoderNative::AllChannelsEnum(
 std::unique_ptr<ImageRow> PileupImageEncoderNative::EncodeRead(
     const DeepVariantCall& dv_call, const string& ref_bases, const Read& read,
     int image_start_pos, const vector<std::string>& alt_alleles) {
-  ImageRow img_row(ref_bases.size(), options_.num_channels(),
-                   options_.use_allele_frequency(), options_.add_hp_channel(),
-                   ToVector(options_.channels()));
+  return EncodeRead(dv_call, ref_bases, read, ReadRegistry::kUnknownReadId,
+                    image_start_pos, alt_alleles);
+}
+
+std::unique_ptr<ImageRow> PileupImageEncoderNative::EncodeRead(
+    const DeepVariantCall& dv_call, const string& ref_bases, const Read& read,
+    int32_t read_id, int image_start_pos,
+    const vector<std::string>& alt_alleles) {
+  std::vector<unsigned char> row(ref_bases.size() * num_pixel_channels_, 0);
+  if (!EncodeReadPixels(dv_call, ref_bases, read, read_id, image_start_pos,
+                        alt_alleles, row.data())) {
+    return nullptr;
+  }
+  return ToImageRow(row, ref_bases.size());
+}
+
+bool PileupImageEncoderNative::EncodeReadPixels(
+    const DeepVariantCall& dv_call, const string& ref_bases, const Read& read,
+    int32_t read_id, int image_start_pos,
+    const vector<std::string>& alt_alleles, unsigned char* row) {
+  column_flags_.assign(ref_bases.size(), 0);
+  return DrawReadPixels(read, ref_bases, image_start_pos, row,
+                        column_flags_.data()) &&
+         FinishReadPixels(dv_call, ref_bases, read, read_id, image_start_pos,
+                          alt_alleles, column_flags_.data(), row);
+}
+
+bool PileupImageEncoderNative::DrawReadPixels(const Read& read,
+                                              absl::string_view ref_bases,
+                                              int image_start_pos,
+                                              unsigned char* row,
+                                              std::uint8_t* flags) {
+  const int num_channels = num_pixel_channels_;
+  const int allele_frequency_channel = NUM_CHANNELS;
+  const int hp_channel =
+      allele_frequency_channel + options_.use_allele_frequency();
 
   // Calculate base channels.
-  const int supports_alt = ReadSupportsAlt(dv_call, read, alt_alleles);
   const int mapping_quality = read.alignment().mapping_quality();
   const int min_mapping_quality =
       options_.read_requirements().min_mapping_quality();
   // Bail early if this read's mapping quality is too low.
   if (mapping_quality < min_mapping_quality) {
-    return nullptr;
+    return false;
   }
   const bool is_forward_strand = !read.alignment().position().reverse_strand();
-  const std::uint8_t alt_color = SupportsAltColor(supports_alt);
   const std::uint8_t mapping_color = MappingQualityColor(mapping_quality);
   const std::uint8_t strand_color = StrandColor(is_forward_strand);
   const int min_base_quality = options_.read_requirements().min_base_quality();
 
   // Calculate AUX channels.
-  const float allele_frequency =
-      (options_.use_allele_frequency())
-          ? ReadAlleleFrequency(dv_call, read, alt_alleles)
-          : 0;
-  const std::uint8_t allele_frequency_color =
-      AlleleFrequencyColor(allele_frequency);
   const int hp_value = (options_.add_hp_channel())
                            ? GetHPValueForHPChannel(
                                  read, options_.hp_tag_for_assembly_polishing())
                            : 0;
 
-  // Calculate OptChannels.
-  OptChannels channel_set{options_};
-  bool ok = channel_set.CalculateChannels(img_row.channels, read,
-                                          ref_bases, dv_call, alt_alleles,
-                                          image_start_pos);
-  // Bail out if we found an issue while calculating channels
-  // (a low-quality base at the call site, mapping quality is too low, etc)
-  if (!ok) {
-    return nullptr;
-  }
+  const int width = ref_bases.size();
+  const std::uint8_t match_color = MatchesRefColor(true);
+  const std::uint8_t mismatch_color = MatchesRefColor(false);
+  const std::uint8_t hp_color = ScaleColor(hp_value, 2);
+  run_base_colors_.resize(width);
+  run_quality_colors_.resize(width);
+  run_matches_ref_colors_.resize(width);
 
-  // Fill OptChannel set.
-  img_row.channel_data.resize(img_row.channels.size(),
-                            std::vector<unsigned char>(ref_bases.size(), 0));
-  for (int j = 0; j < img_row.channels.size(); j++) {
-    const std::string channel = img_row.channels[j];
-    img_row.channel_data[j] = channel_set.data_[channel];
-  }
+  // Fills the channels that are the same for every base of the read.
+  auto fill_read_channels = [&](unsigned char* pixel) {
+    pixel[2] = mapping_color;
+    pixel[3] = strand_color;
+    if (options_.add_hp_channel()) {
+      pixel[hp_channel] = hp_color;
+    }
+  };
+
+  // Draws the bases of an alignment op of len bases starting at ref_start and
+  // read_start. Only the bases within the image are drawn, their colors are
+  // computed for the whole run at once.
+  auto draw_alignment_run = [&](int ref_start, int read_start, int len) {
+    const int first_col = std::max(ref_start - image_start_pos, 0);
+    const int end_col = std::min(ref_start + len - image_start_pos, width);
+    if (first_col >= end_col) {
+      return;
+    }
+    const int n = end_col - first_col;
+    const int first_read_i = read_start + first_col + image_start_pos -
+                             ref_start;
+    DCHECK_LE(first_read_i + n, read.aligned_sequence().size());
+    DCHECK_LE(first_read_i + n, read.aligned_quality_size());
+    const int32_t* base_qualities =
+        read.aligned_quality().data() + first_read_i;
+    const char* read_bases = read.aligned_sequence().data() + first_read_i;
+    kernels_.base_color(read_bases, n, base_colors_, run_base_colors_.data());
+    kernels_.quality_color(base_qualities, n, options_.base_quality_cap(),
+                           run_quality_colors_.data());
+    kernels_.matches_ref_color(read_bases, ref_bases.data() + first_col, n,
+                               match_color, mismatch_color,
+                               run_matches_ref_colors_.data());
+
+    unsigned char* pixel = row + first_col * num_channels;
+    for (int i = 0; i < n; ++i, pixel += num_channels) {
+      pixel[0] = run_base_colors_[i];
+      pixel[1] = run_quality_colors_[i];
+      pixel[5] = run_matches_ref_colors_[i];
+      fill_read_channels(pixel);
+      flags[first_col + i] |=
+          kColumnDrawn |
+          (base_qualities[i] < min_base_quality ? kColumnLowBaseQuality : 0);
+    }
+  };
 
-  // Handler for each component of the CIGAR string, as subdivided
+  // Handler for the other components of the CIGAR string, as subdivided
   // according the rules below.
-  // Side effect: draws in img_row
-  // Return value: true on normal exit; false if we determine that we
-  // have a low quality base at the call position (in which case we
-  // should return null) from EncodeRead.
-  std::function<bool(int, int, const CigarUnit::Operation&)>
+  // Side effect: draws in row
+  std::function<void(int, int, const CigarUnit::Operation&)>
       action_per_cigar_unit =
           [&](int ref_i, int read_i, const CigarUnit::Operation& cigar_op) {
             char read_base = 0;
@@ -351,38 +457,23 @@ std::unique_ptr<ImageRow> PileupImageEncoderNative::EncodeRead(
             } else if (cigar_op == CigarUnit::DELETE) {
               ref_i -= 1;  // Adjust anchor base on reference
               read_base = options_.indel_anchoring_base_char()[0];
-            } else if (cigar_op == CigarUnit::ALIGNMENT_MATCH ||
-                       cigar_op == CigarUnit::SEQUENCE_MATCH ||
-                       cigar_op == CigarUnit::SEQUENCE_MISMATCH) {
-              read_base = read.aligned_sequence()[read_i];
             }
 
             size_t col = ref_i - image_start_pos;
             if (read_base && 0 <= col && col < ref_bases.size()) {
               int base_quality = read.aligned_quality(read_i);
-              if (ref_i == dv_call.variant().start() &&
-                  base_quality < min_base_quality) {
-                return false;
-              }
               bool matches_ref = (read_base == ref_bases[col]);
 
               // Fill Base channel set.
-              img_row.base[col] = BaseColor(read_base);
-              img_row.base_quality[col] = BaseQualityColor(base_quality);
-              img_row.mapping_quality[col] = mapping_color;
-              img_row.on_positive_strand[col] = strand_color;
-              img_row.supports_alt[col] = alt_color;
-              img_row.matches_ref[col] = MatchesRefColor(matches_ref);
-
-              // Fill AUX channel set.
-              if (img_row.use_allele_frequency) {
-                img_row.allele_frequency[col] = allele_frequency_color;
-              }
-              if (img_row.add_hp_channel) {
-                img_row.hp_value[col] = ScaleColor(hp_value, 2);
-              }
+              unsigned char* pixel = row + col * num_channels;
+              pixel[0] = BaseColor(read_base);
+              pixel[1] = BaseQualityColor(base_quality);
+              pixel[5] = MatchesRefColor(matches_ref);
+              fill_read_channels(pixel);
+              flags[col] |= kColumnDrawn | (base_quality < min_base_quality
+                                                ? kColumnLowBaseQuality
+                                                : 0);
             }
-            return true;
           };
 
   // In the following, we iterate over alignment information for each
@@ -424,7 +515,6 @@ std::unique_ptr<ImageRow> PileupImageEncoderNative::EncodeRead(
   //   Fatal error, at present; later we should fail with a status encoding.
   int ref_i = read.alignment().position().position();
   int read_i = 0;
-  ok = true;
 
   for (const auto& cigar_elt : read.alignment().cigar()) {
     const CigarUnit::Operation& op = cigar_elt.operation();
@@ -435,22 +525,20 @@ std::unique_ptr<ImageRow> PileupImageEncoderNative::EncodeRead(
       case CigarUnit::SEQUENCE_MATCH:
       case CigarUnit::SEQUENCE_MISMATCH:
         // Alignment op.
-        for (int i = 0; i < op_len; i++) {
-          ok = ok && action_per_cigar_unit(ref_i, read_i, op);
-          ref_i++;
-          read_i++;
-        }
+        draw_alignment_run(ref_i, read_i, op_len);
+        ref_i += op_len;
+        read_i += op_len;
         break;
       case CigarUnit::INSERT:
       case CigarUnit::CLIP_SOFT:
         // Insert op.
-        ok = action_per_cigar_unit(ref_i - 1, read_i, op);
+        action_per_cigar_unit(ref_i - 1, read_i, op);
         read_i += op_len;
         break;
       case CigarUnit::DELETE:
       case CigarUnit::SKIP:
         // Delete op.
-        ok = action_per_cigar_unit(ref_i, read_i - 1, op);
+        action_per_cigar_unit(ref_i, read_i - 1, op);
         ref_i += op_len;
         break;
       case CigarUnit::CLIP_HARD:
@@ -460,19 +548,110 @@ std::unique_ptr<ImageRow> PileupImageEncoderNative::EncodeRead(
       default:
         LOG(FATAL) << "Unrecognized CIGAR op";
     }
+  }
 
-    // Bail out if we found this read had a low-quality base at the
-    // call site.
+  return true;
+}
+
+bool PileupImageEncoderNative::FinishReadPixels(
+    const DeepVariantCall& dv_call, const string& ref_bases, const Read& read,
+    int32_t read_id, int image_start_pos,
+    const vector<std::string>& alt_alleles, const std::uint8_t* flags,
+    unsigned char* row) {
+  const int num_channels = num_pixel_channels_;
+  const int allele_frequency_channel = NUM_CHANNELS;
+  const int hp_channel =
+      allele_frequency_channel + options_.use_allele_frequency();
+  const int opt_channel = hp_channel + options_.add_hp_channel();
+  const int width = ref_bases.size();
+
+  // Bail out if this read has a low-quality base at the call site.
+  const int call_col = dv_call.variant().start() - image_start_pos;
+  if (0 <= call_col && call_col < width &&
+      (flags[call_col] & kColumnLowBaseQuality)) {
+    return false;
+  }
+
+  // Calculate OptChannels. This walks the whole read, so it is skipped when
+  // there are none: the checks it does are done when drawing as well.
+  if (!channels_.empty()) {
+    OptChannels channel_set{options_};
+    const bool ok = channel_set.CalculateChannels(
+        channels_, read, ref_bases, dv_call, alt_alleles, image_start_pos,
+        read_id);
+    // Bail out if we found an issue while calculating channels
+    // (a low-quality base at the call site, mapping quality is too low, etc)
     if (!ok) {
-      return nullptr;
+      return false;
+    }
+
+    // Fill OptChannel set.
+    for (int j = 0; j < channels_.size(); j++) {
+      const std::vector<unsigned char>& data =
+          channel_set.data_[channels_[j]];
+      unsigned char* pixel = row + opt_channel + j;
+      for (size_t col = 0; col < ref_bases.size(); ++col) {
+        *pixel = data[col];
+        pixel += num_channels;
+      }
     }
   }
 
-  return std::make_unique<ImageRow>(img_row);
+  // Fill the channels that depend on the candidate in the drawn pixels.
+  const int supports_alt =
+      ReadSupportsAlt(dv_call, read, read_id, alt_alleles);
+  const std::uint8_t alt_color = SupportsAltColor(supports_alt);
+  const float allele_frequency =
+      (options_.use_allele_frequency())
+          ? ReadAlleleFrequency(dv_call, read, read_id, alt_alleles)
+          : 0;
+  const std::uint8_t allele_frequency_color =
+      AlleleFrequencyColor(allele_frequency);
+  unsigned char* pixel = row;
+  for (int col = 0; col < width; ++col, pixel += num_channels) {
+    if (flags[col] & kColumnDrawn) {
+      pixel[4] = alt_color;
+      if (options_.use_allele_frequency()) {
+        pixel[allele_frequency_channel] = allele_frequency_color;
+      }
+    }
+  }
+  return true;
+}
+
+std::unique_ptr<ImageRow> PileupImageEncoderNative::EncodeRead(
+    const DeepVariantCall& dv_call, const string& ref_bases,
+    const nucleus::SamRecordView& record, int image_start_pos,
+    const vector<std::string>& alt_alleles, int32_t read_id) {
+  // Unmapped records have no alignment, hence a mapping quality of 0 in their
+  // Read.
+  const int mapping_quality =
+      record.has_alignment() ? record.mapping_quality() : 0;
+  // Bail early if this read's mapping quality is too low.
+  if (mapping_quality < options_.read_requirements().min_mapping_quality()) {
+    return nullptr;
+  }
+  record.ToRead(&record_read_);
+  // ToRead() leaves the aux fields in the record, so copy the only one used
+  // for encoding.
+  int64_t hp_value;
+  if (options_.add_hp_channel() && record.GetAuxInt("HP", &hp_value)) {
+    (*record_read_.mutable_info())["HP"].add_values()->set_int_value(
+        hp_value);
+  }
+  return EncodeRead(dv_call, ref_bases, record_read_, read_id, image_start_pos,
+                    alt_alleles);
 }
 
 std::unique_ptr<ImageRow> PileupImageEncoderNative::EncodeReference(
     const string& ref_bases) {
+  std::vector<unsigned char> row(ref_bases.size() * num_pixel_channels_, 0);
+  EncodeReferencePixels(ref_bases, row.data());
+  return ToImageRow(row, ref_bases.size());
+}
+
+void PileupImageEncoderNative::EncodeReferencePixels(const string& ref_bases,
+                                                     unsigned char* row) {
   int ref_qual = options_.reference_base_quality();
   std::uint8_t base_quality_color = BaseQualityColor(ref_qual);
   std::uint8_t mapping_quality_color = MappingQualityColor(ref_qual);
@@ -481,42 +660,390 @@ std::unique_ptr<ImageRow> PileupImageEncoderNative::EncodeReference(
   std::uint8_t alt_color = SupportsAltColor(0);
   std::uint8_t ref_color = MatchesRefColor(true);
   std::uint8_t allele_frequency_color = AlleleFrequencyColor(0);
-
-  ImageRow img_row(ref_bases.size(), options_.num_channels(),
-                   options_.use_allele_frequency(), options_.add_hp_channel(),
-                   ToVector(options_.channels()));
-
-  // Initialize dynamic channels
-  img_row.channel_data.resize(img_row.channels.size(),
-                              std::vector<unsigned char>(ref_bases.size(), 0));
+  const int allele_frequency_channel = NUM_CHANNELS;
+  const int hp_channel =
+      allele_frequency_channel + options_.use_allele_frequency();
+  const int opt_channel = hp_channel + options_.add_hp_channel();
 
   // Calculate reference rows at the top of each channel image.
   // These are retrieved for each position in the loop below.
   OptChannels channel_set{options_};
-  channel_set.CalculateRefRows(img_row.channels, ref_bases);
+  channel_set.CalculateRefRows(channels_, ref_bases);
+
+  run_base_colors_.resize(ref_bases.size());
+  kernels_.base_color(ref_bases.data(), ref_bases.size(), base_colors_,
+                      run_base_colors_.data());
 
   for (size_t col = 0; col < ref_bases.size(); ++col) {
-    img_row.base[col] = BaseColor(ref_bases[col]);
-    img_row.base_quality[col] = base_quality_color;
-    img_row.mapping_quality[col] = mapping_quality_color;
-    img_row.on_positive_strand[col] = strand_color;
-    img_row.supports_alt[col] = alt_color;
-    img_row.matches_ref[col] = ref_color;
-    if (img_row.use_allele_frequency) {
-      img_row.allele_frequency[col] = allele_frequency_color;
+    unsigned char* pixel = row + col * num_pixel_channels_;
+    pixel[0] = run_base_colors_[col];
+    pixel[1] = base_quality_color;
+    pixel[2] = mapping_quality_color;
+    pixel[3] = strand_color;
+    pixel[4] = alt_color;
+    pixel[5] = ref_color;
+    if (options_.use_allele_frequency()) {
+      pixel[allele_frequency_channel] = allele_frequency_color;
     }
-    if (img_row.add_hp_channel) {
-      img_row.hp_value[col] = ScaleColor(0, 2);
+    if (options_.add_hp_channel()) {
+      pixel[hp_channel] = ScaleColor(0, 2);
     }
 
     // Optional channels
-    for (int j = 0; j < img_row.channels.size(); j++) {
-      img_row.channel_data[j][col] =
-          channel_set.GetRefRows(img_row.channels[j], col);
+    for (int j = 0; j < channels_.size(); j++) {
+      pixel[opt_channel + j] = channel_set.GetRefRows(channels_[j], col);
+    }
+  }
+}
+
+std::unique_ptr<ImageRow> PileupImageEncoderNative::ToImageRow(
+    const std::vector<unsigned char>& row, int width) const {
+  auto img_row = std::make_unique<ImageRow>(
+      width, options_.num_channels(), options_.use_allele_frequency(),
+      options_.add_hp_channel(), channels_);
+  img_row->channel_data.resize(channels_.size(),
+                               std::vector<unsigned char>(width, 0));
+  const int opt_channel = NUM_CHANNELS + options_.use_allele_frequency() +
+                          options_.add_hp_channel();
+  const unsigned char* pixel = row.data();
+  for (int col = 0; col < width; ++col, pixel += num_pixel_channels_) {
+    img_row->base[col] = pixel[0];
+    img_row->base_quality[col] = pixel[1];
+    img_row->mapping_quality[col] = pixel[2];
+    img_row->on_positive_strand[col] = pixel[3];
+    img_row->supports_alt[col] = pixel[4];
+    img_row->matches_ref[col] = pixel[5];
+    if (options_.use_allele_frequency()) {
+      img_row->allele_frequency[col] = pixel[NUM_CHANNELS];
+    }
+    if (options_.add_hp_channel()) {
+      img_row->hp_value[col] = pixel[opt_channel - 1];
+    }
+    for (int j = 0; j < channels_.size(); j++) {
+      img_row->channel_data[j][col] = pixel[opt_channel + j];
     }
   }
+  return img_row;
+}
+
+PileupImageBuilder::PileupImageBuilder(const PileupImageOptions& options)
+    : options_(options), encoder_(options) {
+  CHECK_EQ(options_.num_channels(), encoder_.NumPixelChannels())
+      << "num_channels doesn't match the channels enabled in options";
+  CHECK_GE(options_.reference_band_height(), 0);
+}
 
-  return std::make_unique<ImageRow>(img_row);
+void PileupImageBuilder::ShuffleLikeNumpy(uint32_t seed,
+                                          std::vector<int>* indices) {
+  // RandomState(seed) seeds MT19937 with init_genrand(seed), as std::mt19937
+  // does. shuffle() is a Fisher-Yates shuffle drawing each index by masked
+  // rejection sampling of 32-bit outputs.
+  std::mt19937 gen(seed);
+  for (int i = static_cast<int>(indices->size()) - 1; i > 0; --i) {
+    uint32_t max = i;
+    uint32_t mask = max;
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+    uint32_t j;
+    do {
+      j = static_cast<uint32_t>(gen()) & mask;
+    } while (j > max);
+    std::swap((*indices)[i], (*indices)[j]);
+  }
+}
+
+int PileupImageBuilder::HaplotypeIndex(const Read& read) const {
+  // By default, reads with no HP are set to 0.
+  if (!options_.sort_by_haplotypes()) {
+    return 0;
+  }
+  auto it = read.info().find("HP");
+  if (it == read.info().end() || it->second.values().empty()) {
+    return 0;
+  }
+  const nucleus::genomics::v1::Value& hp_field = it->second.values(0);
+  if (hp_field.kind_case() != nucleus::genomics::v1::Value::kIntValue) {
+    return 0;
+  }
+  const int hp_value = hp_field.int_value();
+  const int hp_tag_for_assembly_polishing =
+      options_.hp_tag_for_assembly_polishing();
+  if (hp_tag_for_assembly_polishing > 0 &&
+      hp_value == hp_tag_for_assembly_polishing) {
+    // For the target HP tag, set it to -1 so it will be sorted on top of the
+    // pileup image.
+    return -1;
+  }
+  // Reads with HP < 0 are assumed to be untagged.
+  return hp_value < 0 ? 0 : hp_value;
+}
+
+void PileupImageBuilder::BuildSample(
+    const std::vector<const Read*>& reads, int height, size_t row_size,
+    const unsigned char* reference_row,
+    const std::function<bool(int, unsigned char*)>& encode_read,
+    unsigned char* section) {
+  const int reference_band_height = options_.reference_band_height();
+  CHECK_GE(height, reference_band_height)
+      << "Pileup height must be at least reference_band_height";
+
+  for (int i = 0; i < reference_band_height; ++i) {
+    std::copy(reference_row, reference_row + row_size,
+              section + i * row_size);
+  }
+
+  // Encode reads in order, down-sampling if there are more reads than rows.
+  // Shuffle the indices instead of the reads, so the reads keep their order.
+  const int max_reads = height - reference_band_height;
+  read_indices_.resize(reads.size());
+  std::iota(read_indices_.begin(), read_indices_.end(), 0);
+  if (static_cast<int>(reads.size()) > max_reads) {
+    ShuffleLikeNumpy(options_.random_seed(), &read_indices_);
+  }
+  row_keys_.clear();
+  unsigned char* read_rows = section + reference_band_height * row_size;
+  for (int read_index : read_indices_) {
+    if (static_cast<int>(row_keys_.size()) == max_reads) {
+      break;
+    }
+    const Read& read = *reads[read_index];
+    unsigned char* row = read_rows + row_keys_.size() * row_size;
+    if (!encode_read(read_index, row)) {
+      // The rejected read may have drawn part of its row.
+      std::fill(row, row + row_size, 0);
+      continue;
+    }
+    row_keys_.push_back({HaplotypeIndex(read),
+                         read.alignment().position().position(),
+                         static_cast<int>(row_keys_.size())});
+  }
+
+  // Sort the rows by haplotype and position. Rows are encoded in place, so
+  // they only move if they aren't already in order.
+  auto key_less = [](const RowKey& a, const RowKey& b) {
+    return std::tie(a.hap_idx, a.position) < std::tie(b.hap_idx, b.position);
+  };
+  if (std::is_sorted(row_keys_.begin(), row_keys_.end(), key_less)) {
+    return;
+  }
+  std::stable_sort(row_keys_.begin(), row_keys_.end(), key_less);
+  const size_t num_rows = row_keys_.size();
+  sorted_rows_.assign(read_rows, read_rows + num_rows * row_size);
+  for (size_t i = 0; i < num_rows; ++i) {
+    const unsigned char* row =
+        sorted_rows_.data() + row_keys_[i].row * row_size;
+    std::copy(row, row + row_size, read_rows + i * row_size);
+  }
+}
+
+std::unique_ptr<PileupImage> PileupImageBuilder::BuildImage(
+    const string& ref_bases,
+    const std::vector<std::vector<const Read*>>& reads_for_samples,
+    const std::vector<int>& sample_heights,
+    const std::function<bool(int, int, unsigned char*)>& encode_read) {
+  CHECK_EQ(reads_for_samples.size(), sample_heights.size());
+  int height = 0;
+  for (int sample_height : sample_heights) {
+    height += sample_height;
+  }
+  const int width = ref_bases.size();
+  auto image = std::make_unique<PileupImage>(height, width,
+                                             encoder_.NumPixelChannels());
+  if (height == 0) {
+    return image;
+  }
+
+  // The reference is encoded once and copied into every reference band.
+  const size_t row_size = static_cast<size_t>(width) * image->num_channels;
+  reference_row_.assign(row_size, 0);
+  encoder_.EncodeReferencePixels(ref_bases, reference_row_.data());
+
+  int row = 0;
+  for (int i = 0; i < reads_for_samples.size(); ++i) {
+    BuildSample(
+        reads_for_samples[i], sample_heights[i], row_size,
+        reference_row_.data(),
+        [&](int read_index, unsigned char* read_row) {
+          return encode_read(i, read_index, read_row);
+        },
+        image->Row(row));
+    row += sample_heights[i];
+  }
+  return image;
+}
+
+std::unique_ptr<PileupImage> PileupImageBuilder::Build(
+    const DeepVariantCall& dv_call, const string& ref_bases,
+    const std::vector<std::vector<const Read*>>& reads_for_samples,
+    const std::vector<int>& sample_heights,
+    const vector<std::string>& alt_alleles) {
+  const int image_start_pos =
+      dv_call.variant().start() - (options_.width() - 1) / 2;
+  return BuildImage(
+      ref_bases, reads_for_samples, sample_heights,
+      [&](int sample, int read_index, unsigned char* row) {
+        return encoder_.EncodeReadPixels(
+            dv_call, ref_bases, *reads_for_samples[sample][read_index],
+            ReadRegistry::kUnknownReadId, image_start_pos, alt_alleles, row);
+      });
+}
+
+std::vector<std::unique_ptr<PileupImage>> PileupImageBuilder::BuildBatch(
+    const std::vector<const DeepVariantCall*>& dv_calls,
+    const std::vector<std::vector<std::string>>& alt_alleles,
+    absl::string_view ref_bases, int64_t ref_start,
+    const std::vector<std::vector<const Read*>>& reads_for_samples,
+    const std::vector<int>& sample_heights) {
+  CHECK_EQ(dv_calls.size(), alt_alleles.size());
+  CHECK_EQ(reads_for_samples.size(), sample_heights.size());
+  const int width = options_.width();
+  const int num_channels = encoder_.NumPixelChannels();
+  const int64_t ref_end = ref_start + ref_bases.size();
+  const absl::string_view ref = ref_bases;
+
+  std::vector<std::vector<DrawnRead>> drawn_reads(reads_for_samples.size());
+  for (int i = 0; i < reads_for_samples.size(); ++i) {
+    drawn_reads[i].reserve(reads_for_samples[i].size());
+    for (const Read* read : reads_for_samples[i]) {
+      DrawnRead drawn_read;
+      drawn_read.read = read;
+      drawn_read.start = nucleus::ReadStart(*read);
+      drawn_read.end = nucleus::ReadEnd(*read);
+      drawn_reads[i].push_back(std::move(drawn_read));
+    }
+  }
+
+  // Draws read over the reference it spans, including the indel anchor base
+  // before its start, the first time a candidate uses it.
+  auto draw = [&](DrawnRead* read) {
+    if (read->drawn) {
+      return;
+    }
+    read->drawn = true;
+    read->span_start = std::max(read->start - 1, ref_start);
+    const int span_width =
+        std::max<int64_t>(std::min(read->end, ref_end) - read->span_start, 0);
+    read->pixels.assign(static_cast<size_t>(span_width) * num_channels, 0);
+    read->flags.assign(span_width, 0);
+    read->ok = encoder_.DrawReadPixels(
+        *read->read, ref.substr(read->span_start - ref_start, span_width),
+        read->span_start, read->pixels.data(), read->flags.data());
+  };
+
+  std::vector<std::unique_ptr<PileupImage>> images;
+  images.reserve(dv_calls.size());
+  std::vector<std::vector<const Read*>> selected_reads(drawn_reads.size());
+  std::vector<std::vector<DrawnRead*>> selected(drawn_reads.size());
+  for (int c = 0; c < dv_calls.size(); ++c) {
+    const DeepVariantCall& dv_call = *dv_calls[c];
+    const nucleus::genomics::v1::Variant& variant = dv_call.variant();
+    CHECK(c == 0 || dv_calls[c - 1]->variant().start() <= variant.start())
+        << "Candidates must be sorted by start";
+    const int64_t window_start = variant.start() - (width - 1) / 2;
+    CHECK(ref_start <= window_start && window_start + width <= ref_end)
+        << "The reference doesn't cover the window of the candidate at "
+        << variant.start();
+    const string window_ref(ref_bases.substr(window_start - ref_start, width));
+
+    // Select the reads as PileupImageCreator.get_reads() queries them. As the
+    // candidates are sorted, reads ending before the query won't be used again.
+    const int64_t query_start =
+        variant.start() - options_.read_overlap_buffer_bp();
+    const int64_t query_end = variant.end() + options_.read_overlap_buffer_bp();
+    for (int i = 0; i < drawn_reads.size(); ++i) {
+      selected_reads[i].clear();
+      selected[i].clear();
+      for (DrawnRead& read : drawn_reads[i]) {
+        if (read.end <= query_start) {
+          std::vector<unsigned char>().swap(read.pixels);
+          std::vector<std::uint8_t>().swap(read.flags);
+          continue;
+        }
+        if (query_end > read.start &&
+            variant.reference_name() ==
+                read.read->alignment().position().reference_name()) {
+          selected_reads[i].push_back(read.read);
+          selected[i].push_back(&read);
+        }
+      }
+    }
+
+    images.push_back(BuildImage(
+        window_ref, selected_reads, sample_heights,
+        [&](int sample, int read_index, unsigned char* row) {
+          DrawnRead* read = selected[sample][read_index];
+          draw(read);
+          if (!read->ok) {
+            return false;
+          }
+          // Copy the part of the drawn read within the window.
+          window_flags_.assign(width, 0);
+          const int64_t first = std::max(window_start, read->span_start);
+          const int64_t end = std::min<int64_t>(
+              window_start + width, read->span_start + read->flags.size());
+          if (first < end) {
+            std::copy(read->pixels.begin() +
+                          (first - read->span_start) * num_channels,
+                      read->pixels.begin() +
+                          (end - read->span_start) * num_channels,
+                      row + (first - window_start) * num_channels);
+            std::copy(read->flags.begin() + (first - read->span_start),
+                      read->flags.begin() + (end - read->span_start),
+                      window_flags_.begin() + (first - window_start));
+          }
+          return encoder_.FinishReadPixels(
+              dv_call, window_ref, *read->read, ReadRegistry::kUnknownReadId,
+              window_start, alt_alleles[c], window_flags_.data(), row);
+        }));
+  }
+  return images;
+}
+
+std::unique_ptr<PileupImage> PileupImageBuilder::BuildPython(
+    const nucleus::ConstProtoPtr<const DeepVariantCall>& wrapped_dv_call,
+    const string& ref_bases,
+    const std::vector<std::vector<nucleus::ConstProtoPtr<const Read>>>&
+        wrapped_reads_for_samples,
+    const std::vector<int>& sample_heights,
+    const vector<std::string>& alt_alleles) {
+  std::vector<std::vector<const Read*>> reads_for_samples(
+      wrapped_reads_for_samples.size());
+  for (int i = 0; i < wrapped_reads_for_samples.size(); ++i) {
+    reads_for_samples[i].reserve(wrapped_reads_for_samples[i].size());
+    for (const auto& wrapped_read : wrapped_reads_for_samples[i]) {
+      reads_for_samples[i].push_back(wrapped_read.p_);
+    }
+  }
+  return Build(*wrapped_dv_call.p_, ref_bases, reads_for_samples,
+               sample_heights, alt_alleles);
+}
+
+std::vector<std::unique_ptr<PileupImage>> PileupImageBuilder::BuildBatchPython(
+    const std::vector<nucleus::ConstProtoPtr<const DeepVariantCall>>&
+        wrapped_dv_calls,
+    const std::vector<std::vector<std::string>>& alt_alleles,
+    const string& ref_bases, int64_t ref_start,
+    const std::vector<std::vector<nucleus::ConstProtoPtr<const Read>>>&
+        wrapped_reads_for_samples,
+    const std::vector<int>& sample_heights) {
+  std::vector<const DeepVariantCall*> dv_calls;
+  dv_calls.reserve(wrapped_dv_calls.size());
+  for (const auto& wrapped_dv_call : wrapped_dv_calls) {
+    dv_calls.push_back(wrapped_dv_call.p_);
+  }
+  std::vector<std::vector<const Read*>> reads_for_samples(
+      wrapped_reads_for_samples.size());
+  for (int i = 0; i < wrapped_reads_for_samples.size(); ++i) {
+    reads_for_samples[i].reserve(wrapped_reads_for_samples[i].size());
+    for (const auto& wrapped_read : wrapped_reads_for_samples[i]) {
+      reads_for_samples[i].push_back(wrapped_read.p_);
+    }
+  }
+  return BuildBatch(dv_calls, alt_alleles, ref_bases, ref_start,
+                    reads_for_samples, sample_heights);
 }
 
 }  // namespace deepvariant
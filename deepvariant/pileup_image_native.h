@@ -32,13 +32,19 @@
 #ifndef LEARNING_GENOMICS_DEEPVARIANT_PILEUP_IMAGE_NATIVE_H_
 #define LEARNING_GENOMICS_DEEPVARIANT_PILEUP_IMAGE_NATIVE_H_
 
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "deepvariant/pileup_channel_simd.h"
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/read_registry.h"
+#include "third_party/nucleus/io/sam_record_view.h"
 #include "third_party/nucleus/protos/reads.pb.h"
 #include "third_party/nucleus/util/proto_ptr.h"
+#include "absl/strings/string_view.h"
 
 namespace learning {
 namespace genomics {
@@ -90,6 +96,25 @@ class PileupImageEncoderNative {
       const string& ref_bases, const nucleus::genomics::v1::Read& read,
       int image_start_pos, const std::vector<std::string>& alt_alleles);
 
+  // Same as above for a read whose ReadRegistry id is known. When dv_call
+  // carries the integer read id sidecar, read support is looked up by read_id
+  // instead of by the read's string key.
+  std::unique_ptr<ImageRow> EncodeRead(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const string& ref_bases, const nucleus::genomics::v1::Read& read,
+      int32_t read_id, int image_start_pos,
+      const std::vector<std::string>& alt_alleles);
+
+  // Same as above for an htslib record. Records below the mapping quality
+  // threshold are rejected on the record itself. The others are filled into a
+  // Read that is reused across calls, since the optional channels are computed
+  // from a Read.
+  std::unique_ptr<ImageRow> EncodeRead(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const string& ref_bases, const nucleus::SamRecordView& record,
+      int image_start_pos, const std::vector<std::string>& alt_alleles,
+      int32_t read_id = ReadRegistry::kUnknownReadId);
+
   // Simple wrapper around EncodeRead that allows us to efficiently pass large
   // protobufs in from Python. Simply unwraps the ConstProtoPtr objects and
   // calls EncodeRead().
@@ -108,6 +133,48 @@ class PileupImageEncoderNative {
   // Encode the reference bases into a single row of pixels.
   std::unique_ptr<ImageRow> EncodeReference(const string& ref_bases);
 
+  // Number of channels of a pixel: the six base channels, then the allele
+  // frequency and HP channels if enabled, then options.channels.
+  int NumPixelChannels() const { return num_pixel_channels_; }
+
+  // Encodes read into row, ref_bases.size() pixels of NumPixelChannels()
+  // interleaved channels, zeroed by the caller. Returns false if the read
+  // can't be encoded, in which case row may have been partially written.
+  bool EncodeReadPixels(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const string& ref_bases, const nucleus::genomics::v1::Read& read,
+      int32_t read_id, int image_start_pos,
+      const std::vector<std::string>& alt_alleles, unsigned char* row);
+
+  // EncodeReadPixels() in two steps, so that a read can be drawn once over a
+  // wide window and each candidate finishes its own part of it.
+  //
+  // Flags of the columns drawn by DrawReadPixels().
+  static constexpr std::uint8_t kColumnDrawn = 1;
+  static constexpr std::uint8_t kColumnLowBaseQuality = 2;
+
+  // Draws the channels of read that don't depend on the candidate into row:
+  // base, base quality, mapping quality, strand, matches ref and HP. flags
+  // gets kColumnDrawn for each drawn column, plus kColumnLowBaseQuality if a
+  // base below min_base_quality was drawn there. row and flags are zeroed by
+  // the caller. Returns false if the read's mapping quality is too low.
+  bool DrawReadPixels(const nucleus::genomics::v1::Read& read,
+                      absl::string_view ref_bases, int image_start_pos,
+                      unsigned char* row, std::uint8_t* flags);
+
+  // Finishes a row drawn by DrawReadPixels() over ref_bases for dv_call: fills
+  // the supports alt, allele frequency and optional channels. Returns false if
+  // the read is rejected, e.g. for a low quality base at the call position.
+  bool FinishReadPixels(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const string& ref_bases, const nucleus::genomics::v1::Read& read,
+      int32_t read_id, int image_start_pos,
+      const std::vector<std::string>& alt_alleles, const std::uint8_t* flags,
+      unsigned char* row);
+
+  // Encodes the reference bases into row, laid out as in EncodeReadPixels().
+  void EncodeReferencePixels(const string& ref_bases, unsigned char* row);
+
  public:
   // Get the pixel color (int) for a base.
   int BaseColor(char base) const;
@@ -127,7 +194,171 @@ class PileupImageEncoderNative {
   int MappingQualityColor(int mapping_qual) const;
 
  private:
+  // Converts a row of interleaved pixels into an ImageRow.
+  std::unique_ptr<ImageRow> ToImageRow(const std::vector<unsigned char>& row,
+                                       int width) const;
+
   const PileupImageOptions options_;
+  const std::vector<std::string> channels_;
+  const int num_pixel_channels_;
+
+  // Kernels computing the colors of runs of bases, and their buffers.
+  const PileupKernels& kernels_;
+  BaseColors base_colors_;
+  std::vector<std::uint8_t> run_base_colors_;
+  std::vector<std::uint8_t> run_quality_colors_;
+  std::vector<std::uint8_t> run_matches_ref_colors_;
+  // Column flags of EncodeReadPixels().
+  std::vector<std::uint8_t> column_flags_;
+
+  // Read reused by EncodeRead(SamRecordView).
+  nucleus::genomics::v1::Read record_read_;
+};
+
+// A pileup image of height rows of width pixels, each of num_channels
+// channels, stored contiguously in row-major (HWC) order.
+struct PileupImage {
+  int height;
+  int width;
+  int num_channels;
+  std::vector<unsigned char> data;
+
+  PileupImage(int height, int width, int num_channels)
+      : height(height),
+        width(width),
+        num_channels(num_channels),
+        data(static_cast<size_t>(height) * width * num_channels, 0) {}
+
+  unsigned char* Row(int row) {
+    return data.data() + static_cast<size_t>(row) * width * num_channels;
+  }
+  const unsigned char* Row(int row) const {
+    return data.data() + static_cast<size_t>(row) * width * num_channels;
+  }
+};
+
+// Builds the full pileup image of a candidate, one section per sample, directly
+// into a single contiguous buffer. Each section starts with
+// reference_band_height rows of reference, followed by the encoded reads
+// sorted by haplotype (if sort_by_haplotypes) then position, and is padded
+// with empty rows up to the sample's height. If a sample has more reads than
+// fit in its section, a random subset is encoded, drawn exactly as
+// numpy.random.RandomState(random_seed).shuffle would draw it.
+class PileupImageBuilder {
+ public:
+  explicit PileupImageBuilder(const PileupImageOptions& options);
+
+  // Builds the pileup image of dv_call. reads_for_samples and sample_heights
+  // give the reads and height of each section, in image order.
+  std::unique_ptr<PileupImage> Build(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const string& ref_bases,
+      const std::vector<std::vector<const nucleus::genomics::v1::Read*>>&
+          reads_for_samples,
+      const std::vector<int>& sample_heights,
+      const std::vector<std::string>& alt_alleles);
+
+  // Wrapper around Build that allows us to efficiently pass large protobufs in
+  // from Python.
+  std::unique_ptr<PileupImage> BuildPython(
+      const nucleus::ConstProtoPtr<
+          const learning::genomics::deepvariant::DeepVariantCall>&
+          wrapped_dv_call,
+      const string& ref_bases,
+      const std::vector<std::vector<
+          nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>>&
+          wrapped_reads_for_samples,
+      const std::vector<int>& sample_heights,
+      const std::vector<std::string>& alt_alleles);
+
+  // Builds the images of a batch of candidates sharing the reads of a region,
+  // the same images as calling Build() for each of them. The candidate
+  // dv_calls[i], sorted by start, is drawn with alt_alleles[i]. ref_bases
+  // starts at ref_start and covers the window of every candidate.
+  // reads_for_samples holds all the reads of each sample, each candidate using
+  // those overlapping its variant padded by read_overlap_buffer_bp, as
+  // PileupImageCreator.get_reads() selects them. Each read is drawn once over
+  // the reference it spans and each candidate copies its window from it.
+  std::vector<std::unique_ptr<PileupImage>> BuildBatch(
+      const std::vector<
+          const learning::genomics::deepvariant::DeepVariantCall*>& dv_calls,
+      const std::vector<std::vector<std::string>>& alt_alleles,
+      absl::string_view ref_bases, int64_t ref_start,
+      const std::vector<std::vector<const nucleus::genomics::v1::Read*>>&
+          reads_for_samples,
+      const std::vector<int>& sample_heights);
+
+  // Wrapper around BuildBatch that allows us to efficiently pass large
+  // protobufs in from Python.
+  std::vector<std::unique_ptr<PileupImage>> BuildBatchPython(
+      const std::vector<nucleus::ConstProtoPtr<
+          const learning::genomics::deepvariant::DeepVariantCall>>&
+          wrapped_dv_calls,
+      const std::vector<std::vector<std::string>>& alt_alleles,
+      const string& ref_bases, int64_t ref_start,
+      const std::vector<std::vector<
+          nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>>&
+          wrapped_reads_for_samples,
+      const std::vector<int>& sample_heights);
+
+  // Returns the haplotype index used to sort read in its section.
+  int HaplotypeIndex(const nucleus::genomics::v1::Read& read) const;
+
+  // Shuffles indices in place as numpy's RandomState(seed).shuffle does.
+  static void ShuffleLikeNumpy(uint32_t seed, std::vector<int>* indices);
+
+ private:
+  // Sort key of an encoded read row.
+  struct RowKey {
+    int hap_idx;
+    int64_t position;
+    int row;
+  };
+
+  // A read of BuildBatch(), drawn over the reference it spans.
+  struct DrawnRead {
+    const nucleus::genomics::v1::Read* read = nullptr;
+    // Alignment span of the read.
+    int64_t start = 0;
+    int64_t end = 0;
+    // Output of DrawReadPixels() over the reference from span_start, filled
+    // the first time the read is used.
+    bool drawn = false;
+    bool ok = false;
+    int64_t span_start = 0;
+    std::vector<unsigned char> pixels;
+    std::vector<std::uint8_t> flags;
+  };
+
+  // Builds an image over ref_bases, with one section per sample.
+  // encode_read(sample, read_index, row) encodes
+  // reads_for_samples[sample][read_index] into row, or returns false to reject
+  // it.
+  std::unique_ptr<PileupImage> BuildImage(
+      const string& ref_bases,
+      const std::vector<std::vector<const nucleus::genomics::v1::Read*>>&
+          reads_for_samples,
+      const std::vector<int>& sample_heights,
+      const std::function<bool(int, int, unsigned char*)>& encode_read);
+
+  // Fills the height rows of one sample section starting at section.
+  // reference_row holds the encoded reference bases, encode_read(i, row)
+  // encodes reads[i] as in BuildImage().
+  void BuildSample(const std::vector<const nucleus::genomics::v1::Read*>& reads,
+                   int height, size_t row_size,
+                   const unsigned char* reference_row,
+                   const std::function<bool(int, unsigned char*)>& encode_read,
+                   unsigned char* section);
+
+  const PileupImageOptions options_;
+  PileupImageEncoderNative encoder_;
+
+  // Scratch space reused across sections and images.
+  std::vector<int> read_indices_;
+  std::vector<RowKey> row_keys_;
+  std::vector<unsigned char> sorted_rows_;
+  std::vector<unsigned char> reference_row_;
+  std::vector<std::uint8_t> window_flags_;
 };
 
 
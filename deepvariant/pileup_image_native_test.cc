@@ -0,0 +1,435 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/pileup_image_native.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/read_registry.h"
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+#include "third_party/nucleus/protos/variants.pb.h"
+#include "third_party/nucleus/testing/test_utils.h"
+#include "third_party/nucleus/util/utils.h"
+#include "absl/strings/str_cat.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using nucleus::MakeRead;
+using nucleus::genomics::v1::Read;
+using ::testing::ElementsAre;
+using ::testing::ElementsAreArray;
+
+namespace {
+
+// Seed used by pileup_image.default_options().
+constexpr uint32_t kRandomSeed = 2101079370;
+
+PileupImageOptions MakeOptions(int height, int reference_band_height) {
+  PileupImageOptions options;
+  options.set_width(3);
+  options.set_height(height);
+  options.set_num_channels(NUM_CHANNELS);
+  options.set_reference_band_height(reference_band_height);
+  options.set_base_color_offset_a_and_g(40);
+  options.set_base_color_offset_t_and_c(30);
+  options.set_base_color_stride(70);
+  options.set_allele_supporting_read_alpha(1.0);
+  options.set_allele_unsupporting_read_alpha(0.6);
+  options.set_other_allele_supporting_read_alpha(0.6);
+  options.set_reference_matching_read_alpha(0.2);
+  options.set_reference_mismatching_read_alpha(1.0);
+  options.set_indel_anchoring_base_char("*");
+  options.set_reference_base_quality(60);
+  options.set_positive_strand_color(70);
+  options.set_negative_strand_color(240);
+  options.set_base_quality_cap(40);
+  options.set_mapping_quality_cap(60);
+  options.set_random_seed(kRandomSeed);
+  options.mutable_read_requirements()->set_min_base_quality(10);
+  options.mutable_read_requirements()->set_min_mapping_quality(10);
+  return options;
+}
+
+DeepVariantCall MakeCall() {
+  DeepVariantCall dv_call;
+  auto* variant = dv_call.mutable_variant();
+  variant->set_reference_name("chr1");
+  variant->set_start(10);
+  variant->set_end(11);
+  variant->set_reference_bases("G");
+  variant->add_alternate_bases("C");
+  return dv_call;
+}
+
+std::vector<unsigned char> Row(const PileupImage& image, int row) {
+  const int row_size = image.width * image.num_channels;
+  return std::vector<unsigned char>(image.Row(row), image.Row(row) + row_size);
+}
+
+// The interleaved pixels of an ImageRow, or an empty row if img_row is null.
+std::vector<unsigned char> Pixels(const ImageRow* img_row, int width,
+                                  int num_channels) {
+  std::vector<unsigned char> pixels(width * num_channels, 0);
+  if (img_row == nullptr) return pixels;
+  for (int i = 0; i < width; ++i) {
+    unsigned char* pixel = pixels.data() + i * num_channels;
+    pixel[0] = img_row->base[i];
+    pixel[1] = img_row->base_quality[i];
+    pixel[2] = img_row->mapping_quality[i];
+    pixel[3] = img_row->on_positive_strand[i];
+    pixel[4] = img_row->supports_alt[i];
+    pixel[5] = img_row->matches_ref[i];
+  }
+  return pixels;
+}
+
+class PileupImageBuilderTest : public ::testing::Test {
+ protected:
+  PileupImageBuilderTest()
+      : dv_call_(MakeCall()),
+        ref_bases_("AGC"),
+        alt_alleles_({"C"}),
+        read1_(MakeRead("chr1", 8, "AGC", {"3M"}, "read1")),
+        read2_(MakeRead("chr1", 9, "AGC", {"3M"}, "read2")),
+        read3_(MakeRead("chr1", 10, "AGC", {"3M"}, "read3")),
+        read4_(MakeRead("chr1", 11, "AGC", {"3M"}, "read4")) {
+    // read3 is rejected by the encoder.
+    read3_.mutable_alignment()->set_mapping_quality(1);
+  }
+
+  std::vector<unsigned char> ReferenceRow(const PileupImageOptions& options) {
+    PileupImageEncoderNative encoder(options);
+    return Pixels(encoder.EncodeReference(ref_bases_).get(), 3, NUM_CHANNELS);
+  }
+
+  std::vector<unsigned char> ReadRow(const PileupImageOptions& options,
+                                     const Read& read) {
+    PileupImageEncoderNative encoder(options);
+    return Pixels(
+        encoder.EncodeRead(dv_call_, ref_bases_, read, 9, alt_alleles_).get(),
+        3, NUM_CHANNELS);
+  }
+
+  std::vector<unsigned char> EmptyRow() {
+    return std::vector<unsigned char>(3 * NUM_CHANNELS, 0);
+  }
+
+  DeepVariantCall dv_call_;
+  std::string ref_bases_;
+  std::vector<std::string> alt_alleles_;
+  Read read1_;
+  Read read2_;
+  Read read3_;
+  Read read4_;
+};
+
+TEST(PileupImageBuilderShuffleTest, MatchesNumpyRandomStateShuffle) {
+  // Expected orders from numpy.random.RandomState(2101079370).shuffle, as
+  // relied upon by pileup_image_test.py.
+  std::vector<int> three = {0, 1, 2};
+  PileupImageBuilder::ShuffleLikeNumpy(kRandomSeed, &three);
+  EXPECT_THAT(three, ElementsAre(2, 1, 0));
+
+  std::vector<int> four = {0, 1, 2, 3};
+  PileupImageBuilder::ShuffleLikeNumpy(kRandomSeed, &four);
+  EXPECT_EQ(four[0], 3);
+  EXPECT_EQ(four[1], 2);
+}
+
+TEST(PileupImageBuilderShuffleTest, IsAPermutation) {
+  std::vector<int> indices(1000);
+  std::iota(indices.begin(), indices.end(), 0);
+  PileupImageBuilder::ShuffleLikeNumpy(kRandomSeed, &indices);
+  std::vector<int> sorted = indices;
+  std::sort(sorted.begin(), sorted.end());
+  for (int i = 0; i < sorted.size(); ++i) {
+    EXPECT_EQ(sorted[i], i);
+  }
+}
+
+TEST_F(PileupImageBuilderTest, NoReadsIsReferenceThenEmptyRows) {
+  const PileupImageOptions options = MakeOptions(4, 2);
+  PileupImageBuilder builder(options);
+  std::unique_ptr<PileupImage> image =
+      builder.Build(dv_call_, ref_bases_, {{}}, {4}, alt_alleles_);
+  ASSERT_EQ(image->height, 4);
+  EXPECT_EQ(image->width, 3);
+  EXPECT_EQ(image->num_channels, NUM_CHANNELS);
+  EXPECT_EQ(image->data.size(), 4 * 3 * NUM_CHANNELS);
+  EXPECT_EQ(Row(*image, 0), ReferenceRow(options));
+  EXPECT_EQ(Row(*image, 1), ReferenceRow(options));
+  EXPECT_EQ(Row(*image, 2), EmptyRow());
+  EXPECT_EQ(Row(*image, 3), EmptyRow());
+}
+
+TEST_F(PileupImageBuilderTest, RowsMatchEncoder) {
+  const PileupImageOptions options = MakeOptions(5, 1);
+  PileupImageBuilder builder(options);
+  std::unique_ptr<PileupImage> image = builder.Build(
+      dv_call_, ref_bases_, {{&read4_, &read3_, &read1_}}, {5}, alt_alleles_);
+  ASSERT_EQ(image->height, 5);
+  // read3 is skipped and the others are sorted by position.
+  EXPECT_EQ(Row(*image, 0), ReferenceRow(options));
+  EXPECT_EQ(Row(*image, 1), ReadRow(options, read1_));
+  EXPECT_EQ(Row(*image, 2), ReadRow(options, read4_));
+  EXPECT_EQ(Row(*image, 3), EmptyRow());
+  EXPECT_EQ(Row(*image, 4), EmptyRow());
+}
+
+TEST_F(PileupImageBuilderTest, DownsamplesReadsLikeNumpy) {
+  const PileupImageOptions options = MakeOptions(4, 2);
+  PileupImageBuilder builder(options);
+  // The shuffled order is read4, read2, read1: read1 doesn't fit.
+  std::unique_ptr<PileupImage> image = builder.Build(
+      dv_call_, ref_bases_, {{&read1_, &read2_, &read4_}}, {4}, alt_alleles_);
+  EXPECT_EQ(Row(*image, 2), ReadRow(options, read2_));
+  EXPECT_EQ(Row(*image, 3), ReadRow(options, read4_));
+
+  // The shuffled order starts with read1 and read4, which fill the image.
+  image = builder.Build(dv_call_, ref_bases_,
+                        {{&read2_, &read3_, &read4_, &read1_}}, {4},
+                        alt_alleles_);
+  EXPECT_EQ(Row(*image, 2), ReadRow(options, read1_));
+  EXPECT_EQ(Row(*image, 3), ReadRow(options, read4_));
+}
+
+TEST_F(PileupImageBuilderTest, RejectedReadsLeaveNoPixels) {
+  const PileupImageOptions options = MakeOptions(4, 2);
+  PileupImageBuilder builder(options);
+  // A low quality base at the call site is only detected while drawing the
+  // read, so the read has already drawn its first base.
+  Read low_quality = MakeRead("chr1", 9, "AGC", {"3M"}, "low_quality");
+  low_quality.set_aligned_quality(1, 1);
+  std::unique_ptr<PileupImage> image = builder.Build(
+      dv_call_, ref_bases_, {{&low_quality}}, {4}, alt_alleles_);
+  EXPECT_EQ(Row(*image, 2), EmptyRow());
+  EXPECT_EQ(Row(*image, 3), EmptyRow());
+}
+
+TEST_F(PileupImageBuilderTest, SortsByHaplotype) {
+  PileupImageOptions options = MakeOptions(6, 1);
+  options.set_sort_by_haplotypes(true);
+  options.set_hp_tag_for_assembly_polishing(2);
+  read1_.mutable_info()->operator[]("HP").add_values()->set_int_value(1);
+  read2_.mutable_info()->operator[]("HP").add_values()->set_int_value(2);
+  read4_.mutable_info()->operator[]("HP").add_values()->set_int_value(-1);
+  Read read5 = MakeRead("chr1", 10, "AGC", {"3M"}, "read5");
+  PileupImageBuilder builder(options);
+  std::unique_ptr<PileupImage> image = builder.Build(
+      dv_call_, ref_bases_, {{&read1_, &read2_, &read4_, &read5}}, {6},
+      alt_alleles_);
+  // HP=2 first, then reads without HP by position, then HP=1.
+  EXPECT_EQ(Row(*image, 1), ReadRow(options, read2_));
+  EXPECT_EQ(Row(*image, 2), ReadRow(options, read5));
+  EXPECT_EQ(Row(*image, 3), ReadRow(options, read4_));
+  EXPECT_EQ(Row(*image, 4), ReadRow(options, read1_));
+  EXPECT_EQ(Row(*image, 5), EmptyRow());
+}
+
+TEST_F(PileupImageBuilderTest, StacksSamplesWithTheirHeights) {
+  const PileupImageOptions options = MakeOptions(4, 1);
+  PileupImageBuilder builder(options);
+  std::unique_ptr<PileupImage> image = builder.Build(
+      dv_call_, ref_bases_, {{&read2_}, {}, {&read4_, &read1_}}, {2, 3, 3},
+      alt_alleles_);
+  ASSERT_EQ(image->height, 8);
+  EXPECT_THAT(image->data, ::testing::SizeIs(8 * 3 * NUM_CHANNELS));
+  std::vector<std::vector<unsigned char>> rows;
+  for (int i = 0; i < image->height; ++i) {
+    rows.push_back(Row(*image, i));
+  }
+  EXPECT_THAT(rows, ElementsAreArray({
+                        ReferenceRow(options), ReadRow(options, read2_),
+                        ReferenceRow(options), EmptyRow(), EmptyRow(),
+                        ReferenceRow(options), ReadRow(options, read1_),
+                        ReadRow(options, read4_)}));
+}
+
+TEST_F(PileupImageBuilderTest, MatchesImageRowEncoding) {
+  PileupImageOptions options = MakeOptions(4, 1);
+  options.set_use_allele_frequency(true);
+  options.set_add_hp_channel(true);
+  options.add_channels("read_mapping_percent");
+  options.set_num_channels(NUM_CHANNELS + 3);
+  PileupImageEncoderNative encoder(options);
+  EXPECT_EQ(encoder.NumPixelChannels(), NUM_CHANNELS + 3);
+  std::unique_ptr<ImageRow> img_row =
+      encoder.EncodeRead(dv_call_, ref_bases_, read2_, 9, alt_alleles_);
+  ASSERT_NE(img_row, nullptr);
+  std::vector<unsigned char> pixels(3 * encoder.NumPixelChannels(), 0);
+  ASSERT_TRUE(encoder.EncodeReadPixels(dv_call_, ref_bases_, read2_,
+                                       ReadRegistry::kUnknownReadId, 9,
+                                       alt_alleles_, pixels.data()));
+  for (int i = 0; i < 3; ++i) {
+    const unsigned char* pixel = pixels.data() + i * (NUM_CHANNELS + 3);
+    EXPECT_EQ(pixel[0], img_row->base[i]);
+    EXPECT_EQ(pixel[5], img_row->matches_ref[i]);
+    EXPECT_EQ(pixel[6], img_row->allele_frequency[i]);
+    EXPECT_EQ(pixel[7], img_row->hp_value[i]);
+    EXPECT_EQ(pixel[8], img_row->channel_data[0][i]);
+  }
+}
+
+// Reads of random alignments, indels and clips around [start, end).
+std::vector<Read> RandomReads(std::mt19937* gen, const std::string& chrom,
+                              int start, int end, int num_reads) {
+  auto uniform = [gen](int lo, int hi) {
+    return std::uniform_int_distribution<int>(lo, hi)(*gen);
+  };
+  const std::vector<std::string> ops = {"M", "M", "M", "I", "D", "S", "N"};
+  std::vector<Read> reads;
+  for (int i = 0; i < num_reads; ++i) {
+    std::vector<std::string> cigar = {absl::StrCat(uniform(1, 10), "M")};
+    int read_length = 0;
+    for (int j = uniform(0, 4); j > 0; --j) {
+      cigar.push_back(absl::StrCat(uniform(1, 12), ops[uniform(0, 6)]));
+    }
+    cigar.push_back(absl::StrCat(uniform(1, 10), "M"));
+    for (const std::string& op : cigar) {
+      if (op.back() == 'M' || op.back() == 'I' || op.back() == 'S') {
+        read_length += std::stoi(op);
+      }
+    }
+    std::string bases;
+    for (int j = 0; j < read_length; ++j) bases += "ACGTN"[uniform(0, 4)];
+    Read read = MakeRead(chrom, uniform(start - 20, end), bases, cigar,
+                         absl::StrCat("read", i));
+    read.mutable_alignment()->set_mapping_quality(uniform(0, 60));
+    for (int j = 0; j < read_length; ++j) {
+      read.set_aligned_quality(j, uniform(0, 40));
+    }
+    reads.push_back(read);
+  }
+  return reads;
+}
+
+TEST(PileupImageBuilderBatchTest, MatchesBuildForEachCandidate) {
+  PileupImageOptions options = MakeOptions(12, 2);
+  options.set_width(11);
+  options.set_read_overlap_buffer_bp(5);
+  options.set_use_allele_frequency(true);
+  options.set_add_hp_channel(true);
+  options.add_channels("read_mapping_percent");
+  options.set_num_channels(NUM_CHANNELS + 3);
+  PileupImageBuilder builder(options);
+
+  std::mt19937 gen(42);
+  const int ref_start = 100;
+  std::string ref_bases;
+  for (int i = 0; i < 80; ++i) ref_bases += "ACGT"[gen() % 4];
+
+  std::vector<std::vector<Read>> reads = {
+      RandomReads(&gen, "chr1", ref_start, ref_start + 80, 40),
+      RandomReads(&gen, "chr1", ref_start, ref_start + 80, 30)};
+  // Reads of another contig are never used.
+  std::vector<Read> chr2_reads =
+      RandomReads(&gen, "chr2", ref_start, ref_start + 80, 5);
+  reads[1].insert(reads[1].end(), chr2_reads.begin(), chr2_reads.end());
+  std::vector<std::vector<const Read*>> reads_for_samples(reads.size());
+  for (int i = 0; i < reads.size(); ++i) {
+    for (const Read& read : reads[i]) reads_for_samples[i].push_back(&read);
+  }
+  const std::vector<int> sample_heights = {12, 8};
+
+  // Candidates sorted by start, the same call being drawn once per set of alt
+  // alleles.
+  std::vector<DeepVariantCall> calls;
+  for (int start : {105, 110, 111, 140, 174}) {
+    DeepVariantCall dv_call;
+    auto* variant = dv_call.mutable_variant();
+    variant->set_reference_name("chr1");
+    variant->set_start(start);
+    variant->set_end(start + 1 + start % 3);
+    variant->set_reference_bases(ref_bases.substr(start - ref_start, 1));
+    variant->add_alternate_bases("C");
+    variant->add_alternate_bases("TT");
+    for (int i = 0; i < 20; i += 3) {
+      (*dv_call.mutable_allele_support())[i % 2 ? "C" : "TT"].add_read_names(
+          absl::StrCat("read", i + start % 7, "/0"));
+    }
+    (*dv_call.mutable_allele_frequency())["C"] = 0.25;
+    calls.push_back(dv_call);
+  }
+  std::vector<const DeepVariantCall*> dv_calls;
+  std::vector<std::vector<std::string>> alt_alleles;
+  for (const DeepVariantCall& dv_call : calls) {
+    for (const std::vector<std::string>& alts :
+         std::vector<std::vector<std::string>>{{"C"}, {"C", "TT"}}) {
+      dv_calls.push_back(&dv_call);
+      alt_alleles.push_back(alts);
+    }
+  }
+
+  std::vector<std::unique_ptr<PileupImage>> images =
+      builder.BuildBatch(dv_calls, alt_alleles, ref_bases, ref_start,
+                         reads_for_samples, sample_heights);
+  ASSERT_EQ(images.size(), dv_calls.size());
+  for (int c = 0; c < dv_calls.size(); ++c) {
+    const auto& variant = dv_calls[c]->variant();
+    const int window_start = variant.start() - 5;
+    const auto query = nucleus::MakeRange(
+        "chr1", variant.start() - 5, variant.end() + 5);
+    std::vector<std::vector<const Read*>> candidate_reads(reads.size());
+    for (int i = 0; i < reads.size(); ++i) {
+      for (const Read* read : reads_for_samples[i]) {
+        if (nucleus::ReadOverlapsRegion(*read, query)) {
+          candidate_reads[i].push_back(read);
+        }
+      }
+    }
+    std::unique_ptr<PileupImage> expected = builder.Build(
+        *dv_calls[c], ref_bases.substr(window_start - ref_start, 11),
+        candidate_reads, sample_heights, alt_alleles[c]);
+    EXPECT_EQ(images[c]->height, expected->height);
+    EXPECT_EQ(images[c]->width, expected->width);
+    EXPECT_EQ(images[c]->data, expected->data) << "candidate " << c;
+  }
+}
+
+}  // namespace
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -755,6 +755,18 @@ class PileupImageEncoderTest(parameterized.TestCase):
     )
 
 
+def _make_pileup_read(name, start, bases='ACGTTGCA', mapq=50):
+  """Makes a read that overlaps the 3bp pileup window starting at 9."""
+  return test_utils.make_read(
+      bases,
+      start=start,
+      cigar='{}M'.format(len(bases)),
+      quals=[30] * len(bases),
+      mapq=mapq,
+      name=name,
+  )
+
+
 class PileupImageCreatorEncodePileupTest(parameterized.TestCase):
   """Tests of PileupImageCreator build_pileup routine."""
 
@@ -762,51 +774,37 @@ class PileupImageCreatorEncodePileupTest(parameterized.TestCase):
     super(PileupImageCreatorEncodePileupTest, self).setUp()
     self.alt_allele = 'C'
     self.dv_call = _make_dv_call(ref_bases='G', alt_bases=self.alt_allele)
-    samples = [
+    self.samples = [
         sample_lib.Sample(
             options=deepvariant_pb2.SampleOptions(role='any_sample_role')
         )
     ]
     self.pic = _make_image_creator(
         ref_reader=None,
-        samples=samples,
+        samples=self.samples,
         width=3,
         height=4,
         reference_band_height=2,
     )
     self.ref = 'AGC'
-    self.read1 = test_utils.make_read('AGC', start=0, cigar='3M', name='read1')
-    self.read2 = test_utils.make_read('AGC', start=1, cigar='3M', name='read2')
-    self.read3 = test_utils.make_read('AGC', start=2, cigar='3M', name='read3')
-    self.read4 = test_utils.make_read('AGC', start=3, cigar='3M', name='read4')
+    self.read1 = _make_pileup_read('read1', start=4)
+    self.read2 = _make_pileup_read('read2', start=5)
+    # Read3 is bad: its mapping quality is below min_mapping_quality.
+    self.read3 = _make_pileup_read('read3', start=6, mapq=1)
+    self.read4 = _make_pileup_read('read4', start=7)
 
     self.expected_rows = {
-        'ref': np.asarray(
-            range(0, 3 * self.pic.num_channels), np.uint8
-        ).reshape(1, 3, self.pic.num_channels),
+        'ref': self.pic._encoder.encode_reference(self.ref),
         'empty': np.zeros((1, 3, self.pic.num_channels), dtype=np.uint8),
-        'read1': np.full((1, 3, self.pic.num_channels), 1, dtype=np.uint8),
-        'read2': np.full((1, 3, self.pic.num_channels), 2, dtype=np.uint8),
-        'read3': None,
-        'read4': np.full((1, 3, self.pic.num_channels), 3, dtype=np.uint8),
-        'read5': np.full((1, 3, self.pic.num_channels), 3, dtype=np.uint8),
-        'read6': np.full((1, 3, self.pic.num_channels), 3, dtype=np.uint8),
     }
+    for read in [self.read1, self.read2, self.read3, self.read4]:
+      self.expected_rows[read.fragment_name] = self._encode_read(read)
+    self.assertIsNone(self.expected_rows['read3'])
 
-    # Setup our shared mocks.
-    mock_encoder = mock.Mock(spec=['encode_read', 'encode_reference'])
-    mock_encoder.encode_reference.return_value = self.expected_rows['ref']
-
-    # pylint: disable=unused-argument
-    def get_read_row(dv_call, refbases, read, pos, alt_allele):
-      return self.expected_rows[read.fragment_name]
-
-    mock_encoder.encode_read.side_effect = get_read_row
-
-    self.mock_enc_ref = mock_encoder.encode_reference
-    self.mock_enc_read = mock_encoder.encode_read
-
-    self.pic._encoder = mock_encoder
+  def _encode_read(self, read):
+    return self.pic._encoder.encode_read(
+        self.dv_call, self.ref, read, 9, [self.alt_allele]
+    )
 
   def assertImageMatches(self, actual_image, *row_names):
     """Checks that actual_image matches an image from constructed row_names."""
@@ -828,8 +826,6 @@ class PileupImageCreatorEncodePileupTest(parameterized.TestCase):
         reads_for_samples=[[]],
         alt_alleles={self.alt_allele},
     )
-    self.mock_enc_ref.assert_called_once_with(self.ref)
-    test_utils.assert_not_called_workaround(self.mock_enc_read)
     self.assertImageMatches(image, 'ref', 'ref', 'empty', 'empty')
 
   def test_image_one_read(self):
@@ -840,10 +836,6 @@ class PileupImageCreatorEncodePileupTest(parameterized.TestCase):
         reads_for_samples=[[self.read1]],
         alt_alleles={self.alt_allele},
     )
-    self.mock_enc_ref.assert_called_once_with(self.ref)
-    self.mock_enc_read.assert_called_once_with(
-        self.dv_call, self.ref, self.read1, 9, {self.alt_allele}
-    )
     self.assertImageMatches(image, 'ref', 'ref', 'read1', 'empty')
 
   def test_image_creation_with_more_reads_than_rows(self):
@@ -855,37 +847,20 @@ class PileupImageCreatorEncodePileupTest(parameterized.TestCase):
         reads_for_samples=[[self.read1, self.read2, self.read4]],
         alt_alleles={self.alt_allele},
     )
-    self.mock_enc_ref.assert_called_once_with(self.ref)
-    self.assertEqual(
-        self.mock_enc_read.call_args_list,
-        [
-            mock.call(self.dv_call, self.ref, self.read4, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, self.read2, 9, {self.alt_allele}),
-        ],
-    )
     self.assertImageMatches(image, 'ref', 'ref', 'read2', 'read4')
 
   def test_image_creation_with_bad_read(self):
-    # Read 3 is bad (return value is None) so it should be skipped.
+    # Read 3 is bad (it can't be encoded) so it should be skipped.
     image = self.pic.build_pileup(
         dv_call=self.dv_call,
         refbases=self.ref,
         reads_for_samples=[[self.read1, self.read3, self.read2]],
         alt_alleles={self.alt_allele},
     )
-    self.mock_enc_ref.assert_called_once_with(self.ref)
-    self.assertEqual(
-        self.mock_enc_read.call_args_list,
-        [
-            mock.call(self.dv_call, self.ref, self.read2, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, self.read3, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, self.read1, 9, {self.alt_allele}),
-        ],
-    )
     self.assertImageMatches(image, 'ref', 'ref', 'read1', 'read2')
 
   def test_image_creation_with_all_reads_in_new_order(self):
-    # Read 3 is bad (return value is None) so it should be skipped. Read2 should
+    # Read 3 is bad (it can't be encoded) so it should be skipped. Read2 should
     # also be dropped because there's only space for Read1 and Read4. If there
     # are more reads than rows, a deterministic random subset is used.
     image = self.pic.build_pileup(
@@ -894,14 +869,6 @@ class PileupImageCreatorEncodePileupTest(parameterized.TestCase):
         reads_for_samples=[[self.read2, self.read3, self.read4, self.read1]],
         alt_alleles={self.alt_allele},
     )
-    self.mock_enc_ref.assert_called_once_with(self.ref)
-    self.assertEqual(
-        self.mock_enc_read.call_args_list,
-        [
-            mock.call(self.dv_call, self.ref, self.read1, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, self.read4, 9, {self.alt_allele}),
-        ],
-    )
     self.assertImageMatches(image, 'ref', 'ref', 'read1', 'read4')
 
   @parameterized.parameters(
@@ -923,46 +890,38 @@ class PileupImageCreatorEncodePileupTest(parameterized.TestCase):
       expected_reads_layout,
   ):
     # There are 5 reads. They are expected to be sorted by HP tag.
-    read1 = test_utils.make_read('AGC', start=0, cigar='3M', name='read1')
+    read1 = _make_pileup_read('read1', start=4)
     read1.info['HP'].values.add().int_value = 2
-    read2 = test_utils.make_read('AGC', start=2, cigar='3M', name='read2')
+    read2 = _make_pileup_read('read2', start=6)
     read2.info['HP'].values.add().int_value = 1
-    read4 = test_utils.make_read('AGC', start=4, cigar='3M', name='read4')
+    read4 = _make_pileup_read('read4', start=8)
     read4.info['HP'].values.add().int_value = 1
-    read5 = test_utils.make_read('AGC', start=5, cigar='3M', name='read5')
+    read5 = _make_pileup_read('read5', start=9)
     read5.info['HP'].values.add().int_value = 2
-    read6 = test_utils.make_read('AGC', start=1, cigar='3M', name='read6')
+    read6 = _make_pileup_read('read6', start=5)
     read6.info['HP'].values.add().int_value = 0
+    for read in [read1, read2, read4, read5, read6]:
+      self.expected_rows[read.fragment_name] = self._encode_read(read)
 
-    # Change height to 7 so that we have at least 5 rows for reads to test
+    # Use a height of 7 so that we have at least 5 rows for reads to test
     # sorting by haplotypes.
-    self.pic.height = 7
-    # Change options to set sort_by_haplotypes flag.
-    self.pic._options.sort_by_haplotypes = sort_by_haplotypes
-    self.pic._options.hp_tag_for_assembly_polishing = (
-        hp_tag_for_assembly_polishing
+    pic = _make_image_creator(
+        ref_reader=None,
+        samples=self.samples,
+        width=3,
+        height=7,
+        reference_band_height=2,
+        sort_by_haplotypes=sort_by_haplotypes,
+        hp_tag_for_assembly_polishing=hp_tag_for_assembly_polishing,
     )
-    image = self.pic.build_pileup(
+    image = pic.build_pileup(
         dv_call=self.dv_call,
         refbases=self.ref,
         reads_for_samples=[[read1, read2, read4, read5, read6]],
         alt_alleles={self.alt_allele},
     )
-    self.mock_enc_ref.assert_called_once_with(self.ref)
-    self.assertEqual(
-        self.mock_enc_read.call_args_list,
-        [
-            mock.call(self.dv_call, self.ref, read1, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, read2, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, read4, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, read5, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, read6, 9, {self.alt_allele}),
-        ],
-    )
 
-    self.assertEqual(
-        image.shape, (self.pic.height, self.pic.width, self.pic.num_channels)
-    )
+    self.assertEqual(image.shape, (pic.height, pic.width, pic.num_channels))
     expected_image = np.vstack(
         [self.expected_rows[name] for name in expected_reads_layout]
     )
@@ -997,82 +956,36 @@ class PileupImageForTrioCreatorEncodePileupTest(parameterized.TestCase):
     )
     self.ref = 'AGC'
 
-    self.read1 = test_utils.make_read('AGC', start=0, cigar='3M', name='read1')
-    self.read2 = test_utils.make_read('AGC', start=1, cigar='3M', name='read2')
-    self.read3 = test_utils.make_read('AGC', start=2, cigar='3M', name='read3')
-    self.read4 = test_utils.make_read('AGC', start=3, cigar='3M', name='read4')
+    # Reads 3 are bad: their mapping quality is below min_mapping_quality.
+    self.read1 = _make_pileup_read('read1', start=4)
+    self.read2 = _make_pileup_read('read2', start=5)
+    self.read3 = _make_pileup_read('read3', start=6, mapq=1)
+    self.read4 = _make_pileup_read('read4', start=7)
 
-    self.read1_parent1 = test_utils.make_read(
-        'TGC', start=0, cigar='3M', name='read1'
-    )
-    self.read2_parent1 = test_utils.make_read(
-        'TGC', start=1, cigar='3M', name='read2'
+    self.read1_parent1 = _make_pileup_read(
+        'read1', start=4, bases='TCGTTGCA'
     )
-    self.read3_parent1 = test_utils.make_read(
-        'AGC', start=2, cigar='3M', name='read3'
-    )
-    self.read4_parent1 = test_utils.make_read(
-        'AGC', start=3, cigar='3M', name='read4'
+    self.read2_parent1 = _make_pileup_read(
+        'read2', start=5, bases='TCGTTGCA'
     )
+    self.read3_parent1 = _make_pileup_read('read3', start=6, mapq=1)
+    self.read4_parent1 = _make_pileup_read('read4', start=7)
 
-    self.read1_parent2 = test_utils.make_read(
-        'AGC', start=0, cigar='3M', name='read1'
-    )
-    self.read2_parent2 = test_utils.make_read(
-        'AGC', start=1, cigar='3M', name='read2'
-    )
-    self.read3_parent2 = test_utils.make_read(
-        'AGC', start=2, cigar='3M', name='read3'
-    )
-    self.read4_parent2 = test_utils.make_read(
-        'AGC', start=3, cigar='3M', name='read4'
-    )
+    self.read1_parent2 = _make_pileup_read('read1', start=4, mapq=30)
+    self.read2_parent2 = _make_pileup_read('read2', start=5, mapq=30)
+    self.read3_parent2 = _make_pileup_read('read3', start=6, mapq=1)
+    self.read4_parent2 = _make_pileup_read('read4', start=7, mapq=30)
 
     self.expected_rows = {
-        'ref': np.asarray(
-            range(0, 3 * self.pic.num_channels), np.uint8
-        ).reshape(1, 3, self.pic.num_channels),
+        'ref': self.pic._encoder.encode_reference(self.ref),
         'empty': np.zeros((1, 3, self.pic.num_channels), dtype=np.uint8),
-        'read1_parent1': np.full(
-            (1, 3, self.pic.num_channels), 1, dtype=np.uint8
-        ),
-        'read2_parent1': np.full(
-            (1, 3, self.pic.num_channels), 2, dtype=np.uint8
-        ),
-        'read3_parent1': None,
-        'read4_parent1': np.full(
-            (1, 3, self.pic.num_channels), 3, dtype=np.uint8
-        ),
-        'read1': np.full((1, 3, self.pic.num_channels), 1, dtype=np.uint8),
-        'read2': np.full((1, 3, self.pic.num_channels), 2, dtype=np.uint8),
-        'read3': None,
-        'read4': np.full((1, 3, self.pic.num_channels), 3, dtype=np.uint8),
-        'read1_parent2': np.full(
-            (1, 3, self.pic.num_channels), 1, dtype=np.uint8
-        ),
-        'read2_parent2': np.full(
-            (1, 3, self.pic.num_channels), 2, dtype=np.uint8
-        ),
-        'read3_parent2': None,
-        'read4_parent2': np.full(
-            (1, 3, self.pic.num_channels), 3, dtype=np.uint8
-        ),
     }
-
-    # Setup our shared mocks.
-    mock_encoder = mock.Mock(spec=['encode_read', 'encode_reference'])
-    mock_encoder.encode_reference.return_value = self.expected_rows['ref']
-
-    # pylint: disable=unused-argument
-    def get_read_row(dv_call, refbases, read, pos, alt_allele):
-      return self.expected_rows[read.fragment_name]
-
-    mock_encoder.encode_read.side_effect = get_read_row
-
-    self.mock_enc_ref = mock_encoder.encode_reference
-    self.mock_enc_read = mock_encoder.encode_read
-
-    self.pic._encoder = mock_encoder
+    for suffix in ['', '_parent1', '_parent2']:
+      for i in range(1, 5):
+        name = 'read{}{}'.format(i, suffix)
+        self.expected_rows[name] = self.pic._encoder.encode_read(
+            self.dv_call, self.ref, getattr(self, name), 9, [self.alt_allele]
+        )
 
   def assertImageMatches(self, actual_image, *row_names):
     """Checks that actual_image matches an image from constructed row_names."""
@@ -1091,7 +1004,6 @@ class PileupImageForTrioCreatorEncodePileupTest(parameterized.TestCase):
         reads_for_samples=[[], [], []],
         alt_alleles={self.alt_allele},
     )
-    test_utils.assert_not_called_workaround(self.mock_enc_read)
     self.assertImageMatches(
         image,
         'ref',
@@ -1180,28 +1092,6 @@ class PileupImageForTrioCreatorEncodePileupTest(parameterized.TestCase):
         ],
         alt_alleles={self.alt_allele},
     )
-    self.mock_enc_ref.assert_called_with(self.ref)
-    self.mock_enc_ref.assert_called_with(self.ref)
-    self.mock_enc_ref.assert_called_with(self.ref)
-    self.assertEqual(
-        self.mock_enc_read.call_args_list,
-        [
-            mock.call(
-                self.dv_call, self.ref, self.read4_parent1, 9, {self.alt_allele}
-            ),
-            mock.call(
-                self.dv_call, self.ref, self.read2_parent1, 9, {self.alt_allele}
-            ),
-            mock.call(self.dv_call, self.ref, self.read4, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, self.read2, 9, {self.alt_allele}),
-            mock.call(
-                self.dv_call, self.ref, self.read4_parent2, 9, {self.alt_allele}
-            ),
-            mock.call(
-                self.dv_call, self.ref, self.read2_parent2, 9, {self.alt_allele}
-            ),
-        ],
-    )
     self.assertImageMatches(
         image,
         'ref',
@@ -1219,7 +1109,7 @@ class PileupImageForTrioCreatorEncodePileupTest(parameterized.TestCase):
     )
 
   def test_image_creation_with_bad_read(self):
-    # Read 3 is bad (return value is None) so it should be skipped.
+    # Read 3 is bad (it can't be encoded) so it should be skipped.
     image = self.pic.build_pileup(
         dv_call=self.dv_call,
         refbases=self.ref,
@@ -1230,35 +1120,6 @@ class PileupImageForTrioCreatorEncodePileupTest(parameterized.TestCase):
         ],
         alt_alleles={self.alt_allele},
     )
-    self.mock_enc_ref.assert_called_with(self.ref)
-    self.mock_enc_ref.assert_called_with(self.ref)
-    self.mock_enc_ref.assert_called_with(self.ref)
-    self.assertEqual(
-        self.mock_enc_read.call_args_list,
-        [
-            mock.call(
-                self.dv_call, self.ref, self.read2_parent1, 9, {self.alt_allele}
-            ),
-            mock.call(
-                self.dv_call, self.ref, self.read3_parent1, 9, {self.alt_allele}
-            ),
-            mock.call(
-                self.dv_call, self.ref, self.read1_parent1, 9, {self.alt_allele}
-            ),
-            mock.call(self.dv_call, self.ref, self.read2, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, self.read3, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, self.read1, 9, {self.alt_allele}),
-            mock.call(
-                self.dv_call, self.ref, self.read2_parent2, 9, {self.alt_allele}
-            ),
-            mock.call(
-                self.dv_call, self.ref, self.read3_parent2, 9, {self.alt_allele}
-            ),
-            mock.call(
-                self.dv_call, self.ref, self.read1_parent2, 9, {self.alt_allele}
-            ),
-        ],
-    )
     self.assertImageMatches(
         image,
         'ref',
@@ -1276,7 +1137,7 @@ class PileupImageForTrioCreatorEncodePileupTest(parameterized.TestCase):
     )
 
   def test_image_creation_with_all_reads_in_new_order(self):
-    # Read 3 is bad (return value is None) so it should be skipped. Read2 should
+    # Read 3 is bad (it can't be encoded) so it should be skipped. Read2 should
     # also be dropped because there's only space for Read1 and Read4. If there
     # are more reads than rows, a deterministic random subset is used.
     image = self.pic.build_pileup(
@@ -1299,28 +1160,6 @@ class PileupImageForTrioCreatorEncodePileupTest(parameterized.TestCase):
         ],
         alt_alleles={self.alt_allele},
     )
-    self.mock_enc_ref.assert_called_with(self.ref)
-    self.mock_enc_ref.assert_called_with(self.ref)
-    self.mock_enc_ref.assert_called_with(self.ref)
-    self.assertEqual(
-        self.mock_enc_read.call_args_list,
-        [
-            mock.call(
-                self.dv_call, self.ref, self.read1_parent1, 9, {self.alt_allele}
-            ),
-            mock.call(
-                self.dv_call, self.ref, self.read4_parent1, 9, {self.alt_allele}
-            ),
-            mock.call(self.dv_call, self.ref, self.read1, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, self.read4, 9, {self.alt_allele}),
-            mock.call(
-                self.dv_call, self.ref, self.read1_parent2, 9, {self.alt_allele}
-            ),
-            mock.call(
-                self.dv_call, self.ref, self.read4_parent2, 9, {self.alt_allele}
-            ),
-        ],
-    )
     self.assertImageMatches(
         image,
         'ref',
@@ -1364,7 +1203,6 @@ class PileupImageForTrioCreatorEncodePileupTest(parameterized.TestCase):
         reference_band_height=2,
         sequencing_type=deepvariant_pb2.PileupImageOptions.TRIO,
     )
-    self.custom_pic._encoder = self.pic._encoder
 
     image = self.custom_pic.build_pileup(
         dv_call=self.dv_call,
@@ -1376,22 +1214,6 @@ class PileupImageForTrioCreatorEncodePileupTest(parameterized.TestCase):
         ],
         alt_alleles={self.alt_allele},
     )
-    self.mock_enc_ref.assert_called_with(self.ref)
-    self.mock_enc_ref.assert_called_with(self.ref)
-    self.mock_enc_ref.assert_called_with(self.ref)
-    self.assertEqual(
-        self.mock_enc_read.call_args_list,
-        [
-            mock.call(
-                self.dv_call, self.ref, self.read4_parent1, 9, {self.alt_allele}
-            ),
-            mock.call(self.dv_call, self.ref, self.read4, 9, {self.alt_allele}),
-            mock.call(self.dv_call, self.ref, self.read2, 9, {self.alt_allele}),
-            mock.call(
-                self.dv_call, self.ref, self.read4_parent2, 9, {self.alt_allele}
-            ),
-        ],
-    )
     self.assertImageMatches(
         image,
         'ref',
@@ -1477,7 +1299,6 @@ class PileupImageForTrioCreatorEncodePileupTest(parameterized.TestCase):
         reference_band_height=1,
         sequencing_type=deepvariant_pb2.PileupImageOptions.TRIO,
     )
-    self.custom_pic._encoder = self.pic._encoder
 
     image = self.custom_pic.build_pileup(
         dv_call=self.dv_call,
@@ -32,13 +32,24 @@
 #include "deepvariant/postprocess_variants.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
-#include <map>
+#include <limits>
 #include <memory>
+#include <queue>
 #include <string>
+#include <thread>  // NOLINT
+#include <utility>
 #include <vector>
 
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/wire_format_lite.h"
 #include "third_party/nucleus/protos/reference.pb.h"
 #include "third_party/nucleus/protos/variants.pb.h"
 #include "third_party/nucleus/util/utils.h"
@@ -53,52 +64,332 @@ namespace deepvariant {
 
 namespace {
 
-void SortSingleSiteCalls(
-    const std::vector<nucleus::genomics::v1::ContigInfo>& contigs,
-    std::vector<CallVariantsOutput>* calls) {
-  std::vector<CallVariantsOutput> output;
-  if (calls->empty()) {
-    return;
-  }
-  //   Create the mapping from from contig to pos_in_fasta.
-  std::map<std::string, int> contig_name_to_pos_in_fasta =
-      nucleus::MapContigNameToPosInFasta(contigs);
-  std::stable_sort(calls->begin(), calls->end(),
-            [&contig_name_to_pos_in_fasta](const CallVariantsOutput& a,
-                                           const CallVariantsOutput& b) {
-              return nucleus::CompareVariants(a.variant(), b.variant(),
-                                              contig_name_to_pos_in_fasta);
-            });
+using google::protobuf::internal::WireFormatLite;
+
+// Maximum number of sorted runs merged at once. More runs are first merged in
+// groups of this size, so the number of open files stays bounded.
+constexpr std::size_t kMaxRunsPerMerge = 256;
+
+// Below this many calls the radix sort runs on the calling thread only.
+constexpr std::size_t kMinCallsPerSortThread = 1 << 16;
+
+// Sort key of a call: pos_in_fasta of its contig and start packed in
+// `position`, and its end. `index` is the position of the call in its batch.
+// Keys compare like nucleus::CompareVariants.
+struct SortKey {
+  std::uint64_t position;
+  std::uint32_t end;
+  std::uint32_t index;
+
+  bool operator<(const SortKey& other) const {
+    return position != other.position ? position < other.position
+                                      : end < other.end;
+  }
+};
+
+// Extracts sort keys from serialized CallVariantsOutput protos. Only the
+// fields of the key are decoded; the rest of each record is skipped.
+class SortKeyReader {
+ public:
+  explicit SortKeyReader(
+      const std::vector<nucleus::genomics::v1::ContigInfo>& contigs) {
+    for (const nucleus::genomics::v1::ContigInfo& contig : contigs) {
+      QCHECK_GE(contig.pos_in_fasta(), 0) << contig.name();
+      contig_name_to_pos_in_fasta_[contig.name()] = contig.pos_in_fasta();
+    }
+  }
+
+  // Returns the key of the serialized call in `record`. Fields are decoded as
+  // ParseFromArray would: the last value of a field wins and repeated
+  // `variant` fields are merged. Each call must have exactly one VariantCall.
+  SortKey Read(absl::string_view record, std::uint32_t index) const {
+    VariantFields fields;
+    google::protobuf::io::CodedInputStream input(
+        reinterpret_cast<const std::uint8_t*>(record.data()), record.size());
+    for (std::uint32_t tag = input.ReadTag(); tag != 0;
+         tag = input.ReadTag()) {
+      if (tag == kVariantTag) {
+        absl::string_view variant;
+        QCHECK(ReadLengthDelimited(record, &input, &variant))
+            << "Failed to parse CallVariantsOutput";
+        ReadVariantFields(variant, &fields);
+      } else {
+        QCHECK(WireFormatLite::SkipField(&input, tag))
+            << "Failed to parse CallVariantsOutput";
+      }
+    }
+    QCHECK(input.ConsumedEntireMessage())
+        << "Failed to parse CallVariantsOutput";
+    // Here we assume each variant has only 1 call.
+    QCHECK_EQ(fields.num_calls, 1);
+
+    auto pos_in_fasta = contig_name_to_pos_in_fasta_.find(fields.reference_name);
+    QCHECK(pos_in_fasta != contig_name_to_pos_in_fasta_.end())
+        << "Reference name " << fields.reference_name << " not in contig info.";
+    QCHECK(fields.start >= 0 && fields.start <= kMaxCoordinate &&
+           fields.end >= 0 && fields.end <= kMaxCoordinate)
+        << "Variant " << fields.reference_name << ":" << fields.start << "-"
+        << fields.end << " is out of range.";
+    return {static_cast<std::uint64_t>(pos_in_fasta->second) << 32 |
+                static_cast<std::uint64_t>(fields.start),
+            static_cast<std::uint32_t>(fields.end), index};
+  }
+
+ private:
+  static constexpr std::int64_t kMaxCoordinate =
+      std::numeric_limits<std::uint32_t>::max();
+  static constexpr std::uint32_t kVariantTag = WireFormatLite::MakeTag(
+      CallVariantsOutput::kVariantFieldNumber,
+      WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+  static constexpr std::uint32_t kReferenceNameTag = WireFormatLite::MakeTag(
+      nucleus::genomics::v1::Variant::kReferenceNameFieldNumber,
+      WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+  static constexpr std::uint32_t kStartTag = WireFormatLite::MakeTag(
+      nucleus::genomics::v1::Variant::kStartFieldNumber,
+      WireFormatLite::WIRETYPE_VARINT);
+  static constexpr std::uint32_t kEndTag = WireFormatLite::MakeTag(
+      nucleus::genomics::v1::Variant::kEndFieldNumber,
+      WireFormatLite::WIRETYPE_VARINT);
+  static constexpr std::uint32_t kCallsTag = WireFormatLite::MakeTag(
+      nucleus::genomics::v1::Variant::kCallsFieldNumber,
+      WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+
+  struct VariantFields {
+    absl::string_view reference_name;
+    std::int64_t start = 0;
+    std::int64_t end = 0;
+    int num_calls = 0;
+  };
+
+  // Reads a length-delimited field of `message` from `input` into `field`.
+  static bool ReadLengthDelimited(absl::string_view message,
+                                  google::protobuf::io::CodedInputStream* input,
+                                  absl::string_view* field) {
+    std::uint32_t length;
+    if (!input->ReadVarint32(&length)) return false;
+    const int offset = input->CurrentPosition();
+    if (length > message.size() - offset) return false;
+    *field = message.substr(offset, length);
+    return input->Skip(length);
+  }
+
+  static void ReadVariantFields(absl::string_view variant,
+                                VariantFields* fields) {
+    google::protobuf::io::CodedInputStream input(
+        reinterpret_cast<const std::uint8_t*>(variant.data()), variant.size());
+    bool ok = true;
+    for (std::uint32_t tag = input.ReadTag(); ok && tag != 0;
+         tag = input.ReadTag()) {
+      std::uint64_t value;
+      absl::string_view bytes;
+      switch (tag) {
+        case kReferenceNameTag:
+          ok = ReadLengthDelimited(variant, &input, &fields->reference_name);
+          break;
+        case kStartTag:
+          ok = input.ReadVarint64(&value);
+          fields->start = static_cast<std::int64_t>(value);
+          break;
+        case kEndTag:
+          ok = input.ReadVarint64(&value);
+          fields->end = static_cast<std::int64_t>(value);
+          break;
+        case kCallsTag:
+          ok = ReadLengthDelimited(variant, &input, &bytes);
+          ++fields->num_calls;
+          break;
+        default:
+          ok = WireFormatLite::SkipField(&input, tag);
+      }
+    }
+    QCHECK(ok && input.ConsumedEntireMessage())
+        << "Failed to parse CallVariantsOutput";
+  }
+
+  absl::flat_hash_map<std::string, int> contig_name_to_pos_in_fasta_;
+};
+
+// Stable LSD radix sort of `keys` by (position, end), one byte per pass.
+// Passes where all keys share the same byte are skipped. Each pass splits the
+// keys between up to `num_threads` threads.
+void RadixSortKeys(std::vector<SortKey>* keys, int num_threads) {
+  const std::size_t n = keys->size();
+  const std::size_t num_chunks = std::max<std::size_t>(
+      1, std::min<std::size_t>(num_threads, n / kMinCallsPerSortThread));
+  const std::size_t chunk_size = (n + num_chunks - 1) / num_chunks;
+  std::vector<SortKey> buffer(n);
+  std::vector<std::array<std::size_t, 256>> counts(num_chunks);
+  auto for_each_chunk = [&](const auto& fn) {
+    std::vector<std::thread> threads;
+    for (std::size_t chunk = 1; chunk < num_chunks; ++chunk) {
+      threads.emplace_back(fn, chunk);
+    }
+    fn(0);
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  };
+  // Bytes 0-3 are those of `end`, bytes 4-11 those of `position`.
+  auto digit = [](const SortKey& key, int byte) -> std::size_t {
+    return byte < 4 ? (key.end >> (8 * byte)) & 0xff
+                    : (key.position >> (8 * (byte - 4))) & 0xff;
+  };
+  for (int byte = 0; byte < 12; ++byte) {
+    for_each_chunk([&](std::size_t chunk) {
+      counts[chunk].fill(0);
+      const std::size_t end = std::min(n, (chunk + 1) * chunk_size);
+      for (std::size_t i = chunk * chunk_size; i < end; ++i) {
+        ++counts[chunk][digit((*keys)[i], byte)];
+      }
+    });
+    // Turns counts into the first output slot of each digit in each chunk.
+    std::size_t offset = 0;
+    bool single_digit = false;
+    for (std::size_t d = 0; d < 256; ++d) {
+      std::size_t total = 0;
+      for (std::size_t chunk = 0; chunk < num_chunks; ++chunk) {
+        const std::size_t count = counts[chunk][d];
+        counts[chunk][d] = offset + total;
+        total += count;
+      }
+      single_digit |= total == n;
+      offset += total;
+    }
+    if (single_digit) {
+      continue;
+    }
+    for_each_chunk([&](std::size_t chunk) {
+      const std::size_t end = std::min(n, (chunk + 1) * chunk_size);
+      for (std::size_t i = chunk * chunk_size; i < end; ++i) {
+        buffer[counts[chunk][digit((*keys)[i], byte)]++] = (*keys)[i];
+      }
+    });
+    keys->swap(buffer);
+  }
 }
 
-}  // namespace
+// Serialized calls and their sort keys. Records are kept as read, so calls
+// whose order is all that changes are never parsed or re-serialized.
+class SerializedCalls {
+ public:
+  void Add(absl::string_view record, const SortKeyReader& key_reader) {
+    QCHECK_LT(keys_.size(), std::numeric_limits<std::uint32_t>::max());
+    keys_.push_back(key_reader.Read(record, keys_.size()));
+    if (keys_.size() > 1 && keys_.back() < keys_[keys_.size() - 2]) {
+      is_sorted_ = false;
+    }
+    offsets_.push_back(bytes_.size());
+    bytes_.append(record.data(), record.size());
+  }
 
-std::uint64_t ProcessSingleSiteCallTfRecords(
-    const std::vector<nucleus::genomics::v1::ContigInfo>& contigs,
-    const std::vector<std::string>& tfrecord_paths,
-    const string& output_tfrecord_path) {
-  std::vector<CallVariantsOutput> single_site_calls;
-  tensorflow::Env* env = tensorflow::Env::Default();
-  for (const string& tfrecord_path : tfrecord_paths) {
-    std::unique_ptr<tensorflow::RandomAccessFile> read_file;
-    TF_CHECK_OK(env->NewRandomAccessFile(tfrecord_path, &read_file));
+  // Sorts the calls by key. Calls with equal keys keep their order.
+  void Sort(int num_threads) {
+    if (!is_sorted_) {
+      RadixSortKeys(&keys_, num_threads);
+      is_sorted_ = true;
+    }
+  }
+
+  std::size_t size() const { return keys_.size(); }
+  bool empty() const { return keys_.empty(); }
+
+  // The i-th call, in sorted order after Sort.
+  const SortKey& key(std::size_t i) const { return keys_[i]; }
+  absl::string_view record(std::size_t i) const {
+    const std::uint32_t index = keys_[i].index;
+    const std::size_t end =
+        index + 1 < offsets_.size() ? offsets_[index + 1] : bytes_.size();
+    return absl::string_view(bytes_).substr(offsets_[index],
+                                            end - offsets_[index]);
+  }
+
+  void Clear() {
+    bytes_.clear();
+    offsets_.clear();
+    keys_.clear();
+    is_sorted_ = true;
+  }
+
+ private:
+  std::string bytes_;
+  std::vector<std::size_t> offsets_;
+  std::vector<SortKey> keys_;
+  bool is_sorted_ = true;
+};
+
+// Reads serialized CallVariantsOutput records from a TFRecord file, gzipped if
+// the path ends with ".gz".
+class CallReader {
+ public:
+  explicit CallReader(const string& tfrecord_path) {
+    TF_CHECK_OK(tensorflow::Env::Default()->NewRandomAccessFile(tfrecord_path,
+                                                                &file_));
     const char* const option = nucleus::EndsWith(tfrecord_path, ".gz")
                                    ? tensorflow::io::compression::kGzip
                                    : tensorflow::io::compression::kNone;
-    tensorflow::io::RecordReader reader(
-        read_file.get(),
+    reader_ = std::make_unique<tensorflow::io::RecordReader>(
+        file_.get(),
         tensorflow::io::RecordReaderOptions::CreateRecordReaderOptions(option));
+  }
+
+  // Reads the next record into `record`. Returns false at the end of the file.
+  bool Next(tensorflow::tstring* record) {
+    return reader_->ReadRecord(&offset_, record).ok();
+  }
+
+ private:
+  std::unique_ptr<tensorflow::RandomAccessFile> file_;
+  std::unique_ptr<tensorflow::io::RecordReader> reader_;
+  std::uint64_t offset_ = 0;
+};
+
+// Writes serialized CallVariantsOutput records to an uncompressed TFRecord
+// file.
+class CallWriter {
+ public:
+  explicit CallWriter(const string& tfrecord_path) {
+    TF_CHECK_OK(
+        tensorflow::Env::Default()->NewWritableFile(tfrecord_path, &file_));
+    writer_ = std::make_unique<tensorflow::io::RecordWriter>(file_.get());
+  }
+
+  void Write(absl::string_view record) {
+    tensorflow::Status writer_status = writer_->WriteRecord(record);
+    QCHECK(writer_status.ok())
+        << "Failed to write serialized proto to output_writer. "
+        << "Status = " << writer_status.error_message();
+  }
 
-    std::uint64_t offset = 0;
-    tensorflow::tstring data;
+  void WriteAll(const SerializedCalls& calls) {
+    for (std::size_t i = 0; i < calls.size(); ++i) {
+      Write(calls.record(i));
+    }
+  }
+
+  void Close() {
+    TF_CHECK_OK(writer_->Close()) << "Failed to flush the output writer.";
+    TF_CHECK_OK(file_->Close());
+  }
+
+ private:
+  std::unique_ptr<tensorflow::WritableFile> file_;
+  std::unique_ptr<tensorflow::io::RecordWriter> writer_;
+};
+
+// Sorts the calls of all shards in memory and writes them to
+// `output_tfrecord_path`.
+std::uint64_t SortInMemory(const SortKeyReader& key_reader,
+                           const std::vector<std::string>& tfrecord_paths,
+                           const string& output_tfrecord_path,
+                           int num_threads) {
+  SerializedCalls single_site_calls;
+  tensorflow::tstring record;
+  for (const string& tfrecord_path : tfrecord_paths) {
     LOG(INFO) << "Read from: " << tfrecord_path;
-    while (reader.ReadRecord(&offset, &data).ok()) {
-      CallVariantsOutput single_site_call;
-      QCHECK(single_site_call.ParseFromArray(data.data(), data.length()))
-          << "Failed to parse CallVariantsOutput";
-      // Here we assume each variant has only 1 call.
-      QCHECK_EQ(single_site_call.variant().calls_size(), 1);
-      single_site_calls.push_back(single_site_call);
+    CallReader reader(tfrecord_path);
+    while (reader.Next(&record)) {
+      single_site_calls.Add(absl::string_view(record.data(), record.size()),
+                            key_reader);
     }
     if (tfrecord_paths.size() > 1) {
       LOG(INFO) << "Done reading: " << tfrecord_path
@@ -109,25 +400,196 @@ std::uint64_t ProcessSingleSiteCallTfRecords(
   LOG(INFO) << "Total #entries in single_site_calls = "
             << std::to_string(single_site_calls.size());
   VLOG(3) << "Start SortSingleSiteCalls";
-  SortSingleSiteCalls(contigs, &single_site_calls);
+  single_site_calls.Sort(num_threads);
   VLOG(3) << "Done SortSingleSiteCalls";
 
   // Write sorted calls to output_tfrecord_path.
-  std::unique_ptr<tensorflow::WritableFile> output_file;
-  TF_CHECK_OK(tensorflow::Env::Default()->NewWritableFile(output_tfrecord_path,
-                                                          &output_file));
-  tensorflow::io::RecordWriter output_writer(output_file.get());
-  for (const auto& single_site_call : single_site_calls) {
-    tensorflow::Status writer_status =
-        output_writer.WriteRecord(single_site_call.SerializeAsString());
-    QCHECK(writer_status.ok())
-        << "Failed to write serialized proto to output_writer. "
-        << "Status = " << writer_status.error_message();
-  }
-  TF_CHECK_OK(output_writer.Flush()) << "Failed to flush the output writer.";
+  CallWriter output_writer(output_tfrecord_path);
+  output_writer.WriteAll(single_site_calls);
+  output_writer.Close();
   return single_site_calls.size();
 }
 
+// Splits one input shard into sorted runs written to `run_path_prefix-<n>`.
+// Calls are buffered up to `max_calls_in_memory` at a time and the buffer is
+// only sorted if it is out of order. A buffer that starts at or after the end
+// of the previous one extends the same run, so a shard that is already sorted
+// becomes a single run. Returns the run paths in input order.
+std::vector<std::string> SpillSortedRuns(const SortKeyReader& key_reader,
+                                         const string& tfrecord_path,
+                                         std::size_t max_calls_in_memory,
+                                         const string& run_path_prefix,
+                                         std::uint64_t* num_calls) {
+  std::vector<std::string> run_paths;
+  std::unique_ptr<CallWriter> run_writer;
+  SortKey last_in_run = {};
+  SerializedCalls buffer;
+  auto flush_buffer = [&]() {
+    if (buffer.empty()) {
+      return;
+    }
+    buffer.Sort(/*num_threads=*/1);
+    if (run_writer == nullptr || buffer.key(0) < last_in_run) {
+      if (run_writer != nullptr) {
+        run_writer->Close();
+      }
+      run_paths.push_back(absl::StrCat(run_path_prefix, "-", run_paths.size()));
+      run_writer = std::make_unique<CallWriter>(run_paths.back());
+    }
+    run_writer->WriteAll(buffer);
+    last_in_run = buffer.key(buffer.size() - 1);
+    buffer.Clear();
+  };
+
+  LOG(INFO) << "Read from: " << tfrecord_path;
+  CallReader reader(tfrecord_path);
+  tensorflow::tstring record;
+  while (reader.Next(&record)) {
+    buffer.Add(absl::string_view(record.data(), record.size()), key_reader);
+    ++*num_calls;
+    if (buffer.size() >= max_calls_in_memory) {
+      flush_buffer();
+    }
+  }
+  flush_buffer();
+  if (run_writer != nullptr) {
+    run_writer->Close();
+  }
+  LOG(INFO) << "Done reading: " << tfrecord_path << ". Spilled "
+            << run_paths.size() << " sorted runs.";
+  return run_paths;
+}
+
+// Merges the sorted runs in `run_paths` into `output_path`. Calls that compare
+// equal are written in the order of their runs, which keeps the merge stable.
+void MergeSortedRuns(const SortKeyReader& key_reader,
+                     const std::vector<std::string>& run_paths,
+                     const string& output_path) {
+  std::vector<std::unique_ptr<CallReader>> readers;
+  std::vector<tensorflow::tstring> heads(run_paths.size());
+  std::vector<SortKey> head_keys(run_paths.size());
+  // Min-heap of run indices, ordered by their head key and then by run.
+  auto later = [&head_keys](std::size_t a, std::size_t b) {
+    if (head_keys[b] < head_keys[a]) return true;
+    if (head_keys[a] < head_keys[b]) return false;
+    return a > b;
+  };
+  std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(later)>
+      queue(later);
+  auto advance = [&](std::size_t i) {
+    if (readers[i]->Next(&heads[i])) {
+      head_keys[i] = key_reader.Read(
+          absl::string_view(heads[i].data(), heads[i].size()), 0);
+      queue.push(i);
+    }
+  };
+  for (std::size_t i = 0; i < run_paths.size(); ++i) {
+    readers.push_back(std::make_unique<CallReader>(run_paths[i]));
+    advance(i);
+  }
+  CallWriter writer(output_path);
+  while (!queue.empty()) {
+    const std::size_t i = queue.top();
+    queue.pop();
+    writer.Write(absl::string_view(heads[i].data(), heads[i].size()));
+    advance(i);
+  }
+  writer.Close();
+}
+
+void DeleteRuns(const std::vector<std::string>& run_paths) {
+  for (const string& run_path : run_paths) {
+    TF_CHECK_OK(tensorflow::Env::Default()->DeleteFile(run_path));
+  }
+}
+
+// Sorts the calls of all shards with an external merge sort. See
+// ProcessSingleSiteCallTfRecords.
+std::uint64_t SortWithSpilling(const SortKeyReader& key_reader,
+                               const std::vector<std::string>& tfrecord_paths,
+                               const string& output_tfrecord_path,
+                               std::uint64_t max_records_in_memory,
+                               const string& spill_dir, int num_threads) {
+  string run_path_prefix = output_tfrecord_path;
+  if (!spill_dir.empty()) {
+    run_path_prefix = absl::StrCat(
+        spill_dir, nucleus::EndsWith(spill_dir, "/") ? "" : "/",
+        output_tfrecord_path.substr(output_tfrecord_path.rfind('/') + 1));
+  }
+  num_threads = std::max(
+      1, std::min(num_threads, static_cast<int>(tfrecord_paths.size())));
+  const std::size_t max_calls_per_thread =
+      std::max<std::uint64_t>(1, max_records_in_memory / num_threads);
+
+  // Each thread takes the next unsorted shard until none is left.
+  std::vector<std::vector<std::string>> shard_runs(tfrecord_paths.size());
+  std::vector<std::uint64_t> shard_calls(tfrecord_paths.size(), 0);
+  std::atomic<std::size_t> next_shard(0);
+  auto spill_shards = [&]() {
+    for (std::size_t shard = next_shard++; shard < tfrecord_paths.size();
+         shard = next_shard++) {
+      shard_runs[shard] = SpillSortedRuns(
+          key_reader, tfrecord_paths[shard], max_calls_per_thread,
+          absl::StrCat(run_path_prefix, ".run-", shard), &shard_calls[shard]);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    threads.emplace_back(spill_shards);
+  }
+  spill_shards();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  std::uint64_t num_calls = 0;
+  std::vector<std::string> run_paths;
+  for (std::size_t shard = 0; shard < tfrecord_paths.size(); ++shard) {
+    num_calls += shard_calls[shard];
+    run_paths.insert(run_paths.end(), shard_runs[shard].begin(),
+                     shard_runs[shard].end());
+  }
+  LOG(INFO) << "Total #entries in single_site_calls = "
+            << std::to_string(num_calls) << " in " << run_paths.size()
+            << " sorted runs";
+
+  // Groups of consecutive runs are merged so that ties keep their order.
+  for (int pass = 0; run_paths.size() > kMaxRunsPerMerge; ++pass) {
+    std::vector<std::string> merged_paths;
+    for (std::size_t begin = 0; begin < run_paths.size();
+         begin += kMaxRunsPerMerge) {
+      const std::vector<std::string> group(
+          run_paths.begin() + begin,
+          run_paths.begin() +
+              std::min(run_paths.size(), begin + kMaxRunsPerMerge));
+      merged_paths.push_back(absl::StrCat(run_path_prefix, ".merge-", pass,
+                                          "-", merged_paths.size()));
+      MergeSortedRuns(key_reader, group, merged_paths.back());
+      DeleteRuns(group);
+    }
+    run_paths = std::move(merged_paths);
+  }
+  MergeSortedRuns(key_reader, run_paths, output_tfrecord_path);
+  DeleteRuns(run_paths);
+  return num_calls;
+}
+
+}  // namespace
+
+std::uint64_t ProcessSingleSiteCallTfRecords(
+    const std::vector<nucleus::genomics::v1::ContigInfo>& contigs,
+    const std::vector<std::string>& tfrecord_paths,
+    const string& output_tfrecord_path, std::uint64_t max_records_in_memory,
+    const string& spill_dir, int num_threads) {
+  const SortKeyReader key_reader(contigs);
+  if (max_records_in_memory == 0) {
+    return SortInMemory(key_reader, tfrecord_paths, output_tfrecord_path,
+                        std::max(num_threads, 1));
+  }
+  return SortWithSpilling(key_reader, tfrecord_paths, output_tfrecord_path,
+                          max_records_in_memory, spill_dir, num_threads);
+}
+
 }  // namespace deepvariant
 }  // namespace genomics
 }  // namespace learning
@@ -32,6 +32,7 @@
 #ifndef LEARNING_GENOMICS_DEEPVARIANT_POSTPROCESS_VARIANTS_H_
 #define LEARNING_GENOMICS_DEEPVARIANT_POSTPROCESS_VARIANTS_H_
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -48,10 +49,24 @@ using std::string;
 // on the mapping of chromosome names to positions in FASTA in `contigs`,
 // and then outputs the sorted TFRecord of CallVariantsOutput protos to
 // `output_tfrecord_path`.
+//
+// Records are ordered by a key read from their serialized bytes and written
+// out unchanged, so calls are never parsed and re-serialized.
+//
+// If `max_records_in_memory` is 0, all calls are loaded and sorted in memory
+// with a radix sort using up to `num_threads` threads.
+// Otherwise an external merge sort keeps at most about `max_records_in_memory`
+// calls in memory: `num_threads` threads split the input shards between them,
+// spill each shard as sorted runs under `spill_dir` (next to
+// `output_tfrecord_path` if empty), and the runs are streamed through a k-way
+// merge into `output_tfrecord_path`. Stretches of a shard that are already in
+// order are spilled without sorting. Both modes write the same output.
 std::uint64_t ProcessSingleSiteCallTfRecords(
     const std::vector<nucleus::genomics::v1::ContigInfo>& contigs,
     const std::vector<std::string>& tfrecord_paths,
-    const string& output_tfrecord_path);
+    const string& output_tfrecord_path,
+    std::uint64_t max_records_in_memory = 0, const string& spill_dir = "",
+    int num_threads = 1);
 
 }  // namespace deepvariant
 }  // namespace genomics
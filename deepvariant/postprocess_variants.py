@@ -200,6 +200,28 @@ _PAR_REGIONS = flags.DEFINE_string(
     ),
 )
 
+_SORT_MAX_RECORDS_IN_MEMORY = flags.DEFINE_integer(
+    'sort_max_records_in_memory',
+    0,
+    (
+        'Optional. If positive, call_variants outputs are sorted with an '
+        'external merge sort that keeps at most about this many records in '
+        'memory, spilling sorted runs to --sort_spill_dir. If 0, all records '
+        'are sorted in memory.'
+    ),
+)
+
+_SORT_SPILL_DIR = flags.DEFINE_string(
+    'sort_spill_dir',
+    '',
+    (
+        'Optional. Directory for the sorted runs spilled when '
+        '--sort_max_records_in_memory is positive. If empty, the runs are '
+        'written next to the sorted call file, which is a temporary file in '
+        'the system temporary directory (see Python tempfile).'
+    ),
+)
+
 _PROCESS_SOMATIC = flags.DEFINE_boolean(
     'process_somatic',
     False,
@@ -1307,7 +1329,12 @@ def main(argv=()):
       temp = tempfile.NamedTemporaryFile()
       start_time = time.time()
       num_cvo_records = postprocess_variants_lib.process_single_sites_tfrecords(
-          contigs, cvo_paths, temp.name
+          contigs,
+          cvo_paths,
+          temp.name,
+          max_records_in_memory=_SORT_MAX_RECORDS_IN_MEMORY.value,
+          spill_dir=_SORT_SPILL_DIR.value,
+          num_threads=max(_CPUS.value, 1),
       )
 
       logging.info(
@@ -1399,6 +1426,7 @@ def main(argv=()):
           FLAGS.gvcf_outfile,
           header,
           _PROCESS_SOMATIC.value,
+          max(_CPUS.value, 1),
       )
       if FLAGS.outfile.endswith('.gz'):
         build_index(FLAGS.outfile, use_csi)
@@ -31,6 +31,11 @@
 
 #include "deepvariant/postprocess_variants.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
 #include <vector>
 
 #include <gmock/gmock-generated-matchers.h>
@@ -41,6 +46,7 @@
 #include "third_party/nucleus/protos/reference.pb.h"
 #include "third_party/nucleus/protos/variants.pb.h"
 #include "third_party/nucleus/testing/test_utils.h"
+#include "third_party/nucleus/util/utils.h"
 
 namespace learning {
 namespace genomics {
@@ -113,6 +119,122 @@ TEST(ProcessSingleSiteCallTfRecords, BasicCase) {
   EXPECT_EQ(output[4].variant().quality(), 0.7);
 }
 
+// Shards with ties, sorted stretches and out of order calls, sorted in memory
+// and with spilling under several memory limits, must give the same output.
+TEST(ProcessSingleSiteCallTfRecords, SpillingMatchesInMemorySort) {
+  std::vector<nucleus::genomics::v1::ContigInfo> contigs =
+      nucleus::CreateContigInfos({"chr1", "chr2", "chr10"}, {0, 1, 2});
+  const std::vector<string> contig_names = {"chr10", "chr2", "chr1"};
+  std::mt19937 gen(42);
+  std::vector<string> input_tfrecord_paths;
+  int quality = 0;
+  for (int shard = 0; shard < 4; ++shard) {
+    std::vector<CallVariantsOutput> single_site_calls;
+    // Shard 0 is sorted, the others are random. Shard 3 is long enough to
+    // spill more runs than are merged at once.
+    const int num_calls = shard == 3 ? 1200 : 50;
+    for (int i = 0; i < num_calls; ++i) {
+      const string& contig =
+          shard == 0 ? contig_names[2 - i * 3 / num_calls]
+                     : contig_names[gen() % contig_names.size()];
+      const int start = shard == 0 ? i : gen() % 20;
+      single_site_calls.push_back(CreateSingleSiteCalls(
+          contig, start, start + 1 + gen() % 2, quality++));
+    }
+    input_tfrecord_paths.push_back(nucleus::MakeTempFile(
+        "ProcessSingleSiteCallTfRecordsSpilling.in" + std::to_string(shard) +
+        ".tfrecord"));
+    nucleus::WriteProtosToTFRecord(single_site_calls,
+                                   input_tfrecord_paths.back());
+  }
+  const string expected_tfrecord_path = nucleus::MakeTempFile(
+      "ProcessSingleSiteCallTfRecordsSpilling.expected.tfrecord");
+  EXPECT_EQ(ProcessSingleSiteCallTfRecords(contigs, input_tfrecord_paths,
+                                           expected_tfrecord_path),
+            1350);
+  std::vector<CallVariantsOutput> expected =
+      nucleus::ReadProtosFromTFRecord<CallVariantsOutput>(
+          expected_tfrecord_path);
+
+  for (int max_records_in_memory : {1, 7, 100, 10000}) {
+    for (int num_threads : {1, 3}) {
+      const string output_tfrecord_path = nucleus::MakeTempFile(
+          "ProcessSingleSiteCallTfRecordsSpilling.out.tfrecord");
+      EXPECT_EQ(ProcessSingleSiteCallTfRecords(
+                    contigs, input_tfrecord_paths, output_tfrecord_path,
+                    max_records_in_memory, ::testing::TempDir(),
+                    num_threads),
+                1350);
+      std::vector<CallVariantsOutput> output =
+          nucleus::ReadProtosFromTFRecord<CallVariantsOutput>(
+              output_tfrecord_path);
+      ASSERT_EQ(output.size(), expected.size());
+      for (int i = 0; i < output.size(); ++i) {
+        // Qualities are unique, so they identify each call.
+        EXPECT_EQ(output[i].variant().quality(),
+                  expected[i].variant().quality())
+            << "max_records_in_memory=" << max_records_in_memory
+            << " num_threads=" << num_threads << " i=" << i;
+      }
+    }
+  }
+}
+
+// Calls with other fields set and coordinates spanning all bytes of the sort
+// key, enough of them for the sort to use several threads.
+TEST(ProcessSingleSiteCallTfRecords, SortsLikeCompareVariants) {
+  std::vector<nucleus::genomics::v1::ContigInfo> contigs =
+      nucleus::CreateContigInfos({"chr1", "chr2", "chrX"}, {0, 1, 300});
+  const std::vector<string> contig_names = {"chrX", "chr2", "chr1"};
+  std::mt19937 gen(7);
+  std::vector<CallVariantsOutput> all_calls;
+  std::vector<string> input_tfrecord_paths;
+  for (int shard = 0; shard < 2; ++shard) {
+    std::vector<CallVariantsOutput> single_site_calls;
+    for (int i = 0; i < 80000; ++i) {
+      const int64_t start = gen() % (shard == 0 ? 300 : 3000000000LL);
+      CallVariantsOutput call = CreateSingleSiteCalls(
+          contig_names[gen() % contig_names.size()], 0, 0, all_calls.size());
+      call.mutable_variant()->set_start(start);
+      call.mutable_variant()->set_end(start + 1 + gen() % 3);
+      call.mutable_variant()->add_alternate_bases("A");
+      call.add_genotype_probabilities(0.5);
+      single_site_calls.push_back(call);
+      all_calls.push_back(call);
+    }
+    input_tfrecord_paths.push_back(nucleus::MakeTempFile(
+        "ProcessSingleSiteCallTfRecordsCompareVariants.in" +
+        std::to_string(shard) + ".tfrecord"));
+    nucleus::WriteProtosToTFRecord(single_site_calls,
+                                   input_tfrecord_paths.back());
+  }
+  const std::map<string, int> contig_name_to_pos_in_fasta =
+      nucleus::MapContigNameToPosInFasta(contigs);
+  std::stable_sort(all_calls.begin(), all_calls.end(),
+                   [&contig_name_to_pos_in_fasta](const CallVariantsOutput& a,
+                                                  const CallVariantsOutput& b) {
+                     return nucleus::CompareVariants(
+                         a.variant(), b.variant(), contig_name_to_pos_in_fasta);
+                   });
+
+  for (int max_records_in_memory : {0, 50000}) {
+    const string output_tfrecord_path = nucleus::MakeTempFile(
+        "ProcessSingleSiteCallTfRecordsCompareVariants.out.tfrecord");
+    EXPECT_EQ(ProcessSingleSiteCallTfRecords(
+                  contigs, input_tfrecord_paths, output_tfrecord_path,
+                  max_records_in_memory, ::testing::TempDir(), 4),
+              all_calls.size());
+    std::vector<CallVariantsOutput> output =
+        nucleus::ReadProtosFromTFRecord<CallVariantsOutput>(
+            output_tfrecord_path);
+    ASSERT_EQ(output.size(), all_calls.size());
+    for (int i = 0; i < output.size(); ++i) {
+      ASSERT_EQ(output[i].SerializeAsString(), all_calls[i].SerializeAsString())
+          << "max_records_in_memory=" << max_records_in_memory << " i=" << i;
+    }
+  }
+}
+
 }  // namespace deepvariant
 }  // namespace genomics
 }  // namespace learning
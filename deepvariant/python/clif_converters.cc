@@ -98,6 +98,31 @@ PyObject* Clif_PyObjFrom(std::unique_ptr<ImageRow> img_row,
   return PyArray_Return(res);
 }
 
+// Destructor of the capsule owning the PileupImage viewed by a numpy array.
+void DeletePileupImageCapsule(PyObject* capsule) {
+  delete reinterpret_cast<PileupImage*>(PyCapsule_GetPointer(capsule, nullptr));
+}
+
+PyObject* Clif_PyObjFrom(std::unique_ptr<PileupImage> image,
+                         const clif::py::PostConv& pc) {
+  // Initialize numpy C array API if needed.
+  std::call_once(import_array_flag, call_import_array);
+  if (!image) { Py_RETURN_NONE; }
+
+  // The image is already laid out as a C-contiguous HWC array, so the numpy
+  // array views its buffer and takes ownership of the image.
+  npy_intp dims[] { image->height, image->width, image->num_channels };
+  PyArrayObject* res = reinterpret_cast<PyArrayObject*>(
+      PyArray_SimpleNewFromData(3, dims, NPY_UBYTE, image->data.data()));
+  CHECK(res != nullptr);
+  PyObject* owner =
+      PyCapsule_New(image.get(), nullptr, DeletePileupImageCapsule);
+  CHECK(owner != nullptr);
+  image.release();
+  CHECK_EQ(PyArray_SetBaseObject(res, owner), 0);
+  return PyArray_Return(res);
+}
+
 }  // namespace deepvariant
 }  // namespace genomics
 }  // namespace learning
@@ -47,6 +47,12 @@ namespace deepvariant {
 PyObject* Clif_PyObjFrom(std::unique_ptr<ImageRow> img_row,
                          const ::clif::py::PostConv& pc);
 
+// CLIF use `::learning::genomics::deepvariant::PileupImage` as PileupImage
+
+// Convert a PileupImage to a numpy 3D array of shape (height, width, channels).
+PyObject* Clif_PyObjFrom(std::unique_ptr<PileupImage> image,
+                         const ::clif::py::PostConv& pc);
+
 }  // namespace deepvariant
 }  // namespace genomics
 }  // namespace learning
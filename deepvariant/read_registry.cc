@@ -0,0 +1,103 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/read_registry.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+#include "third_party/nucleus/util/proto_ptr.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using nucleus::genomics::v1::Read;
+
+// Separator string that will appear between the fragment name and read number
+// in the string key constructed from a Read with ReadKey().
+static constexpr char kFragmentNameReadNumberSeparator[] = "/";
+
+std::string ReadRegistry::ReadKey(const Read& read) {
+  return ReadKey(read.fragment_name(), read.read_number());
+}
+
+std::string ReadRegistry::ReadKey(absl::string_view fragment_name,
+                                  int read_number) {
+  return absl::StrCat(fragment_name, kFragmentNameReadNumberSeparator,
+                      read_number);
+}
+
+int32_t ReadRegistry::Register(const Read& read) {
+  return RegisterKey(ReadKey(read));
+}
+
+int32_t ReadRegistry::Register(absl::string_view fragment_name,
+                               int read_number) {
+  return RegisterKey(ReadKey(fragment_name, read_number));
+}
+
+int32_t ReadRegistry::RegisterKey(std::string read_key) {
+  auto [it, is_inserted] = ids_.try_emplace(read_key, keys_.size());
+  if (is_inserted) {
+    keys_.push_back(std::move(read_key));
+  }
+  return it->second;
+}
+
+std::vector<int32_t> ReadRegistry::RegisterAll(
+    const std::vector<nucleus::ConstProtoPtr<const Read>>& reads) {
+  std::vector<int32_t> read_ids;
+  read_ids.reserve(reads.size());
+  for (const auto& read : reads) {
+    read_ids.push_back(Register(*read.p_));
+  }
+  return read_ids;
+}
+
+int32_t ReadRegistry::Find(absl::string_view read_key) const {
+  auto it = ids_.find(read_key);
+  return it == ids_.end() ? kUnknownReadId : it->second;
+}
+
+void ReadRegistry::Clear() {
+  keys_.clear();
+  ids_.clear();
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_READ_REGISTRY_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_READ_REGISTRY_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+#include "third_party/nucleus/util/proto_ptr.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+// Hands out dense integer ids to the reads of a region.
+//
+// Reads are identified across DeepVariant by a string key constructed as
+// "fragment_name/read_number". Building and hashing that key every time a
+// component needs to recognize a read is expensive, so a ReadRegistry is
+// filled once when the reads of a region are loaded, and the components that
+// share it (AlleleCounter, VariantCaller, the pileup encoder and
+// DirectPhasing) refer to reads by their id instead. Ids are assigned in
+// registration order starting at 0, and reads with the same key share an id.
+//
+// A ReadRegistry is not thread-safe and is meant to be cleared (or discarded)
+// between regions.
+class ReadRegistry {
+ public:
+  // Id returned for keys that were never registered.
+  static constexpr int32_t kUnknownReadId = -1;
+
+  ReadRegistry() = default;
+
+  // ReadRegistry is neither copyable nor movable.
+  ReadRegistry(const ReadRegistry&) = delete;
+  ReadRegistry& operator=(const ReadRegistry&) = delete;
+
+  // Constructs the unique string key of read: the concatenation of
+  // fragment_name, "/", and read_number.
+  static std::string ReadKey(const nucleus::genomics::v1::Read& read);
+  static std::string ReadKey(absl::string_view fragment_name,
+                             int read_number);
+
+  // Returns the id of read, registering it if needed.
+  int32_t Register(const nucleus::genomics::v1::Read& read);
+
+  // Same as above for a read given by its fragment_name and read_number, e.g.
+  // the fields of a nucleus::SamRecordView.
+  int32_t Register(absl::string_view fragment_name, int read_number);
+
+  // Returns the id of the read with the given ReadKey(), registering it if
+  // needed.
+  int32_t RegisterKey(std::string read_key);
+
+  // Registers all reads in order and returns their ids, so that the id of
+  // reads[i] is at position i.
+  std::vector<int32_t> RegisterAll(
+      const std::vector<
+          nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads);
+
+  // Returns the id of the read with the given ReadKey(), or kUnknownReadId.
+  int32_t Find(absl::string_view read_key) const;
+
+  // Returns the ReadKey() of the read with the given id.
+  const std::string& Key(int32_t read_id) const { return keys_[read_id]; }
+
+  // Number of distinct reads registered so far. Ids are in [0, size()).
+  int size() const { return keys_.size(); }
+
+  // Forgets all registered reads.
+  void Clear();
+
+ private:
+  // ReadKey() of each read, indexed by read id.
+  std::vector<std::string> keys_;
+  absl::flat_hash_map<std::string, int32_t> ids_;
+};
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_READ_REGISTRY_H_
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/read_registry.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+#include "absl/strings/string_view.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+#include "third_party/nucleus/util/proto_ptr.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using nucleus::genomics::v1::Read;
+using ::testing::ElementsAre;
+
+Read MakeRead(absl::string_view fragment_name, int read_number) {
+  Read read;
+  read.set_fragment_name(std::string(fragment_name));
+  read.set_read_number(read_number);
+  return read;
+}
+
+TEST(ReadRegistryTest, ReadKey) {
+  EXPECT_EQ(ReadRegistry::ReadKey(MakeRead("read1", 1)), "read1/1");
+}
+
+TEST(ReadRegistryTest, AssignsDenseIdsInRegistrationOrder) {
+  ReadRegistry registry;
+  EXPECT_EQ(registry.Register(MakeRead("read1", 0)), 0);
+  EXPECT_EQ(registry.Register(MakeRead("read1", 1)), 1);
+  EXPECT_EQ(registry.Register(MakeRead("read2", 0)), 2);
+  // Reads with the same key share an id.
+  EXPECT_EQ(registry.Register(MakeRead("read1", 1)), 1);
+  EXPECT_EQ(registry.RegisterKey("read2/0"), 2);
+  EXPECT_EQ(registry.size(), 3);
+  EXPECT_EQ(registry.Key(1), "read1/1");
+}
+
+TEST(ReadRegistryTest, Find) {
+  ReadRegistry registry;
+  registry.Register(MakeRead("read1", 0));
+  registry.Register(MakeRead("read2", 0));
+  EXPECT_EQ(registry.Find("read2/0"), 1);
+  EXPECT_EQ(registry.Find("read3/0"), ReadRegistry::kUnknownReadId);
+  registry.Clear();
+  EXPECT_EQ(registry.size(), 0);
+  EXPECT_EQ(registry.Find("read2/0"), ReadRegistry::kUnknownReadId);
+}
+
+TEST(ReadRegistryTest, RegisterAll) {
+  const Read read1 = MakeRead("read1", 0);
+  const Read read2 = MakeRead("read2", 0);
+  ReadRegistry registry;
+  registry.Register(read2);
+  std::vector<nucleus::ConstProtoPtr<const Read>> reads = {
+      nucleus::ConstProtoPtr<const Read>(&read1),
+      nucleus::ConstProtoPtr<const Read>(&read2),
+      nucleus::ConstProtoPtr<const Read>(&read1)};
+  EXPECT_THAT(registry.RegisterAll(reads), ElementsAre(1, 0, 1));
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,456 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/batch_smith_waterman.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "deepvariant/pileup_channel_simd.h"
+#include "absl/log/check.h"
+#include "absl/strings/string_view.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define DEEPVARIANT_REALIGNER_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+namespace {
+
+// Code of bases that score 0 against everything. Lanes past the end of their
+// query are padded with it, which cannot raise the lane's best score.
+constexpr uint8_t kOtherBase = 4;
+constexpr int kNumCodes = 5;
+
+uint8_t BaseCode(char base) {
+  switch (base) {
+    case 'A':
+    case 'a':
+      return 0;
+    case 'C':
+    case 'c':
+      return 1;
+    case 'G':
+    case 'g':
+      return 2;
+    case 'T':
+    case 't':
+      return 3;
+    default:
+      return kOtherBase;
+  }
+}
+
+//--------//
+// Scalar //
+//--------//
+
+// Gotoh local alignment score with exact integer arithmetic.
+int ScoreScalar(const std::vector<uint8_t>& target, absl::string_view query,
+                int match, int mismatch, int gap_open, int gap_extend) {
+  const int rows = query.size();
+  const int kMinScore = std::numeric_limits<int>::min() / 2;
+  // h[i] and e[i] hold column j - 1 of rows i while column j is computed.
+  std::vector<int> h(rows, 0);
+  std::vector<int> e(rows, kMinScore);
+  std::vector<uint8_t> query_codes(rows);
+  for (int i = 0; i < rows; ++i) query_codes[i] = BaseCode(query[i]);
+  int best = 0;
+  for (uint8_t t : target) {
+    int h_diag = 0;
+    int h_up = 0;
+    int f = kMinScore;
+    for (int i = 0; i < rows; ++i) {
+      const uint8_t q = query_codes[i];
+      const int s = (q == kOtherBase || t == kOtherBase) ? 0
+                    : q == t                            ? match
+                                                        : -mismatch;
+      const int h_left = h[i];
+      e[i] = std::max(e[i] - gap_extend, h_left - gap_open);
+      f = std::max(f - gap_extend, h_up - gap_open);
+      const int cell = std::max({0, h_diag + s, e[i], f});
+      h[i] = cell;
+      h_diag = h_left;
+      h_up = cell;
+      best = std::max(best, cell);
+    }
+  }
+  return best;
+}
+
+// Scores of one group of queries, one per lane, split into a bonus added and a
+// penalty subtracted with unsigned saturation.  Entry (c * rows + i) * lanes +
+// lane is for base code c of the target against row i of the lane's query.
+template <typename T>
+struct QueryProfile {
+  int rows = 0;
+  std::vector<T> bonus;
+  std::vector<T> penalty;
+};
+
+template <typename T>
+void BuildQueryProfile(const std::vector<absl::string_view>& queries,
+                       const int* indices, int count, int lanes, int match,
+                       int mismatch, QueryProfile<T>* profile) {
+  int rows = 0;
+  for (int l = 0; l < count; ++l) {
+    rows = std::max(rows, static_cast<int>(queries[indices[l]].size()));
+  }
+  profile->rows = rows;
+  profile->bonus.assign(kNumCodes * rows * lanes, 0);
+  profile->penalty.assign(kNumCodes * rows * lanes, 0);
+  for (int l = 0; l < count; ++l) {
+    absl::string_view query = queries[indices[l]];
+    for (int i = 0; i < query.size(); ++i) {
+      const uint8_t q = BaseCode(query[i]);
+      if (q == kOtherBase) continue;
+      for (int c = 0; c < kNumCodes - 1; ++c) {
+        const int entry = (c * rows + i) * lanes + l;
+        if (q == c) {
+          profile->bonus[entry] = match;
+        } else {
+          profile->penalty[entry] = mismatch;
+        }
+      }
+    }
+  }
+}
+
+// Computes the best score of every lane of a group. h and e are scratch rows
+// of rows * lanes elements.
+template <typename T>
+using GroupKernel = void (*)(const uint8_t* target, int target_len,
+                             const QueryProfile<T>& profile, int gap_open,
+                             int gap_extend, T* h, T* e, T* best);
+
+#ifdef DEEPVARIANT_REALIGNER_SIMD_X86
+
+// The kernels below walk the target one column at a time and the lanes' query
+// rows within a column, keeping the column's vertical gap score and the
+// previous row in registers:
+//   E[i][j] = max(E[i][j-1] - gap_extend, H[i][j-1] - gap_open)
+//   F[i][j] = max(F[i-1][j] - gap_extend, H[i-1][j] - gap_open)
+//   H[i][j] = max(0, H[i-1][j-1] + s(i, j), E[i][j], F[i][j])
+// Unsigned saturation clamps every value at 0, which is harmless as H >= 0,
+// and at the type's maximum, which callers treat as an overflow.
+
+//--------//
+// SSE4.1 //
+//--------//
+
+#define DV_TARGET_SSE4 __attribute__((target("sse4.1")))
+
+struct Sse4U8 {
+  using T = uint8_t;
+  static constexpr int kLanes = 16;
+  DV_TARGET_SSE4 static __m128i Set1(int v) {
+    return _mm_set1_epi8(static_cast<char>(v));
+  }
+  DV_TARGET_SSE4 static __m128i Adds(__m128i a, __m128i b) {
+    return _mm_adds_epu8(a, b);
+  }
+  DV_TARGET_SSE4 static __m128i Subs(__m128i a, __m128i b) {
+    return _mm_subs_epu8(a, b);
+  }
+  DV_TARGET_SSE4 static __m128i Max(__m128i a, __m128i b) {
+    return _mm_max_epu8(a, b);
+  }
+};
+
+struct Sse4U16 {
+  using T = uint16_t;
+  static constexpr int kLanes = 8;
+  DV_TARGET_SSE4 static __m128i Set1(int v) {
+    return _mm_set1_epi16(static_cast<int16_t>(v));
+  }
+  DV_TARGET_SSE4 static __m128i Adds(__m128i a, __m128i b) {
+    return _mm_adds_epu16(a, b);
+  }
+  DV_TARGET_SSE4 static __m128i Subs(__m128i a, __m128i b) {
+    return _mm_subs_epu16(a, b);
+  }
+  DV_TARGET_SSE4 static __m128i Max(__m128i a, __m128i b) {
+    return _mm_max_epu16(a, b);
+  }
+};
+
+template <typename Ops>
+DV_TARGET_SSE4 void ScoreGroupSse4(const uint8_t* target, int target_len,
+                                   const QueryProfile<typename Ops::T>& profile,
+                                   int gap_open, int gap_extend,
+                                   typename Ops::T* h, typename Ops::T* e,
+                                   typename Ops::T* best) {
+  const int rows = profile.rows;
+  auto* h_rows = reinterpret_cast<__m128i*>(h);
+  auto* e_rows = reinterpret_cast<__m128i*>(e);
+  const auto* bonus = reinterpret_cast<const __m128i*>(profile.bonus.data());
+  const auto* penalty =
+      reinterpret_cast<const __m128i*>(profile.penalty.data());
+  const __m128i gap_o = Ops::Set1(gap_open);
+  const __m128i gap_e = Ops::Set1(gap_extend);
+  const __m128i zero = _mm_setzero_si128();
+  for (int i = 0; i < rows; ++i) {
+    _mm_storeu_si128(h_rows + i, zero);
+    _mm_storeu_si128(e_rows + i, zero);
+  }
+  __m128i v_best = zero;
+  for (int j = 0; j < target_len; ++j) {
+    const __m128i* column_bonus = bonus + target[j] * rows;
+    const __m128i* column_penalty = penalty + target[j] * rows;
+    __m128i h_diag = zero;
+    __m128i h_up = zero;
+    __m128i f = zero;
+    for (int i = 0; i < rows; ++i) {
+      const __m128i h_left = _mm_loadu_si128(h_rows + i);
+      const __m128i e_cell =
+          Ops::Max(Ops::Subs(_mm_loadu_si128(e_rows + i), gap_e),
+                   Ops::Subs(h_left, gap_o));
+      f = Ops::Max(Ops::Subs(f, gap_e), Ops::Subs(h_up, gap_o));
+      __m128i cell =
+          Ops::Subs(Ops::Adds(h_diag, _mm_loadu_si128(column_bonus + i)),
+                    _mm_loadu_si128(column_penalty + i));
+      cell = Ops::Max(Ops::Max(cell, e_cell), f);
+      _mm_storeu_si128(h_rows + i, cell);
+      _mm_storeu_si128(e_rows + i, e_cell);
+      v_best = Ops::Max(v_best, cell);
+      h_diag = h_left;
+      h_up = cell;
+    }
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(best), v_best);
+}
+
+//------//
+// AVX2 //
+//------//
+
+#define DV_TARGET_AVX2 __attribute__((target("avx2")))
+
+struct Avx2U8 {
+  using T = uint8_t;
+  static constexpr int kLanes = 32;
+  DV_TARGET_AVX2 static __m256i Set1(int v) {
+    return _mm256_set1_epi8(static_cast<char>(v));
+  }
+  DV_TARGET_AVX2 static __m256i Adds(__m256i a, __m256i b) {
+    return _mm256_adds_epu8(a, b);
+  }
+  DV_TARGET_AVX2 static __m256i Subs(__m256i a, __m256i b) {
+    return _mm256_subs_epu8(a, b);
+  }
+  DV_TARGET_AVX2 static __m256i Max(__m256i a, __m256i b) {
+    return _mm256_max_epu8(a, b);
+  }
+};
+
+struct Avx2U16 {
+  using T = uint16_t;
+  static constexpr int kLanes = 16;
+  DV_TARGET_AVX2 static __m256i Set1(int v) {
+    return _mm256_set1_epi16(static_cast<int16_t>(v));
+  }
+  DV_TARGET_AVX2 static __m256i Adds(__m256i a, __m256i b) {
+    return _mm256_adds_epu16(a, b);
+  }
+  DV_TARGET_AVX2 static __m256i Subs(__m256i a, __m256i b) {
+    return _mm256_subs_epu16(a, b);
+  }
+  DV_TARGET_AVX2 static __m256i Max(__m256i a, __m256i b) {
+    return _mm256_max_epu16(a, b);
+  }
+};
+
+template <typename Ops>
+DV_TARGET_AVX2 void ScoreGroupAvx2(const uint8_t* target, int target_len,
+                                   const QueryProfile<typename Ops::T>& profile,
+                                   int gap_open, int gap_extend,
+                                   typename Ops::T* h, typename Ops::T* e,
+                                   typename Ops::T* best) {
+  const int rows = profile.rows;
+  auto* h_rows = reinterpret_cast<__m256i*>(h);
+  auto* e_rows = reinterpret_cast<__m256i*>(e);
+  const auto* bonus = reinterpret_cast<const __m256i*>(profile.bonus.data());
+  const auto* penalty =
+      reinterpret_cast<const __m256i*>(profile.penalty.data());
+  const __m256i gap_o = Ops::Set1(gap_open);
+  const __m256i gap_e = Ops::Set1(gap_extend);
+  const __m256i zero = _mm256_setzero_si256();
+  for (int i = 0; i < rows; ++i) {
+    _mm256_storeu_si256(h_rows + i, zero);
+    _mm256_storeu_si256(e_rows + i, zero);
+  }
+  __m256i v_best = zero;
+  for (int j = 0; j < target_len; ++j) {
+    const __m256i* column_bonus = bonus + target[j] * rows;
+    const __m256i* column_penalty = penalty + target[j] * rows;
+    __m256i h_diag = zero;
+    __m256i h_up = zero;
+    __m256i f = zero;
+    for (int i = 0; i < rows; ++i) {
+      const __m256i h_left = _mm256_loadu_si256(h_rows + i);
+      const __m256i e_cell =
+          Ops::Max(Ops::Subs(_mm256_loadu_si256(e_rows + i), gap_e),
+                   Ops::Subs(h_left, gap_o));
+      f = Ops::Max(Ops::Subs(f, gap_e), Ops::Subs(h_up, gap_o));
+      __m256i cell =
+          Ops::Subs(Ops::Adds(h_diag, _mm256_loadu_si256(column_bonus + i)),
+                    _mm256_loadu_si256(column_penalty + i));
+      cell = Ops::Max(Ops::Max(cell, e_cell), f);
+      _mm256_storeu_si256(h_rows + i, cell);
+      _mm256_storeu_si256(e_rows + i, e_cell);
+      v_best = Ops::Max(v_best, cell);
+      h_diag = h_left;
+      h_up = cell;
+    }
+  }
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(best), v_best);
+}
+
+#endif  // DEEPVARIANT_REALIGNER_SIMD_X86
+
+// Scores queries[indices[k]] in groups of lanes. Queries whose score
+// saturates T are appended to overflowed instead.
+template <typename T>
+void ScoreInLanes(GroupKernel<T> kernel, int lanes,
+                  const std::vector<uint8_t>& target,
+                  const std::vector<absl::string_view>& queries,
+                  const std::vector<int>& indices, int match, int mismatch,
+                  int gap_open, int gap_extend, std::vector<int>* scores,
+                  std::vector<int>* overflowed) {
+  QueryProfile<T> profile;
+  std::vector<T> h;
+  std::vector<T> e;
+  std::vector<T> best(lanes);
+  for (size_t start = 0; start < indices.size(); start += lanes) {
+    const int count = std::min(static_cast<size_t>(lanes),
+                               indices.size() - start);
+    BuildQueryProfile(queries, &indices[start], count, lanes, match, mismatch,
+                      &profile);
+    h.resize(profile.rows * lanes);
+    e.resize(profile.rows * lanes);
+    kernel(target.data(), target.size(), profile, gap_open, gap_extend,
+           h.data(), e.data(), best.data());
+    for (int l = 0; l < count; ++l) {
+      if (best[l] == std::numeric_limits<T>::max()) {
+        overflowed->push_back(indices[start + l]);
+      } else {
+        (*scores)[indices[start + l]] = best[l];
+      }
+    }
+  }
+}
+
+}  // namespace
+
+BatchSmithWaterman::BatchSmithWaterman(uint8_t match_score,
+                                       uint8_t mismatch_penalty,
+                                       uint8_t gap_opening_penalty,
+                                       uint8_t gap_extending_penalty)
+    : BatchSmithWaterman(match_score, mismatch_penalty, gap_opening_penalty,
+                         gap_extending_penalty, DetectSimdLevel()) {}
+
+BatchSmithWaterman::BatchSmithWaterman(uint8_t match_score,
+                                       uint8_t mismatch_penalty,
+                                       uint8_t gap_opening_penalty,
+                                       uint8_t gap_extending_penalty,
+                                       SimdLevel level)
+    : match_score_(match_score),
+      mismatch_penalty_(mismatch_penalty),
+      gap_opening_penalty_(gap_opening_penalty),
+      gap_extending_penalty_(gap_extending_penalty),
+      level_(level) {
+  CHECK_LE(static_cast<int>(level), static_cast<int>(DetectSimdLevel()))
+      << SimdLevelName(level) << " is not supported by this CPU";
+}
+
+std::vector<int> BatchSmithWaterman::Score(
+    absl::string_view target,
+    const std::vector<absl::string_view>& queries) const {
+  std::vector<int> scores(queries.size(), 0);
+  if (target.empty()) return scores;
+  std::vector<uint8_t> target_codes(target.size());
+  for (int j = 0; j < target.size(); ++j) {
+    target_codes[j] = BaseCode(target[j]);
+  }
+
+  // Longest queries first, so that each group pads few rows.
+  std::vector<int> indices;
+  for (int i = 0; i < queries.size(); ++i) {
+    if (!queries[i].empty()) indices.push_back(i);
+  }
+  std::stable_sort(indices.begin(), indices.end(), [&queries](int a, int b) {
+    return queries[a].size() > queries[b].size();
+  });
+
+  std::vector<int> overflowed;
+#ifdef DEEPVARIANT_REALIGNER_SIMD_X86
+  if (level_ != SimdLevel::kScalar) {
+    GroupKernel<uint8_t> kernel8 = ScoreGroupSse4<Sse4U8>;
+    GroupKernel<uint16_t> kernel16 = ScoreGroupSse4<Sse4U16>;
+    int lanes8 = Sse4U8::kLanes;
+    int lanes16 = Sse4U16::kLanes;
+    if (level_ == SimdLevel::kAvx2) {
+      kernel8 = ScoreGroupAvx2<Avx2U8>;
+      kernel16 = ScoreGroupAvx2<Avx2U16>;
+      lanes8 = Avx2U8::kLanes;
+      lanes16 = Avx2U16::kLanes;
+    }
+    std::vector<int> overflowed8;
+    ScoreInLanes<uint8_t>(kernel8, lanes8, target_codes, queries, indices,
+                          match_score_, mismatch_penalty_,
+                          gap_opening_penalty_, gap_extending_penalty_,
+                          &scores, &overflowed8);
+    ScoreInLanes<uint16_t>(kernel16, lanes16, target_codes, queries,
+                           overflowed8, match_score_, mismatch_penalty_,
+                           gap_opening_penalty_, gap_extending_penalty_,
+                           &scores, &overflowed);
+    indices = std::move(overflowed);
+  }
+#endif  // DEEPVARIANT_REALIGNER_SIMD_X86
+  for (int i : indices) {
+    scores[i] =
+        ScoreScalar(target_codes, queries[i], match_score_, mismatch_penalty_,
+                    gap_opening_penalty_, gap_extending_penalty_);
+  }
+  return scores;
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Inter-sequence batched Smith-Waterman scoring.
+//
+// BatchSmithWaterman scores many queries against one target by giving each
+// query its own SIMD lane, so a single pass over the dynamic programming
+// matrix scores 16 or 32 queries at once.  Lanes first use saturating 8-bit
+// scores; queries whose score reaches the 8-bit maximum are scored again with
+// 16-bit lanes.  Only scores are computed: callers run the striped SSW
+// Aligner for the pairs whose score makes them worth a traceback.
+//
+// Scoring follows the SSW Aligner exactly: bases are A, C, G and T in either
+// case, anything else scores 0 against everything, and a gap of length g costs
+// gap_open + (g - 1) * gap_extend.
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_BATCH_SMITH_WATERMAN_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_BATCH_SMITH_WATERMAN_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "deepvariant/pileup_channel_simd.h"
+#include "absl/strings/string_view.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+class BatchSmithWaterman {
+ public:
+  // Scores with the kernels of DetectSimdLevel().
+  BatchSmithWaterman(uint8_t match_score, uint8_t mismatch_penalty,
+                     uint8_t gap_opening_penalty, uint8_t gap_extending_penalty);
+
+  // Scores with the kernels of level, which must be supported by this CPU.
+  BatchSmithWaterman(uint8_t match_score, uint8_t mismatch_penalty,
+                     uint8_t gap_opening_penalty, uint8_t gap_extending_penalty,
+                     SimdLevel level);
+
+  // Returns, for each query, the score of its best local alignment to target.
+  // This is the sw_score the SSW Aligner reports for the same pair, or 0 if
+  // the query or the target is empty.
+  std::vector<int> Score(absl::string_view target,
+                         const std::vector<absl::string_view>& queries) const;
+
+  SimdLevel level() const { return level_; }
+
+ private:
+  uint8_t match_score_;
+  uint8_t mismatch_penalty_;
+  uint8_t gap_opening_penalty_;
+  uint8_t gap_extending_penalty_;
+  SimdLevel level_;
+};
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_BATCH_SMITH_WATERMAN_H_
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Throughput of read-to-haplotype Smith-Waterman on a realistic realignment
+// window: SSW one pair at a time, BatchSmithWaterman scoring at each
+// SimdLevel supported by this CPU.
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "deepvariant/pileup_channel_simd.h"
+#include "deepvariant/realigner/batch_smith_waterman.h"
+#include "deepvariant/realigner/ssw.h"
+#include "absl/strings/string_view.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+namespace {
+
+// Default AlignerOptions scoring of the realigner.
+constexpr int kMatch = 4;
+constexpr int kMismatch = 6;
+constexpr int kGapOpen = 8;
+constexpr int kGapExtend = 2;
+constexpr int kReadSize = 148;
+
+// A 400 bp window with a reference haplotype, two alternate haplotypes, and
+// 100 reads of 148 bp drawn from all three with sequencing errors and small
+// indels, i.e. the reads the fast pass cannot align.
+struct Window {
+  std::string reference;
+  std::vector<std::string> haplotypes;
+  std::vector<std::string> reads;
+};
+
+const Window& RealisticWindow() {
+  static const Window* window = [] {
+    std::mt19937 gen(2024);
+    auto random_base = [&gen]() { return "ACGT"[gen() % 4]; };
+    auto* window = new Window;
+    for (int i = 0; i < 400; ++i) window->reference.push_back(random_base());
+    std::string snp = window->reference;
+    snp[200] = snp[200] == 'A' ? 'C' : 'A';
+    std::string deletion = window->reference;
+    deletion.erase(180, 9);
+    window->haplotypes = {window->reference, snp, deletion};
+    for (int r = 0; r < 100; ++r) {
+      const std::string& haplotype = window->haplotypes[r % 3];
+      std::string read =
+          haplotype.substr(gen() % (haplotype.size() - kReadSize), kReadSize);
+      for (char& base : read) {
+        if (gen() % 100 == 0) base = random_base();
+      }
+      const int indel_position = gen() % (kReadSize - 10) + 5;
+      if (r % 2 == 0) {
+        read.erase(indel_position, 1 + gen() % 3);
+      } else {
+        read.insert(indel_position, std::string(1 + gen() % 3, random_base()));
+      }
+      window->reads.push_back(read);
+    }
+    return window;
+  }();
+  return *window;
+}
+
+void BM_SswAlignPairs(benchmark::State& state) {
+  const Window& window = RealisticWindow();
+  Aligner aligner(kMatch, kMismatch, kGapOpen, kGapExtend);
+  for (auto _ : state) {
+    for (const std::string& haplotype : window.haplotypes) {
+      for (const std::string& read : window.reads) {
+        // As FastPassAligner does, the reference is set for every pair.
+        aligner.SetReferenceSequence(haplotype);
+        Alignment alignment;
+        aligner.Align(read, Filter(), &alignment);
+        benchmark::DoNotOptimize(alignment.sw_score);
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * window.haplotypes.size() *
+                          window.reads.size());
+}
+BENCHMARK(BM_SswAlignPairs);
+
+void BM_BatchSmithWatermanScore(benchmark::State& state) {
+  const Window& window = RealisticWindow();
+  const std::vector<absl::string_view> reads(window.reads.begin(),
+                                             window.reads.end());
+  BatchSmithWaterman aligner(kMatch, kMismatch, kGapOpen, kGapExtend,
+                             static_cast<SimdLevel>(state.range(0)));
+  for (auto _ : state) {
+    for (const std::string& haplotype : window.haplotypes) {
+      benchmark::DoNotOptimize(aligner.Score(haplotype, reads));
+    }
+  }
+  state.SetLabel(SimdLevelName(aligner.level()));
+  state.SetItemsProcessed(state.iterations() * window.haplotypes.size() *
+                          window.reads.size());
+}
+
+void LevelArgs(benchmark::internal::Benchmark* b) {
+  for (SimdLevel level : SupportedSimdLevels()) {
+    b->Arg(static_cast<int>(level));
+  }
+}
+BENCHMARK(BM_BatchSmithWatermanScore)->Apply(LevelArgs);
+
+}  // namespace
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
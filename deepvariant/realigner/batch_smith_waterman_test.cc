@@ -0,0 +1,184 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/batch_smith_waterman.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "deepvariant/pileup_channel_simd.h"
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+#include "absl/strings/string_view.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using ::testing::ElementsAre;
+
+namespace {
+
+// Full-matrix Gotoh local alignment, written independently of the kernels.
+int ReferenceScore(const std::string& target, const std::string& query,
+                   int match, int mismatch, int gap_open, int gap_extend) {
+  auto code = [](char c) {
+    const std::string bases = "ACGT";
+    const size_t pos = bases.find(toupper(c));
+    return pos == std::string::npos ? -1 : static_cast<int>(pos);
+  };
+  const int n = query.size();
+  const int m = target.size();
+  const int kNegative = -1000000;
+  std::vector<std::vector<int>> h(n + 1, std::vector<int>(m + 1, 0));
+  std::vector<std::vector<int>> e(n + 1, std::vector<int>(m + 1, kNegative));
+  std::vector<std::vector<int>> f(n + 1, std::vector<int>(m + 1, kNegative));
+  int best = 0;
+  for (int i = 1; i <= n; ++i) {
+    for (int j = 1; j <= m; ++j) {
+      const int q = code(query[i - 1]);
+      const int t = code(target[j - 1]);
+      const int s = (q < 0 || t < 0) ? 0 : q == t ? match : -mismatch;
+      e[i][j] = std::max(e[i][j - 1] - gap_extend, h[i][j - 1] - gap_open);
+      f[i][j] = std::max(f[i - 1][j] - gap_extend, h[i - 1][j] - gap_open);
+      h[i][j] = std::max({0, h[i - 1][j - 1] + s, e[i][j], f[i][j]});
+      best = std::max(best, h[i][j]);
+    }
+  }
+  return best;
+}
+
+std::string RandomSequence(std::mt19937* rng, int length) {
+  const std::string alphabet = "ACGTACGTACGTACGTacgtN";
+  std::string sequence;
+  for (int i = 0; i < length; ++i) {
+    sequence.push_back(alphabet[(*rng)() % alphabet.size()]);
+  }
+  return sequence;
+}
+
+// Copies template with random substitutions and small indels.
+std::string Mutate(std::mt19937* rng, const std::string& sequence, int edits) {
+  std::string mutated = sequence;
+  for (int i = 0; i < edits && !mutated.empty(); ++i) {
+    const int pos = (*rng)() % mutated.size();
+    switch ((*rng)() % 3) {
+      case 0:
+        mutated[pos] = "ACGT"[(*rng)() % 4];
+        break;
+      case 1:
+        mutated.erase(pos, 1 + (*rng)() % 3);
+        break;
+      default:
+        mutated.insert(pos, RandomSequence(rng, 1 + (*rng)() % 3));
+    }
+  }
+  return mutated;
+}
+
+class BatchSmithWatermanTest : public ::testing::TestWithParam<SimdLevel> {};
+
+TEST_P(BatchSmithWatermanTest, SswExample) {
+  BatchSmithWaterman aligner(4, 2, 4, 2, GetParam());
+  // SSW aligns these as 2=1I2=.
+  EXPECT_THAT(aligner.Score("tttt", {"ttAtt"}), ElementsAre(12));
+}
+
+TEST_P(BatchSmithWatermanTest, EmptySequencesScoreZero) {
+  BatchSmithWaterman aligner(4, 6, 8, 1, GetParam());
+  EXPECT_THAT(aligner.Score("", {"ACGT", ""}), ElementsAre(0, 0));
+  EXPECT_THAT(aligner.Score("ACGT", {"", "ACGT", ""}), ElementsAre(0, 16, 0));
+  EXPECT_TRUE(aligner.Score("ACGT", {}).empty());
+}
+
+TEST_P(BatchSmithWatermanTest, OtherBasesScoreZero) {
+  BatchSmithWaterman aligner(4, 6, 8, 1, GetParam());
+  EXPECT_THAT(aligner.Score("ACNGT", {"ACGGT", "acngt", "NNNNN"}),
+              ElementsAre(16, 16, 0));
+}
+
+TEST_P(BatchSmithWatermanTest, MatchesReferenceOnRandomReads) {
+  std::mt19937 rng(2024);
+  for (int trial = 0; trial < 10; ++trial) {
+    const std::string haplotype = RandomSequence(&rng, 50 + rng() % 300);
+    std::vector<std::string> reads;
+    // Enough reads for several full and partial groups, from very short to
+    // long enough to overflow 8-bit and 16-bit lanes.
+    const int num_reads = 1 + rng() % 80;
+    for (int r = 0; r < num_reads; ++r) {
+      const int start = rng() % haplotype.size();
+      const int length = rng() % 160;
+      std::string read = haplotype.substr(start, length);
+      read = Mutate(&rng, read, rng() % 6);
+      if (rng() % 10 == 0) read = RandomSequence(&rng, rng() % 150);
+      reads.push_back(read);
+    }
+    const std::vector<absl::string_view> queries(reads.begin(), reads.end());
+    for (int match : {1, 4, 255}) {
+      BatchSmithWaterman aligner(match, 6, 8, 1, GetParam());
+      const std::vector<int> scores = aligner.Score(haplotype, queries);
+      ASSERT_EQ(scores.size(), reads.size());
+      for (int r = 0; r < reads.size(); ++r) {
+        ASSERT_EQ(scores[r], ReferenceScore(haplotype, reads[r], match, 6, 8, 1))
+            << "read=" << reads[r] << " haplotype=" << haplotype;
+      }
+    }
+  }
+}
+
+TEST_P(BatchSmithWatermanTest, ScoresBeyond16Bits) {
+  std::mt19937 rng(7);
+  const std::string haplotype = RandomSequence(&rng, 400);
+  const std::string read = haplotype.substr(50, 300);
+  BatchSmithWaterman aligner(255, 6, 8, 1, GetParam());
+  const int expected = ReferenceScore(haplotype, read, 255, 6, 8, 1);
+  EXPECT_GT(expected, 65535);
+  EXPECT_THAT(aligner.Score(haplotype, {read, "ACGT"}),
+              ElementsAre(expected, ReferenceScore(haplotype, "ACGT", 255, 6,
+                                                   8, 1)));
+}
+
+INSTANTIATE_TEST_SUITE_P(AllSimdLevels, BatchSmithWatermanTest,
+                         ::testing::ValuesIn(SupportedSimdLevels()),
+                         [](const ::testing::TestParamInfo<SimdLevel>& info) {
+                           return SimdLevelName(info.param);
+                         });
+
+}  // namespace
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
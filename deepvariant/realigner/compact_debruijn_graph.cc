@@ -0,0 +1,663 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/compact_debruijn_graph.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "deepvariant/protos/realigner.pb.h"
+#include "deepvariant/realigner/debruijn_graph.h"
+#include "absl/log/check.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+#include "third_party/nucleus/util/proto_ptr.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using Read = nucleus::genomics::v1::Read;
+
+using absl::string_view;
+
+namespace {
+
+// Code for bases other than A, C, G and T.
+constexpr uint8_t kNotACGT = 4;
+
+uint8_t BaseCode(char base) {
+  switch (base) {
+    case 'A':
+      return 0;
+    case 'C':
+      return 1;
+    case 'G':
+      return 2;
+    case 'T':
+      return 3;
+    default:
+      return kNotACGT;
+  }
+}
+
+// A k-mer of up to 32 * W bases, two bits per base, stored little-endian
+// across the words so that the last base occupies the lowest two bits.
+template <int W>
+struct PackedKmer {
+  uint64_t words[W];
+
+  bool operator==(const PackedKmer& other) const {
+    for (int i = 0; i < W; ++i) {
+      if (words[i] != other.words[i]) return false;
+    }
+    return true;
+  }
+
+  // Appends a base code, dropping bits above top_mask in the highest word.
+  void Append(uint8_t code, uint64_t top_mask) {
+    for (int i = W - 1; i > 0; --i) {
+      words[i] = (words[i] << 2) | (words[i - 1] >> 62);
+    }
+    words[0] = (words[0] << 2) | code;
+    words[W - 1] &= top_mask;
+  }
+
+  uint64_t Hash() const {
+    uint64_t h = words[0];
+    for (int i = 1; i < W; ++i) {
+      h = (h ^ (h >> 29)) * 0xbf58476d1ce4e5b9ULL + words[i];
+    }
+    return (h ^ (h >> 32)) * 0x9e3779b97f4a7c15ULL;
+  }
+};
+
+int WordsForK(int k) { return (k + 31) / 32; }
+
+}  // namespace
+
+// All sequences share one buffer: the reference occupies [0, ref_size) and
+// each read kept by the mapping quality filter follows it.
+struct CompactDeBruijnGraph::EncodedWindow {
+  struct Segment {
+    int32_t start;
+    int32_t length;
+  };
+
+  EncodedWindow(
+      const std::string& ref,
+      const std::vector<nucleus::ConstProtoPtr<const Read>>& reads,
+      const Options& options);
+
+  // Uppercased bases.
+  std::string bases;
+  // 2-bit code of each base, or kNotACGT.
+  std::vector<uint8_t> codes;
+  // For each position, the end of the run of A/C/G/T bases containing it
+  // (the position itself if it is not one of them).
+  std::vector<int32_t> acgt_run_ends;
+  // For each read position, the next position at or after it that is not
+  // usable in a k-mer because of its base or its quality.
+  std::vector<int32_t> next_bad_positions;
+  Segment reference;
+  std::vector<Segment> reads;
+};
+
+CompactDeBruijnGraph::EncodedWindow::EncodedWindow(
+    const std::string& ref,
+    const std::vector<nucleus::ConstProtoPtr<const Read>>& reads_in,
+    const Options& options) {
+  size_t total_size = ref.size();
+  for (const nucleus::ConstProtoPtr<const Read>& read_ptr : reads_in) {
+    const Read& read = *read_ptr.p_;
+    if (read.alignment().mapping_quality() >= options.min_mapq()) {
+      total_size += read.aligned_sequence().size();
+    }
+  }
+  bases.reserve(total_size);
+  codes.resize(total_size);
+  acgt_run_ends.resize(total_size);
+  next_bad_positions.resize(total_size);
+
+  bases.append(ref);
+  reference = {0, static_cast<int32_t>(ref.size())};
+  for (const nucleus::ConstProtoPtr<const Read>& read_ptr : reads_in) {
+    const Read& read = *read_ptr.p_;
+    if (read.alignment().mapping_quality() < options.min_mapq()) continue;
+    const int32_t start = bases.size();
+    const int32_t length = read.aligned_sequence().size();
+    bases.append(read.aligned_sequence());
+    for (int32_t i = 0; i < length; ++i) {
+      bases[start + i] = absl::ascii_toupper(bases[start + i]);
+    }
+    reads.push_back({start, length});
+
+    int32_t next_bad = start + length;
+    for (int32_t i = length - 1; i >= 0; --i) {
+      if (BaseCode(bases[start + i]) == kNotACGT ||
+          read.aligned_quality(i) < options.min_base_quality()) {
+        next_bad = start + i;
+      }
+      next_bad_positions[start + i] = next_bad;
+    }
+  }
+
+  auto encode = [this](const Segment& segment) {
+    int32_t run_end = segment.start + segment.length;
+    for (int32_t i = segment.start + segment.length - 1; i >= segment.start;
+         --i) {
+      codes[i] = BaseCode(bases[i]);
+      if (codes[i] == kNotACGT) run_end = i;
+      acgt_run_ends[i] = run_end;
+    }
+  };
+  encode(reference);
+  for (const Segment& segment : reads) encode(segment);
+}
+
+// Mirrors the DeBruijnGraph constructor, HasCycle() and Prune() for a single
+// k.  Buffers are kept between calls so that successive k values reuse them.
+template <int W>
+class CompactDeBruijnGraph::Builder {
+ public:
+  explicit Builder(const EncodedWindow& window)
+      : window_(window), kmers_(window.bases.size()) {
+    size_t capacity = 16;
+    while (capacity < 2 * window.bases.size()) capacity *= 2;
+    table_.resize(capacity);
+    table_shift_ = 64;
+    for (size_t c = capacity; c > 1; c /= 2) --table_shift_;
+  }
+
+  // Returns the pruned graph for k, or nullptr if the reference repeats a
+  // k-mer or the unpruned graph is cyclic.
+  std::unique_ptr<CompactDeBruijnGraph> Build(int k, const Options& options);
+
+ private:
+  using Segment = EncodedWindow::Segment;
+
+  static constexpr int32_t kNone = -1;
+
+  // Computes the packed k-mer starting at every position of segment that is
+  // followed by at least k - 1 more A/C/G/T bases.
+  void PackKmers(const Segment& segment);
+
+  // Returns the vertex for the k-mer starting at position, adding it if
+  // needed.
+  int32_t EnsureVertex(int32_t position);
+
+  // Adds or reweights the edge between the k-mers starting at position - 1
+  // and position, whose vertices are from and to.
+  void AddEdge(int32_t from, int32_t to, int32_t position, bool is_ref);
+
+  // Adds the k-mers starting in [start, end] and the edges between them, with
+  // the quirks of DeBruijnGraph::AddKmersAndEdges.
+  void AddKmersAndEdges(int32_t start, int32_t end, bool is_ref);
+
+  // Returns false if the reference contains a repeated k-mer.
+  bool AddReference();
+
+  void AddRead(const Segment& read);
+
+  bool HasCycle() const;
+
+  std::unique_ptr<CompactDeBruijnGraph> Prune(const Options& options) const;
+
+  const EncodedWindow& window_;
+  int k_ = 0;
+  uint64_t top_mask_ = 0;
+
+  std::vector<PackedKmer<W>> kmers_;
+  // Open-addressing table of vertex ids, probed linearly.
+  std::vector<int32_t> table_;
+  int table_shift_;
+
+  // Per-vertex data.
+  std::vector<PackedKmer<W>> vertex_kmers_;
+  std::vector<int32_t> vertex_positions_;
+  // Edge ids indexed by 4 * vertex + code of the base appended (outgoing) or
+  // dropped (incoming) along the edge.
+  std::vector<int32_t> out_edges_;
+  std::vector<int32_t> in_edges_;
+
+  std::vector<Edge> edges_;
+};
+
+template <int W>
+void CompactDeBruijnGraph::Builder<W>::PackKmers(const Segment& segment) {
+  PackedKmer<W> kmer = {};
+  int run = 0;
+  const int32_t end = segment.start + segment.length;
+  for (int32_t i = segment.start; i < end; ++i) {
+    const uint8_t code = window_.codes[i];
+    if (code == kNotACGT) {
+      run = 0;
+      continue;
+    }
+    kmer.Append(code, top_mask_);
+    if (++run >= k_) kmers_[i - k_ + 1] = kmer;
+  }
+}
+
+template <int W>
+int32_t CompactDeBruijnGraph::Builder<W>::EnsureVertex(int32_t position) {
+  const PackedKmer<W>& kmer = kmers_[position];
+  const size_t mask = table_.size() - 1;
+  for (size_t slot = kmer.Hash() >> table_shift_;; slot = (slot + 1) & mask) {
+    const int32_t v = table_[slot];
+    if (v == kNone) {
+      const int32_t added = vertex_kmers_.size();
+      table_[slot] = added;
+      vertex_kmers_.push_back(kmer);
+      vertex_positions_.push_back(position);
+      out_edges_.insert(out_edges_.end(), 4, kNone);
+      in_edges_.insert(in_edges_.end(), 4, kNone);
+      return added;
+    }
+    if (vertex_kmers_[v] == kmer) return v;
+  }
+}
+
+template <int W>
+void CompactDeBruijnGraph::Builder<W>::AddEdge(int32_t from, int32_t to,
+                                                int32_t position,
+                                                bool is_ref) {
+  int32_t& out_edge = out_edges_[4 * from + window_.codes[position + k_ - 1]];
+  if (out_edge == kNone) {
+    out_edge = edges_.size();
+    in_edges_[4 * to + window_.codes[position - 1]] = out_edge;
+    edges_.push_back({from, to, 0, false});
+  }
+  Edge& edge = edges_[out_edge];
+  edge.weight++;
+  edge.is_ref |= is_ref;
+}
+
+template <int W>
+void CompactDeBruijnGraph::Builder<W>::AddKmersAndEdges(int32_t start,
+                                                         int32_t end,
+                                                         bool is_ref) {
+  int32_t vertex_prev = EnsureVertex(start);
+  for (int32_t i = start + 1; i <= end; ++i) {
+    const int32_t vertex_cur = EnsureVertex(i);
+    AddEdge(vertex_prev, vertex_cur, i, is_ref);
+    vertex_prev = vertex_cur;
+  }
+}
+
+template <int W>
+bool CompactDeBruijnGraph::Builder<W>::AddReference() {
+  const Segment& ref = window_.reference;
+  PackKmers(ref);
+  // The reference is added first, so its k-mers are all distinct exactly when
+  // each one creates a vertex numbered by its position.
+  const int32_t last = ref.length - k_;
+  int32_t vertex_prev = EnsureVertex(0);
+  for (int32_t i = 1; i <= last; ++i) {
+    const int32_t vertex_cur = EnsureVertex(i);
+    if (vertex_cur != i) return false;
+    AddEdge(vertex_prev, vertex_cur, i, true /* is_ref */);
+    vertex_prev = vertex_cur;
+  }
+  return true;
+}
+
+template <int W>
+void CompactDeBruijnGraph::Builder<W>::AddRead(const Segment& read) {
+  PackKmers(read);
+  // Same walk as DeBruijnGraph::AddEdgesForRead, in segment-relative offsets.
+  const int32_t stop = read.length - k_;
+  int32_t i = 0;
+  while (i < stop) {
+    const int32_t next_bad_position =
+        window_.next_bad_positions[read.start + i] - read.start;
+    const int32_t end = next_bad_position - k_;
+    if (end > 0) {
+      if (end >= i) {
+        AddKmersAndEdges(read.start + i, read.start + end, false /* is_ref */);
+      } else if (window_.acgt_run_ends[read.start + i] - read.start - i >=
+                 k_) {
+        // DeBruijnGraph still adds the k-mer at i, which overlaps the bad
+        // position, as an isolated vertex.  Pruning drops it, but it fixes
+        // the vertex order if a later read contains the same k-mer.  K-mers
+        // with other bases can never match a later one, so they are skipped.
+        EnsureVertex(read.start + i);
+      }
+    }
+    i = next_bad_position + 1;
+  }
+}
+
+template <int W>
+bool CompactDeBruijnGraph::Builder<W>::HasCycle() const {
+  // Kahn's algorithm: the graph is acyclic iff every vertex gets removed.
+  const int32_t num_vertices = vertex_kmers_.size();
+  std::vector<int32_t> in_degree(num_vertices, 0);
+  for (const Edge& edge : edges_) in_degree[edge.to]++;
+  std::vector<int32_t> ready;
+  for (int32_t v = 0; v < num_vertices; ++v) {
+    if (in_degree[v] == 0) ready.push_back(v);
+  }
+  int32_t removed = 0;
+  while (!ready.empty()) {
+    const int32_t v = ready.back();
+    ready.pop_back();
+    ++removed;
+    for (int slot = 0; slot < 4; ++slot) {
+      const int32_t e = out_edges_[4 * v + slot];
+      if (e != kNone && --in_degree[edges_[e].to] == 0) {
+        ready.push_back(edges_[e].to);
+      }
+    }
+  }
+  return removed != num_vertices;
+}
+
+template <int W>
+std::unique_ptr<CompactDeBruijnGraph> CompactDeBruijnGraph::Builder<W>::Prune(
+    const Options& options) const {
+  const int32_t num_vertices = vertex_kmers_.size();
+  std::vector<bool> kept_edges(edges_.size());
+  for (size_t e = 0; e < edges_.size(); ++e) {
+    kept_edges[e] =
+        edges_[e].is_ref || edges_[e].weight >= options.min_edge_weight();
+  }
+
+  // Marks vertices reachable from start along kept edges, following
+  // edges forward or backward.
+  auto reachable = [&](int32_t start, bool forward) {
+    const std::vector<int32_t>& adjacent = forward ? out_edges_ : in_edges_;
+    std::vector<bool> seen(num_vertices, false);
+    std::vector<int32_t> stack = {start};
+    seen[start] = true;
+    while (!stack.empty()) {
+      const int32_t v = stack.back();
+      stack.pop_back();
+      for (int slot = 0; slot < 4; ++slot) {
+        const int32_t e = adjacent[4 * v + slot];
+        if (e == kNone || !kept_edges[e]) continue;
+        const int32_t w = forward ? edges_[e].to : edges_[e].from;
+        if (!seen[w]) {
+          seen[w] = true;
+          stack.push_back(w);
+        }
+      }
+    }
+    return seen;
+  };
+  const int32_t source = 0;
+  const int32_t sink = window_.reference.length - k_;
+  const std::vector<bool> from_source = reachable(source, true);
+  const std::vector<bool> to_sink = reachable(sink, false);
+
+  auto graph = std::unique_ptr<CompactDeBruijnGraph>(
+      new CompactDeBruijnGraph(options, k_));
+  std::vector<int32_t> new_ids(num_vertices, kNone);
+  for (int32_t v = 0; v < num_vertices; ++v) {
+    if (from_source[v] && to_sink[v]) {
+      new_ids[v] = graph->kmer_offsets_.size();
+      graph->kmer_offsets_.push_back(vertex_positions_[v]);
+    }
+  }
+  graph->source_ = new_ids[source];
+  graph->sink_ = new_ids[sink];
+
+  const int32_t num_kept = graph->kmer_offsets_.size();
+  graph->successor_starts_.assign(num_kept + 1, 0);
+  for (size_t e = 0; e < edges_.size(); ++e) {
+    const int32_t from = new_ids[edges_[e].from];
+    const int32_t to = new_ids[edges_[e].to];
+    if (kept_edges[e] && from != kNone && to != kNone) {
+      graph->edges_.push_back({from, to, edges_[e].weight, edges_[e].is_ref});
+      graph->successor_starts_[from + 1]++;
+    }
+  }
+  for (int32_t v = 0; v < num_kept; ++v) {
+    graph->successor_starts_[v + 1] += graph->successor_starts_[v];
+  }
+  graph->successors_.resize(graph->edges_.size());
+  std::vector<int32_t> fill(graph->successor_starts_.begin(),
+                            graph->successor_starts_.end() - 1);
+  for (const Edge& edge : graph->edges_) {
+    graph->successors_[fill[edge.from]++] = edge.to;
+  }
+  for (int32_t v = 0; v < num_kept; ++v) {
+    std::sort(graph->successors_.begin() + graph->successor_starts_[v],
+              graph->successors_.begin() + graph->successor_starts_[v + 1]);
+  }
+  return graph;
+}
+
+template <int W>
+std::unique_ptr<CompactDeBruijnGraph> CompactDeBruijnGraph::Builder<W>::Build(
+    int k, const Options& options) {
+  CHECK_GT(k, 0);
+  CHECK_LE(k, 32 * W);
+  CHECK_LT(k, window_.reference.length);
+  k_ = k;
+  const int top_bits = 2 * k - 64 * (W - 1);
+  top_mask_ = top_bits == 64 ? ~uint64_t{0} : (uint64_t{1} << top_bits) - 1;
+  std::fill(table_.begin(), table_.end(), kNone);
+  vertex_kmers_.clear();
+  vertex_positions_.clear();
+  out_edges_.clear();
+  in_edges_.clear();
+  edges_.clear();
+
+  if (!AddReference()) return nullptr;
+  for (const Segment& read : window_.reads) AddRead(read);
+  if (HasCycle()) return nullptr;
+  return Prune(options);
+}
+
+CompactDeBruijnGraph::CompactDeBruijnGraph(const Options& options, int k)
+    : options_(options), k_(k) {}
+
+std::unique_ptr<CompactDeBruijnGraph> CompactDeBruijnGraph::FromFallback(
+    std::unique_ptr<DeBruijnGraph> graph, const Options& options) {
+  if (graph == nullptr) return nullptr;
+  auto compact = std::unique_ptr<CompactDeBruijnGraph>(
+      new CompactDeBruijnGraph(options, graph->KmerSize()));
+  compact->fallback_ = std::move(graph);
+  return compact;
+}
+
+std::unique_ptr<CompactDeBruijnGraph> CompactDeBruijnGraph::Build(
+    const std::string& ref,
+    const std::vector<nucleus::ConstProtoPtr<const Read>>& reads,
+    const Options& options) {
+  for (char base : ref) {
+    if (BaseCode(base) == kNotACGT) {
+      return FromFallback(DeBruijnGraph::Build(ref, reads, options), options);
+    }
+  }
+
+  // DeBruijnGraph::Build returns the graph of the first k, among min_k,
+  // min_k + step_k, ..., that neither repeats a reference k-mer nor has a
+  // cycle.  Both failures carry over to every smaller k: a repeated
+  // (k + 1)-mer contains a repeated k-mer, and each vertex of a cycle of the
+  // (k + 1)-mer graph is an edge of the k-mer graph (a (k + 1)-mer of a read
+  // run or of the reference), consecutive vertices being consecutive edges,
+  // so the cycle maps to a closed walk of the k-mer graph.  The k values that
+  // fail therefore form a prefix of the sequence, and the first one that
+  // works is found by galloping over the sequence and then bisecting, which
+  // builds O(log n) graphs instead of up to n in long repeats.  The window is
+  // encoded once and the builders keep their buffers across all the k tried.
+  CHECK_GT(options.step_k(), 0);
+  const int max_k = std::min(options.max_k(), static_cast<int>(ref.size()) - 1);
+  const int max_packed_k = std::min(max_k, kMaxPackedK);
+  const int num_packed_k =
+      max_packed_k < options.min_k()
+          ? 0
+          : (max_packed_k - options.min_k()) / options.step_k() + 1;
+  std::unique_ptr<EncodedWindow> window;
+  std::unique_ptr<Builder<1>> builder1;
+  std::unique_ptr<Builder<2>> builder2;
+  std::unique_ptr<Builder<3>> builder3;
+  std::unique_ptr<Builder<4>> builder4;
+  // Builds the graph of the i-th k value, or returns nullptr if it fails.
+  auto build = [&](int i) -> std::unique_ptr<CompactDeBruijnGraph> {
+    const int k = options.min_k() + i * options.step_k();
+    if (window == nullptr) {
+      window = std::make_unique<EncodedWindow>(ref, reads, options);
+    }
+    switch (WordsForK(k)) {
+      case 1:
+        if (!builder1) builder1 = std::make_unique<Builder<1>>(*window);
+        return builder1->Build(k, options);
+      case 2:
+        if (!builder2) builder2 = std::make_unique<Builder<2>>(*window);
+        return builder2->Build(k, options);
+      case 3:
+        if (!builder3) builder3 = std::make_unique<Builder<3>>(*window);
+        return builder3->Build(k, options);
+      default:
+        if (!builder4) builder4 = std::make_unique<Builder<4>>(*window);
+        return builder4->Build(k, options);
+    }
+  };
+
+  // The k values before index failed fail, the one at index works.
+  std::unique_ptr<CompactDeBruijnGraph> graph;
+  int failed = -1;
+  int works = num_packed_k;
+  for (int stride = 1; failed + 1 < num_packed_k; stride *= 2) {
+    const int i = std::min(failed + stride, num_packed_k - 1);
+    graph = build(i);
+    if (graph != nullptr) {
+      works = i;
+      break;
+    }
+    failed = i;
+  }
+  while (works - failed > 1) {
+    const int i = failed + (works - failed) / 2;
+    std::unique_ptr<CompactDeBruijnGraph> candidate = build(i);
+    if (candidate != nullptr) {
+      graph = std::move(candidate);
+      works = i;
+    } else {
+      failed = i;
+    }
+  }
+  if (graph != nullptr) {
+    graph->bases_ = std::move(window->bases);
+    return graph;
+  }
+
+  const int next_k = options.min_k() + num_packed_k * options.step_k();
+  if (next_k <= max_k) {
+    Options remaining = options;
+    remaining.set_min_k(next_k);
+    return FromFallback(DeBruijnGraph::Build(ref, reads, remaining), options);
+  }
+  return nullptr;
+}
+
+std::vector<std::string> CompactDeBruijnGraph::CandidateHaplotypes() const {
+  if (fallback_ != nullptr) return fallback_->CandidateHaplotypes();
+
+  // Breadth-first path enumeration as in DeBruijnGraph::CandidatePaths, with
+  // paths stored as parent links rather than copied vertex lists.
+  struct PathNode {
+    int32_t vertex;
+    int32_t parent;
+  };
+  std::vector<PathNode> nodes = {{source_, -1}};
+  std::vector<int32_t> terminated;
+  size_t next_extendable = 0;
+  std::vector<int32_t> extendable = {0};
+
+  CHECK_GT(successor_starts_[source_ + 1] - successor_starts_[source_], 0);
+  while (next_extendable < extendable.size()) {
+    const int n_total_paths =
+        terminated.size() + extendable.size() - next_extendable;
+    if (n_total_paths > options_.max_num_paths()) {
+      return {};
+    }
+
+    const int32_t path = extendable[next_extendable++];
+    const int32_t last_v = nodes[path].vertex;
+    for (int32_t i = successor_starts_[last_v];
+         i < successor_starts_[last_v + 1]; ++i) {
+      const int32_t v = successors_[i];
+      const int32_t extended = nodes.size();
+      nodes.push_back({v, path});
+      if (v == sink_ || successor_starts_[v] == successor_starts_[v + 1]) {
+        terminated.push_back(extended);
+      } else {
+        extendable.push_back(extended);
+      }
+    }
+  }
+
+  std::vector<std::string> haplotypes;
+  haplotypes.reserve(terminated.size());
+  for (int32_t path : terminated) {
+    // Each vertex contributes its first base, and the last one the rest of
+    // its k-mer.
+    std::string haplotype;
+    absl::string_view last_kmer = Kmer(nodes[path].vertex);
+    for (int32_t n = path; n != -1; n = nodes[n].parent) {
+      haplotype.push_back(bases_[kmer_offsets_[nodes[n].vertex]]);
+    }
+    std::reverse(haplotype.begin(), haplotype.end());
+    absl::StrAppend(&haplotype, last_kmer.substr(1));
+    haplotypes.push_back(std::move(haplotype));
+  }
+  std::sort(haplotypes.begin(), haplotypes.end());
+  return haplotypes;
+}
+
+std::string CompactDeBruijnGraph::GraphViz() const {
+  if (fallback_ != nullptr) return fallback_->GraphViz();
+
+  std::string graphviz = "digraph G {\n";
+  for (int32_t v = 0; v < kmer_offsets_.size(); ++v) {
+    absl::StrAppend(&graphviz, v, "[label=", Kmer(v), "];\n");
+  }
+  for (const Edge& edge : edges_) {
+    absl::StrAppend(&graphviz, edge.from, "->", edge.to, " [label=",
+                    edge.weight, edge.is_ref ? " color=red" : "", "];\n");
+  }
+  absl::StrAppend(&graphviz, "}\n");
+  return graphviz;
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_COMPACT_DEBRUIJN_GRAPH_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_COMPACT_DEBRUIJN_GRAPH_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "deepvariant/protos/realigner.pb.h"
+#include "deepvariant/realigner/debruijn_graph.h"
+#include "absl/strings/string_view.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+#include "third_party/nucleus/util/proto_ptr.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+// A DeBruijn graph over 2-bit packed k-mers.
+//
+// This is a drop-in replacement for DeBruijnGraph: Build() picks the same k,
+// applies the same read filters, pruning and path enumeration, and
+// CandidateHaplotypes() returns exactly what DeBruijnGraph returns for the
+// same inputs.  Instead of a boost graph keyed by k-mer strings, the window
+// reference and the usable reads are uppercased and encoded once into a single
+// 2-bit code buffer; every k tried rolls its k-mers out of that buffer as
+// 64-bit words, interns them in an open-addressing table, and links vertices
+// through fixed four-slot adjacency (a k-mer has at most one successor per
+// appended base).  The pruned graph is kept in CSR form.
+//
+// Since a k that fails also fails for every smaller k, Build() searches for
+// the smallest k that works instead of trying the k values in order.
+//
+// References containing anything other than A, C, G or T, and k values larger
+// than kMaxPackedK, are delegated to DeBruijnGraph.
+class CompactDeBruijnGraph {
+ public:
+  using Options = DeBruijnGraphOptions;
+
+  // Largest k handled by the packed representation.
+  static constexpr int kMaxPackedK = 128;
+
+  // Same contract as DeBruijnGraph::Build(): returns the pruned graph for the
+  // first k in [options.min_k, options.max_k] (stepping by options.step_k)
+  // whose graph is acyclic, or nullptr if there is no such k.
+  static std::unique_ptr<CompactDeBruijnGraph> Build(
+      const std::string& ref,
+      const std::vector<
+          nucleus::ConstProtoPtr<const nucleus::genomics::v1::Read>>& reads,
+      const Options& options);
+
+  // Gets all the candidate haplotypes defined by paths through the graph.  If
+  // more than options.max_num_paths() haplotypes are identified, returns an
+  // empty vector, to preempt excessive computation.
+  std::vector<std::string> CandidateHaplotypes() const;
+
+  // Gets a GraphViz representation of the graph, formatted exactly as
+  // DeBruijnGraph::GraphViz().
+  std::string GraphViz() const;
+
+  // Gets the kmer size used in this graph.
+  int KmerSize() const { return k_; }
+
+ private:
+  // The window's reference and reads, encoded once for every k tried.
+  struct EncodedWindow;
+
+  // Builds the graph for one k with k-mers packed into W 64-bit words.
+  template <int W>
+  class Builder;
+
+  struct Edge {
+    int32_t from;
+    int32_t to;
+    int weight;
+    bool is_ref;
+  };
+
+  CompactDeBruijnGraph(const Options& options, int k);
+
+  // Wraps a graph built by DeBruijnGraph, or returns nullptr if there is none.
+  static std::unique_ptr<CompactDeBruijnGraph> FromFallback(
+      std::unique_ptr<DeBruijnGraph> graph, const Options& options);
+
+  // Returns the k-mer labelling vertex v.
+  absl::string_view Kmer(int32_t v) const {
+    return absl::string_view(bases_).substr(kmer_offsets_[v], k_);
+  }
+
+  Options options_;
+  int k_;
+
+  // Set when the graph was built by DeBruijnGraph, in which case every other
+  // member is unused.
+  std::unique_ptr<DeBruijnGraph> fallback_;
+
+  // Uppercased reference and read bases; vertex labels point into it.
+  std::string bases_;
+  // Offset into bases_ of each vertex's k-mer, in vertex creation order.
+  std::vector<int32_t> kmer_offsets_;
+  // Edges in creation order.
+  std::vector<Edge> edges_;
+  // Successors of vertex v are successors_[successor_starts_[v] ..
+  // successor_starts_[v + 1]), in increasing vertex order.
+  std::vector<int32_t> successor_starts_;
+  std::vector<int32_t> successors_;
+  int32_t source_ = 0;
+  int32_t sink_ = 0;
+};
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_COMPACT_DEBRUIJN_GRAPH_H_
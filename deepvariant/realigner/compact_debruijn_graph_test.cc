@@ -0,0 +1,290 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/compact_debruijn_graph.h"
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "deepvariant/protos/realigner.pb.h"
+#include "deepvariant/realigner/debruijn_graph.h"
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+#include "third_party/nucleus/testing/test_utils.h"
+#include "third_party/nucleus/util/proto_ptr.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using nucleus::genomics::v1::Read;
+using ::testing::ElementsAre;
+
+using ReadPtrs = std::vector<nucleus::ConstProtoPtr<const Read>>;
+
+DeBruijnGraphOptions TestOptions(int min_k, int max_k, int step_k) {
+  DeBruijnGraphOptions options;
+  options.set_min_k(min_k);
+  options.set_max_k(max_k);
+  options.set_step_k(step_k);
+  options.set_min_mapq(20);
+  options.set_min_base_quality(20);
+  options.set_min_edge_weight(2);
+  options.set_max_num_paths(256);
+  return options;
+}
+
+Read TestRead(const std::string& bases) {
+  return nucleus::MakeRead("chr20", 1, bases,
+                           {absl::StrCat(bases.size(), "M")});
+}
+
+ReadPtrs Pointers(const std::vector<Read>& reads) {
+  ReadPtrs pointers;
+  for (const Read& read : reads) pointers.push_back(&read);
+  return pointers;
+}
+
+// Checks that both graph implementations agree on ref and reads.
+void ExpectSameAsDeBruijnGraph(const std::string& ref,
+                               const std::vector<Read>& reads,
+                               const DeBruijnGraphOptions& options) {
+  SCOPED_TRACE(absl::StrCat("ref=", ref));
+  std::unique_ptr<DeBruijnGraph> expected =
+      DeBruijnGraph::Build(ref, Pointers(reads), options);
+  std::unique_ptr<CompactDeBruijnGraph> actual =
+      CompactDeBruijnGraph::Build(ref, Pointers(reads), options);
+  ASSERT_EQ(expected == nullptr, actual == nullptr);
+  if (expected == nullptr) return;
+  EXPECT_EQ(expected->KmerSize(), actual->KmerSize());
+  EXPECT_EQ(expected->GraphViz(), actual->GraphViz());
+  EXPECT_EQ(expected->CandidateHaplotypes(), actual->CandidateHaplotypes());
+}
+
+TEST(CompactDeBruijnGraphTest, Basics) {
+  const std::vector<Read> reads = {TestRead("GATGACA"), TestRead("GATGACA")};
+  std::unique_ptr<CompactDeBruijnGraph> graph = CompactDeBruijnGraph::Build(
+      "GATTACA", Pointers(reads), TestOptions(3, 3, 1));
+  ASSERT_NE(graph, nullptr);
+  EXPECT_EQ(3, graph->KmerSize());
+  EXPECT_THAT(graph->CandidateHaplotypes(), ElementsAre("GATGACA", "GATTACA"));
+  EXPECT_EQ(
+      "digraph G {\n"
+      "0[label=GAT];\n"
+      "1[label=ATT];\n"
+      "2[label=TTA];\n"
+      "3[label=TAC];\n"
+      "4[label=ACA];\n"
+      "5[label=ATG];\n"
+      "6[label=TGA];\n"
+      "7[label=GAC];\n"
+      "0->1 [label=1 color=red];\n"
+      "1->2 [label=1 color=red];\n"
+      "2->3 [label=1 color=red];\n"
+      "3->4 [label=1 color=red];\n"
+      "0->5 [label=2];\n"
+      "5->6 [label=2];\n"
+      "6->7 [label=2];\n"
+      "7->4 [label=2];\n"
+      "}\n",
+      graph->GraphViz());
+}
+
+TEST(CompactDeBruijnGraphTest, PrunesSingleReadPath) {
+  const std::vector<Read> reads = {TestRead("GATGACA")};
+  std::unique_ptr<CompactDeBruijnGraph> graph = CompactDeBruijnGraph::Build(
+      "GATTACA", Pointers(reads), TestOptions(3, 3, 1));
+  ASSERT_NE(graph, nullptr);
+  EXPECT_THAT(graph->CandidateHaplotypes(), ElementsAre("GATTACA"));
+}
+
+TEST(CompactDeBruijnGraphTest, RejectsKNotBelowRefLength) {
+  EXPECT_EQ(nullptr,
+            CompactDeBruijnGraph::Build("GATTACA", {}, TestOptions(7, 7, 1)));
+  EXPECT_EQ(nullptr,
+            CompactDeBruijnGraph::Build("GATTACA", {}, TestOptions(8, 8, 1)));
+}
+
+TEST(CompactDeBruijnGraphTest, SkipsKWithRepeatedReferenceKmers) {
+  for (int k = 1; k < 13; ++k) {
+    std::unique_ptr<CompactDeBruijnGraph> graph =
+        CompactDeBruijnGraph::Build("ACGTAAACGTAAA", {}, TestOptions(k, k, 1));
+    EXPECT_EQ(k >= 8, graph != nullptr) << "k=" << k;
+  }
+}
+
+TEST(CompactDeBruijnGraphTest, MatchesDeBruijnGraphWithBadBases) {
+  for (int bad_position = 0; bad_position < 7; ++bad_position) {
+    for (bool bad_quality : {false, true}) {
+      Read read = TestRead("GATTACA");
+      if (bad_quality) {
+        read.set_aligned_quality(bad_position, 1);
+      } else {
+        read.mutable_aligned_sequence()->at(bad_position) = 'N';
+      }
+      ExpectSameAsDeBruijnGraph("GATTACA", {read, read, read},
+                                TestOptions(2, 2, 1));
+    }
+  }
+}
+
+TEST(CompactDeBruijnGraphTest, MatchesDeBruijnGraphOnNonACGTReference) {
+  const std::vector<Read> reads = {TestRead("GATGACANNTTAC"),
+                                   TestRead("GATGACANNTTAC")};
+  ExpectSameAsDeBruijnGraph("GATTACANNTTAC", reads, TestOptions(3, 10, 1));
+}
+
+// Generates low-complexity windows with reads from two haplotypes, sprinkled
+// with low qualities, N's, lowercase bases and low mapping qualities.
+class RandomWindows {
+ public:
+  explicit RandomWindows(int seed) : rng_(seed) {}
+
+  std::string Sequence(int length, int period) {
+    std::string unit;
+    for (int i = 0; i < period; ++i) unit.push_back(Base());
+    std::string sequence;
+    while (sequence.size() < length) {
+      sequence.push_back(Uniform(10) == 0 ? Base()
+                                          : unit[sequence.size() % period]);
+    }
+    return sequence;
+  }
+
+  std::string Mutate(const std::string& sequence) {
+    std::string mutated = sequence;
+    for (int i = 0; i < 3; ++i) {
+      const int position = Uniform(mutated.size() - 1);
+      switch (Uniform(3)) {
+        case 0:
+          mutated[position] = Base();
+          break;
+        case 1:
+          mutated.erase(position, 1 + Uniform(3));
+          break;
+        default:
+          mutated.insert(position, Sequence(1 + Uniform(4), 1 + Uniform(2)));
+      }
+    }
+    return mutated;
+  }
+
+  std::vector<Read> Reads(const std::vector<std::string>& haplotypes,
+                          int count) {
+    std::vector<Read> reads;
+    for (int i = 0; i < count; ++i) {
+      const std::string& haplotype = haplotypes[Uniform(haplotypes.size())];
+      const int start = Uniform(haplotype.size() / 2);
+      std::string bases =
+          haplotype.substr(start, 5 + Uniform(haplotype.size() - start));
+      for (char& base : bases) {
+        if (Uniform(200) == 0) base = 'N';
+        if (Uniform(100) == 0) base = base - 'A' + 'a';
+      }
+      Read read = TestRead(bases);
+      for (int j = 0; j < read.aligned_quality_size(); ++j) {
+        if (Uniform(50) == 0) read.set_aligned_quality(j, 5);
+      }
+      read.mutable_alignment()->set_mapping_quality(Uniform(10) == 0 ? 5 : 60);
+      reads.push_back(read);
+    }
+    return reads;
+  }
+
+  int Uniform(int n) {
+    return std::uniform_int_distribution<int>(0, n - 1)(rng_);
+  }
+
+ private:
+  char Base() { return "ACGT"[Uniform(4)]; }
+
+  std::mt19937 rng_;
+};
+
+TEST(CompactDeBruijnGraphTest, MatchesDeBruijnGraphOnRandomWindows) {
+  RandomWindows windows(2024);
+  for (int trial = 0; trial < 300; ++trial) {
+    const int period = 1 + windows.Uniform(6);
+    const std::string ref = windows.Sequence(40 + windows.Uniform(120), period);
+    const std::vector<Read> reads =
+        windows.Reads({ref, windows.Mutate(ref), windows.Mutate(ref)},
+                      10 + windows.Uniform(60));
+    DeBruijnGraphOptions options = TestOptions(10, 101, 1);
+    ExpectSameAsDeBruijnGraph(ref, reads, options);
+    options.set_min_edge_weight(1);
+    options.set_max_num_paths(2);
+    ExpectSameAsDeBruijnGraph(ref, reads, options);
+    ExpectSameAsDeBruijnGraph(ref, reads, TestOptions(3, 140, 3));
+  }
+}
+
+// In tandem repeats many k values fail before one works, and Build() does not
+// try them in order.
+TEST(CompactDeBruijnGraphTest, MatchesDeBruijnGraphInTandemRepeats) {
+  RandomWindows windows(25);
+  for (int trial = 0; trial < 20; ++trial) {
+    const std::string unit = windows.Sequence(2 + windows.Uniform(5), 6);
+    std::string ref = windows.Sequence(40, 40);
+    while (ref.size() < 100) ref += unit;
+    ref += windows.Sequence(40, 40);
+    const std::vector<Read> reads =
+        windows.Reads({ref, windows.Mutate(ref)}, 30);
+    for (int min_k = 3; min_k < 40; min_k += 4) {
+      for (int step_k : {1, 2, 5}) {
+        ExpectSameAsDeBruijnGraph(ref, reads, TestOptions(min_k, 101, step_k));
+      }
+    }
+  }
+}
+
+TEST(CompactDeBruijnGraphTest, MatchesDeBruijnGraphBeyondPackedK) {
+  RandomWindows windows(7);
+  const std::string unit = windows.Sequence(CompactDeBruijnGraph::kMaxPackedK,
+                                            CompactDeBruijnGraph::kMaxPackedK);
+  const std::string ref = absl::StrCat(unit, "ACGT", unit);
+  const std::vector<Read> reads = windows.Reads({ref}, 10);
+  ExpectSameAsDeBruijnGraph(ref, reads, TestOptions(100, 200, 5));
+  std::unique_ptr<CompactDeBruijnGraph> graph =
+      CompactDeBruijnGraph::Build(ref, Pointers(reads), TestOptions(100, 200, 5));
+  ASSERT_NE(graph, nullptr);
+  EXPECT_GT(graph->KmerSize(), CompactDeBruijnGraph::kMaxPackedK);
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
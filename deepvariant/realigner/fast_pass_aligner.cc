@@ -40,14 +40,19 @@
 #include <set>
 #include <sstream>
 #include <string>
+#include <tuple>
+#include <utility>
 #include <vector>
 
+#include "absl/hash/hash.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
 #include "absl/memory/memory.h"
+#include "absl/numeric/bits.h"
 #include "absl/strings/ascii.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "third_party/nucleus/protos/cigar.pb.h"
 #include "third_party/nucleus/protos/position.pb.h"
 #include "re2/re2.h"
@@ -56,6 +61,246 @@ namespace learning {
 namespace genomics {
 namespace deepvariant {
 
+namespace {
+
+constexpr size_t kBasesPerWord = 32;
+
+// Returns the kBasesPerWord packed bases of words starting at base start.
+inline uint64_t PackedWordAt(const std::vector<uint64_t>& words,
+                             size_t start) {
+  const size_t word = start / kBasesPerWord;
+  const int shift = 2 * (start % kBasesPerWord);
+  uint64_t value = words[word] >> shift;
+  if (shift != 0 && word + 1 < words.size()) {
+    value |= words[word + 1] << (64 - shift);
+  }
+  return value;
+}
+
+// Returns the 2-bit code of base, or -1 if it is not A, C, G or T.
+inline int BaseCode(char base) {
+  switch (base) {
+    case 'A':
+      return 0;
+    case 'C':
+      return 1;
+    case 'G':
+      return 2;
+    case 'T':
+      return 3;
+    default:
+      return -1;
+  }
+}
+
+// The 2-bit encoding of the last k bases pushed, for k <= 32.
+class RollingKmer {
+ public:
+  explicit RollingKmer(int k)
+      : k_(k), mask_(k == 32 ? ~uint64_t{0} : (uint64_t{1} << (2 * k)) - 1) {}
+
+  // Adds base and returns true if the last k bases are all A, C, G or T, in
+  // which case kmer() is their encoding.
+  bool Push(char base) {
+    const int code = BaseCode(base);
+    if (code < 0) {
+      num_valid_ = 0;
+      return false;
+    }
+    kmer_ = ((kmer_ << 2) | code) & mask_;
+    num_valid_ = std::min(num_valid_ + 1, k_);
+    return num_valid_ == k_;
+  }
+
+  uint64_t kmer() const { return kmer_; }
+
+ private:
+  const int k_;
+  const uint64_t mask_;
+  uint64_t kmer_ = 0;
+  int num_valid_ = 0;
+};
+
+}  // namespace
+
+void ReadKmerIndex::Build(const std::vector<string>& reads, int k) {
+  CHECK_LE(k, 32);
+  reads_ = &reads;
+  k_ = k;
+  kmers_.clear();
+  starts_.clear();
+  occurrences_.clear();
+  other_kmers_.clear();
+
+  std::vector<std::pair<uint64_t, KmerOccurrence>> encoded_kmers;
+  for (size_t read_id = 0; read_id < reads.size(); read_id++) {
+    absl::string_view read = reads[read_id];
+    // Ignoring reads that are too short for a kmer size. Those reads will
+    // still be realigned with SSW.
+    if (read.length() <= k) {
+      continue;
+    }
+    RollingKmer rolling_kmer(k);
+    for (size_t i = 0; i < read.length(); i++) {
+      const bool is_encoded = rolling_kmer.Push(read[i]);
+      if (i + 1 < k) {
+        continue;
+      }
+      const size_t pos = i + 1 - k;
+      const KmerOccurrence occurrence{ReadId(read_id), KmerOffset(pos)};
+      if (is_encoded) {
+        encoded_kmers.emplace_back(rolling_kmer.kmer(), occurrence);
+      } else {
+        other_kmers_[read.substr(pos, k)].push_back(occurrence);
+      }
+    }
+  }
+
+  // Occurrences were added in read and offset order, which the stable sort
+  // keeps for each k-mer.
+  std::stable_sort(encoded_kmers.begin(), encoded_kmers.end(),
+                   [](const std::pair<uint64_t, KmerOccurrence>& a,
+                      const std::pair<uint64_t, KmerOccurrence>& b) {
+                     return a.first < b.first;
+                   });
+  occurrences_.reserve(encoded_kmers.size());
+  for (const auto& [kmer, occurrence] : encoded_kmers) {
+    if (kmers_.empty() || kmers_.back() != kmer) {
+      kmers_.push_back(kmer);
+      starts_.push_back(occurrences_.size());
+    }
+    occurrences_.push_back(occurrence);
+  }
+  starts_.push_back(occurrences_.size());
+}
+
+absl::Span<const KmerOccurrence> ReadKmerIndex::Find(uint64_t kmer) const {
+  const auto it = std::lower_bound(kmers_.begin(), kmers_.end(), kmer);
+  if (it == kmers_.end() || *it != kmer) {
+    return {};
+  }
+  const size_t i = it - kmers_.begin();
+  return absl::MakeConstSpan(occurrences_.data() + starts_[i],
+                             starts_[i + 1] - starts_[i]);
+}
+
+absl::Span<const KmerOccurrence> ReadKmerIndex::Find(
+    absl::string_view kmer) const {
+  DCHECK_EQ(kmer.size(), k_);
+  RollingKmer rolling_kmer(k_);
+  bool is_encoded = false;
+  for (char base : kmer) {
+    is_encoded = rolling_kmer.Push(base);
+  }
+  if (is_encoded) {
+    return Find(rolling_kmer.kmer());
+  }
+  const auto it = other_kmers_.find(kmer);
+  if (it == other_kmers_.end()) {
+    return {};
+  }
+  return it->second;
+}
+
+KmerIndexType ReadKmerIndex::ToKmerIndexType() const {
+  KmerIndexType index = other_kmers_;
+  for (size_t i = 0; i < kmers_.size(); i++) {
+    const KmerOccurrence& first = occurrences_[starts_[i]];
+    absl::string_view kmer = absl::string_view((*reads_)[first.read_id.id])
+                                 .substr(first.read_pos.pos, k_);
+    index[kmer].assign(occurrences_.begin() + starts_[i],
+                       occurrences_.begin() + starts_[i + 1]);
+  }
+  return index;
+}
+
+HaplotypeAlignmentCache::Key HaplotypeAlignmentCache::MakeKey(
+    absl::string_view reference, absl::string_view haplotype,
+    uint64_t scoring) {
+  return {absl::Hash<std::pair<absl::string_view, uint64_t>>()(
+              std::make_pair(reference, scoring)),
+          absl::Hash<absl::string_view>()(haplotype)};
+}
+
+const HaplotypeAlignmentCache::CachedAlignment*
+HaplotypeAlignmentCache::Lookup(absl::string_view reference,
+                                absl::string_view haplotype,
+                                uint64_t scoring) {
+  const auto it = index_.find(MakeKey(reference, haplotype, scoring));
+  if (it == index_.end() || it->second->reference != reference ||
+      it->second->haplotype != haplotype) {
+    misses_++;
+    return nullptr;
+  }
+  hits_++;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return &entries_.front().alignment;
+}
+
+void HaplotypeAlignmentCache::Insert(absl::string_view reference,
+                                     absl::string_view haplotype,
+                                     uint64_t scoring,
+                                     const CachedAlignment& alignment) {
+  if (capacity_ == 0) {
+    return;
+  }
+  const Key key = MakeKey(reference, haplotype, scoring);
+  const auto it = index_.find(key);
+  if (it != index_.end()) {
+    // Replaces the entry, which may be a hash collision.
+    entries_.erase(it->second);
+    index_.erase(it);
+  } else if (entries_.size() >= capacity_) {
+    index_.erase(entries_.back().key);
+    entries_.pop_back();
+    evictions_++;
+  }
+  entries_.push_front(
+      Entry{key, string(reference), string(haplotype), alignment});
+  index_[key] = entries_.begin();
+}
+
+PackedBases PackBases(absl::string_view sequence) {
+  PackedBases packed;
+  packed.size = sequence.size();
+  const size_t num_words = (sequence.size() + kBasesPerWord - 1) /
+                           kBasesPerWord;
+  packed.bases.assign(num_words, 0);
+  packed.valid.assign(num_words, 0);
+  for (size_t i = 0; i < sequence.size(); i++) {
+    const int code = BaseCode(sequence[i]);
+    if (code < 0) {
+      packed.has_other_bases |= sequence[i] != 'N';
+      continue;
+    }
+    const int shift = 2 * (i % kBasesPerWord);
+    packed.bases[i / kBasesPerWord] |= static_cast<uint64_t>(code) << shift;
+    packed.valid[i / kBasesPerWord] |= uint64_t{1} << shift;
+  }
+  return packed;
+}
+
+int CountPackedMismatches(const PackedBases& haplotype, size_t haplotype_start,
+                          const PackedBases& read, int max_mismatches) {
+  DCHECK(!haplotype.has_other_bases && !read.has_other_bases);
+  DCHECK_LE(haplotype_start + read.size, haplotype.size);
+  int num_of_mismatches = 0;
+  for (size_t w = 0; w < read.bases.size(); w++) {
+    const size_t start = haplotype_start + w * kBasesPerWord;
+    const uint64_t diff = PackedWordAt(haplotype.bases, start) ^ read.bases[w];
+    // A base differs if either of its 2 bits does. Bases past the end of the
+    // read are not valid in it.
+    const uint64_t mismatches =
+        (diff | (diff >> 1)) & PackedWordAt(haplotype.valid, start) &
+        read.valid[w];
+    num_of_mismatches += absl::popcount(mismatches);
+    if (num_of_mismatches >= max_mismatches) {
+      return max_mismatches;
+    }
+  }
+  return num_of_mismatches;
+}
+
 void FastPassAligner::set_reference(const string& reference) {
   this->reference_ = reference;
 }
@@ -102,6 +347,7 @@ void FastPassAligner::set_options(const AlignerOptions& options) {
     this->gap_extending_penalty_ = options.gap_extend();
   }
   this->force_alignment_ = options.force_alignment();
+  this->batch_smith_waterman_ = options.batch_smith_waterman();
 
   CHECK(kmer_size_ >= 3 && kmer_size_ <= 32);
   CHECK_GE(similarity_threshold_, 0.0);
@@ -129,6 +375,22 @@ void FastPassAligner::CalculateSswAlignmentScoreThreshold() {
 std::unique_ptr<std::vector<nucleus::genomics::v1::Read>>
 FastPassAligner::AlignReads(
     const std::vector<nucleus::genomics::v1::Read>& reads_param) {
+  std::vector<nucleus::genomics::v1::Read*> heap_reads =
+      AlignReads(reads_param, nullptr);
+  std::unique_ptr<std::vector<nucleus::genomics::v1::Read>> realigned_reads(
+      new std::vector<nucleus::genomics::v1::Read>());
+  realigned_reads->reserve(heap_reads.size());
+  for (nucleus::genomics::v1::Read* read : heap_reads) {
+    // Heap allocated messages are swapped, not copied, by a move.
+    std::unique_ptr<nucleus::genomics::v1::Read> owned_read(read);
+    realigned_reads->push_back(std::move(*owned_read));
+  }
+  return realigned_reads;
+}
+
+std::vector<nucleus::genomics::v1::Read*> FastPassAligner::AlignReads(
+    const std::vector<nucleus::genomics::v1::Read>& reads_param,
+    google::protobuf::Arena* arena) {
 
   // Copy reads
   for (const auto& read : reads_param) {
@@ -166,9 +428,8 @@ FastPassAligner::AlignReads(
   // reference. From all read to haplotype alignments the best one is picked.
   // In the case where read alignments are equally good to ref haplotype and
   // non-ref haplotype, a non-ref haplotype is preferred.
-  std::unique_ptr<std::vector<nucleus::genomics::v1::Read>> realigned_reads(
-      new std::vector<nucleus::genomics::v1::Read>());
-  RealignReadsToReference(reads_param, &realigned_reads);
+  std::vector<nucleus::genomics::v1::Read*> realigned_reads;
+  RealignReadsToReference(reads_param, arena, &realigned_reads);
 
   return realigned_reads;
 }
@@ -231,19 +492,35 @@ void FastPassAligner::FastAlignReadsToHaplotype(
   CHECK(haplotype_read_alignment_scores != nullptr);
 
   bool is_ref = (haplotype == reference_);
-  std::vector<int> coverage(haplotype.size(), 0);
+  const PackedBases packed_haplotype = PackBases(haplotype);
+  // Reads aligned while scanning position i start at or before i, so the
+  // coverage of i is kept as a running sum, and ends[pos] holds the number of
+  // aligned reads that end at pos.
+  int coverage = 0;
+  std::vector<int> ends(haplotype.size() + 1, 0);
   // In the loop we try to align reads for each position in haplotype up to
   // lastPos.
   const auto& lastPos = haplotype.length() - kmer_size_;
+  // The k-mer at i is encoded by rolling it over from the one at i - 1.
+  RollingKmer rolling_kmer(kmer_size_);
+  for (int i = 0; i + 1 < kmer_size_; i++) {
+    rolling_kmer.Push(haplotype[i]);
+  }
   for (int i = 0; i <= lastPos; i++) {
+    coverage -= ends[i];
     // get all reads that are aligned against i-th position
-    auto index_it = kmer_index_.find(haplotype.substr(i, kmer_size_));
-    if (index_it == kmer_index_.end()) {
+    absl::Span<const KmerOccurrence> occurrences;
+    if (rolling_kmer.Push(haplotype[i + kmer_size_ - 1])) {
+      occurrences = kmer_index_.Find(rolling_kmer.kmer());
+    } else {
+      occurrences = kmer_index_.Find(haplotype.substr(i, kmer_size_));
+    }
+    if (occurrences.empty()) {
       continue;
     }
     // Iterate through all the reads that are found in the index for the current
     // kmer.
-    for (const auto& it : index_it->second) {
+    for (const auto& it : occurrences) {
       uint64_t read_id_index = static_cast<uint64_t>(it.read_id);
       CHECK(read_id_index < reads_.size() && it.read_id.is_set);
       size_t target_start_pos = std::max(
@@ -264,19 +541,26 @@ void FastPassAligner::FastAlignReadsToHaplotype(
       }
       CHECK(target_start_pos + span <= haplotype.size());
       int num_of_mismatches = 0;
-      int new_read_alignment_score = FastAlignStrings(
-          haplotype.substr(target_start_pos, span),
-          reads_[read_id_index],
-          max_num_of_mismatches_ + 1, &num_of_mismatches);
+      int new_read_alignment_score;
+      const PackedBases& packed_read = packed_reads_[read_id_index];
+      if (packed_haplotype.has_other_bases || packed_read.has_other_bases) {
+        new_read_alignment_score = FastAlignStrings(
+            haplotype.substr(target_start_pos, span), reads_[read_id_index],
+            max_num_of_mismatches_ + 1, &num_of_mismatches);
+      } else {
+        new_read_alignment_score = FastAlignPackedBases(
+            packed_haplotype, target_start_pos, packed_read,
+            max_num_of_mismatches_ + 1, &num_of_mismatches);
+      }
 
       if (num_of_mismatches <= max_num_of_mismatches_) {
         CHECK(it.read_id.is_set &&
             read_id_index < haplotype_read_alignment_scores->size());
         int oldScore = read_alignment.score;
 
-        for (auto pos = target_start_pos; pos < target_start_pos + span;
-             pos++) {
-          coverage[pos]++;
+        if (target_start_pos + span > static_cast<size_t>(i)) {
+          coverage++;
+          ends[target_start_pos + span]++;
         }
 
         if (oldScore < new_read_alignment_score) {
@@ -292,7 +576,7 @@ void FastPassAligner::FastAlignReadsToHaplotype(
     // At the same time we don't want to discard reference haplotype because,
     // there might be cases were not all haplotypes were generated and we can
     // get away with that by aligning reads to reference haplotype.
-    if (coverage[i] == 0 && i >= ref_prefix_len_ &&
+    if (coverage == 0 && i >= ref_prefix_len_ &&
         i < haplotype.size() - ref_suffix_len_ && !is_ref) {
       *haplotype_score = 0;
       return;
@@ -325,6 +609,20 @@ int FastPassAligner::FastAlignStrings(absl::string_view s1,
   return num_of_matches * match_score_ - *num_of_mismatches * mismatch_penalty_;
 }
 
+int FastPassAligner::FastAlignPackedBases(const PackedBases& haplotype,
+                                          size_t haplotype_start,
+                                          const PackedBases& read,
+                                          int max_mismatches,
+                                          int* num_of_mismatches) const {
+  *num_of_mismatches =
+      CountPackedMismatches(haplotype, haplotype_start, read, max_mismatches);
+  if (*num_of_mismatches == max_mismatches) {
+    return 0;
+  }
+  const int num_of_matches = read.size - *num_of_mismatches;
+  return num_of_matches * match_score_ - *num_of_mismatches * mismatch_penalty_;
+}
+
 CigarUnit::Operation CigarOperationFromChar(char op) {
   switch (op) {
     case '=':
@@ -360,8 +658,17 @@ inline bool AlignmentIsRef(absl::string_view cigar, size_t target_len) {
 }
 
 // Align haplotypes to reference using ssw library.
+uint64_t FastPassAligner::HaplotypeAlignmentScoring() const {
+  return absl::Hash<std::tuple<int, int, int, int>>()(
+      std::make_tuple(match_score_, mismatch_penalty_, gap_opening_penalty_,
+                      gap_extending_penalty_));
+}
+
 void FastPassAligner::AlignHaplotypesToReference() {
-  SswSetReference(reference_);
+  // The SSW reference is only set once a haplotype that is neither the
+  // reference nor cached has to be aligned.
+  bool ssw_reference_set = false;
+  const uint64_t scoring = HaplotypeAlignmentScoring();
 
   // Initialize read_to_haplotype_alignments_ if it is not initialized yet.
   if (read_to_haplotype_alignments_.empty()) {
@@ -370,38 +677,61 @@ void FastPassAligner::AlignHaplotypesToReference() {
           i, -1, std::vector<ReadAlignment>(reads_.size())));
     }
   }
+  haplotype_alignment_sources_.assign(
+      read_to_haplotype_alignments_.size(),
+      HaplotypeAlignmentSource::kNotCacheable);
 
-  for (auto& haplotype_alignment : read_to_haplotype_alignments_) {
+  for (int i = 0; i < read_to_haplotype_alignments_.size(); i++) {
+    auto& haplotype_alignment = read_to_haplotype_alignments_[i];
     Filter filter;
     CHECK(haplotype_alignment.haplotype_index < haplotypes_.size());
-    auto hap_len = haplotypes_[haplotype_alignment.haplotype_index].size();
+    const string& haplotype = haplotypes_[haplotype_alignment.haplotype_index];
+    auto hap_len = haplotype.size();
     // Most of the time, one haplotype will perfectly match the reference.
-    if (haplotypes_[haplotype_alignment.haplotype_index] == reference_) {
+    if (haplotype == reference_) {
       haplotype_alignment.is_reference = true;
       haplotype_alignment.cigar = absl::StrCat(hap_len, "=");
       haplotype_alignment.cigar_ops =
           CigarStringToVector(haplotype_alignment.cigar);
       haplotype_alignment.ref_pos = 0;
-    } else {
-      Alignment alignment =
-          SswAlign(haplotypes_[haplotype_alignment.haplotype_index]);
-      if (alignment.sw_score > 0) {
-        // In rare cases, the ref haplotype will be a substring of the ref, and
-        // therefore not caught by the string equality check above.
-        haplotype_alignment.is_reference =
-            AlignmentIsRef(alignment.cigar_string, hap_len);
-
-        haplotype_alignment.cigar = alignment.cigar_string;
-        haplotype_alignment.cigar_ops =
-            CigarStringToVector(haplotype_alignment.cigar);
-        haplotype_alignment.ref_pos = alignment.ref_begin;
+      continue;
+    }
+    if (haplotype_alignment_cache_ != nullptr) {
+      const HaplotypeAlignmentCache::CachedAlignment* cached =
+          haplotype_alignment_cache_->Lookup(reference_, haplotype, scoring);
+      if (cached != nullptr) {
+        haplotype_alignment.is_reference = cached->is_reference;
+        haplotype_alignment.cigar = cached->cigar;
+        haplotype_alignment.cigar_ops = cached->cigar_ops;
+        haplotype_alignment.ref_pos = cached->ref_pos;
+        haplotype_alignment.hap_to_ref_positions_map =
+            cached->hap_to_ref_positions_map;
+        haplotype_alignment_sources_[i] = HaplotypeAlignmentSource::kCache;
+        continue;
       }
     }
+    if (!ssw_reference_set) {
+      SswSetReference(reference_);
+      ssw_reference_set = true;
+    }
+    Alignment alignment = SswAlign(haplotype);
+    if (alignment.sw_score > 0) {
+      // In rare cases, the ref haplotype will be a substring of the ref, and
+      // therefore not caught by the string equality check above.
+      haplotype_alignment.is_reference =
+          AlignmentIsRef(alignment.cigar_string, hap_len);
+
+      haplotype_alignment.cigar = alignment.cigar_string;
+      haplotype_alignment.cigar_ops =
+          CigarStringToVector(haplotype_alignment.cigar);
+      haplotype_alignment.ref_pos = alignment.ref_begin;
+      haplotype_alignment_sources_[i] = HaplotypeAlignmentSource::kSsw;
+    }
   }
 }
 
-void FastPassAligner::SswAlignReadsToHaplotypes(uint16_t score_threshold) {
-  // For each read
+std::vector<int> FastPassAligner::ReadsWithoutAlignment() const {
+  std::vector<int> read_indices;
   for (int i = 0; i < reads_.size(); i++) {
     bool has_at_least_one_alignment = false;
     // Check if this read is aligned to at least one haplotype
@@ -411,37 +741,95 @@ void FastPassAligner::SswAlignReadsToHaplotypes(uint16_t score_threshold) {
         break;
       }
     }
-    // If this read is not aligned to any of the haplotypes we try SSW.
     if (!has_at_least_one_alignment) {
-      for (auto& hap_alignment : read_to_haplotype_alignments_) {
-        // Skip haplotypes with no read support (score=0), except if
-        // force_alignment, then compute an alignment against the reference no
-        // matter what.
-        if (hap_alignment.haplotype_score == 0 &&
-            !(force_alignment_ && hap_alignment.is_reference)) {
-          continue;
-        }
-        CHECK(hap_alignment.haplotype_index < haplotypes_.size());
-        SswSetReference(haplotypes_[hap_alignment.haplotype_index]);
-        Alignment alignment = SswAlign(reads_[i]);
-        if (alignment.sw_score > 0) {
-          // TODO Remove score_threshold condition. It is effectively
-          // not used.
-          if (alignment.sw_score >= score_threshold ||
-              (force_alignment_ && hap_alignment.is_reference)) {
-            hap_alignment.read_alignment_scores[i].score = alignment.sw_score;
-            hap_alignment.read_alignment_scores[i].cigar =
-                alignment.cigar_string;
-            hap_alignment.read_alignment_scores[i].position =
-                alignment.ref_begin;
-          }
-        } else if (force_alignment_ && hap_alignment.is_reference) {
-        }
+      read_indices.push_back(i);
+    }
+  }
+  return read_indices;
+}
+
+void FastPassAligner::KeepSswAlignment(
+    const Alignment& alignment, uint16_t score_threshold, size_t read_index,
+    HaplotypeReadsAlignment* hap_alignment) const {
+  if (alignment.sw_score > 0) {
+    // TODO Remove score_threshold condition. It is effectively
+    // not used.
+    if (alignment.sw_score >= score_threshold ||
+        (force_alignment_ && hap_alignment->is_reference)) {
+      hap_alignment->read_alignment_scores[read_index].score =
+          alignment.sw_score;
+      hap_alignment->read_alignment_scores[read_index].cigar =
+          alignment.cigar_string;
+      hap_alignment->read_alignment_scores[read_index].position =
+          alignment.ref_begin;
+    }
+  }
+}
+
+void FastPassAligner::SswAlignReadsToHaplotypes(uint16_t score_threshold) {
+  if (batch_smith_waterman_) {
+    BatchSswAlignReadsToHaplotypes(score_threshold);
+    return;
+  }
+  // If a read is not aligned to any of the haplotypes we try SSW.
+  for (int i : ReadsWithoutAlignment()) {
+    for (auto& hap_alignment : read_to_haplotype_alignments_) {
+      // Skip haplotypes with no read support (score=0), except if
+      // force_alignment, then compute an alignment against the reference no
+      // matter what.
+      if (hap_alignment.haplotype_score == 0 &&
+          !(force_alignment_ && hap_alignment.is_reference)) {
+        continue;
       }
+      CHECK(hap_alignment.haplotype_index < haplotypes_.size());
+      SswSetReference(haplotypes_[hap_alignment.haplotype_index]);
+      Alignment alignment = SswAlign(reads_[i]);
+      KeepSswAlignment(alignment, score_threshold, i, &hap_alignment);
     }
   }  // for all reads
 }
 
+void FastPassAligner::BatchSswAlignReadsToHaplotypes(
+    uint16_t score_threshold) {
+  const std::vector<int> read_indices = ReadsWithoutAlignment();
+  if (read_indices.empty()) {
+    return;
+  }
+  std::vector<absl::string_view> reads;
+  reads.reserve(read_indices.size());
+  for (int i : read_indices) {
+    reads.push_back(reads_[i]);
+  }
+  BatchSmithWaterman batch_aligner(match_score_, mismatch_penalty_,
+                                   gap_opening_penalty_,
+                                   gap_extending_penalty_);
+  // Each read/haplotype pair is independent, so haplotypes can go in the outer
+  // loop and SSW only needs each haplotype set as its reference once.
+  for (auto& hap_alignment : read_to_haplotype_alignments_) {
+    const bool force_reference = force_alignment_ && hap_alignment.is_reference;
+    if (hap_alignment.haplotype_score == 0 && !force_reference) {
+      continue;
+    }
+    CHECK(hap_alignment.haplotype_index < haplotypes_.size());
+    const string& haplotype = haplotypes_[hap_alignment.haplotype_index];
+    const std::vector<int> scores = batch_aligner.Score(haplotype, reads);
+    bool reference_is_set = false;
+    for (int r = 0; r < read_indices.size(); ++r) {
+      // Same test as KeepSswAlignment, on the score SSW would report.
+      if (scores[r] == 0 || (scores[r] < score_threshold && !force_reference)) {
+        continue;
+      }
+      if (!reference_is_set) {
+        SswSetReference(haplotype);
+        reference_is_set = true;
+      }
+      Alignment alignment = SswAlign(reads_[read_indices[r]]);
+      KeepSswAlignment(alignment, score_threshold, read_indices[r],
+                       &hap_alignment);
+    }
+  }
+}
+
 // Each operation except MATCH is checked in the input cigar.
 // If reference base preceding operation is the same as the last base of the
 // operation alt bases then alignment is not normalized.
@@ -510,23 +898,27 @@ void FastPassAligner::RealignReadsToReference(
     const std::vector<nucleus::genomics::v1::Read>& reads,
     std::unique_ptr<std::vector<nucleus::genomics::v1::Read>>*
         realigned_reads) {
+  std::vector<nucleus::genomics::v1::Read*> heap_reads;
+  RealignReadsToReference(reads, nullptr, &heap_reads);
+  for (nucleus::genomics::v1::Read* read : heap_reads) {
+    std::unique_ptr<nucleus::genomics::v1::Read> owned_read(read);
+    (*realigned_reads)->push_back(std::move(*owned_read));
+  }
+}
+
+void FastPassAligner::RealignReadsToReference(
+    const std::vector<nucleus::genomics::v1::Read>& reads,
+    google::protobuf::Arena* arena,
+    std::vector<nucleus::genomics::v1::Read*>* realigned_reads) {
   // Loop through all reads
   for (size_t read_index = 0; read_index < reads.size(); read_index++) {
     const nucleus::genomics::v1::Read& read = reads[read_index];
-    nucleus::genomics::v1::Read realigned_read;
-    realigned_read.MergeFrom(read);
     int best_hap_index = -1;
     // See if we have a better alignment
     if (GetBestReadAlignment(read_index, &best_hap_index)) {
       const HaplotypeReadsAlignment& bestHaplotypeAlignments =
           read_to_haplotype_alignments_[best_hap_index];
-      std::unique_ptr<LinearAlignment> new_alignment(new LinearAlignment());
-      new_alignment->MergeFrom(read.alignment());
-      new_alignment->clear_cigar();
       // Calculate new alignment position.
-      std::unique_ptr<nucleus::genomics::v1::Position> new_position(
-          new nucleus::genomics::v1::Position());
-      new_position->MergeFrom(read.alignment().position());
       auto read_to_hap_pos = bestHaplotypeAlignments
           .read_alignment_scores[read_index]
           .position;
@@ -534,14 +926,6 @@ void FastPassAligner::RealignReadsToReference(
           .hap_to_ref_positions_map.size());
       int hap_to_ref_position = bestHaplotypeAlignments
           .hap_to_ref_positions_map[read_to_hap_pos];
-      // We only change position of original read alignment and don't change
-      // chromosome, it shouldn't change anyway!
-      new_position->set_position(
-          region_position_in_chr_
-              + bestHaplotypeAlignments.ref_pos
-              + read_to_hap_pos
-              + hap_to_ref_position);
-      new_alignment->set_allocated_position(new_position.release());
       std::list<CigarOp> readToRefCigarOps;
       // Calculate new cigar by merging read to haplotype and haplotype to ref
       // alignments.
@@ -565,49 +949,50 @@ void FastPassAligner::RealignReadsToReference(
         }
       }
 
-      for (auto& op : readToRefCigarOps) {
-        CigarUnit* cu = new_alignment->add_cigar();
-        cu->set_operation(op.operation);
-        cu->set_operation_length(op.length);
-      }
-
+      nucleus::genomics::v1::Read* realigned_read =
+          google::protobuf::Arena::CreateMessage<nucleus::genomics::v1::Read>(
+              arena);
+      *realigned_read = read;
       if (!readToRefCigarOps.empty()) {
-        realigned_read.set_allocated_alignment(new_alignment.release());
+        // The new alignment is the original one with a new cigar. We only
+        // change position of original read alignment and don't change
+        // chromosome, it shouldn't change anyway!
+        LinearAlignment* new_alignment = realigned_read->mutable_alignment();
+        new_alignment->clear_cigar();
+        new_alignment->mutable_position()->set_position(
+            region_position_in_chr_
+                + bestHaplotypeAlignments.ref_pos
+                + read_to_hap_pos
+                + hap_to_ref_position);
+        for (auto& op : readToRefCigarOps) {
+          CigarUnit* cu = new_alignment->add_cigar();
+          cu->set_operation(op.operation);
+          cu->set_operation_length(op.length);
+        }
       } else if (force_alignment_) {
       }
-      (*realigned_reads)->push_back(realigned_read);
+      realigned_reads->push_back(realigned_read);
     } else {  // Could not find a new alignment.
       if (force_alignment_) {
       } else {
         // Keeping original alignment (force_alignment is off).
-        (*realigned_reads)->push_back(realigned_read);
+        nucleus::genomics::v1::Read* realigned_read =
+            google::protobuf::Arena::CreateMessage<
+                nucleus::genomics::v1::Read>(arena);
+        *realigned_read = read;
+        realigned_reads->push_back(realigned_read);
       }
     }
   }  // for
 }
 
-void FastPassAligner::AddKmerToIndex(absl::string_view kmer,
-                                     ReadId read_id, KmerOffset pos) {
-  kmer_index_[kmer].push_back(KmerOccurrence(read_id, pos));
-}
-
-void FastPassAligner::AddReadToIndex(absl::string_view read, ReadId read_id) {
-  // Ignoring reads that are too short for a kmer size. Those reads will still
-  // be realigned with SSW.
-  if (read.length() <= kmer_size_) {
-    return;
-  }
-  auto last_pos = read.length() - kmer_size_;
-  for (int i = 0; i <= last_pos; i++) {
-    AddKmerToIndex(read.substr(i, kmer_size_), read_id, KmerOffset(i));
-  }
-}
-
 void FastPassAligner::BuildIndex() {
-  size_t read_id = 0;
+  packed_reads_.clear();
+  packed_reads_.reserve(reads_.size());
   for (const auto& read : reads_) {
-    AddReadToIndex(read, ReadId(read_id++));
+    packed_reads_.push_back(PackBases(read));
   }
+  kmer_index_.Build(reads_, kmer_size_);
 }
 
 void SetPositionsMap(size_t haplotype_size,
@@ -659,9 +1044,26 @@ void SetPositionsMap(size_t haplotype_size,
 }
 
 void FastPassAligner::CalculatePositionMaps() {
-  for (auto& hyplotype_alignment : read_to_haplotype_alignments_) {
-    SetPositionsMap(haplotypes_[hyplotype_alignment.haplotype_index].size(),
-                    &hyplotype_alignment);
+  const uint64_t scoring = HaplotypeAlignmentScoring();
+  for (int i = 0; i < read_to_haplotype_alignments_.size(); i++) {
+    auto& hyplotype_alignment = read_to_haplotype_alignments_[i];
+    const HaplotypeAlignmentSource source =
+        i < haplotype_alignment_sources_.size()
+            ? haplotype_alignment_sources_[i]
+            : HaplotypeAlignmentSource::kNotCacheable;
+    if (source == HaplotypeAlignmentSource::kCache) {
+      continue;
+    }
+    const string& haplotype = haplotypes_[hyplotype_alignment.haplotype_index];
+    SetPositionsMap(haplotype.size(), &hyplotype_alignment);
+    if (source == HaplotypeAlignmentSource::kSsw &&
+        haplotype_alignment_cache_ != nullptr) {
+      haplotype_alignment_cache_->Insert(
+          reference_, haplotype, scoring,
+          {hyplotype_alignment.is_reference, hyplotype_alignment.cigar,
+           hyplotype_alignment.cigar_ops, hyplotype_alignment.ref_pos,
+           hyplotype_alignment.hap_to_ref_positions_map});
+    }
   }
 }
 
@@ -41,13 +41,16 @@
 #include <vector>
 
 #include "deepvariant/protos/realigner.pb.h"
+#include "deepvariant/realigner/batch_smith_waterman.h"
 #include "deepvariant/realigner/ssw.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/node_hash_map.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "third_party/nucleus/protos/cigar.pb.h"
 #include "third_party/nucleus/protos/reads.pb.h"
+#include "google/protobuf/arena.h"
 #include "re2/re2.h"
 
 namespace learning {
@@ -214,9 +217,128 @@ void SetPositionsMap(size_t haplotype_size,
 
 void MergeCigarOp(const CigarOp& op, int read_len, std::list<CigarOp>* cigar);
 
+// A sequence packed 32 bases per 64-bit word, so that it can be compared with
+// another one a word at a time. A, C, G and T take 2 bits each (0, 1, 2 and 3)
+// and have the low bit of their 2 bits set in valid. N is not valid, so it
+// matches any base, as in FastAlignStrings.
+struct PackedBases {
+  std::vector<uint64_t> bases;
+  std::vector<uint64_t> valid;
+  size_t size = 0;
+  // True if a base is neither A, C, G, T nor N. Such a sequence has to be
+  // compared as a string.
+  bool has_other_bases = false;
+};
+
+PackedBases PackBases(absl::string_view sequence);
+
+// Returns the number of bases of read that mismatch the bases of haplotype
+// starting at haplotype_start, where N matches anything. Counting stops a word
+// after max_mismatches is reached, and max_mismatches is returned then.
+// Neither sequence may have other bases, and the read must fit in haplotype.
+int CountPackedMismatches(const PackedBases& haplotype, size_t haplotype_start,
+                          const PackedBases& read, int max_mismatches);
+
 using KmerIndexType =
     absl::flat_hash_map<absl::string_view, std::vector<KmerOccurrence>>;
 
+// Index of the k-mers of a set of reads, for k <= 32.
+//
+// K-mers of A, C, G and T only are encoded 2 bits per base in a uint64_t. Their
+// occurrences are stored in one array sorted by encoded k-mer, then by read and
+// offset, and the sorted distinct k-mers point into it, like the rows of a CSR
+// matrix. The few other k-mers, with an N for example, are kept in a
+// KmerIndexType.
+class ReadKmerIndex {
+ public:
+  // Indexes the k-mers of reads, which must outlive the index. Reads of k bases
+  // or fewer are not indexed.
+  void Build(const std::vector<string>& reads, int k);
+
+  // Returns the occurrences of the encoded k-mer kmer, in read and offset
+  // order.
+  absl::Span<const KmerOccurrence> Find(uint64_t kmer) const;
+
+  // Returns the occurrences of kmer, which has k bases, in read and offset
+  // order.
+  absl::Span<const KmerOccurrence> Find(absl::string_view kmer) const;
+
+  // Returns the index as a map keyed by k-mer sequence.
+  KmerIndexType ToKmerIndexType() const;
+
+ private:
+  const std::vector<string>* reads_ = nullptr;
+  int k_ = 0;
+  std::vector<uint64_t> kmers_;
+  // The occurrences of kmers_[i] are occurrences_[starts_[i], starts_[i + 1]).
+  std::vector<uint32_t> starts_;
+  std::vector<KmerOccurrence> occurrences_;
+  KmerIndexType other_kmers_;
+};
+
+// A bounded cache of haplotype to reference alignments.
+//
+// FastPassAligner aligns every haplotype of a window to the window reference
+// with SSW. Overlapping, adjacent and retried windows often align the same
+// haplotypes to the same reference again, so their alignments are kept here,
+// keyed by the hashes of the reference (with the alignment scoring) and of the
+// haplotype, and evicted least recently used first. The sequences are kept
+// too, so a hash collision is a miss, not a wrong alignment.
+//
+// A cache is not thread-safe: use one per region-processing thread.
+class HaplotypeAlignmentCache {
+ public:
+  // The parts of a HaplotypeReadsAlignment that only depend on the haplotype
+  // and the reference.
+  struct CachedAlignment {
+    bool is_reference = false;
+    string cigar;
+    std::list<CigarOp> cigar_ops;
+    uint64_t ref_pos = 0;
+    std::vector<int> hap_to_ref_positions_map;
+  };
+
+  // Keeps up to capacity alignments. A capacity of 0 keeps none.
+  explicit HaplotypeAlignmentCache(size_t capacity) : capacity_(capacity) {}
+
+  // Returns the alignment of haplotype to reference with scoring, or nullptr
+  // if it is not cached. scoring identifies the alignment parameters.
+  const CachedAlignment* Lookup(absl::string_view reference,
+                                absl::string_view haplotype,
+                                uint64_t scoring);
+
+  // Caches the alignment of haplotype to reference with scoring, evicting the
+  // least recently used alignment if the cache is full.
+  void Insert(absl::string_view reference, absl::string_view haplotype,
+              uint64_t scoring, const CachedAlignment& alignment);
+
+  size_t capacity() const { return capacity_; }
+  int size() const { return entries_.size(); }
+  int64_t hits() const { return hits_; }
+  int64_t misses() const { return misses_; }
+  int64_t evictions() const { return evictions_; }
+
+ private:
+  using Key = std::pair<uint64_t, uint64_t>;
+  struct Entry {
+    Key key;
+    string reference;
+    string haplotype;
+    CachedAlignment alignment;
+  };
+
+  static Key MakeKey(absl::string_view reference, absl::string_view haplotype,
+                     uint64_t scoring);
+
+  const size_t capacity_;
+  // Most recently used first.
+  std::list<Entry> entries_;
+  absl::flat_hash_map<Key, std::list<Entry>::iterator> index_;
+  int64_t hits_ = 0;
+  int64_t misses_ = 0;
+  int64_t evictions_ = 0;
+};
+
 // Align a set of reads to a target sequence.
 // This class is intended for realigning reads to haplotypes (graph paths)
 // generated by DeBrujn graph. Since graph's paths are constructed from the same
@@ -264,6 +386,11 @@ class FastPassAligner {
   int16_t get_ssw_alignment_score_threshold() const {
     return ssw_alignment_score_threshold_;
   }
+  // Haplotype to reference alignments are looked up in and added to cache,
+  // which must outlive this aligner. By default nothing is cached.
+  void set_haplotype_alignment_cache(HaplotypeAlignmentCache* cache) {
+    haplotype_alignment_cache_ = cache;
+  }
 
   // Align reads to the reference by first aligning reads to haplotypes and
   // then by merging haplotype to reference cigars and reads to haplotype
@@ -272,10 +399,16 @@ class FastPassAligner {
   std::unique_ptr<std::vector<nucleus::genomics::v1::Read>> AlignReads(
       const std::vector<nucleus::genomics::v1::Read>& reads_param);
 
+  // Same as AlignReads() above, but the realigned reads are allocated on
+  // arena, typically one per region, and are released with it.
+  std::vector<nucleus::genomics::v1::Read*> AlignReads(
+      const std::vector<nucleus::genomics::v1::Read>& reads_param,
+      google::protobuf::Arena* arena);
+
   // Build K-mer index for all reads.
   void BuildIndex();
 
-  KmerIndexType GetKmerIndex() const { return kmer_index_; }
+  KmerIndexType GetKmerIndex() const { return kmer_index_.ToKmerIndexType(); }
 
   // Align all reads to a haplotype using fast pass alignment.
   void FastAlignReadsToHaplotype(
@@ -285,6 +418,9 @@ class FastPassAligner {
   // Align reads to haplotypes using SSW library. Only reads that could not
   // be aligned with FastAlignReadsToHaplotype are aligned here.
   // Only alignment with better than score_threshold score are kept.
+  // If the batch_smith_waterman option is set, reads are first scored against
+  // each haplotype with BatchSmithWaterman and SSW only aligns the pairs whose
+  // alignment would be kept.
   void SswAlignReadsToHaplotypes(uint16_t score_threshold);
 
   // Initialize SSW library.
@@ -336,6 +472,13 @@ class FastPassAligner {
       std::unique_ptr<std::vector<nucleus::genomics::v1::Read>>*
           realigned_reads);
 
+  // Same as above, with the realigned reads allocated on arena. If arena is
+  // nullptr they are allocated on the heap and owned by the caller.
+  void RealignReadsToReference(
+      const std::vector<nucleus::genomics::v1::Read>& reads,
+      google::protobuf::Arena* arena,
+      std::vector<nucleus::genomics::v1::Read*>* realigned_reads);
+
   void CalculateSswAlignmentScoreThreshold();
 
  private:
@@ -353,13 +496,28 @@ class FastPassAligner {
 
   std::vector<HaplotypeReadsAlignment> read_to_haplotype_alignments_;
 
+  // Not owned. May be nullptr.
+  HaplotypeAlignmentCache* haplotype_alignment_cache_ = nullptr;
+
+  // How each element of read_to_haplotype_alignments_ was aligned to the
+  // reference by AlignHaplotypesToReference. Only new SSW alignments are added
+  // to the cache.
+  enum class HaplotypeAlignmentSource { kNotCacheable, kCache, kSsw };
+  std::vector<HaplotypeAlignmentSource> haplotype_alignment_sources_;
+
+  // Identifies the scoring of haplotype to reference alignments in the cache.
+  uint64_t HaplotypeAlignmentScoring() const;
+
   // index of reads. Allows to find all reads that contain a given k-mer
   // and their align position.
-  KmerIndexType kmer_index_;
+  ReadKmerIndex kmer_index_;
 
   // Vector of reads that need to be realigned
   std::vector<string> reads_;
 
+  // reads_ packed by BuildIndex for FastAlignReadsToHaplotype.
+  std::vector<PackedBases> packed_reads_;
+
   // K-mer size that is used for indexing input reads
   int kmer_size_ = 32;
 
@@ -396,6 +554,10 @@ class FastPassAligner {
   // SSW aligner instance
   std::unique_ptr<Aligner> ssw_aligner_;
 
+  // If true, SswAlignReadsToHaplotypes scores reads in SIMD batches before
+  // aligning them with SSW.
+  bool batch_smith_waterman_ = false;
+
   // These attributes allow debug output.
   bool debug_out_ = false;
   int debug_read_id_ = 0;
@@ -410,14 +572,28 @@ class FastPassAligner {
   // be able align all the reads that are aligned to haplotypes w/o indels.
   void FastAlignReadsToHaplotypes();
 
-  void AddReadToIndex(absl::string_view read, ReadId read_id);
-
-  void AddKmerToIndex(absl::string_view kmer, ReadId read_id,
-                      KmerOffset pos);
-
   int FastAlignStrings(absl::string_view s1, absl::string_view s2,
                        int max_mismatches, int* num_of_mismatches) const;
 
+  // Same as FastAlignStrings for read and the bases of haplotype starting at
+  // haplotype_start, compared a word at a time.
+  int FastAlignPackedBases(const PackedBases& haplotype,
+                           size_t haplotype_start, const PackedBases& read,
+                           int max_mismatches, int* num_of_mismatches) const;
+
+  // Returns the indices of reads that FastAlignReadsToHaplotypes could not
+  // align to any haplotype.
+  std::vector<int> ReadsWithoutAlignment() const;
+
+  // Stores the SSW alignment of read read_index to the haplotype of
+  // hap_alignment if it is good enough.
+  void KeepSswAlignment(const Alignment& alignment, uint16_t score_threshold,
+                        size_t read_index,
+                        HaplotypeReadsAlignment* hap_alignment) const;
+
+  // SswAlignReadsToHaplotypes for the batch_smith_waterman option.
+  void BatchSswAlignReadsToHaplotypes(uint16_t score_threshold);
+
   void UpdateBestHaplotypes(
       size_t haplotype_index, int haplotype_score,
       const std::vector<ReadAlignment>& current_read_scores);
@@ -36,6 +36,7 @@
 #include <list>
 #include <map>
 #include <ostream>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -50,6 +51,7 @@
 #include "third_party/nucleus/protos/reads.pb.h"
 #include "third_party/nucleus/testing/protocol-buffer-matchers.h"
 #include "third_party/nucleus/testing/test_utils.h"
+#include "google/protobuf/arena.h"
 #include "google/protobuf/text_format.h"
 
 namespace learning {
@@ -167,6 +169,35 @@ TEST_F(FastPassAlignerTest, ReadsIndexIgnoreReadsShorterThanKmerTest) {
   EXPECT_EQ(aligner_.GetKmerIndex(), expected_index);
 }
 
+// K-mers with an N cannot be encoded, but are still indexed and found.
+TEST_F(FastPassAlignerTest, ReadsIndexKmersWithNTest) {
+  aligner_.set_reads({"AANCCA", "CCAA"});
+  AlignerOptions aligner_options;
+  aligner_options.set_kmer_size(3);
+  aligner_.set_options(aligner_options);
+  KmerIndexType expected_index = {
+      {"AAN", {KmerOccurrence(ReadId(0), KmerOffset(0))}},
+      {"ANC", {KmerOccurrence(ReadId(0), KmerOffset(1))}},
+      {"NCC", {KmerOccurrence(ReadId(0), KmerOffset(2))}},
+      {"CCA",
+       {KmerOccurrence(ReadId(0), KmerOffset(3)),
+        KmerOccurrence(ReadId(1), KmerOffset(0))}},
+      {"CAA", {KmerOccurrence(ReadId(1), KmerOffset(1))}}};
+  aligner_.BuildIndex();
+  EXPECT_EQ(aligner_.GetKmerIndex(), expected_index);
+
+  aligner_.set_ref_prefix_len(0);
+  aligner_.set_ref_suffix_len(0);
+  int haplotype_score = 0;
+  std::vector<ReadAlignment> read_scores(aligner_.get_reads().size());
+  aligner_.FastAlignReadsToHaplotype("AANCCAA", &haplotype_score, &read_scores);
+  const int match = aligner_.get_match_score();
+  EXPECT_THAT(read_scores,
+              testing::ElementsAre(ReadAlignment(0, "6=", 6 * match),
+                                   ReadAlignment(3, "4=", 4 * match)));
+  EXPECT_EQ(haplotype_score, 10 * match);
+}
+
 // Test haplotype consists of read1 and read3. We check expected haplotype
 // score and all read alignments.
 TEST_F(FastPassAlignerTest, FastAlignReadsToHaplotypeTest) {
@@ -307,6 +338,80 @@ TEST_F(FastPassAlignerTest,
               testing::UnorderedElementsAreArray(expected_read_scores));
 }
 
+// Reads longer than a packed word, with Ns and with a base other than A, C, G,
+// T or N, which is compared as a string.
+TEST_F(FastPassAlignerTest, FastAlignReadsToHaplotypePackedBasesTest) {
+  const string haplotype =
+      "ATCAAGGGAAAAAGTGCCCAGGGCCAAATATGTTTTGGGTTTTGCAGGACAAAGTATGGTTGAAACTGAG";
+  aligner_.set_reads({
+      // Covers the whole haplotype, with an N.
+      "ATCAAGGGAAAAAGTGCCCAGGGCCAAATATGTTTTGGGTTTTGCAGGACNAAGTATGGTTGAAACTGAG",
+      // One mismatch in its second word.
+      "AGGGCCAAATATGTTTTGGGTTTTGCAGGACAAAGTATGTTTG",
+      // Three mismatches, one more than allowed.
+      "AGGGCCAAATATGTTTTGGGTTTTGCAGGACAAAGTATGTAAG",
+      // An R, which mismatches.
+      "GGGAAAAAGTGCCCAGGGCCAAATATGTTTTGGGTTTTGRAGGA",
+  });
+  AlignerOptions aligner_options;
+  aligner_options.set_kmer_size(8);
+  aligner_options.set_max_num_of_mismatches(2);
+  aligner_.set_options(aligner_options);
+  aligner_.set_ref_prefix_len(0);
+  aligner_.set_ref_suffix_len(0);
+  aligner_.BuildIndex();
+
+  int haplotype_score = 0;
+  std::vector<ReadAlignment> read_scores(aligner_.get_reads().size());
+  aligner_.FastAlignReadsToHaplotype(haplotype, &haplotype_score, &read_scores);
+
+  const int match = aligner_.get_match_score();
+  const int mismatch = aligner_.get_mismatch_penalty();
+  std::vector<ReadAlignment> expected_read_scores = {
+      ReadAlignment(0, "70=", 70 * match),
+      ReadAlignment(19, "43=", 42 * match - mismatch),
+      ReadAlignment(),
+      ReadAlignment(5, "44=", 43 * match - mismatch),
+  };
+  EXPECT_THAT(read_scores, testing::ElementsAreArray(expected_read_scores));
+  EXPECT_EQ(haplotype_score, 70 * match + 85 * match - 2 * mismatch);
+}
+
+TEST(PackedBasesTest, CountPackedMismatchesMatchesStringComparison) {
+  std::mt19937 random(42);
+  const string kBases = "ACGTN";
+  string haplotype;
+  for (int i = 0; i < 200; i++) {
+    haplotype += kBases[random() % kBases.size()];
+  }
+  const PackedBases packed_haplotype = PackBases(haplotype);
+  EXPECT_FALSE(packed_haplotype.has_other_bases);
+  for (int read_size : {1, 31, 32, 33, 64, 100, 150}) {
+    for (int start = 0; start + read_size <= haplotype.size(); start += 7) {
+      string read = haplotype.substr(start, read_size);
+      for (int i = 0; i < read_size / 10; i++) {
+        read[random() % read_size] = kBases[random() % kBases.size()];
+      }
+      int expected = 0;
+      for (int i = 0; i < read_size; i++) {
+        const char h = haplotype[start + i];
+        if (h != read[i] && h != 'N' && read[i] != 'N') {
+          expected++;
+        }
+      }
+      const PackedBases packed_read = PackBases(read);
+      EXPECT_EQ(CountPackedMismatches(packed_haplotype, start, packed_read,
+                                      read_size + 1),
+                expected)
+          << read << " at " << start;
+      EXPECT_EQ(CountPackedMismatches(packed_haplotype, start, packed_read, 3),
+                std::min(expected, 3))
+          << read << " at " << start;
+    }
+  }
+  EXPECT_TRUE(PackBases("ACGTR").has_other_bases);
+}
+
 // This test is not intended to test SSW library. It is a sanity check that
 // library can be called and results are as excepted.
 TEST_F(FastPassAlignerTest, SswAlignerSanityCheck) {
@@ -479,6 +584,46 @@ TEST_F(FastPassAlignerTest, SswAlignReadsToHaplotypes_Test) {
               testing::ElementsAreArray(expected_read_alignments_for_hap2));
 }
 
+TEST_F(FastPassAlignerTest, SswAlignReadsToHaplotypes_BatchSmithWaterman_Test) {
+  std::vector<std::string> haplotypes = {
+      // reference
+      "AAGTGCCCAGGGCCAAATATGTTTTGGGTTTTGCAGGACAAAGTATGGTT",
+      // reference with 1 del
+      "AAGTGCCCAGGGCCAAATGTTTTGGGTTTTGCAGGACAAAGTATGGTT",
+      // reference with 1 sub
+      "AAGTGCCCAGGGCCAAATATGCACAGGGTTTTGCAGGACAAAGTATGGTT"};
+  std::vector<std::string> reads = {
+      "CAGGGCCAAATGTTT",        "GCCATATATGCACAGGGTTATG",
+      "TTGGGTTGCAGGACA",        "ACAGGGTTTTTTGCAGGACAA",
+      "TGTTGGGTTCAGCAGTTTT",    "",
+      "NNNNNNNNNNNNNNNNNNNNNN", "CCCAGGGCCAAATATGTTTTGGGTTTTGCAGG"};
+  for (bool force_alignment : {false, true}) {
+    for (int score_threshold : {1, 40, 60}) {
+      std::vector<HaplotypeReadsAlignment> expected;
+      for (bool batch_smith_waterman : {false, true}) {
+        FastPassAligner aligner;
+        aligner.set_reference(haplotypes[0]);
+        aligner.set_reads(reads);
+        aligner.InitSswLib();
+        AlignerOptions aligner_options;
+        aligner_options.set_kmer_size(3);
+        aligner_options.set_force_alignment(force_alignment);
+        aligner_options.set_batch_smith_waterman(batch_smith_waterman);
+        aligner.set_options(aligner_options);
+        aligner.set_haplotypes(haplotypes);
+        aligner.AlignHaplotypesToReference();
+        aligner.SswAlignReadsToHaplotypes(score_threshold);
+        if (batch_smith_waterman) {
+          EXPECT_THAT(aligner.GetReadToHaplotypeAlignments(),
+                      testing::ElementsAreArray(expected));
+        } else {
+          expected = aligner.GetReadToHaplotypeAlignments();
+        }
+      }
+    }
+  }
+}
+
 // Haplotype to ref has one mismatch. Read matches haplotype exactly.
 TEST_F(FastPassAlignerTest, CalculateReadToRefAlignment_MatchMismatch_Test) {
   aligner_.InitSswLib();
@@ -1240,6 +1385,127 @@ TEST_F(FastPassAlignerTest, IsAlignmentNormalized_Ins_Norm) {
       ));
 }
 
+// AlignReads on an arena realigns reads exactly like the heap allocating
+// AlignReads.
+TEST_F(FastPassAlignerTest, AlignReadsOnArena_Test) {
+  const std::vector<std::string> haplotypes = {
+      // reference
+      "AAGTGCCCAGGGCCAAATATGTTTTGGGTTTTGCAGGACAAAGTATGGTT",
+      // reference with 1 del
+      "AAGTGCCCAGGGCCAAATGTTTTGGGTTTTGCAGGACAAAGTATGGTT"};
+  const std::vector<nucleus::genomics::v1::Read> reads = {
+      nucleus::MakeRead("chr20", 10, "CAGGGCCAAATGTTTTGGG", {"19M"}, "read1"),
+      nucleus::MakeRead("chr20", 3, "TGCCCAGGGCCAAATATGTT", {"20M"}, "read2"),
+      nucleus::MakeRead("chr20", 20, "NNNNNNNNNNNNNNN", {"15M"}, "read3")};
+  AlignerOptions aligner_options;
+  aligner_options.set_kmer_size(5);
+  aligner_options.set_read_size(20);
+  auto make_aligner = [&](FastPassAligner* aligner) {
+    aligner->set_reference(haplotypes[0]);
+    aligner->set_ref_start("chr20", 0);
+    aligner->set_options(aligner_options);
+    aligner->set_haplotypes(haplotypes);
+    aligner->set_ref_prefix_len(0);
+    aligner->set_ref_suffix_len(0);
+  };
+
+  FastPassAligner heap_aligner;
+  make_aligner(&heap_aligner);
+  std::unique_ptr<std::vector<nucleus::genomics::v1::Read>> expected =
+      heap_aligner.AlignReads(reads);
+
+  google::protobuf::Arena arena;
+  FastPassAligner arena_aligner;
+  make_aligner(&arena_aligner);
+  const std::vector<nucleus::genomics::v1::Read*> realigned_reads =
+      arena_aligner.AlignReads(reads, &arena);
+
+  ASSERT_EQ(realigned_reads.size(), expected->size());
+  for (int i = 0; i < realigned_reads.size(); ++i) {
+    EXPECT_EQ(realigned_reads[i]->GetArena(), &arena);
+    EXPECT_THAT(*realigned_reads[i], nucleus::EqualsProto((*expected)[i]));
+  }
+  // read1 spans the deletion of the second haplotype.
+  EXPECT_EQ(realigned_reads[0]->alignment().cigar_size(), 3);
+}
+
+// A second aligner for the same window takes its haplotype to reference
+// alignments from the cache, and realigns reads the same way.
+TEST_F(FastPassAlignerTest, AlignReadsWithHaplotypeAlignmentCache_Test) {
+  const std::vector<std::string> haplotypes = {
+      // reference
+      "AAGTGCCCAGGGCCAAATATGTTTTGGGTTTTGCAGGACAAAGTATGGTT",
+      // reference with 1 del
+      "AAGTGCCCAGGGCCAAATGTTTTGGGTTTTGCAGGACAAAGTATGGTT",
+      // reference with 1 mismatch
+      "AAGTGCCCAGGGCCAAATATGTTTTCGGTTTTGCAGGACAAAGTATGGTT"};
+  const std::vector<nucleus::genomics::v1::Read> reads = {
+      nucleus::MakeRead("chr20", 10, "CAGGGCCAAATGTTTTGGG", {"19M"}, "read1"),
+      nucleus::MakeRead("chr20", 3, "TGCCCAGGGCCAAATATGTT", {"20M"}, "read2"),
+      nucleus::MakeRead("chr20", 12, "GGCCAAATATGTTTTCGGTT", {"20M"}, "read3")};
+  AlignerOptions aligner_options;
+  aligner_options.set_kmer_size(5);
+  aligner_options.set_read_size(20);
+  HaplotypeAlignmentCache cache(/*capacity=*/10);
+  auto align_reads = [&](HaplotypeAlignmentCache* cache) {
+    FastPassAligner aligner;
+    aligner.set_reference(haplotypes[0]);
+    aligner.set_ref_start("chr20", 0);
+    aligner.set_options(aligner_options);
+    aligner.set_haplotypes(haplotypes);
+    aligner.set_ref_prefix_len(0);
+    aligner.set_ref_suffix_len(0);
+    aligner.set_haplotype_alignment_cache(cache);
+    return aligner.AlignReads(reads);
+  };
+
+  const auto expected = align_reads(nullptr);
+  const auto first = align_reads(&cache);
+  // The reference haplotype is not aligned, so it is not cached.
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.hits(), 0);
+  EXPECT_EQ(cache.misses(), 2);
+  const auto second = align_reads(&cache);
+  EXPECT_EQ(cache.hits(), 2);
+  EXPECT_EQ(cache.misses(), 2);
+
+  ASSERT_EQ(first->size(), expected->size());
+  ASSERT_EQ(second->size(), expected->size());
+  for (int i = 0; i < expected->size(); ++i) {
+    EXPECT_THAT((*first)[i], nucleus::EqualsProto((*expected)[i]));
+    EXPECT_THAT((*second)[i], nucleus::EqualsProto((*expected)[i]));
+  }
+}
+
+TEST(HaplotypeAlignmentCacheTest, EvictsLeastRecentlyUsed) {
+  HaplotypeAlignmentCache cache(/*capacity=*/2);
+  HaplotypeAlignmentCache::CachedAlignment alignment;
+  alignment.cigar = "4=";
+  cache.Insert("ACGT", "ACGT", 1, alignment);
+  alignment.cigar = "2=1X1=";
+  cache.Insert("ACGT", "ACCT", 1, alignment);
+  // Different reference or scoring.
+  EXPECT_EQ(cache.Lookup("ACGA", "ACGT", 1), nullptr);
+  EXPECT_EQ(cache.Lookup("ACGT", "ACGT", 2), nullptr);
+  // Makes ACGT the most recently used.
+  ASSERT_NE(cache.Lookup("ACGT", "ACGT", 1), nullptr);
+  EXPECT_EQ(cache.Lookup("ACGT", "ACGT", 1)->cigar, "4=");
+
+  cache.Insert("ACGT", "AGGT", 1, alignment);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.evictions(), 1);
+  EXPECT_EQ(cache.Lookup("ACGT", "ACCT", 1), nullptr);
+  EXPECT_NE(cache.Lookup("ACGT", "ACGT", 1), nullptr);
+  EXPECT_NE(cache.Lookup("ACGT", "AGGT", 1), nullptr);
+  EXPECT_EQ(cache.hits(), 4);
+  EXPECT_EQ(cache.misses(), 3);
+
+  HaplotypeAlignmentCache disabled(/*capacity=*/0);
+  disabled.Insert("ACGT", "ACGT", 1, alignment);
+  EXPECT_EQ(disabled.size(), 0);
+  EXPECT_EQ(disabled.Lookup("ACGT", "ACGT", 1), nullptr);
+}
+
 }  // namespace deepvariant
 }  // namespace genomics
 }  // namespace learning
@@ -306,6 +306,24 @@ class DeBruijnGraphWrapTest(parameterized.TestCase):
     self.assertLen(dbg.candidate_haplotypes(), 2)
     self.assertIn(ref_seq, dbg.candidate_haplotypes())
 
+  @parameterized.parameters(
+      dict(region='chr20:10,000,000-10,000,100'),
+      dict(region='chr20:10,095,379-10,095,500'),
+  )
+  def test_compact_graph_matches(self, region):
+    ref_reader = fasta.IndexedFastaReader(testdata.CHR20_FASTA)
+    bam_reader = sam.SamReader(testdata.CHR20_BAM)
+    region = ranges.parse_literal(region)
+    ref_seq = ref_reader.query(region)
+    reads = list(bam_reader.query(region))
+    dbg = debruijn_graph.build(ref_seq, reads, self.dbg_options())
+    compact = debruijn_graph.build_compact(ref_seq, reads, self.dbg_options())
+    self.assertIsNotNone(compact)
+    self.assertEqual(dbg.kmer_size, compact.kmer_size)
+    self.assertEqual(dbg.candidate_haplotypes(),
+                     compact.candidate_haplotypes())
+    self.assertEqual(dbg.graphviz(), compact.graphviz())
+
   def test_k_exceeds_read_length(self):
     """This is a regression test for internal."""
     # If k > read length, no edges will go into the graph from this read.
@@ -46,6 +46,7 @@ from deepvariant.protos import realigner_pb2
 from deepvariant.realigner import window_selector
 from deepvariant.realigner.python import debruijn_graph
 from deepvariant.realigner.python import fast_pass_aligner
+from deepvariant.realigner.python import window_realigner
 from deepvariant.vendor import timer
 from google.protobuf import text_format
 from third_party.nucleus.io import sam
@@ -189,6 +190,24 @@ _ALN_K = flags.DEFINE_integer(
 _ALN_ERROR_RATE = flags.DEFINE_float(
     'aln_error_rate', 0.01, 'Estimated sequencing error rate.'
 )
+_ALN_BATCH_SMITH_WATERMAN = flags.DEFINE_bool(
+    'aln_batch_smith_waterman',
+    False,
+    (
+        'If True, reads that the fast pass cannot align are scored against '
+        'all haplotypes with a SIMD batch Smith-Waterman, and only the pairs '
+        'that pass the score threshold get a full SSW alignment.'
+    ),
+)
+_ALN_HAPLOTYPE_ALIGNMENT_CACHE_SIZE = flags.DEFINE_integer(
+    'aln_haplotype_alignment_cache_size',
+    1024,
+    (
+        'Maximum number of haplotype to reference alignments kept in an LRU'
+        ' cache, so that overlapping or repeated windows do not align the same'
+        ' haplotypes again. 0 disables the cache.'
+    ),
+)
 _REALIGNER_DIAGNOSTICS = flags.DEFINE_string(
     'realigner_diagnostics',
     '',
@@ -234,6 +253,16 @@ _SPLIT_SKIP_READS = flags.DEFINE_bool(
 _KMER_SIZE = flags.DEFINE_integer(
     'kmer_size', 32, 'K-mer size for fast pass alinger reads index.'
 )
+_REALIGNER_NUM_THREADS = flags.DEFINE_integer(
+    'realigner_num_threads',
+    1,
+    (
+        'Number of threads used to assemble and align the windows of a region.'
+        ' With more than 1, the windows are realigned in C++ on a thread pool'
+        ' and the realigned reads are sorted by position. Not used when'
+        ' --realigner_diagnostics is set.'
+    ),
+)
 
 # Margin added to the reference sequence for the aligner module.
 _REF_ALIGN_MARGIN = 20
@@ -383,6 +412,10 @@ def realigner_config(flags_obj):
       realignment_similarity_threshold=flags_obj.realignment_similarity_threshold,
       kmer_size=flags_obj.kmer_size,
       force_alignment=False,
+      batch_smith_waterman=flags_obj.aln_batch_smith_waterman,
+      haplotype_alignment_cache_size=(
+          flags_obj.aln_haplotype_alignment_cache_size
+      ),
   )
 
   diagnostics = realigner_pb2.Diagnostics(
@@ -407,6 +440,7 @@ def realigner_config(flags_obj):
       diagnostics=diagnostics,
       split_skip_reads=flags_obj.split_skip_reads,
       normalize_reads=normalize_reads,
+      num_threads=flags_obj.realigner_num_threads,
   )
 
 
@@ -419,24 +453,36 @@ class DiagnosticLogger(object):
       graph_filename='graph.dot',
       metrics_filename='realigner_metrics.csv',
       realigned_reads_filename='realigned_reads.bam',
+      cache_metrics_filename='haplotype_alignment_cache_metrics.csv',
   ):
     self.config = config
     self.graph_filename = graph_filename
     self.metrics_filename = metrics_filename
     self.realigned_reads_filename = realigned_reads_filename
+    self.cache_metrics_filename = cache_metrics_filename
 
     # Setup diagnostics outputs if requested.
     if self.enabled:
       self._csv_file = open(self._root_join(self.metrics_filename), 'w')
       self._csv_writer = csv.writer(self._csv_file)
       self._write_csv_line('window', 'k', 'n_haplotypes', 'time')
+      self._cache_csv_file = open(
+          self._root_join(self.cache_metrics_filename), 'w'
+      )
+      self._cache_csv_writer = csv.writer(self._cache_csv_file)
+      self._cache_csv_writer.writerow(
+          ('region', 'hits', 'misses', 'evictions', 'size')
+      )
     else:
       self._csv_file = None
       self._csv_writer = None
+      self._cache_csv_file = None
+      self._cache_csv_writer = None
 
   def close(self):
     if self.enabled:
       self._csv_file.close()
+      self._cache_csv_file.close()
 
   @property
   def enabled(self):
@@ -490,6 +536,17 @@ class DiagnosticLogger(object):
           graph_building_time,
       )
 
+  def log_haplotype_alignment_cache_metrics(self, region, cache):
+    """Logs, if enabled, the cumulative counters of cache after region."""
+    if self.enabled and cache is not None:
+      self._cache_csv_writer.writerow((
+          ranges.to_literal(region),
+          cache.hits,
+          cache.misses,
+          cache.evictions,
+          cache.size,
+      ))
+
 
 class AssemblyRegion(object):
   """A region to assemble, holding the region Range and the reads.
@@ -681,6 +738,22 @@ class Realigner(object):
     self.ref_reader = ref_reader
     self.diagnostic_logger = DiagnosticLogger(self.config.diagnostics)
     self.shared_header = shared_header
+    # Shared by all the FastPassAligners of this realigner, which align in
+    # this thread only.
+    self.haplotype_alignment_cache = None
+    if self.config.aln_config.haplotype_alignment_cache_size > 0:
+      self.haplotype_alignment_cache = (
+          fast_pass_aligner.HaplotypeAlignmentCache(
+              self.config.aln_config.haplotype_alignment_cache_size
+          )
+      )
+    # Realigns the windows of a region on several threads. The diagnostics are
+    # only logged by the Python implementation.
+    self.window_realigner = None
+    if self.config.num_threads > 1 and not self.diagnostic_logger.enabled:
+      self.window_realigner = window_realigner.WindowRealigner(
+          self.config, self.ref_reader.c_reader, self.config.num_threads
+      )
 
   def call_debruijn_graph(self, windows, reads):
     """Helper function to call debruijn_graph module."""
@@ -697,7 +770,9 @@ class Realigner(object):
       window_reads = list(sam_reader.query(window))
 
       with timer.Timer() as t:
-        graph = debruijn_graph.build(ref, window_reads, self.config.dbg_config)
+        graph = debruijn_graph.build_compact(
+            ref, window_reads, self.config.dbg_config
+        )
       graph_building_time = t.GetDuration()
 
       if not graph:
@@ -761,6 +836,10 @@ class Realigner(object):
     fast_pass_realigner.set_ref_start(contig, ref_start)
     fast_pass_realigner.set_ref_prefix_len(len(ref_prefix))
     fast_pass_realigner.set_ref_suffix_len(len(ref_suffix))
+    if self.haplotype_alignment_cache is not None:
+      fast_pass_realigner.set_haplotype_alignment_cache(
+          self.haplotype_alignment_cache
+      )
     fast_pass_realigner.set_haplotypes(
         [
             ref_prefix + target + ref_suffix
@@ -807,6 +886,11 @@ class Realigner(object):
         self.config.ws_config, self.ref_reader, reads, region
     )
 
+    # With several threads, the steps below are done in C++ for all windows.
+    if self.window_realigner is not None:
+      realigned = self.window_realigner.realign_reads(candidate_windows, reads)
+      return realigned.candidate_haplotypes, realigned.reads
+
     # Assemble each of those regions.
     candidate_haplotypes = self.call_debruijn_graph(candidate_windows, reads)
     # Create our simple container to store candidate / read mappings.
@@ -831,6 +915,9 @@ class Realigner(object):
     self.diagnostic_logger.log_realigned_reads(
         region, realigned_reads, self.shared_header
     )
+    self.diagnostic_logger.log_haplotype_alignment_cache_metrics(
+        region, self.haplotype_alignment_cache
+    )
 
     return candidate_haplotypes, realigned_reads
 
@@ -877,6 +964,10 @@ class Realigner(object):
     central_allele_margin = min(len(prefix), len(suffix), 100)
     fast_pass_realigner.set_ref_prefix_len(len(prefix) - central_allele_margin)
     fast_pass_realigner.set_ref_suffix_len(len(suffix) - central_allele_margin)
+    if self.haplotype_alignment_cache is not None:
+      fast_pass_realigner.set_haplotype_alignment_cache(
+          self.haplotype_alignment_cache
+      )
     extended_haplotypes = [prefix + target + suffix for target in haplotypes]
     fast_pass_realigner.set_haplotypes(extended_haplotypes)
     return fast_pass_realigner.realign_reads(reads)
@@ -346,6 +346,28 @@ class RealignerTest(parameterized.TestCase):
           ref_pos >= variant.end):
         self.assertTrue(has_variant)
 
+  @parameterized.parameters(
+      dict(region_literal='chr20:10,046,080-10,046,307', num_threads=2),
+      dict(region_literal='chr20:10,095,379-10,095,500', num_threads=4),
+  )
+  def test_realigner_multithreaded(self, region_literal, num_threads):
+    region = ranges.parse_literal(region_literal)
+    reads = _get_reads(region)
+    expected_haplotypes, expected_reads = self.reads_realigner.realign_reads(
+        reads, region)
+
+    self.config.num_threads = num_threads
+    threaded_realigner = realigner.Realigner(self.config, self.ref_reader)
+    self.assertIsNotNone(threaded_realigner.window_realigner)
+    windows_haplotypes, realigned_reads = threaded_realigner.realign_reads(
+        reads, region)
+
+    self.assertEqual(expected_haplotypes, windows_haplotypes)
+    # The realigned reads are the same, sorted by position.
+    self.assertCountEqual(expected_reads, realigned_reads)
+    positions = [read.alignment.position.position for read in realigned_reads]
+    self.assertEqual(sorted(positions), positions)
+
   def test_realigner_doesnt_create_invalid_intervals(self):
     """Tests that read sets don't result in a crash in reference_fai.cc."""
     region = ranges.parse_literal('chr20:63,025,320-63,025,520')
@@ -418,6 +440,21 @@ class RealignerTest(parameterized.TestCase):
         # Check that our runtime is reasonable (greater than 0, less than 10 s).
         self.assertTrue(0.0 < float(rows[0]['time']) < 10.0)
 
+      # The haplotype alignment cache counters are logged once per region.
+      cache_metrics_file = os.path.join(
+          dx_dir,
+          self.reads_realigner.diagnostic_logger.cache_metrics_filename)
+      with epath.Path(cache_metrics_file).open('r') as fin:
+        rows = list(csv.DictReader(fin))
+        self.assertLen(rows, 1)
+        self.assertEqual(
+            set(rows[0].keys()),
+            {'region', 'hits', 'misses', 'evictions', 'size'})
+        self.assertEqual(rows[0]['region'], region_str)
+        self.assertEqual(
+            int(rows[0]['size']),
+            self.reads_realigner.haplotype_alignment_cache.size)
+
       # As does the subdirectory for this region.
       region_subdir = os.path.join(dx_dir, assembled_region_str)
       self.assertTrue(epath.Path(region_subdir).is_dir())
@@ -0,0 +1,314 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/window_realigner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include "deepvariant/realigner/compact_debruijn_graph.h"
+#include "absl/log/check.h"
+#include "third_party/nucleus/util/proto_ptr.h"
+#include "third_party/nucleus/util/utils.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using nucleus::genomics::v1::Range;
+using nucleus::genomics::v1::Read;
+
+namespace {
+
+// Margin of reference added around the reads of a window to align them, as
+// _REF_ALIGN_MARGIN in realigner.py.
+constexpr int64_t kRefAlignMargin = 20;
+
+// A window selected for assembly.
+struct Window {
+  Range range;
+  std::string ref;
+  // The candidate haplotypes of the window, or empty if the window has none
+  // other than the reference.
+  std::vector<std::string> haplotypes;
+};
+
+// A window with candidate haplotypes, and the reads assigned to it.
+struct AssembledWindow {
+  const Window* window;
+  std::vector<Read> reads;
+  int64_t read_start;
+  int64_t read_end;
+  // The reference the reads are aligned to: the window with ref_prefix_len
+  // and ref_suffix_len bases of flanking reference.
+  int64_t ref_start = 0;
+  std::string ref_seq;
+  int ref_prefix_len = 0;
+  int ref_suffix_len = 0;
+  // The reads are returned unchanged if false.
+  bool align = false;
+  std::unique_ptr<std::vector<Read>> realigned_reads;
+};
+
+// Number of bases read and range have in common, 0 if they are on different
+// contigs, as ranges.overlap_len() of the read_range() of read.
+int64_t OverlapLen(const Read& read, int64_t read_end, const Range& range) {
+  const auto& position = read.alignment().position();
+  if (position.reference_name() != range.reference_name()) {
+    return 0;
+  }
+  return std::max<int64_t>(0, std::min(read_end, range.end()) -
+                                  std::max(position.position(), range.start()));
+}
+
+}  // namespace
+
+WindowRealigner::WindowRealigner(const RealignerOptions& options,
+                                 const nucleus::GenomeReference* ref,
+                                 int num_threads)
+    : options_(options), ref_(ref), num_threads_(num_threads) {
+  CHECK(ref_ != nullptr);
+  CHECK_GT(num_threads_, 0);
+  const int cache_size = options_.aln_config().haplotype_alignment_cache_size();
+  if (cache_size > 0) {
+    for (int worker = 0; worker < num_threads_; ++worker) {
+      caches_.push_back(std::make_unique<HaplotypeAlignmentCache>(cache_size));
+    }
+  }
+}
+
+template <typename Fn>
+void WindowRealigner::ParallelFor(int n, const Fn& fn) {
+  std::atomic<int> next{0};
+  auto work = [&next, n, &fn](int worker) {
+    for (int i = next++; i < n; i = next++) {
+      fn(i, worker);
+    }
+  };
+  std::vector<std::thread> threads;
+  const int num_workers = std::min(num_threads_, n);
+  for (int worker = 1; worker < num_workers; ++worker) {
+    threads.emplace_back(work, worker);
+  }
+  work(0);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+nucleus::StatusOr<RealignedWindows> WindowRealigner::RealignReads(
+    const std::vector<Range>& windows, const std::vector<Read>& reads) {
+  // Reads the reference of the windows to assemble.
+  std::vector<Window> selected_windows;
+  for (const Range& range : windows) {
+    if (range.end() - range.start() > options_.ws_config().max_window_size() ||
+        !ref_->IsValidInterval(range)) {
+      continue;
+    }
+    nucleus::StatusOr<std::string> ref = ref_->GetBases(range);
+    if (!ref.ok()) {
+      return ref.status();
+    }
+    selected_windows.push_back({range, std::move(ref.ValueOrDie()), {}});
+  }
+
+  // Builds the graph of each window from the reads overlapping it.
+  ParallelFor(static_cast<int>(selected_windows.size()), [&](int i, int worker) {
+    Window& window = selected_windows[i];
+    std::vector<nucleus::ConstProtoPtr<const Read>> window_reads;
+    for (const Read& read : reads) {
+      if (nucleus::ReadOverlapsRegion(read, window.range)) {
+        window_reads.emplace_back(&read);
+      }
+    }
+    std::unique_ptr<CompactDeBruijnGraph> graph = CompactDeBruijnGraph::Build(
+        window.ref, window_reads, options_.dbg_config());
+    if (graph) {
+      std::vector<std::string> haplotypes = graph->CandidateHaplotypes();
+      if (!(haplotypes.size() == 1 && haplotypes[0] == window.ref)) {
+        window.haplotypes = std::move(haplotypes);
+      }
+    }
+  });
+
+  RealignedWindows output;
+  std::vector<AssembledWindow> assembled_windows;
+  for (const Window& window : selected_windows) {
+    if (!window.haplotypes.empty()) {
+      CandidateHaplotypes& candidates =
+          output.candidate_haplotypes.emplace_back();
+      *candidates.mutable_span() = window.range;
+      for (const std::string& haplotype : window.haplotypes) {
+        candidates.add_haplotypes(haplotype);
+      }
+      AssembledWindow& assembled = assembled_windows.emplace_back();
+      assembled.window = &window;
+    }
+  }
+
+  // Assigns each read to the window it overlaps most, the first one on ties.
+  // The reads overlapping no window are returned as they are.
+  for (const Read& read : reads) {
+    const int64_t read_end = nucleus::ReadEnd(read);
+    AssembledWindow* best = nullptr;
+    int64_t best_overlap = 0;
+    for (AssembledWindow& assembled : assembled_windows) {
+      const int64_t overlap =
+          OverlapLen(read, read_end, assembled.window->range);
+      if (overlap > best_overlap) {
+        best = &assembled;
+        best_overlap = overlap;
+      }
+    }
+    if (best == nullptr) {
+      output.reads.push_back(read);
+      continue;
+    }
+    const int64_t read_start = read.alignment().position().position();
+    if (best->reads.empty()) {
+      best->read_start = read_start;
+      best->read_end = read_end;
+    } else {
+      best->read_start = std::min(best->read_start, read_start);
+      best->read_end = std::max(best->read_end, read_end);
+    }
+    best->reads.push_back(read);
+  }
+
+  // Reads the reference each window's reads are aligned to, as
+  // Realigner.call_fast_pass_aligner() does.
+  for (AssembledWindow& assembled : assembled_windows) {
+    if (assembled.reads.empty()) {
+      continue;
+    }
+    const Range& range = assembled.window->range;
+    nucleus::StatusOr<const nucleus::genomics::v1::ContigInfo*> contig =
+        ref_->Contig(range.reference_name());
+    if (!contig.ok()) {
+      return contig.status();
+    }
+    const int64_t ref_start = std::max<int64_t>(
+        0, std::min(assembled.read_start, range.start()) - kRefAlignMargin);
+    const int64_t ref_end =
+        std::min(contig.ValueOrDie()->n_bases(),
+                 std::max(assembled.read_end, range.end()) + kRefAlignMargin);
+    // Without a reference suffix the reads keep their alignments.
+    if (ref_end <= range.end()) {
+      continue;
+    }
+    nucleus::StatusOr<std::string> ref_seq = ref_->GetBases(
+        nucleus::MakeRange(range.reference_name(), ref_start, ref_end));
+    if (!ref_seq.ok()) {
+      return ref_seq.status();
+    }
+    assembled.ref_start = ref_start;
+    assembled.ref_seq = std::move(ref_seq.ValueOrDie());
+    assembled.ref_prefix_len = range.start() - ref_start;
+    assembled.ref_suffix_len = ref_end - range.end();
+    assembled.align = true;
+  }
+
+  // Aligns the reads of each window to its haplotypes.
+  ParallelFor(static_cast<int>(assembled_windows.size()), [&](int i, int worker) {
+    AssembledWindow& assembled = assembled_windows[i];
+    if (!assembled.align) {
+      return;
+    }
+    AlignerOptions aln_options = options_.aln_config();
+    // Read sizes may vary. We need this for realigner initialization and
+    // sanity checks.
+    aln_options.set_read_size(assembled.reads[0].aligned_sequence().size());
+    aln_options.set_force_alignment(false);
+
+    FastPassAligner aligner;
+    aligner.set_normalize_reads(options_.normalize_reads());
+    aligner.set_options(aln_options);
+    aligner.set_reference(assembled.ref_seq);
+    aligner.set_ref_start(assembled.window->range.reference_name(),
+                          assembled.ref_start);
+    aligner.set_ref_prefix_len(assembled.ref_prefix_len);
+    aligner.set_ref_suffix_len(assembled.ref_suffix_len);
+    if (!caches_.empty()) {
+      aligner.set_haplotype_alignment_cache(caches_[worker].get());
+    }
+    const std::string prefix =
+        assembled.ref_seq.substr(0, assembled.ref_prefix_len);
+    const std::string suffix = assembled.ref_seq.substr(
+        assembled.ref_seq.size() - assembled.ref_suffix_len);
+    std::vector<std::string> haplotypes;
+    for (const std::string& haplotype : assembled.window->haplotypes) {
+      haplotypes.push_back(prefix + haplotype + suffix);
+    }
+    aligner.set_haplotypes(haplotypes);
+    assembled.realigned_reads = aligner.AlignReads(assembled.reads);
+  });
+
+  for (AssembledWindow& assembled : assembled_windows) {
+    std::vector<Read>& window_reads =
+        assembled.align ? *assembled.realigned_reads : assembled.reads;
+    std::move(window_reads.begin(), window_reads.end(),
+              std::back_inserter(output.reads));
+  }
+  std::stable_sort(output.reads.begin(), output.reads.end(),
+                   [](const Read& read1, const Read& read2) {
+                     return nucleus::ComparePositions(
+                                read1.alignment().position(),
+                                read2.alignment().position()) < 0;
+                   });
+  return output;
+}
+
+int64_t WindowRealigner::HaplotypeAlignmentCacheHits() const {
+  int64_t hits = 0;
+  for (const auto& cache : caches_) {
+    hits += cache->hits();
+  }
+  return hits;
+}
+
+int64_t WindowRealigner::HaplotypeAlignmentCacheMisses() const {
+  int64_t misses = 0;
+  for (const auto& cache : caches_) {
+    misses += cache->misses();
+  }
+  return misses;
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_WINDOW_REALIGNER_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_WINDOW_REALIGNER_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "deepvariant/protos/realigner.pb.h"
+#include "deepvariant/realigner/fast_pass_aligner.h"
+#include "third_party/nucleus/core/statusor.h"
+#include "third_party/nucleus/io/reference.h"
+#include "third_party/nucleus/protos/range.pb.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+// The output of WindowRealigner::RealignReads() for a region.
+struct RealignedWindows {
+  // The windows whose assembly found haplotypes other than the reference, in
+  // the order of the windows.
+  std::vector<CandidateHaplotypes> candidate_haplotypes;
+  // All the reads of the region, realigned or not, sorted by position.
+  std::vector<nucleus::genomics::v1::Read> reads;
+};
+
+// Realigns the reads of a region, assembling and aligning its windows on a
+// pool of threads.
+//
+// This does what Realigner.realign_reads() in realigner.py does once the
+// windows are selected: a CompactDeBruijnGraph is built for each window from
+// the reads overlapping it, each read is assigned to the window it overlaps
+// most, and the reads of each window with candidate haplotypes are realigned
+// by a FastPassAligner. The windows are independent, so graph construction and
+// then read alignment run concurrently across windows. The reference is only
+// read from the calling thread, since GenomeReference implementations such as
+// IndexedFastaReader are not thread safe.
+//
+// Each worker thread owns a HaplotypeAlignmentCache of
+// options.aln_config().haplotype_alignment_cache_size() entries.
+class WindowRealigner {
+ public:
+  // ref must outlive this WindowRealigner. num_threads must be positive.
+  WindowRealigner(const RealignerOptions& options,
+                  const nucleus::GenomeReference* ref, int num_threads);
+
+  // Realigns reads, the reads of a region, in windows, as selected by the
+  // WindowSelector for that region. Windows longer than
+  // options.ws_config().max_window_size() or outside of the reference are
+  // skipped. Returns an error if the reference cannot be read.
+  nucleus::StatusOr<RealignedWindows> RealignReads(
+      const std::vector<nucleus::genomics::v1::Range>& windows,
+      const std::vector<nucleus::genomics::v1::Read>& reads);
+
+  int NumThreads() const { return num_threads_; }
+
+  // Hit and miss counts, summed over the caches of all worker threads.
+  int64_t HaplotypeAlignmentCacheHits() const;
+  int64_t HaplotypeAlignmentCacheMisses() const;
+
+ private:
+  // Runs fn(i, worker) for i in [0, n) on up to num_threads_ threads, the
+  // calling thread being one of them. worker is the index, in
+  // [0, num_threads_), of the thread running fn.
+  template <typename Fn>
+  void ParallelFor(int n, const Fn& fn);
+
+  const RealignerOptions options_;
+  const nucleus::GenomeReference* const ref_;
+  const int num_threads_;
+  // One per worker thread, or empty if the cache is disabled.
+  std::vector<std::unique_ptr<HaplotypeAlignmentCache>> caches_;
+};
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_WINDOW_REALIGNER_H_
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/window_realigner.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "deepvariant/protos/realigner.pb.h"
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/nucleus/io/reference.h"
+#include "third_party/nucleus/protos/cigar.pb.h"
+#include "third_party/nucleus/protos/range.pb.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+#include "third_party/nucleus/protos/reference.pb.h"
+#include "third_party/nucleus/testing/protocol-buffer-matchers.h"
+#include "third_party/nucleus/testing/test_utils.h"
+#include "third_party/nucleus/util/utils.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using nucleus::EqualsProto;
+using nucleus::genomics::v1::CigarUnit;
+using nucleus::genomics::v1::Range;
+using nucleus::genomics::v1::Read;
+using ::testing::Pointwise;
+
+constexpr char kChr[] = "chr1";
+constexpr int kRefLength = 2000;
+constexpr int kReadLength = 100;
+// 4 bp deletions at these positions, each in its own window.
+constexpr int kDeletionStarts[] = {500, 1300};
+constexpr int kDeletionLength = 4;
+
+class WindowRealignerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    std::mt19937 gen(42);
+    for (int i = 0; i < kRefLength; ++i) {
+      ref_bases_.push_back("ACGT"[gen() % 4]);
+    }
+    nucleus::genomics::v1::ContigInfo contig;
+    contig.set_name(kChr);
+    contig.set_n_bases(kRefLength);
+    nucleus::genomics::v1::ReferenceSequence seq;
+    *seq.mutable_region() = nucleus::MakeRange(kChr, 0, kRefLength);
+    seq.set_bases(ref_bases_);
+    ref_ = std::move(
+        nucleus::InMemoryFastaReader::Create({contig}, {seq}).ValueOrDie());
+
+    RealignerOptions& options = options_;
+    options.mutable_ws_config()->set_max_window_size(1000);
+    DeBruijnGraphOptions& dbg = *options.mutable_dbg_config();
+    dbg.set_min_k(10);
+    dbg.set_max_k(101);
+    dbg.set_step_k(1);
+    dbg.set_min_mapq(14);
+    dbg.set_min_base_quality(15);
+    dbg.set_min_edge_weight(2);
+    dbg.set_max_num_paths(256);
+    AlignerOptions& aln = *options.mutable_aln_config();
+    aln.set_match(4);
+    aln.set_mismatch(6);
+    aln.set_gap_open(8);
+    aln.set_gap_extend(2);
+    aln.set_k(23);
+    aln.set_error_rate(.01);
+    aln.set_max_num_of_mismatches(2);
+    aln.set_realignment_similarity_threshold(0.16934);
+    aln.set_kmer_size(32);
+    aln.set_haplotype_alignment_cache_size(16);
+
+    for (int deletion_start : kDeletionStarts) {
+      windows_.push_back(nucleus::MakeRange(kChr, deletion_start - 30,
+                                            deletion_start + 30));
+    }
+  }
+
+  // Reads of the haplotype with the deletion at deletion_start, starting at
+  // start, every step bases, as an aligner not allowing gaps would place them.
+  void AddDeletionReads(int deletion_start, int start, int end, int step) {
+    const std::string alt =
+        ref_bases_.substr(0, deletion_start) +
+        ref_bases_.substr(deletion_start + kDeletionLength);
+    for (int pos = start; pos < end; pos += step) {
+      reads_.push_back(nucleus::MakeRead(
+          kChr, pos, alt.substr(pos, kReadLength),
+          {absl::StrCat(kReadLength, "M")}, absl::StrCat("read_", pos)));
+    }
+  }
+
+  // Reads of the reference, which no window overlaps.
+  void AddReferenceReads(int start, int end, int step) {
+    for (int pos = start; pos < end; pos += step) {
+      reads_.push_back(nucleus::MakeRead(
+          kChr, pos, ref_bases_.substr(pos, kReadLength),
+          {absl::StrCat(kReadLength, "M")}, absl::StrCat("ref_read_", pos)));
+    }
+  }
+
+  RealignedWindows Realign(int num_threads) {
+    WindowRealigner realigner(options_, ref_.get(), num_threads);
+    EXPECT_EQ(realigner.NumThreads(), num_threads);
+    return realigner.RealignReads(windows_, reads_).ValueOrDie();
+  }
+
+  std::string ref_bases_;
+  std::unique_ptr<nucleus::InMemoryFastaReader> ref_;
+  RealignerOptions options_;
+  std::vector<Range> windows_;
+  std::vector<Read> reads_;
+};
+
+// Returns the reference position of the first deletion of read, or -1.
+int64_t DeletionStart(const Read& read) {
+  int64_t pos = read.alignment().position().position();
+  for (const CigarUnit& cigar : read.alignment().cigar()) {
+    if (cigar.operation() == CigarUnit::DELETE) {
+      return pos;
+    }
+    if (cigar.operation() == CigarUnit::ALIGNMENT_MATCH ||
+        cigar.operation() == CigarUnit::SEQUENCE_MATCH ||
+        cigar.operation() == CigarUnit::SEQUENCE_MISMATCH) {
+      pos += cigar.operation_length();
+    }
+  }
+  return -1;
+}
+
+TEST_F(WindowRealignerTest, RealignsReadsOfEachWindow) {
+  for (int deletion_start : kDeletionStarts) {
+    AddDeletionReads(deletion_start, deletion_start - 80, deletion_start - 10,
+                     3);
+  }
+  AddReferenceReads(100, 300, 20);
+
+  const RealignedWindows realigned = Realign(4);
+
+  ASSERT_EQ(realigned.candidate_haplotypes.size(), 2);
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_THAT(realigned.candidate_haplotypes[i].span(),
+                EqualsProto(windows_[i]));
+    EXPECT_EQ(realigned.candidate_haplotypes[i].haplotypes_size(), 2);
+  }
+  ASSERT_EQ(realigned.reads.size(), reads_.size());
+  int num_deletions = 0;
+  for (size_t i = 0; i < realigned.reads.size(); ++i) {
+    const Read& read = realigned.reads[i];
+    if (i > 0) {
+      EXPECT_LE(realigned.reads[i - 1].alignment().position().position(),
+                read.alignment().position().position());
+    }
+    const int64_t deletion_start = DeletionStart(read);
+    if (absl::StartsWith(read.fragment_name(), "ref_read_")) {
+      EXPECT_EQ(deletion_start, -1);
+    } else if (deletion_start != -1) {
+      // The deletion may be shifted within a repeat of its bases.
+      EXPECT_TRUE(std::abs(deletion_start - kDeletionStarts[0]) <
+                      kDeletionLength ||
+                  std::abs(deletion_start - kDeletionStarts[1]) <
+                      kDeletionLength)
+          << deletion_start;
+      ++num_deletions;
+    }
+  }
+  EXPECT_GT(num_deletions, 0);
+}
+
+TEST_F(WindowRealignerTest, SameOutputWithAnyNumberOfThreads) {
+  for (int deletion_start : kDeletionStarts) {
+    AddDeletionReads(deletion_start, deletion_start - 80, deletion_start - 10,
+                     2);
+  }
+  // More windows than threads, some without variants.
+  for (int start = 700; start < 1200; start += 100) {
+    windows_.push_back(nucleus::MakeRange(kChr, start, start + 50));
+  }
+  AddReferenceReads(650, 1150, 10);
+
+  const RealignedWindows expected = Realign(1);
+  for (int num_threads : {2, 3, 8}) {
+    const RealignedWindows realigned = Realign(num_threads);
+    EXPECT_THAT(realigned.candidate_haplotypes,
+                Pointwise(EqualsProto(), expected.candidate_haplotypes));
+    EXPECT_THAT(realigned.reads, Pointwise(EqualsProto(), expected.reads));
+  }
+
+  options_.mutable_aln_config()->set_haplotype_alignment_cache_size(0);
+  const RealignedWindows uncached = Realign(3);
+  EXPECT_THAT(uncached.reads, Pointwise(EqualsProto(), expected.reads));
+}
+
+TEST_F(WindowRealignerTest, SkipsWindowsTooLongOrOffTheReference) {
+  AddDeletionReads(kDeletionStarts[0], kDeletionStarts[0] - 80,
+                   kDeletionStarts[0] - 10, 3);
+  windows_ = {nucleus::MakeRange(kChr, 0, 1500),
+              nucleus::MakeRange(kChr, kRefLength - 10, kRefLength + 40),
+              nucleus::MakeRange("chr2", 100, 150)};
+
+  const RealignedWindows realigned = Realign(2);
+
+  EXPECT_TRUE(realigned.candidate_haplotypes.empty());
+  ASSERT_EQ(realigned.reads.size(), reads_.size());
+  for (size_t i = 0; i < reads_.size(); ++i) {
+    EXPECT_THAT(realigned.reads[i], EqualsProto(reads_[i]));
+  }
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -57,19 +57,17 @@ void UpdateCounts(T by, int start, int end, std::vector<T>* counts) {
 std::vector<int> VariantReadsWindowSelectorCandidates(
     const AlleleCounter& allele_counter) {
   // We start with a vector of 0s, one for each position in allele_counter.
-  std::vector<int> window_counts(allele_counter.Counts().size(), 0);
+  std::vector<int> window_counts(allele_counter.NumPositions(), 0);
 
   // Now loop over all of the counts, incrementing the window_counts for all
-  // SUBSTITITION, INSERT, DELETE, and SOFT_CLIP alleles.
-  const std::vector<AlleleCount>& counts = allele_counter.Counts();
-  for (int i = 0; i < counts.size(); ++i) {
-    for (const auto& entry : counts[i].read_alleles()) {
-      const Allele& allele = entry.second;
-
+  // SUBSTITITION, INSERT, DELETE, and SOFT_CLIP alleles. The columnar view of
+  // the counter is used so that no AlleleCount protos are built.
+  for (int i = 0; i < allele_counter.NumPositions(); ++i) {
+    allele_counter.ForEachReadAllele(i, [&](const Allele& allele) {
       // We used to discard low quality allele counts. Now we keep them, but
       // in order to maintain the original logic the filter is added.
       if (allele.is_low_quality()) {
-        continue;
+        return;
       }
 
       int start, end;
@@ -96,10 +94,11 @@ std::vector<int> VariantReadsWindowSelectorCandidates(
         default:
           LOG(FATAL) << "Saw an Allele " << allele.DebugString()
                      << " with an unexpected type " << allele.type()
-                     << " in AlleleCount " << counts[i].DebugString()
+                     << " in AlleleCount "
+                     << allele_counter.CountAt(i).DebugString()
                      << " which should never happen.";
       }
-    }
+    });
   }
 
   return window_counts;
@@ -108,18 +107,15 @@ std::vector<int> VariantReadsWindowSelectorCandidates(
 std::vector<float> AlleleCountLinearWindowSelectorCandidates(
     const AlleleCounter& allele_counter,
     const WindowSelectorModel::AlleleCountLinearModel& config) {
-  std::vector<float> window_scores(allele_counter.Counts().size(),
+  std::vector<float> window_scores(allele_counter.NumPositions(),
                                    config.bias());
 
-  const std::vector<AlleleCount>& counts = allele_counter.Counts();
-  for (int i = 0; i < counts.size(); ++i) {
-    UpdateCounts(
-        counts[i].ref_supporting_read_count() * config.coeff_reference(), i,
-        i + 1, &window_scores);
-
-    for (const auto& entry : counts[i].read_alleles()) {
-      const Allele& allele = entry.second;
+  for (int i = 0; i < allele_counter.NumPositions(); ++i) {
+    UpdateCounts(allele_counter.RefSupportingReadCount(i) *
+                     config.coeff_reference(),
+                 i, i + 1, &window_scores);
 
+    allele_counter.ForEachReadAllele(i, [&](const Allele& allele) {
       int start, end;
       switch (allele.type()) {
         case SUBSTITUTION:
@@ -156,10 +152,11 @@ std::vector<float> AlleleCountLinearWindowSelectorCandidates(
         default:
           LOG(FATAL) << "Saw an Allele " << allele.DebugString()
                      << " with an unexpected type " << allele.type()
-                     << " in AlleleCount " << counts[i].DebugString()
+                     << " in AlleleCount "
+                     << allele_counter.CountAt(i).DebugString()
                      << " which should never happen.";
       }
-    }
+    });
   }
 
   return window_scores;
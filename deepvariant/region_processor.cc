@@ -0,0 +1,642 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/region_processor.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "deepvariant/allelecounter.h"
+#include "third_party/nucleus/protos/example.pb.h"
+#include "third_party/nucleus/util/proto_ptr.h"
+#include "third_party/nucleus/util/utils.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using nucleus::genomics::v1::Range;
+using nucleus::genomics::v1::Read;
+using nucleus::genomics::v1::Variant;
+
+namespace {
+
+// Same as dv_utils_using_clif.EncodedVariantType.
+enum class EncodedVariantType { kUnknown = 0, kSnp = 1, kIndel = 2 };
+
+// Same as variant_utils.is_snp() and variant_utils.is_indel().
+EncodedVariantType GetEncodedVariantType(const Variant& variant) {
+  std::vector<const std::string*> alts;
+  for (const std::string& alt : variant.alternate_bases()) {
+    if (alt != "<*>" && alt != "<NON_REF>" && alt != ".") {
+      alts.push_back(&alt);
+    }
+  }
+  if (alts.empty()) {
+    return EncodedVariantType::kUnknown;
+  }
+  const bool all_alts_are_bases =
+      std::all_of(alts.begin(), alts.end(),
+                  [](const std::string* alt) { return alt->size() == 1; });
+  if (variant.reference_bases().size() == 1 && all_alts_are_bases) {
+    return EncodedVariantType::kSnp;
+  }
+  if (variant.reference_bases().size() > 1 || !all_alts_are_bases) {
+    return EncodedVariantType::kIndel;
+  }
+  return EncodedVariantType::kUnknown;
+}
+
+// Same as dv_utils_using_clif.make_example(), without a second image.
+std::string MakeExample(const Variant& variant,
+                        const std::vector<std::string>& alt_alleles,
+                        const PileupImage& image, int sequencing_type) {
+  tensorflow::Example example;
+  auto& features = *example.mutable_features()->mutable_feature();
+  features["locus"].mutable_bytes_list()->add_value(
+      absl::StrCat(variant.reference_name(), ":", variant.start() + 1, "-",
+                   variant.end()));
+  features["variant/encoded"].mutable_bytes_list()->add_value(
+      variant.SerializeAsString());
+  features["variant_type"].mutable_int64_list()->add_value(
+      static_cast<int64_t>(GetEncodedVariantType(variant)));
+
+  CallVariantsOutput::AltAlleleIndices alt_allele_indices;
+  std::vector<int> indices;
+  for (const std::string& alt : alt_alleles) {
+    const auto& alts = variant.alternate_bases();
+    indices.push_back(std::find(alts.begin(), alts.end(), alt) - alts.begin());
+  }
+  std::sort(indices.begin(), indices.end());
+  for (int index : indices) {
+    alt_allele_indices.add_indices(index);
+  }
+  features["alt_allele_indices/encoded"].mutable_bytes_list()->add_value(
+      alt_allele_indices.SerializeAsString());
+
+  features["image/encoded"].mutable_bytes_list()->add_value(
+      std::string(image.data.begin(), image.data.end()));
+  auto* shape = features["image/shape"].mutable_int64_list();
+  shape->add_value(image.height);
+  shape->add_value(image.width);
+  shape->add_value(image.num_channels);
+  features["sequencing_type"].mutable_int64_list()->add_value(sequencing_type);
+  return example.SerializeAsString();
+}
+
+// Same as PileupImageCreator._alt_allele_combinations().
+std::vector<std::vector<std::string>> AltAlleleCombinations(
+    const Variant& variant,
+    PileupImageOptions::MultiAllelicMode multi_allelic_mode) {
+  std::vector<std::vector<std::string>> combinations;
+  if (multi_allelic_mode == PileupImageOptions::NO_HET_ALT_IMAGES) {
+    for (const std::string& alt : variant.alternate_bases()) {
+      combinations.push_back({alt});
+    }
+    return combinations;
+  }
+  std::vector<std::string> alleles = {variant.reference_bases()};
+  alleles.insert(alleles.end(), variant.alternate_bases().begin(),
+                 variant.alternate_bases().end());
+  for (int i = 0; i < alleles.size(); ++i) {
+    for (int j = i + 1; j < alleles.size(); ++j) {
+      std::set<std::string> alts = {alleles[i], alleles[j]};
+      alts.erase(variant.reference_bases());
+      combinations.emplace_back(alts.begin(), alts.end());
+    }
+  }
+  return combinations;
+}
+
+// Returns numpy.random.RandomState.randint(0, max + 1), drawn from gen as
+// PileupImageBuilder::ShuffleLikeNumpy() draws its indices.
+uint32_t RandIntLikeNumpy(uint32_t max, std::mt19937* gen) {
+  if (max == 0) {
+    return 0;
+  }
+  uint32_t mask = max;
+  mask |= mask >> 1;
+  mask |= mask >> 2;
+  mask |= mask >> 4;
+  mask |= mask >> 8;
+  mask |= mask >> 16;
+  uint32_t value;
+  do {
+    value = static_cast<uint32_t>((*gen)()) & mask;
+  } while (value > max);
+  return value;
+}
+
+int64_t OverlapLen(const Range& region, const Read& read) {
+  if (region.reference_name() != read.alignment().position().reference_name()) {
+    return 0;
+  }
+  return std::max<int64_t>(
+      0, std::min<int64_t>(region.end(), nucleus::ReadEnd(read)) -
+             std::max<int64_t>(region.start(), nucleus::ReadStart(read)));
+}
+
+}  // namespace
+
+nucleus::StatusOr<std::unique_ptr<RegionProcessor>> RegionProcessor::Create(
+    const MakeExamplesOptions& options, const nucleus::GenomeReference* ref) {
+  // Same as RegionProcessor._make_sam_readers().
+  nucleus::genomics::v1::SamReaderOptions sam_options;
+  *sam_options.mutable_read_requirements() = options.read_requirements();
+  sam_options.set_aux_field_handling(
+      options.parse_sam_aux_fields()
+          ? nucleus::genomics::v1::SamReaderOptions::PARSE_ALL_AUX_FIELDS
+          : nucleus::genomics::v1::SamReaderOptions::SKIP_AUX_FIELDS);
+  *sam_options.mutable_aux_fields_to_keep() = options.aux_fields_to_keep();
+  sam_options.set_hts_block_size(options.hts_block_size());
+  sam_options.set_random_seed(options.random_seed());
+  sam_options.set_use_original_base_quality_scores(
+      options.use_original_quality_scores());
+  const std::string ref_path =
+      options.use_ref_for_cram() ? options.reference_filename() : "";
+
+  std::vector<std::vector<std::unique_ptr<nucleus::SamReader>>> sam_readers(
+      options.sample_options_size());
+  for (int i = 0; i < options.sample_options_size(); ++i) {
+    const SampleOptions& sample = options.sample_options(i);
+    sam_options.set_downsample_fraction(sample.downsample_fraction());
+    for (const std::string& reads_filename : sample.reads_filenames()) {
+      if (reads_filename.empty()) {
+        continue;
+      }
+      nucleus::StatusOr<std::unique_ptr<nucleus::SamReader>> reader =
+          nucleus::SamReader::FromFile(reads_filename, ref_path, sam_options);
+      if (!reader.ok()) {
+        return reader.status();
+      }
+      sam_readers[i].push_back(std::move(reader.ValueOrDie()));
+    }
+  }
+  return std::make_unique<RegionProcessor>(options, ref,
+                                           std::move(sam_readers));
+}
+
+nucleus::StatusOr<std::unique_ptr<RegionProcessor>> RegionProcessor::Clone(
+    const nucleus::GenomeReference* ref) const {
+  std::vector<std::vector<std::unique_ptr<nucleus::SamReader>>> sam_readers(
+      sam_readers_.size());
+  for (int i = 0; i < sam_readers_.size(); ++i) {
+    for (const std::unique_ptr<nucleus::SamReader>& sam_reader :
+         sam_readers_[i]) {
+      nucleus::StatusOr<std::unique_ptr<nucleus::SamReader>> clone =
+          sam_reader->Clone();
+      if (!clone.ok()) {
+        return clone.status();
+      }
+      sam_readers[i].push_back(std::move(clone.ValueOrDie()));
+    }
+  }
+  return std::make_unique<RegionProcessor>(options_, ref,
+                                           std::move(sam_readers));
+}
+
+RegionProcessor::RegionProcessor(
+    const MakeExamplesOptions& options, const nucleus::GenomeReference* ref,
+    std::vector<std::vector<std::unique_ptr<nucleus::SamReader>>> sam_readers)
+    : options_(options),
+      ref_(ref),
+      sam_readers_(std::move(sam_readers)),
+      pileup_image_builder_(options.pic_options()) {
+  CHECK(ref_ != nullptr);
+  CHECK_EQ(sam_readers_.size(), options_.sample_options_size());
+  CHECK(UnsupportedOption(options_).empty())
+      << "Unsupported option: " << UnsupportedOption(options_);
+  for (const SampleOptions& sample : options_.sample_options()) {
+    // Same as the VerySensitiveCaller of each sample.
+    variant_callers_.push_back(std::make_unique<multi_sample::VariantCaller>(
+        sample.variant_caller_options()));
+    variant_callers_.back()->SetReadRegistry(&read_registry_);
+    gvcf_block_builders_.push_back(std::make_unique<GvcfBlockBuilder>(
+        sample.variant_caller_options(), /*use_cache_table=*/true,
+        /*max_cache_coverage=*/100));
+  }
+}
+
+std::string RegionProcessor::UnsupportedOption(
+    const MakeExamplesOptions& options) {
+  if (options.mode() != MakeExamplesOptions::CALLING) {
+    return "mode";
+  }
+  if (options.variant_caller() != MakeExamplesOptions::VERY_SENSITIVE_CALLER) {
+    return "variant_caller";
+  }
+  if (options.realigner_enabled()) {
+    return "realigner_enabled";
+  }
+  if (options.use_allele_frequency()) {
+    return "use_allele_frequency";
+  }
+  if (options.allele_counter_options().track_ref_reads()) {
+    return "track_ref_reads";
+  }
+  if (options.allele_counter_options().normalize_reads()) {
+    return "normalize_reads";
+  }
+  if (!options.select_variant_types().empty()) {
+    return "select_variant_types";
+  }
+  if (options.output_sitelist()) {
+    return "output_sitelist";
+  }
+  if (!options.read_phases_output().empty()) {
+    return "read_phases_output";
+  }
+  if (!options.realigner_options().diagnostics().output_root().empty()) {
+    return "realigner_diagnostics";
+  }
+  const PileupImageOptions& pic_options = options.pic_options();
+  if (!pic_options.alt_aligned_pileup().empty() &&
+      pic_options.alt_aligned_pileup() != "none") {
+    return "alt_aligned_pileup";
+  }
+  if (pic_options.multi_allelic_mode() == PileupImageOptions::UNSPECIFIED) {
+    return "multi_allelic_mode";
+  }
+  for (const SampleOptions& sample : options.sample_options()) {
+    for (const std::string& reads_filename : sample.reads_filenames()) {
+      if (absl::StrContains(reads_filename, ".tfrecord")) {
+        return "reads";
+      }
+    }
+  }
+  return "";
+}
+
+nucleus::StatusOr<std::vector<RegionSampleOutputs>> RegionProcessor::Process(
+    const Range& region) {
+  google::protobuf::Arena arena;
+  std::vector<std::vector<Read*>> reads_for_samples(sam_readers_.size());
+  for (int i = 0; i < sam_readers_.size(); ++i) {
+    for (const auto& sam_reader : sam_readers_[i]) {
+      nucleus::StatusOr<std::shared_ptr<nucleus::SamIterable>> reads =
+          sam_reader->Query(region);
+      if (!reads.ok()) {
+        return reads.status();
+      }
+      while (true) {
+        Read* read = google::protobuf::Arena::CreateMessage<Read>(&arena);
+        nucleus::StatusOr<bool> has_read = reads.ValueOrDie()->Next(read);
+        if (!has_read.ok()) {
+          return has_read.status();
+        }
+        if (!has_read.ValueOrDie()) {
+          break;
+        }
+        reads_for_samples[i].push_back(read);
+      }
+    }
+  }
+  return ProcessRegion(region, std::move(reads_for_samples), &arena);
+}
+
+nucleus::StatusOr<std::vector<RegionSampleOutputs>>
+RegionProcessor::ProcessReads(
+    const Range& region,
+    const std::vector<std::vector<Read>>& reads_for_samples) {
+  CHECK_EQ(reads_for_samples.size(), options_.sample_options_size());
+  google::protobuf::Arena arena;
+  std::vector<std::vector<Read*>> reads(reads_for_samples.size());
+  for (int i = 0; i < reads_for_samples.size(); ++i) {
+    for (const Read& read : reads_for_samples[i]) {
+      reads[i].push_back(google::protobuf::Arena::CreateMessage<Read>(&arena));
+      *reads[i].back() = read;
+    }
+  }
+  return ProcessRegion(region, std::move(reads), &arena);
+}
+
+nucleus::StatusOr<std::vector<RegionSampleOutputs>>
+RegionProcessor::ProcessRegion(const Range& region,
+                               std::vector<std::vector<Read*>> reads_for_samples,
+                               google::protobuf::Arena* arena) {
+  const int num_samples = options_.sample_options_size();
+  num_reads_ = 0;
+  for (int i = 0; i < num_samples; ++i) {
+    reads_for_samples[i] = SampleReads(region, std::move(reads_for_samples[i]));
+    num_reads_ += reads_for_samples[i].size();
+  }
+  const bool gvcf_enabled = !options_.gvcf_filename().empty();
+
+  // With phasing, candidates are found over a padded region so that reads are
+  // phased with the candidates around the region.
+  Range counted_region = region;
+  const int padding_pct = options_.phase_reads_region_padding_pct();
+  if (options_.phase_reads() && padding_pct > 0) {
+    nucleus::StatusOr<const nucleus::genomics::v1::ContigInfo*> contig =
+        ref_->Contig(region.reference_name());
+    if (!contig.ok()) {
+      return contig.status();
+    }
+    const int64_t padding =
+        static_cast<int64_t>((region.end() - region.start()) * padding_pct /
+                             100.0);
+    counted_region.set_start(std::max<int64_t>(region.start() - padding, 0));
+    counted_region.set_end(std::min<int64_t>(region.end() + padding,
+                                             contig.ValueOrDie()->n_bases()));
+  }
+
+  read_registry_.Clear();
+  std::vector<std::vector<int32_t>> read_ids(num_samples);
+  std::vector<std::unique_ptr<AlleleCounter>> allele_counters(num_samples);
+  std::unordered_map<std::string, AlleleCounter*> allele_counters_by_name;
+  for (int i = 0; i < num_samples; ++i) {
+    const SampleOptions& sample = options_.sample_options(i);
+    if (sample.reads_filenames().empty()) {
+      continue;
+    }
+    allele_counters[i] = std::make_unique<AlleleCounter>(
+        ref_, counted_region, std::vector<int>(),
+        options_.allele_counter_options());
+    allele_counters[i]->SetReadRegistry(&read_registry_);
+    for (const Read* read : reads_for_samples[i]) {
+      read_ids[i].push_back(read_registry_.Register(*read));
+      if (nucleus::ReadOverlapsRegion(*read, region)) {
+        allele_counters[i]->Add(*read, read_ids[i].back(), sample.name());
+      }
+    }
+    allele_counters_by_name[sample.name()] = allele_counters[i].get();
+  }
+
+  std::vector<RegionSampleOutputs> outputs;
+  std::vector<std::vector<DeepVariantCall*>> candidates_for_outputs;
+  for (int i = 0; i < num_samples; ++i) {
+    const SampleOptions& sample = options_.sample_options(i);
+    if (sample.reads_filenames().empty()) {
+      continue;
+    }
+    std::vector<DeepVariantCall*> candidates =
+        variant_callers_[i]->CallsFromAlleleCounts(allele_counters_by_name,
+                                                   sample.name(), arena);
+    std::vector<Variant> gvcfs;
+    if (gvcf_enabled) {
+      nucleus::StatusOr<std::vector<Variant>> status_or_gvcfs =
+          gvcf_block_builders_[i]->MakeGvcfsFromAlleleCounter(
+              *allele_counters[i], region.start() - counted_region.start(),
+              counted_region.end() - region.end(), options_.include_med_dp());
+      if (!status_or_gvcfs.ok()) {
+        return status_or_gvcfs.status();
+      }
+      gvcfs = std::move(status_or_gvcfs.ValueOrDie());
+    }
+    if (options_.phase_reads()) {
+      std::vector<Read*> reads_to_phase;
+      std::vector<int32_t> read_ids_to_phase;
+      for (int j = 0; j < reads_for_samples[i].size(); ++j) {
+        if (nucleus::ReadOverlapsRegion(*reads_for_samples[i][j],
+                                        counted_region)) {
+          reads_to_phase.push_back(reads_for_samples[i][j]);
+          read_ids_to_phase.push_back(read_ids[i][j]);
+        }
+      }
+      NUCLEUS_RETURN_IF_ERROR(
+          PhaseReads(i, candidates, reads_to_phase, read_ids_to_phase));
+    }
+    if (sample.skip_output_generation()) {
+      continue;
+    }
+
+    RegionSampleOutputs sample_outputs;
+    sample_outputs.role = sample.role();
+    sample_outputs.gvcfs = std::move(gvcfs);
+    candidates.erase(
+        std::remove_if(candidates.begin(), candidates.end(),
+                       [&region](const DeepVariantCall* candidate) {
+                         return candidate->variant().start() <
+                                    region.start() ||
+                                candidate->variant().start() >= region.end();
+                       }),
+        candidates.end());
+    outputs.push_back(std::move(sample_outputs));
+    candidates_for_outputs.push_back(std::move(candidates));
+  }
+
+  // Images are built once all samples are phased, as they show the reads of
+  // every sample.
+  int output = 0;
+  for (int i = 0; i < num_samples; ++i) {
+    const SampleOptions& sample = options_.sample_options(i);
+    if (sample.reads_filenames().empty() || sample.skip_output_generation()) {
+      continue;
+    }
+    const std::vector<DeepVariantCall*>& candidates =
+        candidates_for_outputs[output];
+    NUCLEUS_RETURN_IF_ERROR(
+        MakeExamples(i, candidates, reads_for_samples, &outputs[output]));
+    // The read id sidecar only lives within the region.
+    outputs[output].candidates.reserve(candidates.size());
+    for (DeepVariantCall* candidate : candidates) {
+      candidate->clear_allele_support_ids();
+      candidate->clear_ref_support_ids();
+      outputs[output].candidates.push_back(*candidate);
+    }
+    ++output;
+  }
+  return outputs;
+}
+
+std::vector<Read*> RegionProcessor::SampleReads(const Range& region,
+                                                std::vector<Read*> reads) const {
+  const int max_reads = options_.max_reads_per_partition();
+  const int64_t max_bases_to_cover =
+      static_cast<int64_t>(options_.max_reads_for_dynamic_bases_per_region()) *
+      (region.end() - region.start());
+  if (max_reads <= 0 && max_bases_to_cover <= 0) {
+    return reads;
+  }
+
+  // A reservoir sample drawn from a new numpy.random.RandomState(random_seed)
+  // for each region and sample, as reservoir_sample_reads() draws it.
+  std::mt19937 gen(options_.random_seed());
+  const size_t k = max_reads > 0 ? max_reads : std::numeric_limits<int>::max();
+  std::vector<Read*> sampled;
+  std::vector<int64_t> overlap_lens;
+  int64_t bases_covered = 0;
+  for (size_t i = 0; i < reads.size(); ++i) {
+    if (sampled.size() < k &&
+        (max_bases_to_cover <= 0 || bases_covered < max_bases_to_cover)) {
+      sampled.push_back(reads[i]);
+      overlap_lens.push_back(OverlapLen(region, *reads[i]));
+      bases_covered += overlap_lens.back();
+      continue;
+    }
+    const uint32_t j = RandIntLikeNumpy(i, &gen);
+    if (j < sampled.size()) {
+      bases_covered -= overlap_lens[j];
+      sampled[j] = reads[i];
+      overlap_lens[j] = OverlapLen(region, *reads[i]);
+      bases_covered += overlap_lens[j];
+    }
+  }
+
+  if (max_bases_to_cover > 0 && bases_covered >= max_bases_to_cover) {
+    int64_t total_bases = 0;
+    for (size_t i = 0; i < overlap_lens.size(); ++i) {
+      total_bases += overlap_lens[i];
+      if (total_bases > max_bases_to_cover) {
+        sampled.resize(i + 1);
+        bases_covered = total_bases;
+        break;
+      }
+    }
+    LOG(INFO) << "In " << region.reference_name() << ":" << region.start()
+              << "-" << region.end() << ": sampled " << sampled.size()
+              << " reads because bases_covered(" << bases_covered
+              << ") > max_bases_to_cover(" << max_bases_to_cover << ").";
+  }
+  return sampled;
+}
+
+nucleus::Status RegionProcessor::PhaseReads(
+    int sample, const std::vector<DeepVariantCall*>& candidates,
+    const std::vector<Read*>& reads, const std::vector<int32_t>& read_ids) {
+  for (Read* read : reads) {
+    (*read->mutable_info())["HP"].clear_values();
+  }
+  const int max_candidates = options_.phase_max_candidates();
+  if (max_candidates > 0 && candidates.size() > max_candidates) {
+    LOG(INFO) << "Skip phasing: " << candidates.size() << " candidates for "
+              << options_.sample_options(sample).role() << ".";
+    return nucleus::Status();
+  }
+  std::vector<nucleus::ConstProtoPtr<const Read>> wrapped_reads(reads.begin(),
+                                                                reads.end());
+  nucleus::StatusOr<std::vector<int>> phases =
+      direct_phasing_.PhaseReads(candidates, wrapped_reads, read_ids);
+  if (!phases.ok()) {
+    return phases.status();
+  }
+  const bool reverse_haplotypes = options_.pic_options().reverse_haplotypes();
+  for (int i = 0; i < reads.size(); ++i) {
+    int phase = phases.ValueOrDie()[i];
+    if (reverse_haplotypes && (phase == 1 || phase == 2)) {
+      phase = 1 + phase % 2;
+    }
+    (*reads[i]->mutable_info())["HP"].add_values()->set_int_value(phase);
+  }
+  return nucleus::Status();
+}
+
+nucleus::Status RegionProcessor::MakeExamples(
+    int sample, const std::vector<DeepVariantCall*>& candidates,
+    const std::vector<std::vector<Read*>>& reads_for_samples,
+    RegionSampleOutputs* outputs) {
+  const PileupImageOptions& pic_options = options_.pic_options();
+  const int width = pic_options.width();
+  const int half_width = (width - 1) / 2;
+
+  // Candidates whose window runs off the contig get no examples, as in
+  // PileupImageCreator.create_pileup_images().
+  std::vector<const DeepVariantCall*> dv_calls;
+  std::vector<std::vector<std::string>> alt_alleles;
+  for (const DeepVariantCall* candidate : candidates) {
+    const Variant& variant = candidate->variant();
+    const int64_t window_start = variant.start() - half_width;
+    if (!ref_->IsValidInterval(nucleus::MakeRange(
+            variant.reference_name(), window_start, window_start + width))) {
+      continue;
+    }
+    for (std::vector<std::string>& alts :
+         AltAlleleCombinations(variant, pic_options.multi_allelic_mode())) {
+      dv_calls.push_back(candidate);
+      alt_alleles.push_back(std::move(alts));
+    }
+  }
+  if (dv_calls.empty()) {
+    return nucleus::Status();
+  }
+
+  const Variant& first = dv_calls.front()->variant();
+  const int64_t ref_start = first.start() - half_width;
+  const int64_t ref_end = dv_calls.back()->variant().start() - half_width + width;
+  // With a contig cache (see FastaReaderOptions.max_cached_contigs), the
+  // bases are read in place instead of copied for each region.
+  std::string ref_storage;
+  nucleus::StatusOr<absl::string_view> ref_bases = ref_->GetBasesViewOrCopy(
+      nucleus::MakeRange(first.reference_name(), ref_start, ref_end),
+      &ref_storage);
+  if (!ref_bases.ok()) {
+    return ref_bases.status();
+  }
+
+  // Same as the sample_order of PileupImageCreator.build_pileup().
+  std::vector<int> sample_order(
+      options_.sample_options(sample).order().begin(),
+      options_.sample_options(sample).order().end());
+  if (sample_order.empty()) {
+    for (int i = 0; i < options_.sample_options_size(); ++i) {
+      sample_order.push_back(i);
+    }
+  }
+  std::vector<std::vector<const Read*>> reads_in_order;
+  std::vector<int> sample_heights;
+  for (int i : sample_order) {
+    reads_in_order.emplace_back(reads_for_samples[i].begin(),
+                                reads_for_samples[i].end());
+    const int pileup_height = options_.sample_options(i).pileup_height();
+    sample_heights.push_back(pileup_height > 0 ? pileup_height
+                                               : pic_options.height());
+  }
+
+  std::vector<std::unique_ptr<PileupImage>> images =
+      pileup_image_builder_.BuildBatch(dv_calls, alt_alleles,
+                                       ref_bases.ValueOrDie(), ref_start,
+                                       reads_in_order, sample_heights);
+  outputs->examples.reserve(images.size());
+  for (int i = 0; i < images.size(); ++i) {
+    outputs->examples.push_back(MakeExample(dv_calls[i]->variant(),
+                                            alt_alleles[i], *images[i],
+                                            pic_options.sequencing_type()));
+  }
+  const PileupImage& image = *images.front();
+  outputs->example_shape = {image.height, image.width, image.num_channels};
+  return nucleus::Status();
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_REGION_PROCESSOR_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_REGION_PROCESSOR_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "deepvariant/direct_phasing.h"
+#include "deepvariant/gvcf_block_builder.h"
+#include "deepvariant/pileup_image_native.h"
+#include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/read_registry.h"
+#include "deepvariant/variant_calling_multisample.h"
+#include "third_party/nucleus/core/statusor.h"
+#include "third_party/nucleus/io/reference.h"
+#include "third_party/nucleus/io/sam_reader.h"
+#include "third_party/nucleus/protos/range.pb.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+#include "third_party/nucleus/protos/variants.pb.h"
+#include "google/protobuf/arena.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+// The outputs of one sample for a region, as make_examples writes them.
+struct RegionSampleOutputs {
+  // SampleOptions.role of the sample.
+  std::string role;
+  // The candidates of the region, in coordinate order.
+  std::vector<DeepVariantCall> candidates;
+  // gVCF records of the region, if MakeExamplesOptions.gvcf_filename is set.
+  std::vector<nucleus::genomics::v1::Variant> gvcfs;
+  // Serialized tf.Example protos of the candidates, as
+  // dv_utils_using_clif.make_example() builds them.
+  std::vector<std::string> examples;
+  // {height, width, channels} of the images, or empty without examples.
+  std::vector<int> example_shape;
+};
+
+// Runs the per-region pipeline of make_examples natively: queries the reads
+// of each sample, counts alleles, calls candidates, optionally phases reads
+// with DirectPhasing, and encodes the pileup images of the candidates into
+// serialized tf.Examples. The reads, allele counts and candidates of a region
+// live on a protobuf arena released at the end of the region.
+//
+// This is the native counterpart of RegionProcessor.process() followed by
+// RegionProcessor.writes_examples_in_region() in make_examples_core.py, and
+// produces the same outputs for the options it supports (see
+// UnsupportedOption()). Python keeps driving the regions and writing the
+// outputs.
+class RegionProcessor {
+ public:
+  // Opens the reads of each sample in options.sample_options() as
+  // make_examples does. ref must outlive the returned RegionProcessor.
+  static nucleus::StatusOr<std::unique_ptr<RegionProcessor>> Create(
+      const MakeExamplesOptions& options, const nucleus::GenomeReference* ref);
+
+  // sam_readers[i] holds the readers of options.sample_options(i). A sample
+  // whose reads_filenames are empty has no reads.
+  RegionProcessor(
+      const MakeExamplesOptions& options, const nucleus::GenomeReference* ref,
+      std::vector<std::vector<std::unique_ptr<nucleus::SamReader>>>
+          sam_readers);
+
+  // Returns a RegionProcessor with the options of this one that reads ref and
+  // clones of the readers of this one (see SamReader::Clone()), to process
+  // other regions on another thread.
+  nucleus::StatusOr<std::unique_ptr<RegionProcessor>> Clone(
+      const nucleus::GenomeReference* ref) const;
+
+  // RegionProcessor is neither copyable nor movable.
+  RegionProcessor(const RegionProcessor&) = delete;
+  RegionProcessor& operator=(const RegionProcessor&) = delete;
+
+  // Returns the name of the first option used by options that is not
+  // processed natively, e.g. "realigner_enabled", or an empty string if
+  // RegionProcessor supports options.
+  static std::string UnsupportedOption(const MakeExamplesOptions& options);
+
+  // Processes region. Returns the outputs of each sample with reads whose
+  // skip_output_generation is false, in sample order.
+  nucleus::StatusOr<std::vector<RegionSampleOutputs>> Process(
+      const nucleus::genomics::v1::Range& region);
+
+  // Same as Process(), with reads_for_samples[i] as the reads returned by the
+  // readers of sample i for region.
+  nucleus::StatusOr<std::vector<RegionSampleOutputs>> ProcessReads(
+      const nucleus::genomics::v1::Range& region,
+      const std::vector<std::vector<nucleus::genomics::v1::Read>>&
+          reads_for_samples);
+
+  // Number of reads of all samples used for the last region, after sampling.
+  int NumReads() const { return num_reads_; }
+
+ private:
+  // Runs the pipeline on reads_for_samples, allocated on arena.
+  nucleus::StatusOr<std::vector<RegionSampleOutputs>> ProcessRegion(
+      const nucleus::genomics::v1::Range& region,
+      std::vector<std::vector<nucleus::genomics::v1::Read*>> reads_for_samples,
+      google::protobuf::Arena* arena);
+
+  // Keeps up to max_reads_per_partition reads, or reads covering up to
+  // max_reads_for_dynamic_bases_per_region bases per base of region, drawn
+  // as reservoir_sample_reads() draws them.
+  std::vector<nucleus::genomics::v1::Read*> SampleReads(
+      const nucleus::genomics::v1::Range& region,
+      std::vector<nucleus::genomics::v1::Read*> reads) const;
+
+  // Assigns an HP tag to reads of sample from the phasing of candidates.
+  nucleus::Status PhaseReads(
+      int sample, const std::vector<DeepVariantCall*>& candidates,
+      const std::vector<nucleus::genomics::v1::Read*>& reads,
+      const std::vector<int32_t>& read_ids);
+
+  // Encodes the examples of candidates into outputs, with the samples of the
+  // images in the order of sample.
+  nucleus::Status MakeExamples(
+      int sample, const std::vector<DeepVariantCall*>& candidates,
+      const std::vector<std::vector<nucleus::genomics::v1::Read*>>&
+          reads_for_samples,
+      RegionSampleOutputs* outputs);
+
+  const MakeExamplesOptions options_;
+  const nucleus::GenomeReference* const ref_;
+  const std::vector<std::vector<std::unique_ptr<nucleus::SamReader>>>
+      sam_readers_;
+
+  // One caller and gVCF builder per sample, kept across regions as their
+  // Python counterparts are.
+  std::vector<std::unique_ptr<multi_sample::VariantCaller>> variant_callers_;
+  std::vector<std::unique_ptr<GvcfBlockBuilder>> gvcf_block_builders_;
+  DirectPhasing direct_phasing_;
+  PileupImageBuilder pileup_image_builder_;
+  ReadRegistry read_registry_;
+
+  int num_reads_ = 0;
+};
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_REGION_PROCESSOR_H_
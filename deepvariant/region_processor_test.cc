@@ -0,0 +1,343 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/region_processor.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "deepvariant/pileup_image_native.h"
+#include "deepvariant/protos/deepvariant.pb.h"
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+#include "third_party/nucleus/io/reference.h"
+#include "third_party/nucleus/protos/example.pb.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+#include "third_party/nucleus/protos/variants.pb.h"
+#include "third_party/nucleus/testing/protocol-buffer-matchers.h"
+#include "third_party/nucleus/testing/test_utils.h"
+#include "third_party/nucleus/util/utils.h"
+#include "absl/strings/str_cat.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using nucleus::EqualsProto;
+using nucleus::MakeRange;
+using nucleus::MakeRead;
+using nucleus::genomics::v1::Read;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::Not;
+using ::testing::SizeIs;
+
+namespace {
+
+// chr1 of test.fasta starts with ACCACCATCCTCCGTGAAATCAATATCCCGCACAAG.
+constexpr char kChr[] = "chr1";
+
+MakeExamplesOptions MakeOptions(int num_samples) {
+  MakeExamplesOptions options;
+  options.set_mode(MakeExamplesOptions::CALLING);
+  options.set_variant_caller(MakeExamplesOptions::VERY_SENSITIVE_CALLER);
+  options.set_random_seed(609314161);
+  options.mutable_allele_counter_options()
+      ->mutable_read_requirements()
+      ->set_min_base_quality(10);
+
+  PileupImageOptions& pic_options = *options.mutable_pic_options();
+  pic_options.set_width(11);
+  pic_options.set_height(10);
+  pic_options.set_num_channels(NUM_CHANNELS);
+  pic_options.set_reference_band_height(2);
+  pic_options.set_base_color_offset_a_and_g(40);
+  pic_options.set_base_color_offset_t_and_c(30);
+  pic_options.set_base_color_stride(70);
+  pic_options.set_allele_supporting_read_alpha(1.0);
+  pic_options.set_allele_unsupporting_read_alpha(0.6);
+  pic_options.set_other_allele_supporting_read_alpha(0.6);
+  pic_options.set_reference_matching_read_alpha(0.2);
+  pic_options.set_reference_mismatching_read_alpha(1.0);
+  pic_options.set_indel_anchoring_base_char("*");
+  pic_options.set_reference_base_quality(60);
+  pic_options.set_positive_strand_color(70);
+  pic_options.set_negative_strand_color(240);
+  pic_options.set_base_quality_cap(40);
+  pic_options.set_mapping_quality_cap(60);
+  pic_options.set_read_overlap_buffer_bp(5);
+  pic_options.set_multi_allelic_mode(PileupImageOptions::ADD_HET_ALT_IMAGES);
+  pic_options.set_random_seed(2101079370);
+  pic_options.mutable_read_requirements()->set_min_base_quality(10);
+  pic_options.mutable_read_requirements()->set_min_mapping_quality(10);
+
+  for (int i = 0; i < num_samples; ++i) {
+    SampleOptions* sample = options.add_sample_options();
+    sample->set_name(absl::StrCat("sample", i));
+    sample->set_role(absl::StrCat("role", i));
+    sample->add_reads_filenames(absl::StrCat("sample", i, ".bam"));
+    VariantCallerOptions* caller_options =
+        sample->mutable_variant_caller_options();
+    caller_options->set_min_count_snps(2);
+    caller_options->set_min_count_indels(2);
+    caller_options->set_min_fraction_snps(0.12);
+    caller_options->set_min_fraction_indels(0.12);
+    caller_options->set_sample_name(sample->name());
+    caller_options->set_p_error(0.001);
+    caller_options->set_max_gq(50);
+    caller_options->set_gq_resolution(1);
+    caller_options->set_ploidy(2);
+    for (int j = 0; j < num_samples; ++j) {
+      sample->add_order(j);
+    }
+  }
+  return options;
+}
+
+// Reads at chr1:15-25 of which the first num_alts have alt at position 20.
+std::vector<Read> MakeReads(int num_reads, int num_alts, const string& alt,
+                            const string& prefix = "read") {
+  std::vector<Read> reads;
+  for (int i = 0; i < num_reads; ++i) {
+    const string bases = i < num_alts ? absl::StrCat("GAAAT", alt, "AATA")
+                                      : "GAAATCAATA";
+    reads.push_back(
+        MakeRead(kChr, 15, bases, {"10M"}, absl::StrCat(prefix, i)));
+  }
+  return reads;
+}
+
+tensorflow::Example ParseExample(const string& serialized) {
+  tensorflow::Example example;
+  CHECK(example.ParseFromString(serialized));
+  return example;
+}
+
+const tensorflow::Feature& GetFeature(const tensorflow::Example& example,
+                                      const string& name) {
+  return example.features().feature().at(name);
+}
+
+std::vector<int> AltAlleleIndices(const tensorflow::Example& example) {
+  CallVariantsOutput::AltAlleleIndices indices;
+  CHECK(indices.ParseFromString(
+      GetFeature(example, "alt_allele_indices/encoded").bytes_list().value(0)));
+  return std::vector<int>(indices.indices().begin(), indices.indices().end());
+}
+
+class RegionProcessorTest : public ::testing::Test {
+ protected:
+  RegionProcessorTest() {
+    const string& test_fasta_path = nucleus::GetTestData("test.fasta");
+    ref_ = std::move(nucleus::IndexedFastaReader::FromFile(
+                         test_fasta_path, absl::StrCat(test_fasta_path, ".fai"))
+                         .ValueOrDie());
+  }
+
+  std::unique_ptr<RegionProcessor> MakeProcessor(
+      const MakeExamplesOptions& options) {
+    return std::make_unique<RegionProcessor>(
+        options, ref_.get(),
+        std::vector<std::vector<std::unique_ptr<nucleus::SamReader>>>(
+            options.sample_options_size()));
+  }
+
+  std::unique_ptr<const nucleus::GenomeReference> ref_;
+};
+
+TEST_F(RegionProcessorTest, UnsupportedOption) {
+  MakeExamplesOptions options = MakeOptions(1);
+  EXPECT_EQ(RegionProcessor::UnsupportedOption(options), "");
+  options.set_realigner_enabled(true);
+  EXPECT_EQ(RegionProcessor::UnsupportedOption(options), "realigner_enabled");
+  options = MakeOptions(1);
+  options.mutable_pic_options()->set_alt_aligned_pileup("diff_channels");
+  EXPECT_EQ(RegionProcessor::UnsupportedOption(options), "alt_aligned_pileup");
+  options = MakeOptions(1);
+  options.set_mode(MakeExamplesOptions::TRAINING);
+  EXPECT_EQ(RegionProcessor::UnsupportedOption(options), "mode");
+}
+
+TEST_F(RegionProcessorTest, MakesExamplesOfCandidates) {
+  const MakeExamplesOptions options = MakeOptions(1);
+  std::unique_ptr<RegionProcessor> processor = MakeProcessor(options);
+  const std::vector<Read> reads = MakeReads(6, 3, "G");
+
+  auto outputs = processor->ProcessReads(MakeRange(kChr, 10, 30), {reads})
+                     .ValueOrDie();
+  EXPECT_EQ(processor->NumReads(), 6);
+  ASSERT_THAT(outputs, SizeIs(1));
+  EXPECT_EQ(outputs[0].role, "role0");
+  EXPECT_THAT(outputs[0].gvcfs, IsEmpty());
+  ASSERT_THAT(outputs[0].candidates, SizeIs(1));
+  const DeepVariantCall& candidate = outputs[0].candidates[0];
+  EXPECT_EQ(candidate.variant().start(), 20);
+  EXPECT_EQ(candidate.variant().reference_bases(), "C");
+  EXPECT_THAT(candidate.variant().alternate_bases(), ElementsAre("G"));
+  // The read id sidecar isn't part of the outputs.
+  EXPECT_THAT(candidate.allele_support_ids(), IsEmpty());
+  EXPECT_FALSE(candidate.has_ref_support_ids());
+
+  ASSERT_THAT(outputs[0].examples, SizeIs(1));
+  EXPECT_THAT(outputs[0].example_shape, ElementsAre(10, 11, NUM_CHANNELS));
+  const tensorflow::Example example = ParseExample(outputs[0].examples[0]);
+  EXPECT_EQ(GetFeature(example, "locus").bytes_list().value(0), "chr1:21-21");
+  nucleus::genomics::v1::Variant variant;
+  ASSERT_TRUE(variant.ParseFromString(
+      GetFeature(example, "variant/encoded").bytes_list().value(0)));
+  EXPECT_THAT(variant, EqualsProto(candidate.variant()));
+  EXPECT_THAT(GetFeature(example, "variant_type").int64_list().value(),
+              ElementsAre(1));
+  EXPECT_THAT(AltAlleleIndices(example), ElementsAre(0));
+  EXPECT_THAT(GetFeature(example, "image/shape").int64_list().value(),
+              ElementsAre(10, 11, NUM_CHANNELS));
+  EXPECT_THAT(GetFeature(example, "sequencing_type").int64_list().value(),
+              ElementsAre(0));
+
+  // The image is the one PileupImageCreator.build_pileup() builds.
+  PileupImageBuilder builder(options.pic_options());
+  std::vector<const Read*> read_ptrs;
+  for (const Read& read : reads) {
+    read_ptrs.push_back(&read);
+  }
+  const std::unique_ptr<PileupImage> image =
+      builder.Build(candidate, ref_->GetBases(MakeRange(kChr, 15, 26)).ValueOrDie(),
+                    {read_ptrs}, {10}, {"G"});
+  EXPECT_EQ(GetFeature(example, "image/encoded").bytes_list().value(0),
+            string(image->data.begin(), image->data.end()));
+}
+
+TEST_F(RegionProcessorTest, MakesAnExamplePerAltAlleleCombination) {
+  std::unique_ptr<RegionProcessor> processor = MakeProcessor(MakeOptions(1));
+  std::vector<Read> reads = MakeReads(3, 3, "G", "g");
+  for (const Read& read : MakeReads(3, 3, "T", "t")) {
+    reads.push_back(read);
+  }
+
+  auto outputs = processor->ProcessReads(MakeRange(kChr, 10, 30), {reads})
+                     .ValueOrDie();
+  ASSERT_THAT(outputs, SizeIs(1));
+  ASSERT_THAT(outputs[0].candidates, SizeIs(1));
+  EXPECT_THAT(outputs[0].candidates[0].variant().alternate_bases(),
+              ElementsAre("G", "T"));
+  ASSERT_THAT(outputs[0].examples, SizeIs(3));
+  EXPECT_THAT(AltAlleleIndices(ParseExample(outputs[0].examples[0])),
+              ElementsAre(0));
+  EXPECT_THAT(AltAlleleIndices(ParseExample(outputs[0].examples[1])),
+              ElementsAre(1));
+  EXPECT_THAT(AltAlleleIndices(ParseExample(outputs[0].examples[2])),
+              ElementsAre(0, 1));
+}
+
+TEST_F(RegionProcessorTest, NoExamplesForWindowsOffTheContig) {
+  std::unique_ptr<RegionProcessor> processor = MakeProcessor(MakeOptions(1));
+  // Alt at position 2 of chr1, whose window would start at -3.
+  std::vector<Read> reads;
+  for (int i = 0; i < 3; ++i) {
+    reads.push_back(
+        MakeRead(kChr, 0, "ACGACCATCC", {"10M"}, absl::StrCat("read", i)));
+  }
+
+  auto outputs = processor->ProcessReads(MakeRange(kChr, 0, 10), {reads})
+                     .ValueOrDie();
+  ASSERT_THAT(outputs, SizeIs(1));
+  ASSERT_THAT(outputs[0].candidates, SizeIs(1));
+  EXPECT_EQ(outputs[0].candidates[0].variant().start(), 2);
+  EXPECT_THAT(outputs[0].examples, IsEmpty());
+  EXPECT_THAT(outputs[0].example_shape, IsEmpty());
+}
+
+TEST_F(RegionProcessorTest, SkipsSamplesWithoutOutputs) {
+  MakeExamplesOptions options = MakeOptions(2);
+  options.mutable_sample_options(0)->set_skip_output_generation(true);
+  options.mutable_sample_options(1)->set_pileup_height(6);
+  std::unique_ptr<RegionProcessor> processor = MakeProcessor(options);
+
+  auto outputs = processor
+                     ->ProcessReads(MakeRange(kChr, 10, 30),
+                                    {MakeReads(4, 2, "G", "parent"),
+                                     MakeReads(4, 2, "G", "child")})
+                     .ValueOrDie();
+  EXPECT_EQ(processor->NumReads(), 8);
+  ASSERT_THAT(outputs, SizeIs(1));
+  EXPECT_EQ(outputs[0].role, "role1");
+  ASSERT_THAT(outputs[0].examples, SizeIs(1));
+  // One section of the default height and one of pileup_height.
+  EXPECT_THAT(outputs[0].example_shape, ElementsAre(16, 11, NUM_CHANNELS));
+}
+
+TEST_F(RegionProcessorTest, MakesGvcfs) {
+  MakeExamplesOptions options = MakeOptions(1);
+  options.set_gvcf_filename("gvcf.tfrecord");
+  std::unique_ptr<RegionProcessor> processor = MakeProcessor(options);
+
+  auto outputs = processor
+                     ->ProcessReads(MakeRange(kChr, 10, 30),
+                                    {MakeReads(6, 3, "G")})
+                     .ValueOrDie();
+  ASSERT_THAT(outputs, SizeIs(1));
+  const auto& gvcfs = outputs[0].gvcfs;
+  ASSERT_THAT(gvcfs, Not(IsEmpty()));
+  EXPECT_EQ(gvcfs.front().start(), 10);
+  EXPECT_EQ(gvcfs.back().end(), 30);
+}
+
+TEST_F(RegionProcessorTest, SamplesReads) {
+  MakeExamplesOptions options = MakeOptions(1);
+  options.set_max_reads_per_partition(4);
+  std::unique_ptr<RegionProcessor> processor = MakeProcessor(options);
+
+  ASSERT_TRUE(processor
+                  ->ProcessReads(MakeRange(kChr, 10, 30),
+                                 {MakeReads(10, 0, "G")})
+                  .ok());
+  EXPECT_EQ(processor->NumReads(), 4);
+
+  // Each read covers 10 of the 20 bases of the region, so 2 reads cover it
+  // once.
+  options.set_max_reads_per_partition(0);
+  options.set_max_reads_for_dynamic_bases_per_region(1);
+  processor = MakeProcessor(options);
+  ASSERT_TRUE(processor
+                  ->ProcessReads(MakeRange(kChr, 10, 30),
+                                 {MakeReads(10, 0, "G")})
+                  .ok());
+  EXPECT_EQ(processor->NumReads(), 2);
+}
+
+}  // namespace
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
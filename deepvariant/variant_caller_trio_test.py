@@ -37,6 +37,10 @@ import numpy.testing as npt
 
 from deepvariant import variant_caller
 from deepvariant.protos import deepvariant_pb2
+from deepvariant.python import allelecounter
+from third_party.nucleus.io import fasta
+from third_party.nucleus.testing import test_utils
+from third_party.nucleus.util import ranges
 from third_party.nucleus.util import variant_utils
 from third_party.nucleus.util import variantcall_utils
 
@@ -191,41 +195,6 @@ class VariantCallerTests(parameterized.TestCase):
     npt.assert_allclose(expected_likelihoods, likelihoods, atol=1e-6)
     self.assertEqual(expected_gq, gq)
 
-  @parameterized.parameters(
-      # Values below max_allowed_reads are returned without modification.
-      [0, 10, 100, (0, 10)],
-      [5, 10, 100, (5, 10)],
-      [10, 10, 100, (10, 10)],
-      [10, 100, 100, (10, 100)],
-      [100, 100, 100, (100, 100)],
-      # Checks that the rescaling works when n_total_reads > max_allowed.
-      [0, 200, 100, (0, 100)],
-      [0, 200, 100, (0, 100)],
-      [0, 1000, 100, (0, 100)],
-      [0, 10000, 100, (0, 100)],
-      [1, 200, 100, (1, 100)],
-      [1, 1000, 100, (1, 100)],
-      [1, 10000, 100, (1, 100)],
-      [1, 100000, 100, (1, 100)],
-      [2, 200, 100, (1, 100)],
-      [3, 200, 100, (2, 100)],
-      [4, 200, 100, (2, 100)],
-      [10, 200, 100, (5, 100)],
-      [50, 200, 100, (25, 100)],
-      [100, 200, 100, (50, 100)],
-      [200, 200, 100, (100, 100)],
-      # I saw a bug at runtime, and the testcase makes sure we scale values of
-      # n_ref_reads close to n_total_reads appropriately.
-      [99, 100, 100, (99, 100)],
-  )
-  def test_rescale_read_counts(
-      self, n_ref, n_total, max_allowed_reads, expected
-  ):
-    actual = variant_caller._rescale_read_counts_if_necessary(
-        n_ref, n_total, max_allowed_reads
-    )
-    self.assertEqual(actual, expected)
-
   # pylint: disable=g-complex-comprehension
   @parameterized.parameters(
       (n_ref, n_alt_fraction)
@@ -237,7 +206,7 @@ class VariantCallerTests(parameterized.TestCase):
     """Tests that we don't blow up when the coverage gets really high."""
     caller = PlaceholderVariantCaller(0.01, 100)
     n_alt = int(n_alt_fraction * n_ref)
-    gq, likelihoods = caller._calc_reference_confidence(n_ref, n_ref + n_alt)
+    gq, likelihoods = caller.reference_confidence(n_ref, n_ref + n_alt)
     self.assertTrue(
         np.isfinite(likelihoods).all(),
         'Non-finite likelihoods {}'.format(likelihoods),
@@ -455,18 +424,29 @@ class VariantCallerTests(parameterized.TestCase):
     # Only tests the 'gvcfs' creation part of calls_and_gvcfs. The `calls`
     # portion of this method needs to be tested in subclasses, which have
     # implemented the get_candidates method.
-    counts = [
-        (0, 0, 'A'),
-        (10, 10, 'G'),
-        (0, 0, 'G'),
-        (0, 0, 'G'),
-        (10, 10, 'T'),
-    ]
+    ref = fasta.IndexedFastaReader(
+        test_utils.genomics_core_testdata('test.fasta')
+    )
+    # chrM:10-15 is CTATC. Position 11 gets 10 reference and 10 alternate
+    # reads, as does position 14, and the other positions have no coverage.
+    allele_counter = allelecounter.AlleleCounter(
+        ref.c_reader,
+        ranges.make_range('chrM', 10, 15),
+        [],
+        deepvariant_pb2.AlleleCounterOptions(partition_size=5),
+    )
+    for position, bases in [(11, 'TG'), (14, 'CA')]:
+      for base in bases:
+        for _ in range(10):
+          allele_counter.add(
+              test_utils.make_read(
+                  base, start=position, quals=[30], cigar='1M', chrom='chrM'
+              ),
+              'SAMPLE_ID',
+          )
     caller = PlaceholderVariantCaller(0.01, 100)
-    allele_counter = self.fake_allele_counter(10, counts)
-    allele_counters = {'SAMPLE_ID': allele_counter}
     _, gvcfs = caller.calls_and_gvcfs(
-        allele_counters=allele_counters,
+        allele_counters={'SAMPLE_ID': allele_counter},
         target_sample='SAMPLE_ID',
         include_gvcfs=include_gvcfs,
     )
@@ -478,11 +458,18 @@ class VariantCallerTests(parameterized.TestCase):
       # chance of having each genotype is 1/3, in log10 space.
       flat_gls = np.log10([1.0 / 3] * 3)
       self.assertGVCF(
-          gvcfs[0], ref='A', start=10, end=11, gq=1, min_dp=0, gls=flat_gls
+          gvcfs[0],
+          ref='C',
+          start=10,
+          end=11,
+          gq=1,
+          min_dp=0,
+          gls=flat_gls,
+          chrom='chrM',
       )
       self.assertGVCF(
           gvcfs[1],
-          ref='G',
+          ref='T',
           start=11,
           end=12,
           gq=0,
@@ -491,9 +478,17 @@ class VariantCallerTests(parameterized.TestCase):
           # The genotype should NOT be called here ("./.") as the likelihood
           # for het is greater than hom_ref.
           gts=[-1, -1],
+          chrom='chrM',
       )
       self.assertGVCF(
-          gvcfs[2], ref='G', start=12, end=14, gq=1, min_dp=0, gls=flat_gls
+          gvcfs[2],
+          ref='A',
+          start=12,
+          end=14,
+          gq=1,
+          min_dp=0,
+          gls=flat_gls,
+          chrom='chrM',
       )
     else:
       self.assertEmpty(gvcfs)
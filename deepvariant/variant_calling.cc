@@ -359,7 +359,24 @@ bool VariantCaller::KeepReferenceSite() const {
 
 std::vector<DeepVariantCall> VariantCaller::CallsFromAlleleCounter(
     const AlleleCounter& allele_counter) const {
-  return CallsFromAlleleCounts(allele_counter.Counts());
+  // CallVariant returns nothing for a site without any non-reference allele,
+  // unless reference sites are sampled (which draws from sampler_ at every
+  // site). Such sites are skipped using the columnar view of the counter, so
+  // their AlleleCount protos are never built.
+  const bool skip_reference_sites =
+      options_.fraction_reference_sites_to_emit() <= 0.0;
+  std::vector<DeepVariantCall> variants;
+  for (int i = 0; i < allele_counter.NumPositions(); ++i) {
+    if (skip_reference_sites && !allele_counter.HasNonRefAlleles(i)) {
+      continue;
+    }
+    std::optional<DeepVariantCall> call =
+        CallVariant(allele_counter.CountAt(i));
+    if (call) {
+      variants.push_back(*call);
+    }
+  }
+  return variants;
 }
 
 std::vector<DeepVariantCall> VariantCaller::CallsFromAlleleCounts(
@@ -49,12 +49,14 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/container/node_hash_map.h"
+#include "absl/log/check.h"
 #include "absl/log/log.h"
 #include "absl/strings/str_cat.h"
 #include "third_party/nucleus/io/vcf_reader.h"
 #include "third_party/nucleus/protos/variants.pb.h"
 #include "third_party/nucleus/util/math.h"
 #include "third_party/nucleus/util/utils.h"
+#include "google/protobuf/arena.h"
 
 namespace learning {
 namespace genomics {
@@ -431,63 +433,66 @@ bool VariantCaller::KeepReferenceSite() const {
   return options_.fraction_reference_sites_to_emit() > 0.0 && sampler_.Keep();
 }
 
-template <class T>
-std::vector<T> VariantCaller::AlleleCountsGenerator(
+template <typename Fn>
+void VariantCaller::ForEachPosition(
     const std::unordered_map<std::string, AlleleCounter*>& allele_counters,
-    const std::string& target_sample,
-    std::optional<T> (VariantCaller::*F)(
-        const absl::node_hash_map<std::string, AlleleCount>&,
-        const std::string&) const) const {
+    const std::string& target_sample, Fn&& fn) const {
   // Get Allele counts for the target sample
   auto it = allele_counters.find(target_sample);
   if (it == allele_counters.end()) {
     LOG(WARNING)
         << "allele_counters collection does not contain target sample!";
-    return std::vector<T>();
+    return;
   }
 
-  // Contains AlleleCount objects for each position of the target sample.
-  const std::vector<AlleleCount>& target_sample_allele_counts =
-      it->second->Counts();
+  const AlleleCounter& target_allele_counter = *it->second;
 
-  // Initialize a vector of iterators - one iterator per sample.
-  absl::node_hash_map<std::string, std::vector<AlleleCount>::const_iterator>
-      allele_counter_iterators;
-  for (const auto& sample_allele_counters : allele_counters) {
-    allele_counter_iterators[sample_allele_counters.first] =
-        sample_allele_counters.second->Counts().begin();
-  }
-
-  std::vector<T> items;
+  // Both CallVariant and CallVariantPosition return nothing for a site where
+  // the target sample has no non-reference allele, unless reference sites are
+  // sampled (which draws from sampler_ at every site). Such sites are skipped
+  // using the columnar view of the counter, so their AlleleCount protos are
+  // never built.
+  const bool skip_reference_sites =
+      options_.fraction_reference_sites_to_emit() <= 0.0;
 
-  // Iterate through AlleleCount objects for each position, moving iterators
-  // for each sample simultaneously.
-  while (allele_counter_iterators[target_sample] !=
-         target_sample_allele_counts.end()) {
+  // Iterate through the positions of the target sample, building the
+  // AlleleCount of each sample for the same position.
+  for (int i = 0; i < target_allele_counter.NumPositions(); ++i) {
+    if (skip_reference_sites && !target_allele_counter.HasNonRefAlleles(i)) {
+      continue;
+    }
     absl::node_hash_map<std::string, AlleleCount> allele_counts_per_sample;
     for (const auto& sample_counter : allele_counters) {
-      if (allele_counter_iterators[sample_counter.first] !=
-          allele_counters.at(sample_counter.first)->Counts().end()) {
+      if (i < sample_counter.second->NumPositions()) {
         // allele_counts_per_sample contain AlleleCount for each sample for one
         // position.
         allele_counts_per_sample[sample_counter.first] =
-            *(allele_counter_iterators[sample_counter.first]);
-      }
-    }
-    // Calling CallVariant for one position. allele_counts_per_sample contains
-    // AlleleCount object for this position for each sample.
-    std::optional<T> item = (this->*F)(allele_counts_per_sample, target_sample);
-    if (item) {
-      items.push_back(*item);
-    }
-
-    // Increment all iterators.
-    for (auto& it : allele_counter_iterators) {
-      if (it.second != allele_counters.at(it.first)->Counts().end()) {
-        it.second++;
+            sample_counter.second->CountAt(i);
       }
     }
+    fn(i, allele_counts_per_sample);
   }
+}
+
+template <class T>
+std::vector<T> VariantCaller::AlleleCountsGenerator(
+    const std::unordered_map<std::string, AlleleCounter*>& allele_counters,
+    const std::string& target_sample,
+    std::optional<T> (VariantCaller::*F)(
+        const absl::node_hash_map<std::string, AlleleCount>&,
+        const std::string&) const) const {
+  std::vector<T> items;
+  ForEachPosition(
+      allele_counters, target_sample,
+      [&](int /*offset*/,
+          const absl::node_hash_map<std::string, AlleleCount>& allele_counts) {
+        // Calling CallVariant for one position. allele_counts contains
+        // AlleleCount object for this position for each sample.
+        std::optional<T> item = (this->*F)(allele_counts, target_sample);
+        if (item) {
+          items.push_back(*std::move(item));
+        }
+      });
   return items;
 }
 
@@ -498,6 +503,40 @@ std::vector<DeepVariantCall> VariantCaller::CallsFromAlleleCounts(
                                                 &VariantCaller::CallVariant);
 }
 
+std::vector<DeepVariantCall*> VariantCaller::CallsFromAlleleCounts(
+    const std::unordered_map<std::string, AlleleCounter*>& allele_counters,
+    const std::string& target_sample, google::protobuf::Arena* arena) const {
+  CHECK(arena != nullptr);
+  // Read ids are only comparable if all counters take them from the same
+  // registry.
+  const bool fill_read_ids =
+      read_registry_ != nullptr &&
+      std::all_of(allele_counters.begin(), allele_counters.end(),
+                  [this](const auto& sample_counter) {
+                    return &sample_counter.second->read_registry() ==
+                           read_registry_;
+                  });
+  std::vector<DeepVariantCall*> calls;
+  // A call is only taken from the arena once the previous one was used.
+  DeepVariantCall* call = nullptr;
+  ForEachPosition(
+      allele_counters, target_sample,
+      [&](int offset,
+          const absl::node_hash_map<std::string, AlleleCount>& allele_counts) {
+        if (call == nullptr) {
+          call = google::protobuf::Arena::CreateMessage<DeepVariantCall>(arena);
+        }
+        const CounterPosition counter_position = {
+            .allele_counters = &allele_counters, .offset = offset};
+        if (CallVariant(allele_counts, target_sample,
+                        fill_read_ids ? &counter_position : nullptr, call)) {
+          calls.push_back(call);
+          call = nullptr;
+        }
+      });
+  return calls;
+}
+
 std::vector<int> VariantCaller::CallPositionsFromAlleleCounts(
     const std::unordered_map<std::string, AlleleCounter*>& allele_counters,
     const std::string& target_sample) const {
@@ -529,6 +568,24 @@ std::optional<int> VariantCaller::CallVariantPosition(
 std::optional<DeepVariantCall> VariantCaller::CallVariant(
     const absl::node_hash_map<std::string, AlleleCount>& allele_counts,
     const std::string& target_sample) const {
+  DeepVariantCall call;
+  if (!CallVariant(allele_counts, target_sample, &call)) {
+    return std::nullopt;
+  }
+  return std::make_optional(std::move(call));
+}
+
+bool VariantCaller::CallVariant(
+    const absl::node_hash_map<std::string, AlleleCount>& allele_counts,
+    const std::string& target_sample, DeepVariantCall* call) const {
+  return CallVariant(allele_counts, target_sample,
+                     /*counter_position=*/nullptr, call);
+}
+
+bool VariantCaller::CallVariant(
+    const absl::node_hash_map<std::string, AlleleCount>& allele_counts,
+    const std::string& target_sample, const CounterPosition* counter_position,
+    DeepVariantCall* call) const {
   // allele_counts.at will throw an exception if key is not found.
   // Absent target_sample is a critical error.
   const AlleleCount& target_sample_allele_count =
@@ -536,13 +593,13 @@ std::optional<DeepVariantCall> VariantCaller::CallVariant(
   if (!nucleus::AreCanonicalBases(target_sample_allele_count.ref_base())) {
     // We don't emit calls at any site in the genome that isn't one of the
     // canonical DNA bases (one of A, C, G, or T).
-    return std::nullopt;
+    return false;
   }
 
   const std::vector<Allele> alt_alleles =
       SelectAltAlleles(allele_counts, target_sample);
   if (alt_alleles.empty() && !KeepReferenceSite()) {
-    return std::nullopt;
+    return false;
   }
   // Creates a non-reference Variant proto based on the information in
   // allele_count and alt_alleles. This variant starts at the position of
@@ -551,8 +608,7 @@ std::optional<DeepVariantCall> VariantCaller::CallVariant(
   // the variant. For convenience, the alt_alleles are sorted. Also adds a
   // single VariantCall to the Variant, with sample_name and uncalled diploid
   // genotypes.
-  DeepVariantCall call;
-  Variant* variant = call.mutable_variant();
+  Variant* variant = call->mutable_variant();
   variant->set_reference_name(
       target_sample_allele_count.position().reference_name());
   variant->set_start(target_sample_allele_count.position().position());
@@ -577,8 +633,11 @@ std::optional<DeepVariantCall> VariantCaller::CallVariant(
             StringPtrLessThan());
 
   AddReadDepths(target_sample_allele_count, allele_map, variant);
-  AddSupportingReads(allele_counts, allele_map, target_sample, &call);
-  return std::make_optional(call);
+  AddSupportingReads(allele_counts, allele_map, target_sample, call);
+  if (counter_position != nullptr) {
+    AddSupportingReadIds(*counter_position, allele_map, call);
+  }
+  return true;
 }
 
 AlleleMap::const_iterator FindAllele(const Allele& allele,
@@ -646,6 +705,45 @@ void VariantCaller::AddSupportingReads(
   }
 }
 
+void VariantCaller::AddSupportingReadIds(
+    const CounterPosition& counter_position, const AlleleMap& allele_map,
+    DeepVariantCall* call) const {
+  // Same traversal as AddSupportingReads(), over the observations the
+  // AlleleCounts were built from. A read id stands for the read key, so reads
+  // are deduplicated across samples by id.
+  const std::string unknown_allele = kSupportingUncalledAllele;
+  absl::flat_hash_map<std::string, absl::flat_hash_set<int32_t>>
+      alt_allele_support;
+  absl::flat_hash_set<int32_t> ref_support;
+  for (const auto& sample_counter : *counter_position.allele_counters) {
+    const AlleleCounter& counter = *sample_counter.second;
+    if (counter_position.offset >= counter.NumPositions()) {
+      continue;
+    }
+    counter.ForEachReadAlleleWithId(
+        counter_position.offset, [&](int32_t read_id, const Allele& allele) {
+          DeepVariantCall::SupportingReadIds* support_ids;
+          if (allele.type() != AlleleType::REFERENCE) {
+            auto it = FindAllele(allele, allele_map);
+            const std::string& supported_allele =
+                it == allele_map.end() ? unknown_allele : it->second;
+            if (!alt_allele_support[supported_allele].insert(read_id).second) {
+              return;
+            }
+            support_ids =
+                &(*call->mutable_allele_support_ids())[supported_allele];
+          } else {
+            if (!ref_support.insert(read_id).second) {
+              return;
+            }
+            support_ids = call->mutable_ref_support_ids();
+          }
+          support_ids->add_read_ids(read_id);
+          support_ids->add_is_low_quality(allele.is_low_quality());
+        });
+  }
+}
+
 }  // namespace multi_sample
 }  // namespace deepvariant
 }  // namespace genomics
@@ -42,9 +42,11 @@
 
 #include "deepvariant/allelecounter.h"
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/read_registry.h"
 #include "absl/container/node_hash_map.h"
 #include "third_party/nucleus/protos/variants.pb.h"
 #include "third_party/nucleus/util/samplers.h"
+#include "google/protobuf/arena.h"
 
 namespace nucleus {
 class VcfReader;
@@ -145,6 +147,16 @@ class VariantCaller {
   VariantCaller(const VariantCaller&) = delete;
   VariantCaller& operator=(const VariantCaller&) = delete;
 
+  // Makes CallsFromAlleleCounts() with an arena also fill the integer read id
+  // sidecar (allele_support_ids and ref_support_ids) of the DeepVariantCalls,
+  // taking the ids from the observations of the AlleleCounters. The sidecar is
+  // only filled when all the counters assign their ids from read_registry,
+  // typically the one shared by the AlleleCounters of the region. Passing
+  // nullptr turns the sidecar off.
+  void SetReadRegistry(const ReadRegistry* read_registry) {
+    read_registry_ = read_registry;
+  }
+
   // High-level API for calling variants in a region.
   //
   // Generate DeepVariantCall candidates for each position of the window.
@@ -161,6 +173,13 @@ class VariantCaller {
           allele_counts_wrapper,
       const std::string& target_sample) const;
 
+  // Same as CallsFromAlleleCounts() above, but the calls are allocated on
+  // arena, typically one per region, and are released with it. arena must not
+  // be nullptr.
+  std::vector<DeepVariantCall*> CallsFromAlleleCounts(
+      const std::unordered_map<std::string, AlleleCounter*>& allele_counters,
+      const std::string& target_sample, google::protobuf::Arena* arena) const;
+
   // High-level API for calculating potential variant position in a region.
   // This function is almost identical to CallsFromAlleleCounts except it
   // only calculates candidate positions.
@@ -192,6 +211,12 @@ class VariantCaller {
       const absl::node_hash_map<std::string, AlleleCount>& allele_counts,
       const std::string& target_sample) const;
 
+  // Same as CallVariant() above, but fills in call, which may be allocated on
+  // an arena. Returns false, leaving call untouched, if no call is made.
+  bool CallVariant(
+      const absl::node_hash_map<std::string, AlleleCount>& allele_counts,
+      const std::string& target_sample, DeepVariantCall* call) const;
+
   // Adds supporting reads to the DeepVariantCall.
   void AddSupportingReads(
       const absl::node_hash_map<std::string, AlleleCount>& allele_counts,
@@ -199,6 +224,27 @@ class VariantCaller {
       DeepVariantCall* call) const;
 
  private:
+  // The AlleleCounters of all samples, and the offset in them of the position
+  // a set of AlleleCounts was built for.
+  struct CounterPosition {
+    const std::unordered_map<std::string, AlleleCounter*>* allele_counters;
+    int offset;
+  };
+
+  // Same as the public CallVariant() above. If counter_position is not
+  // nullptr, also fills the read id sidecar of call from the observations of
+  // the counters at that position.
+  bool CallVariant(
+      const absl::node_hash_map<std::string, AlleleCount>& allele_counts,
+      const std::string& target_sample, const CounterPosition* counter_position,
+      DeepVariantCall* call) const;
+
+  // Fills the read id sidecar of call with the same reads AddSupportingReads()
+  // lists by name, identified by their read ids in the counters.
+  void AddSupportingReadIds(const CounterPosition& counter_position,
+                            const AlleleMap& allele_map,
+                            DeepVariantCall* call) const;
+
   enum AlleleRejectionAcceptance {
     ACCEPTED,
     REJECTED_REF,
@@ -233,10 +279,20 @@ class VariantCaller {
       const absl::node_hash_map<std::string, AlleleCount>& allele_counts,
       const std::string& target_sample) const;
 
+  // Calls fn(offset, allele_counts) with the AlleleCount of each sample at
+  // every offset of the target sample that may hold a candidate.
+  template <typename Fn>
+  void ForEachPosition(
+      const std::unordered_map<std::string, AlleleCounter*>& allele_counters,
+      const std::string& target_sample, Fn&& fn) const;
+
   const VariantCallerOptions options_;
 
   // Fraction of non-variant sites to emit as DeepVariantCalls.
   mutable nucleus::FractionalSampler sampler_;
+
+  // Registry the read ids of the sidecar of calls come from, if any.
+  const ReadRegistry* read_registry_ = nullptr;
 };
 
 // Helper function
@@ -40,6 +40,7 @@
 
 #include "deepvariant/allelecounter.h"
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/read_registry.h"
 #include "deepvariant/utils.h"
 #include "deepvariant/variant_calling_multisample.h"
 #include <gmock/gmock-generated-matchers.h>
@@ -52,6 +53,7 @@
 #include "third_party/nucleus/protos/variants.pb.h"
 #include "third_party/nucleus/testing/protocol-buffer-matchers.h"
 #include "third_party/nucleus/util/utils.h"
+#include "google/protobuf/arena.h"
 
 namespace learning {
 namespace genomics {
@@ -849,6 +851,89 @@ TEST_F(VariantCallingTest, TestCallsFromAlleleCounts) {
   ReleaseAlleleCounterPointers(allele_counters);
 }
 
+TEST_F(VariantCallingTest, TestCallsFromAlleleCountsOnArena) {
+  const std::unordered_map<std::string, AlleleCounter*> allele_counters = {
+      {"sample_id",
+       AlleleCounter::InitFromAlleleCounts(
+           {MakeTestAlleleCount(0, 0, "sample_id", "A", "C", 10),
+            MakeTestAlleleCount(10, 10, "sample_id", "G", "C", 11),
+            MakeTestAlleleCount(0, 0, "sample_id", "G", "C", 12),
+            MakeTestAlleleCount(11, 9, "sample_id", "T", "C", 13)})}};
+
+  const VariantCaller caller(MakeOptions());
+  const std::vector<DeepVariantCall> expected =
+      caller.CallsFromAlleleCounts(allele_counters, "sample_id");
+  google::protobuf::Arena arena;
+  const std::vector<DeepVariantCall*> candidates =
+      caller.CallsFromAlleleCounts(allele_counters, "sample_id", &arena);
+
+  ASSERT_THAT(candidates.size(), Eq(2));
+  for (int i = 0; i < candidates.size(); ++i) {
+    EXPECT_EQ(candidates[i]->GetArena(), &arena);
+    // Supporting reads follow the unspecified iteration order of the
+    // read_alleles map.
+    EXPECT_THAT(*candidates[i], nucleus::proto::IgnoringRepeatedFieldOrdering(
+                                    EqualsProto(expected[i])));
+  }
+  ReleaseAlleleCounterPointers(allele_counters);
+}
+
+TEST_F(VariantCallingTest, TestCallsFromAlleleCountsFillsReadIds) {
+  const std::unordered_map<std::string, AlleleCounter*> allele_counters = {
+      {"sample_id",
+       AlleleCounter::InitFromAlleleCounts(
+           {MakeTestAlleleCount(10, 10, "sample_id", "G", "C", 10),
+            MakeTestAlleleCount(11, 9, "sample_id", "T", "C", 11)})}};
+  const ReadRegistry& registry =
+      allele_counters.at("sample_id")->read_registry();
+
+  VariantCaller caller(MakeOptions());
+  caller.SetReadRegistry(&registry);
+  google::protobuf::Arena arena;
+  const std::vector<DeepVariantCall*> candidates =
+      caller.CallsFromAlleleCounts(allele_counters, "sample_id", &arena);
+
+  ASSERT_THAT(candidates.size(), Eq(2));
+  for (const DeepVariantCall* candidate : candidates) {
+    ASSERT_EQ(candidate->allele_support_ids_size(),
+              candidate->allele_support_size());
+    for (const auto& [allele, support] : candidate->allele_support()) {
+      const DeepVariantCall::SupportingReadIds& ids =
+          candidate->allele_support_ids().at(allele);
+      ASSERT_EQ(ids.is_low_quality_size(), ids.read_ids_size());
+      std::vector<std::string> keys;
+      for (const int32_t read_id : ids.read_ids()) {
+        keys.push_back(registry.Key(read_id));
+      }
+      EXPECT_THAT(keys, ::testing::UnorderedElementsAreArray(
+                            support.read_names().begin(),
+                            support.read_names().end()));
+    }
+  }
+  ReleaseAlleleCounterPointers(allele_counters);
+}
+
+TEST_F(VariantCallingTest, TestCallsFromAlleleCountsNeedsSharedRegistry) {
+  // Each counter owns its registry, so their read ids are not comparable and
+  // no sidecar is filled.
+  const std::unordered_map<std::string, AlleleCounter*> allele_counters = {
+      {"parent_1", AlleleCounter::InitFromAlleleCounts(
+                       {MakeTestAlleleCount(4, 2, "parent_1", "A", "T", 10)})},
+      {"child", AlleleCounter::InitFromAlleleCounts(
+                    {MakeTestAlleleCount(3, 1, "child", "A", "T", 10)})}};
+
+  VariantCaller caller(MakeOptions());
+  caller.SetReadRegistry(&allele_counters.at("parent_1")->read_registry());
+  google::protobuf::Arena arena;
+  const std::vector<DeepVariantCall*> candidates =
+      caller.CallsFromAlleleCounts(allele_counters, "parent_1", &arena);
+
+  ASSERT_THAT(candidates.size(), Eq(1));
+  EXPECT_EQ(candidates[0]->allele_support().at("T").read_names_size(), 3);
+  EXPECT_EQ(candidates[0]->allele_support_ids_size(), 0);
+  ReleaseAlleleCounterPointers(allele_counters);
+}
+
 // Testing that candidate is created for a target sample if ref support is very
 // high in another sample. In which case allele fraction ratio would be too low
 // for this candidate if we calculate allele ratio from all samples combined.
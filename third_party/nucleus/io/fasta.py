@@ -85,7 +85,13 @@ class FastaReader(genomics_reader.DispatchingGenomicsReader):
 class IndexedFastaReader(genomics_reader.GenomicsReader):
   """Class for reading from FASTA files containing a reference genome."""
 
-  def __init__(self, input_path, keep_true_case=False, cache_size=None):
+  def __init__(
+      self,
+      input_path,
+      keep_true_case=False,
+      cache_size=None,
+      max_cached_contigs=0,
+  ):
     """Initializes an IndexedFastaReader.
 
     Args:
@@ -94,10 +100,15 @@ class IndexedFastaReader(genomics_reader.GenomicsReader):
         returning them.
       cache_size: integer. Number of bases to cache from previous queries.
         Defaults to 64K.  The cache can be disabled using cache_size=0.
+      max_cached_contigs: integer. If positive, whole contigs are decoded once
+        and up to this many are kept in memory, instead of using the cache of
+        cache_size bases.
     """
     super(IndexedFastaReader, self).__init__()
 
-    options = fasta_pb2.FastaReaderOptions(keep_true_case=keep_true_case)
+    options = fasta_pb2.FastaReaderOptions(
+        keep_true_case=keep_true_case, max_cached_contigs=max_cached_contigs
+    )
 
     fasta_path = input_path
     fai_path = fasta_path + '.fai'
@@ -175,6 +186,65 @@ class UnindexedFastaReader(genomics_reader.GenomicsReader):
     self._reader.__exit__(exit_type, exit_value, exit_traceback)
 
 
+class PackedReferenceReader(genomics_reader.GenomicsReader):
+  """Class for reading a reference genome from a packed reference file.
+
+  Packed reference files are written by write_packed_reference (see the
+  pack_reference tool) and are memory-mapped, so they must be on a local
+  filesystem.
+  """
+
+  def __init__(self, input_path, keep_true_case=False):
+    """Initializes a PackedReferenceReader.
+
+    Args:
+      input_path: string. A path to a packed reference file.
+      keep_true_case: bool. If False, casts all bases to uppercase before
+        returning them.
+    """
+    super(PackedReferenceReader, self).__init__()
+
+    options = fasta_pb2.FastaReaderOptions(keep_true_case=keep_true_case)
+    self._reader = reference.PackedReferenceReader.from_file(
+        input_path, options)
+    self.header = RefFastaHeader(contigs=self._reader.contigs)
+
+  def iterate(self):
+    """Returns an iterable of (name, bases) tuples contained in this file."""
+    return self._reader.iterate()
+
+  def query(self, region):
+    """Returns the base pairs (as a string) in the given region."""
+    return self._reader.bases(region)
+
+  def is_valid(self, region):
+    """Returns whether the region is contained in this file."""
+    return self._reader.is_valid_interval(region)
+
+  def contig(self, contig_name):
+    """Returns a ContigInfo proto for contig_name."""
+    return self._reader.contig(contig_name)
+
+  @property
+  def c_reader(self):
+    """Returns the underlying C++ reader."""
+    return self._reader
+
+  def __exit__(self, exit_type, exit_value, exit_traceback):
+    self._reader.__exit__(exit_type, exit_value, exit_traceback)
+
+
+def write_packed_reference(input_path, output_path):
+  """Writes the FASTA file at input_path as a packed reference file.
+
+  Args:
+    input_path: string. A path to an indexed FASTA file.
+    output_path: string. The path of the packed reference file to write.
+  """
+  with IndexedFastaReader(input_path, keep_true_case=True) as fasta_reader:
+    reference.write_packed_reference(fasta_reader.c_reader, output_path)
+
+
 class InMemoryFastaReader(genomics_reader.GenomicsReader):
   """An `IndexedFastaReader` getting its bases from an in-memory data structure.
 
@@ -106,6 +106,26 @@ class UnindexedFastaReaderTests(parameterized.TestCase):
         list(unindexed_fasta_reader.iterate()))
 
 
+class PackedReferenceReaderTests(parameterized.TestCase):
+
+  @parameterized.parameters(True, False)
+  def test_matches_fasta(self, keep_true_case):
+    fasta_path = test_utils.genomics_core_testdata('test.fasta')
+    packed_path = test_utils.test_tmpfile('test.packed')
+    fasta.write_packed_reference(fasta_path, packed_path)
+    with fasta.IndexedFastaReader(
+        fasta_path, keep_true_case=keep_true_case) as fasta_reader, \
+        fasta.PackedReferenceReader(
+            packed_path, keep_true_case=keep_true_case) as packed_reader:
+      self.assertIsInstance(packed_reader.c_reader,
+                            reference.PackedReferenceReader)
+      self.assertEqual(fasta_reader.header, packed_reader.header)
+      self.assertEqual(
+          list(fasta_reader.iterate()), list(packed_reader.iterate()))
+      region = ranges.make_range('chrM', 20, 30)
+      self.assertEqual(fasta_reader.query(region), packed_reader.query(region))
+
+
 class InMemoryFastaReaderTests(parameterized.TestCase):
 
   @classmethod
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "third_party/nucleus/io/hts_thread_pool.h"
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
+
+namespace nucleus {
+
+StatusOr<std::unique_ptr<HtsThreadPool>> HtsThreadPool::Create(
+    int num_threads, int queue_size) {
+  if (num_threads < 1) {
+    return ::nucleus::InvalidArgument(
+        absl::StrCat("num_threads must be positive: ", num_threads));
+  }
+  if (queue_size < 0) {
+    return ::nucleus::InvalidArgument(
+        absl::StrCat("queue_size must not be negative: ", queue_size));
+  }
+  hts_tpool* pool = hts_tpool_init(num_threads);
+  if (pool == nullptr) {
+    return ::nucleus::Unknown("hts_tpool_init call failed");
+  }
+  return absl::WrapUnique(new HtsThreadPool(
+      pool, num_threads, queue_size > 0 ? queue_size : 2 * num_threads));
+}
+
+HtsThreadPool::HtsThreadPool(hts_tpool* pool, int num_threads, int queue_size)
+    : num_threads_(num_threads) {
+  pool_.pool = pool;
+  pool_.qsize = queue_size;
+}
+
+HtsThreadPool::~HtsThreadPool() { hts_tpool_destroy(pool_.pool); }
+
+::nucleus::Status HtsThreadPool::Attach(htsFile* fp) const {
+  htsThreadPool pool = pool_;
+  if (hts_set_thread_pool(fp, &pool) != 0) {
+    return ::nucleus::Unknown("Failed to set the htslib thread pool");
+  }
+  return ::nucleus::Status();
+}
+
+int64_t FlushAndGetCompressedSize(htsFile* fp) {
+  if (fp->format.compression != bgzf) {
+    return 0;
+  }
+  BGZF* bgzf = hts_get_bgzfp(fp);
+  if (bgzf == nullptr || bgzf_flush(bgzf) != 0) {
+    return 0;
+  }
+  return htell(bgzf->fp);
+}
+
+}  // namespace nucleus
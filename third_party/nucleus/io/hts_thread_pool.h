@@ -0,0 +1,101 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_HTS_THREAD_POOL_H_
+#define THIRD_PARTY_NUCLEUS_IO_HTS_THREAD_POOL_H_
+
+#include <cstdint>
+#include <memory>
+
+#include "htslib/hts.h"
+#include "htslib/thread_pool.h"
+#include "third_party/nucleus/core/status.h"
+#include "third_party/nucleus/core/statusor.h"
+
+namespace nucleus {
+
+// A pool of htslib threads that BGZF-compresses the output of writers.
+//
+// One pool can be shared by several writers, for example the VCF and gVCF
+// writers of postprocess_variants, so that the number of compression threads
+// stays bounded however many files are open. Writers keep a shared_ptr to the
+// pool, so it is destroyed only after every writer using it has been closed.
+class HtsThreadPool {
+ public:
+  // Starts `num_threads` threads. Each writer attached to the pool queues at
+  // most `queue_size` blocks for compression before its writes block; 0 means
+  // twice the number of threads.
+  static StatusOr<std::unique_ptr<HtsThreadPool>> Create(int num_threads,
+                                                         int queue_size = 0);
+
+  ~HtsThreadPool();
+
+  // Disable copy and assignment operations.
+  HtsThreadPool(const HtsThreadPool& other) = delete;
+  HtsThreadPool& operator=(const HtsThreadPool&) = delete;
+
+  int num_threads() const { return num_threads_; }
+  int queue_size() const { return pool_.qsize; }
+
+  // Makes `fp` compress its output on this pool. Must be called before
+  // anything is written to `fp`. Uncompressed files are left unchanged.
+  ::nucleus::Status Attach(htsFile* fp) const;
+
+ private:
+  HtsThreadPool(hts_tpool* pool, int num_threads, int queue_size);
+
+  const int num_threads_;
+  htsThreadPool pool_;
+};
+
+// Counters of the records written by a VcfWriter or SamWriter.
+struct HtsWriterStats {
+  // Number of records written.
+  int64_t records = 0;
+  // Size of the encoded records before compression, excluding the header.
+  int64_t uncompressed_bytes = 0;
+  // Size of the compressed output once the writer is closed, including the
+  // header but not the BGZF end-of-file marker. Zero if the output is not BGZF
+  // compressed.
+  int64_t compressed_bytes = 0;
+  // Time spent in htslib writes: encoding the records and compressing them,
+  // or, with an HtsThreadPool, waiting for room in the compression queue.
+  double write_seconds = 0;
+};
+
+// Flushes `fp` and returns the number of compressed bytes written to it so far,
+// or 0 if `fp` is not BGZF compressed. Writers call this just before closing
+// to fill HtsWriterStats.compressed_bytes.
+int64_t FlushAndGetCompressedSize(htsFile* fp);
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_HTS_THREAD_POOL_H_
@@ -32,12 +32,136 @@
 
 #include "third_party/nucleus/io/merge_variants.h"
 
+#include <deque>
+#include <memory>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/synchronization/mutex.h"
+#include "third_party/nucleus/io/hts_thread_pool.h"
 #include "third_party/nucleus/io/reference.h"
 #include "third_party/nucleus/io/variant_reader.h"
 #include "third_party/nucleus/protos/struct.pb.h"
 
 namespace nucleus {
 
+namespace {
+
+// Number of variants handed to a writer thread at a time.
+constexpr int kWriteBatchSize = 1024;
+
+// The merge waits once this many batches are queued for a writer thread.
+constexpr int kMaxQueuedWriteBatches = 16;
+
+// Writes variants to a VcfWriter in order, either on the calling thread or, if
+// `use_thread` is set, on a dedicated thread so that formatting and
+// compressing the output overlaps with reading and merging the inputs.
+class VariantWriterStage {
+ public:
+  VariantWriterStage(VcfWriter* writer, bool process_somatic, bool use_thread)
+      : writer_(writer), process_somatic_(process_somatic) {
+    if (use_thread) {
+      thread_ = std::thread(&VariantWriterStage::Work, this);
+    }
+  }
+
+  ~VariantWriterStage() { CHECK(!thread_.joinable()) << "Close() not called"; }
+
+  void Write(std::unique_ptr<Variant> variant) {
+    if (!thread_.joinable()) {
+      WriteNow(*variant);
+      return;
+    }
+    batch_.push_back(std::move(variant));
+    if (batch_.size() >= kWriteBatchSize) {
+      QueueBatch();
+    }
+  }
+
+  // Writes a copy of `variant`, which the caller may modify afterwards.
+  void WriteCopy(const Variant& variant) {
+    if (!thread_.joinable()) {
+      WriteNow(variant);
+      return;
+    }
+    Write(std::make_unique<Variant>(variant));
+  }
+
+  // Writes all queued variants and closes the writer.
+  void Close() {
+    if (thread_.joinable()) {
+      QueueBatch();
+      {
+        absl::MutexLock lock(&mutex_);
+        closing_ = true;
+      }
+      thread_.join();
+    }
+    NUCLEUS_QCHECK_OK(writer_->Close());
+  }
+
+ private:
+  using Batch = std::vector<std::unique_ptr<Variant>>;
+
+  void WriteNow(const Variant& variant) {
+    if (process_somatic_) {
+      NUCLEUS_QCHECK_OK(writer_->WriteSomatic(variant));
+    } else {
+      NUCLEUS_QCHECK_OK(writer_->Write(variant));
+    }
+  }
+
+  void QueueBatch() {
+    if (batch_.empty()) {
+      return;
+    }
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(
+        +[](std::deque<Batch>* queue) {
+          return queue->size() < kMaxQueuedWriteBatches;
+        },
+        &queue_));
+    queue_.push_back(std::move(batch_));
+    batch_.clear();
+    batch_.reserve(kWriteBatchSize);
+  }
+
+  // Requires mutex_ to be held.
+  bool HasBatchOrClosing() { return !queue_.empty() || closing_; }
+
+  void Work() {
+    while (true) {
+      Batch batch;
+      {
+        absl::MutexLock lock(&mutex_);
+        mutex_.Await(
+            absl::Condition(this, &VariantWriterStage::HasBatchOrClosing));
+        if (queue_.empty()) {
+          return;
+        }
+        batch = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      for (const std::unique_ptr<Variant>& variant : batch) {
+        WriteNow(*variant);
+      }
+    }
+  }
+
+  VcfWriter* const writer_;
+  const bool process_somatic_;
+  // Variants not yet handed to the writer thread.
+  Batch batch_;
+  absl::Mutex mutex_;
+  std::deque<Batch> queue_;
+  bool closing_ = false;
+  std::thread thread_;
+};
+
+}  // namespace
+
 // The alternate allele string for the gVCF "any" alternate allele.
 constexpr std::string_view GVCF_ALT_ALLELE = "<*>";
 
@@ -100,25 +224,45 @@ void ZeroScaleGl(Variant* variant) {
 
 constexpr int kCacheSize = 300000000;
 
+void LogWriterStats(const std::string& path, const HtsWriterStats& stats) {
+  LOG(INFO) << "Wrote " << stats.records << " records to " << path << ": "
+            << stats.uncompressed_bytes << " bytes formatted, "
+            << stats.compressed_bytes << " bytes written, "
+            << stats.write_seconds << "s in writer";
+}
+
 void MergeAndWriteVariantsAndNonVariants(
     bool only_keep_pass, const std::string& variant_file_path,
     const std::vector<std::string>& non_variant_file_paths,
     const std::string& fasta_path, const std::string& vcf_out_path,
     const std::string& gvcf_out_path,
-    const nucleus::genomics::v1::VcfHeader& header, bool process_somatic) {
+    const nucleus::genomics::v1::VcfHeader& header, bool process_somatic,
+    int num_threads) {
+  // Both writers share one pool for BGZF compression.
+  std::shared_ptr<HtsThreadPool> thread_pool;
+  if (num_threads > 1) {
+    auto pool_or_status = HtsThreadPool::Create(num_threads);
+    if (!pool_or_status.ok()) {
+      LOG(ERROR) << "creating thread pool failed"
+                 << pool_or_status.error_message();
+    } else {
+      thread_pool = std::move(pool_or_status.ValueOrDie());
+    }
+  }
+
   // Create VCF and gVCF writers
   nucleus::genomics::v1::VcfWriterOptions writer_options;
   writer_options.set_round_qual_values(true);
-  auto writer_or_status =
-      nucleus::VcfWriter::ToFile(vcf_out_path, header, writer_options);
+  auto writer_or_status = nucleus::VcfWriter::ToFile(
+      vcf_out_path, header, writer_options, thread_pool);
   if (!writer_or_status.ok()) {
     LOG(ERROR) << "opening writer failed" << writer_or_status.error_message();
   }
   std::unique_ptr<VcfWriter> vcf_writer =
       std::move(writer_or_status.ValueOrDie());
 
-  writer_or_status =
-      nucleus::VcfWriter::ToFile(gvcf_out_path, header, writer_options);
+  writer_or_status = nucleus::VcfWriter::ToFile(gvcf_out_path, header,
+                                                writer_options, thread_pool);
   if (!writer_or_status.ok()) {
     LOG(ERROR) << "opening writer failed" << writer_or_status.error_message();
   }
@@ -143,17 +287,28 @@ void MergeAndWriteVariantsAndNonVariants(
 
   // Create reader for non_variants
   std::unique_ptr<ShardedVariantReader> non_variant_reader =
-      ShardedVariantReader::Open(non_variant_file_paths, contig_index_map);
+      ShardedVariantReader::Open(non_variant_file_paths, contig_index_map,
+                                 num_threads);
 
   MergeAndWriteVariantsAndNonVariants(
       only_keep_pass, variant_reader.get(), non_variant_reader.get(),
-      vcf_writer.get(), gvcf_writer.get(), *fasta_reader, process_somatic);
+      vcf_writer.get(), gvcf_writer.get(), *fasta_reader, process_somatic,
+      num_threads);
+
+  // The writer stages above have already closed both writers; their stats
+  // remain available afterwards.
+  LogWriterStats(vcf_out_path, vcf_writer->Stats());
+  LogWriterStats(gvcf_out_path, gvcf_writer->Stats());
 }
 
 void MergeAndWriteVariantsAndNonVariants(
     bool only_keep_pass, VariantReader* variant_reader,
     ShardedVariantReader* non_variant_reader, VcfWriter* vcf_writer,
-    VcfWriter* gvcf_writer, const GenomeReference& ref, bool process_somatic) {
+    VcfWriter* gvcf_writer, const GenomeReference& ref, bool process_somatic,
+    int num_threads) {
+  VariantWriterStage vcf_stage(vcf_writer, process_somatic, num_threads > 1);
+  VariantWriterStage gvcf_stage(gvcf_writer, process_somatic, num_threads > 1);
+
   IndexedVariant variant = variant_reader->GetAndReadNext();
 
   IndexedVariant nonvariant = non_variant_reader->GetAndReadNext();
@@ -165,41 +320,24 @@ void MergeAndWriteVariantsAndNonVariants(
       if (!only_keep_pass ||
           (variant.variant->filter().size() == 1 &&
            variant.variant->filter(0) == DEEP_VARIANT_PASS)) {
-        if (process_somatic) {
-          NUCLEUS_QCHECK_OK(vcf_writer->WriteSomatic(*variant.variant));
-        } else {
-          NUCLEUS_QCHECK_OK(vcf_writer->Write(*variant.variant));
-        }
+        vcf_stage.WriteCopy(*variant.variant);
       }
       ZeroScaleGl(variant.variant.get());
       TransfromToGvcf(variant.variant.get());
-      if (process_somatic) {
-        NUCLEUS_QCHECK_OK(gvcf_writer->WriteSomatic(*variant.variant));
-      } else {
-        NUCLEUS_QCHECK_OK(gvcf_writer->Write(*variant.variant));
-      }
+      gvcf_stage.Write(std::move(variant.variant));
 
       variant = variant_reader->GetAndReadNext();
     } else if (nonvariant.contig_map_index < variant.contig_map_index ||
                (nonvariant.contig_map_index == variant.contig_map_index &&
                 nonvariant.variant->end() <= variant.variant->start())) {
-      if (process_somatic) {
-        NUCLEUS_QCHECK_OK(gvcf_writer->WriteSomatic(*nonvariant.variant));
-      } else {
-        NUCLEUS_QCHECK_OK(gvcf_writer->Write(*nonvariant.variant));
-      }
+      gvcf_stage.Write(std::move(nonvariant.variant));
 
       nonvariant = non_variant_reader->GetAndReadNext();
     } else {
       if (nonvariant.variant->start() < variant.variant->start()) {
-        std::unique_ptr<Variant> v = CreateRecordFromTemplate(
+        gvcf_stage.Write(CreateRecordFromTemplate(
             *nonvariant.variant, nonvariant.variant->start(),
-            variant.variant->start(), ref);
-        if (process_somatic) {
-          NUCLEUS_QCHECK_OK(gvcf_writer->WriteSomatic(*v));
-        } else {
-          NUCLEUS_QCHECK_OK(gvcf_writer->Write(*v));
-        }
+            variant.variant->start(), ref));
       }
       if (nonvariant.variant->end() > variant.variant->end()) {
         nonvariant = {.variant = CreateRecordFromTemplate(
@@ -213,8 +351,8 @@ void MergeAndWriteVariantsAndNonVariants(
     }
   }
 
-  NUCLEUS_QCHECK_OK(vcf_writer->Close());
-  NUCLEUS_QCHECK_OK(gvcf_writer->Close());
+  vcf_stage.Close();
+  gvcf_stage.Close();
 }
 
 }  // namespace nucleus
@@ -57,19 +57,30 @@ void TransfromToGvcf(Variant* variant);
 // modifies the input variant to mimic this transformation of GL -> PL -> GL.
 void ZeroScaleGl(Variant* variant);
 
+// Merges the sorted variants at `variant_file_path` with the sorted non-variant
+// sites in the `non_variant_file_paths` shards, and writes the variants to
+// `vcf_out_path` and both to `gvcf_out_path`.
+//
+// If `num_threads` is greater than 1, the merge runs as a pipeline: up to
+// `num_threads` threads read and parse the non-variant shards, the calling
+// thread merges the records, and the VCF and gVCF are each formatted and
+// written on their own thread. The output is the same for any `num_threads`.
 void MergeAndWriteVariantsAndNonVariants(
     bool only_keep_pass, const std::string& variant_file_path,
     const std::vector<std::string>& non_variant_file_paths,
     const std::string& fasta_path, const std::string& vcf_out_path,
     const std::string& gvcf_out_path,
     const nucleus::genomics::v1::VcfHeader& header,
-    bool process_somatic = false);
+    bool process_somatic = false, int num_threads = 1);
 
+// Same as above with already opened readers and writers. Here `num_threads`
+// only controls whether the writers run on their own threads; pass
+// `num_threads` to ShardedVariantReader::Open to also decode in parallel.
 void MergeAndWriteVariantsAndNonVariants(
     bool only_keep_pass, VariantReader* variant_reader,
     ShardedVariantReader* non_variant_reader, VcfWriter* vcf_writer,
     VcfWriter* gvcf_writer, const GenomeReference& ref,
-    bool process_somatic = false);
+    bool process_somatic = false, int num_threads = 1);
 
 }  // namespace nucleus
 
@@ -32,6 +32,10 @@
 
 #include "third_party/nucleus/io/merge_variants.h"
 
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 #include <gmock/gmock-generated-matchers.h>
@@ -39,15 +43,20 @@
 #include <gmock/gmock-more-matchers.h>
 
 #include "tensorflow/core/platform/test.h"
+#include "absl/strings/str_cat.h"
 #include "third_party/nucleus/io/reference.h"
+#include "third_party/nucleus/io/tfrecord_writer.h"
+#include "third_party/nucleus/io/vcf_reader.h"
 #include "third_party/nucleus/protos/reference.pb.h"
 #include "third_party/nucleus/protos/struct.pb.h"
 #include "third_party/nucleus/protos/variants.pb.h"
 #include "third_party/nucleus/testing/protocol-buffer-matchers.h"
+#include "third_party/nucleus/testing/test_utils.h"
 
 namespace {
 
 using nucleus::EqualsProto;
+using nucleus::genomics::v1::Variant;
 
 nucleus::genomics::v1::Variant SingleVariantCallWithLiklihood(
     const std::vector<double>& liklihoods) {
@@ -232,4 +241,121 @@ TEST(CreateRecordFromTemplateTest, TemplateCreated) {
                      EqualsProto(VariantCallWithStartEnd("1", 10, 12, "G"))));
 }
 
+nucleus::genomics::v1::VcfHeader MergeTestHeader() {
+  nucleus::genomics::v1::VcfHeader header;
+  auto& end = *header.add_infos();
+  end.set_id("END");
+  end.set_number("1");
+  end.set_type("Integer");
+  end.set_description("Stop position of the interval");
+  auto& gt = *header.add_formats();
+  gt.set_id("GT");
+  gt.set_number("1");
+  gt.set_type("String");
+  gt.set_description("Genotype");
+  auto& gl = *header.add_formats();
+  gl.set_id("GL");
+  gl.set_number("G");
+  gl.set_type("Float");
+  gl.set_description("Genotype likelihoods, log10 encoded");
+  // Same contigs as test.fasta.
+  for (const auto& [name, n_bases] :
+       std::vector<std::pair<std::string, int>>{
+           {"chrM", 100}, {"chr1", 76}, {"chr2", 121}}) {
+    auto& contig = *header.add_contigs();
+    contig.set_name(name);
+    contig.set_n_bases(n_bases);
+  }
+  header.add_sample_names("Sample");
+  return header;
+}
+
+Variant MergeTestRecord(const std::string& ref_name, int start, int end,
+                        const std::string& ref, const std::string& alt,
+                        const std::vector<int>& genotype) {
+  Variant variant = VariantCallWithStartEnd(ref_name, start, end, ref);
+  variant.add_alternate_bases(alt);
+  variant.add_filter("PASS");
+  auto* call = variant.add_calls();
+  call->set_call_set_name("Sample");
+  for (int g : genotype) {
+    call->add_genotype(g);
+  }
+  for (double l : {-1.0, -0.1, -2.0}) {
+    call->add_genotype_likelihood(l);
+  }
+  return variant;
+}
+
+void WriteVariants(const std::string& path, const std::string& compression,
+                   const std::vector<Variant>& variants) {
+  auto writer = nucleus::TFRecordWriter::New(path, compression);
+  for (const Variant& variant : variants) {
+    ASSERT_TRUE(writer->WriteRecord(variant.SerializeAsString()));
+  }
+  ASSERT_TRUE(writer->Close());
+}
+
+std::vector<Variant> ReadVcf(const std::string& path) {
+  auto reader = std::move(
+      nucleus::VcfReader::FromFile(path,
+                                   nucleus::genomics::v1::VcfReaderOptions())
+          .ValueOrDie());
+  return nucleus::as_vector(reader->Iterate());
+}
+
+class MergeFilesTest : public testing::TestWithParam<int> {};
+
+// Runs the path based overload end to end, which opens and closes the writers
+// itself.
+TEST_P(MergeFilesTest, MergesVariantsAndNonVariants) {
+  const int num_threads = GetParam();
+  const std::string suffix = absl::StrCat("_", num_threads);
+  const std::string variants_path =
+      nucleus::MakeTempFile(absl::StrCat("variants", suffix, ".tfrecord"));
+  const std::string non_variants_a =
+      nucleus::MakeTempFile(absl::StrCat("non_variants_a", suffix, ".gz"));
+  const std::string non_variants_b =
+      nucleus::MakeTempFile(absl::StrCat("non_variants_b", suffix, ".gz"));
+  const std::string vcf_path =
+      nucleus::MakeTempFile(absl::StrCat("merged", suffix, ".vcf"));
+  const std::string gvcf_path =
+      nucleus::MakeTempFile(absl::StrCat("merged", suffix, ".g.vcf"));
+
+  WriteVariants(variants_path, "",
+                {MergeTestRecord("chr1", 10, 11, "T", "C", {0, 1})});
+  WriteVariants(non_variants_a, "GZIP",
+                {MergeTestRecord("chr1", 0, 20, "A", "<*>", {0, 0})});
+  WriteVariants(non_variants_b, "GZIP",
+                {MergeTestRecord("chrM", 0, 5, "G", "<*>", {0, 0})});
+
+  nucleus::MergeAndWriteVariantsAndNonVariants(
+      /*only_keep_pass=*/false, variants_path, {non_variants_a, non_variants_b},
+      nucleus::GetTestData("test.fasta"), vcf_path, gvcf_path,
+      MergeTestHeader(), /*process_somatic=*/false, num_threads);
+
+  std::vector<Variant> vcf = ReadVcf(vcf_path);
+  ASSERT_EQ(vcf.size(), 1);
+  EXPECT_EQ(vcf[0].reference_name(), "chr1");
+  EXPECT_EQ(vcf[0].start(), 10);
+
+  // The chr1 reference block is split around the variant, and its second
+  // half starts with the reference base at position 11.
+  std::vector<Variant> gvcf = ReadVcf(gvcf_path);
+  ASSERT_EQ(gvcf.size(), 4);
+  std::vector<std::tuple<std::string, int, int, std::string>> actual;
+  for (const Variant& v : gvcf) {
+    actual.emplace_back(v.reference_name(), v.start(), v.end(),
+                        v.reference_bases());
+  }
+  EXPECT_THAT(actual,
+              testing::ElementsAre(std::make_tuple("chrM", 0, 5, "G"),
+                                   std::make_tuple("chr1", 0, 10, "A"),
+                                   std::make_tuple("chr1", 10, 11, "T"),
+                                   std::make_tuple("chr1", 11, 20, "C")));
+}
+
+INSTANTIATE_TEST_SUITE_P(MergeFilesTests, MergeFilesTest,
+                         testing::Values(1, 4));
+
 }  // namespace
@@ -0,0 +1,498 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "third_party/nucleus/io/packed_reference.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "third_party/nucleus/io/reader_base.h"
+#include "third_party/nucleus/util/utils.h"
+
+namespace nucleus {
+
+using nucleus::genomics::v1::Range;
+
+namespace {
+
+// File layout, all integers little-endian and all sections 8-byte aligned:
+//
+//   FileHeader
+//   ContigEntry[num_contigs]
+//   for each contig:
+//     name and description
+//     bases, 2 bits per base, base i in bits 2 * (i % 4) of byte i / 4
+//     BaseRun[num_other_bases]: runs of bases other than A, C, G and T
+//     BaseRun[num_lowercase]: runs of lowercase bases
+constexpr char kMagic[8] = {'N', 'U', 'C', 'P', 'R', 'E', 'F', '\0'};
+constexpr uint32_t kVersion = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_contigs;
+  uint64_t file_size;
+};
+
+struct ContigEntry {
+  uint64_t name_offset;
+  uint32_t name_size;
+  uint32_t description_size;
+  uint64_t n_bases;
+  uint64_t bases_offset;
+  uint64_t other_bases_offset;
+  uint64_t num_other_bases;
+  uint64_t lowercase_offset;
+  uint64_t num_lowercase;
+};
+
+// 2-bit codes of A, C, G and T, and -1 for all other uppercased bases.
+constexpr std::array<int8_t, 256> MakeBaseCodes() {
+  std::array<int8_t, 256> codes{};
+  for (int i = 0; i < 256; ++i) codes[i] = -1;
+  codes['A'] = 0;
+  codes['C'] = 1;
+  codes['G'] = 2;
+  codes['T'] = 3;
+  return codes;
+}
+constexpr std::array<int8_t, 256> kBaseCodes = MakeBaseCodes();
+constexpr char kCodeBases[4] = {'A', 'C', 'G', 'T'};
+
+// The four bases packed in each byte value.
+struct PackedByteBases {
+  PackedByteBases() {
+    for (int byte = 0; byte < 256; ++byte) {
+      for (int i = 0; i < 4; ++i) {
+        bases[byte][i] = kCodeBases[(byte >> (2 * i)) & 3];
+      }
+    }
+  }
+  char bases[256][4];
+};
+
+uint64_t Align8(uint64_t offset) { return (offset + 7) & ~uint64_t{7}; }
+
+// Appends to `file` and keeps track of the offset, so that sections can be
+// aligned.
+class PackedFileWriter {
+ public:
+  explicit PackedFileWriter(FILE* file) : file_(file) {}
+
+  void Write(const void* data, size_t size) {
+    ok_ = ok_ && fwrite(data, 1, size, file_) == size;
+    offset_ += size;
+  }
+
+  void Align() {
+    static constexpr char kZeros[8] = {};
+    Write(kZeros, Align8(offset_) - offset_);
+  }
+
+  void WriteAt(uint64_t offset, const void* data, size_t size) {
+    ok_ = ok_ && fseek(file_, offset, SEEK_SET) == 0 &&
+          fwrite(data, 1, size, file_) == size &&
+          fseek(file_, 0, SEEK_END) == 0;
+  }
+
+  uint64_t offset() const { return offset_; }
+  bool ok() const { return ok_; }
+
+ private:
+  FILE* file_;
+  uint64_t offset_ = 0;
+  bool ok_ = true;
+};
+
+// A file written under a temporary name next to `path`. Unless Commit()
+// succeeds, the file is closed and removed when this goes out of scope, so a
+// failed write never leaves a truncated file behind.
+class TempOutputFile {
+ public:
+  explicit TempOutputFile(const string& path)
+      : path_(path),
+        tmp_path_(absl::StrCat(path, ".tmp.", getpid())),
+        file_(fopen(tmp_path_.c_str(), "wb")),
+        opened_(file_ != nullptr) {}
+
+  ~TempOutputFile() {
+    if (file_ != nullptr) fclose(file_);
+    if (opened() && !committed_) remove(tmp_path_.c_str());
+  }
+
+  TempOutputFile(const TempOutputFile&) = delete;
+  TempOutputFile& operator=(const TempOutputFile&) = delete;
+
+  // True if the temporary file could be created.
+  bool opened() const { return opened_; }
+  FILE* file() const { return file_; }
+
+  // Closes the file and renames it to path. Returns false on failure.
+  bool Commit() {
+    const bool closed = fclose(file_) == 0;
+    file_ = nullptr;
+    committed_ = closed && rename(tmp_path_.c_str(), path_.c_str()) == 0;
+    return committed_;
+  }
+
+ private:
+  const string path_;
+  const string tmp_path_;
+  FILE* file_;
+  const bool opened_;
+  bool committed_ = false;
+};
+
+}  // namespace
+
+::nucleus::Status WritePackedReference(const GenomeReference& reference,
+                                       const string& output_path) {
+  using BaseRun = PackedReferenceReader::BaseRun;
+  const std::vector<nucleus::genomics::v1::ContigInfo>& contigs =
+      reference.Contigs();
+  TempOutputFile output(output_path);
+  if (!output.opened()) {
+    return ::nucleus::Unknown(
+        absl::StrCat("Could not open ", output_path, " for writing"));
+  }
+  PackedFileWriter writer(output.file());
+
+  FileHeader header = {};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.num_contigs = contigs.size();
+  std::vector<ContigEntry> entries(contigs.size());
+  writer.Write(&header, sizeof(header));
+  writer.Write(entries.data(), entries.size() * sizeof(ContigEntry));
+
+  for (size_t i = 0; i < contigs.size(); ++i) {
+    const nucleus::genomics::v1::ContigInfo& contig = contigs[i];
+    ContigEntry& entry = entries[i];
+    entry.n_bases = contig.n_bases();
+    entry.name_offset = writer.offset();
+    entry.name_size = contig.name().size();
+    entry.description_size = contig.description().size();
+    writer.Write(contig.name().data(), contig.name().size());
+    writer.Write(contig.description().data(), contig.description().size());
+    writer.Align();
+
+    string bases;
+    if (contig.n_bases() > 0) {
+      StatusOr<string> bases_or =
+          reference.GetBases(MakeRange(contig.name(), 0, contig.n_bases()));
+      NUCLEUS_RETURN_IF_ERROR(bases_or.status());
+      bases = std::move(bases_or.ValueOrDie());
+    }
+
+    std::vector<uint8_t> packed((bases.size() + 3) / 4, 0);
+    std::vector<BaseRun> other_bases;
+    std::vector<BaseRun> lowercase;
+    // Extends the last run of `runs` with the base at `pos`, or starts a new
+    // run.
+    auto add_to_runs = [](std::vector<BaseRun>* runs, uint64_t pos, char base) {
+      if (!runs->empty() && runs->back().base == base &&
+          runs->back().start + runs->back().length == pos &&
+          runs->back().length < UINT32_MAX) {
+        ++runs->back().length;
+      } else {
+        runs->push_back({pos, 1, base, {}});
+      }
+    };
+    for (uint64_t pos = 0; pos < bases.size(); ++pos) {
+      const unsigned char base = bases[pos];
+      if (absl::ascii_islower(base)) {
+        add_to_runs(&lowercase, pos, 0);
+      }
+      const char upper = absl::ascii_toupper(base);
+      const int8_t code = kBaseCodes[static_cast<unsigned char>(upper)];
+      if (code >= 0) {
+        packed[pos / 4] |= code << (2 * (pos % 4));
+      } else {
+        add_to_runs(&other_bases, pos, upper);
+      }
+    }
+
+    entry.bases_offset = writer.offset();
+    writer.Write(packed.data(), packed.size());
+    writer.Align();
+    entry.other_bases_offset = writer.offset();
+    entry.num_other_bases = other_bases.size();
+    writer.Write(other_bases.data(), other_bases.size() * sizeof(BaseRun));
+    entry.lowercase_offset = writer.offset();
+    entry.num_lowercase = lowercase.size();
+    writer.Write(lowercase.data(), lowercase.size() * sizeof(BaseRun));
+  }
+
+  header.file_size = writer.offset();
+  writer.WriteAt(0, &header, sizeof(header));
+  writer.WriteAt(sizeof(header), entries.data(),
+                 entries.size() * sizeof(ContigEntry));
+  if (!writer.ok() || !output.Commit()) {
+    return ::nucleus::Unknown(absl::StrCat("Failed to write ", output_path));
+  }
+  return ::nucleus::Status();
+}
+
+// Iterable class for traversing all contigs of a packed reference.
+class PackedReferenceReaderIterable : public GenomeReferenceRecordIterable {
+ public:
+  // Advance to the next record.
+  StatusOr<bool> Next(GenomeReferenceRecord* out) override;
+
+  // Constructor is invoked via PackedReferenceReader::Iterate.
+  PackedReferenceReaderIterable(const PackedReferenceReader* reader);
+  ~PackedReferenceReaderIterable() override;
+
+ private:
+  size_t pos_ = 0;
+};
+
+StatusOr<std::unique_ptr<PackedReferenceReader>>
+PackedReferenceReader::FromFile(const string& path) {
+  return FromFile(path, nucleus::genomics::v1::FastaReaderOptions());
+}
+
+StatusOr<std::unique_ptr<PackedReferenceReader>>
+PackedReferenceReader::FromFile(
+    const string& path,
+    const nucleus::genomics::v1::FastaReaderOptions& options) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return ::nucleus::NotFound(
+        absl::StrCat("Could not open packed reference ", path));
+  }
+  struct stat file_stat;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+    data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  // The mapping stays valid after the file descriptor is closed.
+  close(fd);
+  if (data == MAP_FAILED) {
+    return ::nucleus::DataLoss(
+        absl::StrCat("Could not map packed reference ", path));
+  }
+  std::unique_ptr<PackedReferenceReader> reader(new PackedReferenceReader(
+      options, static_cast<const uint8_t*>(data), file_stat.st_size));
+  ::nucleus::Status status = reader->Load();
+  if (!status.ok()) {
+    return ::nucleus::DataLoss(
+        absl::StrCat("Invalid packed reference ", path, ": ",
+                     status.error_message()));
+  }
+  return std::move(reader);
+}
+
+PackedReferenceReader::PackedReferenceReader(
+    const nucleus::genomics::v1::FastaReaderOptions& options,
+    const uint8_t* data, size_t size)
+    : options_(options), data_(data), size_(size) {}
+
+PackedReferenceReader::~PackedReferenceReader() {
+  if (data_) {
+    NUCLEUS_CHECK_OK(Close());
+  }
+}
+
+::nucleus::Status PackedReferenceReader::Load() {
+  FileHeader header;
+  if (size_ < sizeof(header)) {
+    return ::nucleus::DataLoss("file is too short");
+  }
+  std::memcpy(&header, data_, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    return ::nucleus::DataLoss("bad magic");
+  }
+  if (header.version != kVersion) {
+    return ::nucleus::DataLoss(
+        absl::StrCat("unsupported version ", header.version));
+  }
+  if (header.file_size != size_ ||
+      header.num_contigs >
+          (size_ - sizeof(header)) / sizeof(ContigEntry)) {
+    return ::nucleus::DataLoss("file is truncated");
+  }
+
+  // Returns true if `count` items of `item_size` bytes at `offset` are in the
+  // file and 8-byte aligned.
+  auto in_file = [this](uint64_t offset, uint64_t count, uint64_t item_size) {
+    return offset % 8 == 0 && offset <= size_ &&
+           count <= (size_ - offset) / item_size;
+  };
+  const ContigEntry* entries =
+      reinterpret_cast<const ContigEntry*>(data_ + sizeof(header));
+  for (uint32_t i = 0; i < header.num_contigs; ++i) {
+    const ContigEntry& entry = entries[i];
+    if (!in_file(entry.name_offset,
+                 uint64_t{entry.name_size} + entry.description_size, 1) ||
+        !in_file(entry.bases_offset, (entry.n_bases + 3) / 4, 1) ||
+        !in_file(entry.other_bases_offset, entry.num_other_bases,
+                 sizeof(BaseRun)) ||
+        !in_file(entry.lowercase_offset, entry.num_lowercase,
+                 sizeof(BaseRun))) {
+      return ::nucleus::DataLoss(
+          absl::StrCat("contig ", i, " is out of the file"));
+    }
+    const char* name =
+        reinterpret_cast<const char*>(data_ + entry.name_offset);
+    nucleus::genomics::v1::ContigInfo contig;
+    contig.set_name(name, entry.name_size);
+    contig.set_description(name + entry.name_size, entry.description_size);
+    contig.set_n_bases(entry.n_bases);
+    contig.set_pos_in_fasta(i);
+    contig_index_[contig.name()] = i;
+    contigs_.push_back(std::move(contig));
+    packed_contigs_.push_back(
+        {data_ + entry.bases_offset,
+         reinterpret_cast<const BaseRun*>(data_ + entry.other_bases_offset),
+         entry.num_other_bases,
+         reinterpret_cast<const BaseRun*>(data_ + entry.lowercase_offset),
+         entry.num_lowercase});
+  }
+  return ::nucleus::Status();
+}
+
+StatusOr<string> PackedReferenceReader::GetBases(const Range& range) const {
+  if (data_ == nullptr) {
+    return ::nucleus::FailedPrecondition(
+        "can't read from closed PackedReferenceReader object.");
+  }
+  if (!IsValidInterval(range))
+    return ::nucleus::InvalidArgument(
+        absl::StrCat("Invalid interval: ", range.ShortDebugString()));
+
+  static const PackedByteBases* const kByteBases = new PackedByteBases();
+  const PackedContig& contig =
+      packed_contigs_[contig_index_.at(range.reference_name())];
+  const uint64_t start = range.start();
+  const uint64_t end = range.end();
+  string bases(end - start, 'N');
+  char* out = &bases[0];
+  uint64_t pos = start;
+  for (; pos < end && pos % 4 != 0; ++pos) {
+    *out++ = kByteBases->bases[contig.bases[pos / 4]][pos % 4];
+  }
+  for (; pos + 4 <= end; pos += 4, out += 4) {
+    std::memcpy(out, kByteBases->bases[contig.bases[pos / 4]], 4);
+  }
+  for (; pos < end; ++pos) {
+    *out++ = kByteBases->bases[contig.bases[pos / 4]][pos % 4];
+  }
+
+  // Calls fn(run_start, run_end) for the part of each run in `runs` that
+  // overlaps the range, relative to the range start.
+  auto for_each_overlap = [start, end](const BaseRun* runs, uint64_t num_runs,
+                                       auto fn) {
+    // The first run starting after `start`; the one before may overlap too.
+    const BaseRun* run = std::upper_bound(
+        runs, runs + num_runs, start,
+        [](uint64_t pos, const BaseRun& r) { return pos < r.start; });
+    if (run != runs) --run;
+    for (; run != runs + num_runs && run->start < end; ++run) {
+      const uint64_t run_start = std::max(start, run->start);
+      const uint64_t run_end = std::min(end, run->start + run->length);
+      if (run_start < run_end) {
+        fn(*run, run_start - start, run_end - start);
+      }
+    }
+  };
+  for_each_overlap(contig.other_bases, contig.num_other_bases,
+                   [&bases](const BaseRun& run, uint64_t from, uint64_t to) {
+                     std::fill(bases.begin() + from, bases.begin() + to,
+                               run.base);
+                   });
+  if (options_.keep_true_case()) {
+    for_each_overlap(contig.lowercase, contig.num_lowercase,
+                     [&bases](const BaseRun& run, uint64_t from, uint64_t to) {
+                       for (uint64_t i = from; i < to; ++i) {
+                         bases[i] = absl::ascii_tolower(bases[i]);
+                       }
+                     });
+  }
+  return bases;
+}
+
+StatusOr<std::shared_ptr<GenomeReferenceRecordIterable>>
+PackedReferenceReader::Iterate() const {
+  return StatusOr<std::shared_ptr<GenomeReferenceRecordIterable>>(
+      MakeIterable<PackedReferenceReaderIterable>(this));
+}
+
+::nucleus::Status PackedReferenceReader::Close() {
+  if (data_ == nullptr) {
+    return ::nucleus::FailedPrecondition(
+        "PackedReferenceReader already closed");
+  }
+  munmap(const_cast<uint8_t*>(data_), size_);
+  data_ = nullptr;
+  packed_contigs_.clear();
+  return ::nucleus::Status();
+}
+
+StatusOr<bool> PackedReferenceReaderIterable::Next(GenomeReferenceRecord* out) {
+  NUCLEUS_RETURN_IF_ERROR(CheckIsAlive());
+  const PackedReferenceReader* reader =
+      static_cast<const PackedReferenceReader*>(reader_);
+  if (pos_ >= reader->contigs_.size()) {
+    return false;
+  }
+  const genomics::v1::ContigInfo& contig = reader->contigs_.at(pos_);
+  out->first = contig.name();
+  if (contig.n_bases() > 0) {
+    StatusOr<string> bases =
+        reader->GetBases(MakeRange(contig.name(), 0, contig.n_bases()));
+    NUCLEUS_RETURN_IF_ERROR(bases.status());
+    out->second = std::move(bases.ValueOrDie());
+  } else {
+    out->second.clear();
+  }
+  pos_++;
+  return true;
+}
+
+PackedReferenceReaderIterable::~PackedReferenceReaderIterable() {}
+
+PackedReferenceReaderIterable::PackedReferenceReaderIterable(
+    const PackedReferenceReader* reader)
+    : Iterable(reader) {}
+
+}  // namespace nucleus
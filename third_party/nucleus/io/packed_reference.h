@@ -0,0 +1,156 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// A packed, memory-mapped copy of a reference genome.
+//
+// The packed format holds everything GetBases can return for a FASTA file in
+// about a quarter of its size: each base is stored in 2 bits, and bases other
+// than A, C, G and T (mostly runs of N) and lowercase bases are stored as
+// sorted lists of runs. A contig table holds the ContigInfo of every contig in
+// FASTA order. The file is memory-mapped read-only, so opening it costs no
+// parsing or decompression, queries read only the pages they touch, and all
+// processes on a host reading the same file share those pages.
+//
+// Packed files are written from any GenomeReference with WritePackedReference,
+// for example with the pack_reference tool. The file must be on a local
+// filesystem that supports mmap.
+#ifndef THIRD_PARTY_NUCLEUS_IO_PACKED_REFERENCE_H_
+#define THIRD_PARTY_NUCLEUS_IO_PACKED_REFERENCE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "third_party/nucleus/io/reference.h"
+#include "third_party/nucleus/platform/types.h"
+#include "third_party/nucleus/protos/fasta.pb.h"
+#include "third_party/nucleus/protos/range.pb.h"
+#include "third_party/nucleus/protos/reference.pb.h"
+#include "third_party/nucleus/core/status.h"
+#include "third_party/nucleus/core/statusor.h"
+
+namespace nucleus {
+
+// Writes all contigs of `reference` to `output_path` in the packed format.
+// `reference` should keep the case of its bases (see
+// FastaReaderOptions.keep_true_case) for lowercase bases to be recorded.
+// The file is written under a temporary name and only renamed to
+// `output_path` once complete, so on error nothing is left at `output_path`.
+::nucleus::Status WritePackedReference(const GenomeReference& reference,
+                                       const string& output_path);
+
+// A GenomeReference reading from a file written by WritePackedReference.
+//
+// Bases are uppercased unless options.keep_true_case is set, in which case
+// GetBases returns the bases exactly as in the reference the file was written
+// from.
+class PackedReferenceReader : public GenomeReference {
+ public:
+  // Memory-maps the packed reference at `path` and checks its header and
+  // contig table. Returns a value whose status is not ok() if the file cannot
+  // be mapped or is not a valid packed reference.
+  static StatusOr<std::unique_ptr<PackedReferenceReader>> FromFile(
+      const string& path,
+      const nucleus::genomics::v1::FastaReaderOptions& options);
+  static StatusOr<std::unique_ptr<PackedReferenceReader>> FromFile(
+      const string& path);
+
+  ~PackedReferenceReader();
+
+  // Disable copy and assignment operations
+  PackedReferenceReader(const PackedReferenceReader& other) = delete;
+  PackedReferenceReader& operator=(const PackedReferenceReader&) = delete;
+
+  const std::vector<nucleus::genomics::v1::ContigInfo>& Contigs()
+      const override {
+    return contigs_;
+  }
+
+  StatusOr<string> GetBases(
+      const nucleus::genomics::v1::Range& range) const override;
+
+  StatusOr<std::shared_ptr<GenomeReferenceRecordIterable>> Iterate()
+      const override;
+
+  // Unmaps the file.
+  ::nucleus::Status Close() override;
+
+ private:
+  // Allow iteration to access the underlying reader.
+  friend class PackedReferenceReaderIterable;
+
+  // A run of `length` bases starting at `start`. For bases other than A, C, G
+  // and T, `base` is the uppercased base of the whole run.
+  struct BaseRun {
+    uint64_t start;
+    uint32_t length;
+    char base;
+    char padding[3];
+  };
+
+  // Pointers into the mapped file for one contig.
+  struct PackedContig {
+    const uint8_t* bases;
+    const BaseRun* other_bases;
+    uint64_t num_other_bases;
+    const BaseRun* lowercase;
+    uint64_t num_lowercase;
+  };
+
+  friend ::nucleus::Status WritePackedReference(
+      const GenomeReference& reference, const string& output_path);
+
+  // Must use one of the static factory methods.
+  PackedReferenceReader(
+      const nucleus::genomics::v1::FastaReaderOptions& options,
+      const uint8_t* data, size_t size);
+
+  // Checks the header and contig table and fills contigs_ and packed_contigs_.
+  ::nucleus::Status Load();
+
+  // The options controlling the behavior of this reader.
+  const nucleus::genomics::v1::FastaReaderOptions options_;
+
+  // The mapped file, or nullptr once closed.
+  const uint8_t* data_;
+  const size_t size_;
+
+  std::vector<nucleus::genomics::v1::ContigInfo> contigs_;
+  std::vector<PackedContig> packed_contigs_;
+  std::unordered_map<string, int> contig_index_;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_PACKED_REFERENCE_H_
@@ -0,0 +1,243 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "third_party/nucleus/io/packed_reference.h"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/nucleus/io/reference.h"
+#include "third_party/nucleus/platform/types.h"
+#include "third_party/nucleus/protos/fasta.pb.h"
+#include "third_party/nucleus/protos/reference.pb.h"
+#include "third_party/nucleus/testing/protocol-buffer-matchers.h"
+#include "third_party/nucleus/testing/test_utils.h"
+#include "third_party/nucleus/util/utils.h"
+#include "third_party/nucleus/core/status.h"
+#include "third_party/nucleus/core/status_matchers.h"
+
+namespace nucleus {
+
+namespace {
+
+using genomics::v1::FastaReaderOptions;
+
+std::unique_ptr<IndexedFastaReader> LoadFasta(bool keep_true_case) {
+  FastaReaderOptions options;
+  options.set_keep_true_case(keep_true_case);
+  string fasta = GetTestData("test.fasta");
+  return std::move(
+      IndexedFastaReader::FromFile(fasta, fasta + ".fai", options)
+          .ValueOrDie());
+}
+
+std::unique_ptr<PackedReferenceReader> LoadPacked(const string& path,
+                                                  bool keep_true_case) {
+  FastaReaderOptions options;
+  options.set_keep_true_case(keep_true_case);
+  return std::move(PackedReferenceReader::FromFile(path, options).ValueOrDie());
+}
+
+// Checks that `packed` has the same contigs as `expected` and returns the
+// same bases for every range.
+void ExpectSameReference(const GenomeReference& expected,
+                         const GenomeReference& packed) {
+  ASSERT_EQ(expected.Contigs().size(), packed.Contigs().size());
+  for (int i = 0; i < expected.Contigs().size(); ++i) {
+    const genomics::v1::ContigInfo& contig = expected.Contigs()[i];
+    EXPECT_THAT(packed.Contigs()[i], EqualsProto(contig));
+    for (int start = 0; start < contig.n_bases(); ++start) {
+      for (int end = start + 1; end <= contig.n_bases(); ++end) {
+        const genomics::v1::Range range =
+            MakeRange(contig.name(), start, end);
+        ASSERT_EQ(expected.GetBases(range).ValueOrDie(),
+                  packed.GetBases(range).ValueOrDie())
+            << range.ShortDebugString();
+      }
+    }
+  }
+}
+
+TEST(PackedReferenceTest, MatchesFasta) {
+  const string path = MakeTempFile("test.packed");
+  ASSERT_THAT(WritePackedReference(*LoadFasta(true), path), IsOK());
+
+  ExpectSameReference(*LoadFasta(true), *LoadPacked(path, true));
+  ExpectSameReference(*LoadFasta(false), *LoadPacked(path, false));
+}
+
+TEST(PackedReferenceTest, KeepsAllBasesAndCase) {
+  std::vector<genomics::v1::ContigInfo> contigs(4);
+  std::vector<genomics::v1::ReferenceSequence> seqs(4);
+  const std::vector<std::pair<string, string>> named_bases = {
+      {"iupac", "ACGTNRYKMSWBDHVNNNacgtnrykmswbdhv"},
+      {"n_runs", "NNNNNNNNNNACGTTGCAnnnnnNNNNNacgtACGTNNNNNNN"},
+      {"odd", "ACGTA"},
+      {"empty", ""},
+  };
+  for (int i = 0; i < named_bases.size(); ++i) {
+    const string& name = named_bases[i].first;
+    const string& bases = named_bases[i].second;
+    contigs[i].set_name(name);
+    contigs[i].set_description(absl::StrCat("contig ", i));
+    contigs[i].set_pos_in_fasta(i);
+    contigs[i].set_n_bases(bases.size());
+    seqs[i].mutable_region()->set_reference_name(name);
+    seqs[i].mutable_region()->set_start(0);
+    seqs[i].mutable_region()->set_end(bases.size());
+    seqs[i].set_bases(bases);
+  }
+  std::unique_ptr<InMemoryFastaReader> in_memory =
+      std::move(InMemoryFastaReader::Create(contigs, seqs).ValueOrDie());
+  const string path = MakeTempFile("in_memory.packed");
+  ASSERT_THAT(WritePackedReference(*in_memory, path), IsOK());
+
+  std::unique_ptr<PackedReferenceReader> packed = LoadPacked(path, true);
+  ExpectSameReference(*in_memory, *packed);
+  EXPECT_EQ(packed->GetBases(MakeRange("n_runs", 8, 30)).ValueOrDie(),
+            "NNACGTTGCAnnnnnNNNNNac");
+
+  // Without keep_true_case, bases are uppercased.
+  std::unique_ptr<PackedReferenceReader> upper = LoadPacked(path, false);
+  EXPECT_EQ(upper->GetBases(MakeRange("iupac", 16, 33)).ValueOrDie(),
+            "NNACGTNRYKMSWBDHV");
+
+  std::vector<GenomeReferenceRecord> records = as_vector(packed->Iterate());
+  ASSERT_EQ(records.size(), 4);
+  for (int i = 0; i < named_bases.size(); ++i) {
+    EXPECT_EQ(records[i].first, named_bases[i].first);
+    EXPECT_EQ(records[i].second, named_bases[i].second);
+  }
+}
+
+// A reference whose GetBases fails for every contig but the first.
+class FailingReference : public GenomeReference {
+ public:
+  explicit FailingReference(std::unique_ptr<GenomeReference> reference)
+      : reference_(std::move(reference)) {}
+
+  const std::vector<genomics::v1::ContigInfo>& Contigs() const override {
+    return reference_->Contigs();
+  }
+  StatusOr<string> GetBases(const genomics::v1::Range& range) const override {
+    if (range.reference_name() != Contigs()[0].name()) {
+      return ::nucleus::DataLoss("Corrupt reference");
+    }
+    return reference_->GetBases(range);
+  }
+  StatusOr<std::shared_ptr<GenomeReferenceRecordIterable>> Iterate()
+      const override {
+    return reference_->Iterate();
+  }
+
+ private:
+  std::unique_ptr<GenomeReference> reference_;
+};
+
+TEST(PackedReferenceTest, LeavesNoFileOnError) {
+  const string path = MakeTempFile("failed.packed");
+  std::remove(path.c_str());
+  EXPECT_THAT(WritePackedReference(FailingReference(LoadFasta(true)), path),
+              IsNotOKWithCodeAndMessage(absl::StatusCode::kDataLoss,
+                                        "Corrupt reference"));
+  EXPECT_EQ(fopen(path.c_str(), "rb"), nullptr);
+
+  // Nor does it replace an existing file.
+  ASSERT_THAT(WritePackedReference(*LoadFasta(true), path), IsOK());
+  EXPECT_THAT(WritePackedReference(FailingReference(LoadFasta(true)), path),
+              IsNotOKWithCodeAndMessage(absl::StatusCode::kDataLoss,
+                                        "Corrupt reference"));
+  ExpectSameReference(*LoadFasta(true), *LoadPacked(path, true));
+}
+
+TEST(PackedReferenceTest, NotOKIfIntervalIsInvalid) {
+  const string path = MakeTempFile("invalid_interval.packed");
+  ASSERT_THAT(WritePackedReference(*LoadFasta(true), path), IsOK());
+  std::unique_ptr<PackedReferenceReader> packed = LoadPacked(path, false);
+  EXPECT_THAT(packed->GetBases(MakeRange("missing", 0, 1)),
+              IsNotOKWithMessage("Invalid interval"));
+  EXPECT_THAT(packed->GetBases(MakeRange("chrM", 0, 101)),
+              IsNotOKWithMessage("Invalid interval"));
+}
+
+TEST(PackedReferenceTest, NotOKIfFileIsInvalid) {
+  const string path = MakeTempFile("valid.packed");
+  ASSERT_THAT(WritePackedReference(*LoadFasta(true), path), IsOK());
+  string contents;
+  {
+    FILE* file = fopen(path.c_str(), "rb");
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      contents.append(buffer, n);
+    }
+    fclose(file);
+  }
+  auto write_file = [](const string& path, const string& contents) {
+    FILE* file = fopen(path.c_str(), "wb");
+    fwrite(contents.data(), 1, contents.size(), file);
+    fclose(file);
+  };
+
+  EXPECT_THAT(PackedReferenceReader::FromFile(MakeTempFile("missing.packed")),
+              IsNotOKWithMessage("Could not open"));
+
+  string bad_magic = contents;
+  bad_magic[0] = 'X';
+  write_file(MakeTempFile("bad_magic.packed"), bad_magic);
+  EXPECT_THAT(
+      PackedReferenceReader::FromFile(MakeTempFile("bad_magic.packed")),
+      IsNotOKWithMessage("bad magic"));
+
+  write_file(MakeTempFile("truncated.packed"),
+             contents.substr(0, contents.size() - 1));
+  EXPECT_THAT(
+      PackedReferenceReader::FromFile(MakeTempFile("truncated.packed")),
+      IsNotOKWithMessage("truncated"));
+
+  write_file(MakeTempFile("fasta.packed"), "> chr1\nACGT\n");
+  EXPECT_THAT(PackedReferenceReader::FromFile(MakeTempFile("fasta.packed")),
+              IsNotOK());
+}
+
+}  // namespace
+
+}  // namespace nucleus
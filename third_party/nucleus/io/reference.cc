@@ -90,6 +90,26 @@ StatusOr<const nucleus::genomics::v1::ContigInfo*> GenomeReference::Contig(
   return ::nucleus::NotFound(absl::StrCat("Unknown contig ", contig_name));
 }
 
+StatusOr<absl::string_view> GenomeReference::GetBasesView(
+    const Range& range) const {
+  return ::nucleus::Unimplemented(
+      "GetBasesView is not supported by this GenomeReference.");
+}
+
+StatusOr<absl::string_view> GenomeReference::GetBasesViewOrCopy(
+    const Range& range, string* storage) const {
+  StatusOr<absl::string_view> view = GetBasesView(range);
+  if (view.ok()) {
+    return view;
+  }
+  // Views may be unsupported, or disabled by options. GetBases reports any
+  // other error, such as an invalid range, the same way.
+  StatusOr<string> bases = GetBases(range);
+  NUCLEUS_RETURN_IF_ERROR(bases.status());
+  *storage = std::move(bases.ValueOrDie());
+  return absl::string_view(*storage);
+}
+
 // Note that start and end are 0-based, and end is exclusive. So end
 // can go up to the number of bases on contig.
 bool GenomeReference::IsValidInterval(const Range& range) const {
@@ -181,6 +201,11 @@ IndexedFastaReader::~IndexedFastaReader() {
 }
 
 StatusOr<string> IndexedFastaReader::GetBases(const Range& range) const {
+  if (options_.max_cached_contigs() > 0) {
+    StatusOr<absl::string_view> bases = GetBasesView(range);
+    NUCLEUS_RETURN_IF_ERROR(bases.status());
+    return string(bases.ValueOrDie());
+  }
   if (faidx_ == nullptr) {
     return ::nucleus::FailedPrecondition(
         "can't read from closed IndexedFastaReader object.");
@@ -248,6 +273,63 @@ StatusOr<string> IndexedFastaReader::GetBases(const Range& range) const {
   return result;
 }
 
+StatusOr<absl::string_view> IndexedFastaReader::GetBasesView(
+    const Range& range) const {
+  if (faidx_ == nullptr) {
+    return ::nucleus::FailedPrecondition(
+        "can't read from closed IndexedFastaReader object.");
+  }
+  if (options_.max_cached_contigs() <= 0) {
+    return ::nucleus::FailedPrecondition(
+        "GetBasesView requires FastaReaderOptions.max_cached_contigs > 0.");
+  }
+  if (!IsValidInterval(range))
+    return ::nucleus::InvalidArgument(
+        absl::StrCat("Invalid interval: ", range.ShortDebugString()));
+
+  StatusOr<const string*> contig_bases =
+      CachedContigBases(range.reference_name());
+  NUCLEUS_RETURN_IF_ERROR(contig_bases.status());
+  return absl::string_view(*contig_bases.ValueOrDie())
+      .substr(range.start(), range.end() - range.start());
+}
+
+StatusOr<const string*> IndexedFastaReader::CachedContigBases(
+    const string& contig_name) const {
+  for (auto it = contig_cache_.begin(); it != contig_cache_.end(); ++it) {
+    if (it->first == contig_name) {
+      contig_cache_.splice(contig_cache_.begin(), contig_cache_, it);
+      return &contig_cache_.front().second;
+    }
+  }
+
+  // Decode the whole contig. See GetBases for the faidx_fetch_seq arguments.
+  const int64 n_bases = Contig(contig_name).ValueOrDie()->n_bases();
+  string bases;
+  if (n_bases > 0) {
+    int len;
+    char* fetched =
+        faidx_fetch_seq(faidx_, contig_name.c_str(), 0, n_bases - 1, &len);
+    if (len != n_bases) {
+      free(fetched);
+      return ::nucleus::InvalidArgument(
+          absl::StrCat("Couldn't fetch bases for contig ", contig_name));
+    }
+    bases.assign(fetched, len);
+    free(fetched);
+    if (!options_.keep_true_case()) {
+      absl::AsciiStrToUpper(&bases);
+    }
+  }
+
+  if (contig_cache_.size() >=
+      static_cast<size_t>(options_.max_cached_contigs())) {
+    contig_cache_.pop_back();
+  }
+  contig_cache_.emplace_front(contig_name, std::move(bases));
+  return &contig_cache_.front().second;
+}
+
 StatusOr<std::shared_ptr<GenomeReferenceRecordIterable>>
 IndexedFastaReader::Iterate() const {
   return StatusOr<std::shared_ptr<GenomeReferenceRecordIterable>>(
@@ -260,6 +342,7 @@ IndexedFastaReader::Iterate() const {
   } else {
     fai_destroy(faidx_);
     faidx_ = nullptr;
+    contig_cache_.clear();
   }
   return ::nucleus::Status();
 }
@@ -499,6 +582,13 @@ InMemoryFastaReader::Iterate() const {
 }
 
 StatusOr<string> InMemoryFastaReader::GetBases(const Range& range) const {
+  StatusOr<absl::string_view> bases = GetBasesView(range);
+  NUCLEUS_RETURN_IF_ERROR(bases.status());
+  return string(bases.ValueOrDie());
+}
+
+StatusOr<absl::string_view> InMemoryFastaReader::GetBasesView(
+    const Range& range) const {
   if (!IsValidInterval(range))
     return ::nucleus::InvalidArgument(
         absl::StrCat("Invalid interval: ", range.ShortDebugString()));
@@ -514,7 +604,7 @@ StatusOr<string> InMemoryFastaReader::GetBases(const Range& range) const {
   }
   const int64 pos = range.start() - seq.region().start();
   const int64 len = range.end() - range.start();
-  return seq.bases().substr(pos, len);
+  return absl::string_view(seq.bases()).substr(pos, len);
 }
 
 StatusOr<bool> FastaFullFileIterable::Next(GenomeReferenceRecord* out) {
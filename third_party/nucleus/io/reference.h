@@ -57,12 +57,14 @@
 #ifndef THIRD_PARTY_NUCLEUS_IO_REFERENCE_H_
 #define THIRD_PARTY_NUCLEUS_IO_REFERENCE_H_
 
+#include <list>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "htslib/faidx.h"
 #include "third_party/nucleus/io/reader_base.h"
@@ -121,6 +123,18 @@ class GenomeReference : public Reader {
   virtual StatusOr<string> GetBases(
       const nucleus::genomics::v1::Range& range) const = 0;
 
+  // Same as GetBases, but returns a view of bases held by this reference
+  // instead of a copy. How long the view stays valid depends on the subclass.
+  // The default implementation returns an Unimplemented status.
+  virtual StatusOr<absl::string_view> GetBasesView(
+      const nucleus::genomics::v1::Range& range) const;
+
+  // Returns GetBasesView(range) if this reference supports it, or else the
+  // GetBases(range) copy stored in *storage, so callers that only need the
+  // bases for a short while avoid a copy whenever possible.
+  StatusOr<absl::string_view> GetBasesViewOrCopy(
+      const nucleus::genomics::v1::Range& range, string* storage) const;
+
   // Gets all of the FASTA records in this file in order.
   //
   // The specific parsing, filtering, etc behavior is determined by the options
@@ -208,6 +222,12 @@ class IndexedFastaReader : public GenomeReference {
   StatusOr<string> GetBases(
       const nucleus::genomics::v1::Range& range) const override;
 
+  // Requires options.max_cached_contigs > 0. The view points into the decoded
+  // contig and stays valid until that contig is evicted, which only happens
+  // when max_cached_contigs other contigs have been queried since.
+  StatusOr<absl::string_view> GetBasesView(
+      const nucleus::genomics::v1::Range& range) const override;
+
   // Get the options controlling the behavior of this FastaReader.
   const nucleus::genomics::v1::FastaReaderOptions& Options() const {
     return options_;
@@ -228,6 +248,10 @@ class IndexedFastaReader : public GenomeReference {
                      const nucleus::genomics::v1::FastaReaderOptions& options,
                      int cache_size_bases);
 
+  // Returns the decoded bases of contig_name, decoding the whole contig and
+  // adding it to contig_cache_ if it is not there yet.
+  StatusOr<const string*> CachedContigBases(const string& contig_name) const;
+
   // Path to the FASTA file containing our genomic bases.
   const string fasta_path_;
 
@@ -252,6 +276,11 @@ class IndexedFastaReader : public GenomeReference {
   // The range that is held in the cache, or "empty" if there is no range cached
   // yet.  Range must be <= kFastaCacheSize in length.
   mutable absl::optional<nucleus::genomics::v1::Range> cached_range_;
+
+  // (name, bases) of the decoded contigs when options.max_cached_contigs > 0,
+  // most recently used first. A list keeps the bases in place when entries
+  // are reordered, so views of them stay valid.
+  mutable std::list<std::pair<string, string>> contig_cache_;
 };
 
 // A FASTA reader that is not backed by a htslib FAI index.
@@ -354,6 +383,11 @@ class InMemoryFastaReader : public GenomeReference {
   StatusOr<string> GetBases(
       const nucleus::genomics::v1::Range& range) const override;
 
+  // The view points into the ReferenceSequence protos and stays valid for the
+  // lifetime of this reader.
+  StatusOr<absl::string_view> GetBasesView(
+      const nucleus::genomics::v1::Range& range) const override;
+
   StatusOr<std::shared_ptr<GenomeReferenceRecordIterable>> Iterate()
       const override;
 
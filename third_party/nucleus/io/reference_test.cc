@@ -234,6 +234,16 @@ static std::unique_ptr<GenomeReference> JustLoadFai(const string& fasta,
   return LoadWithCaseOption(fasta, false, cache_size);
 }
 
+static std::unique_ptr<GenomeReference> LoadWithContigCache(
+    const string& fasta, int max_cached_contigs) {
+  nucleus::genomics::v1::FastaReaderOptions options;
+  options.set_max_cached_contigs(max_cached_contigs);
+  StatusOr<std::unique_ptr<IndexedFastaReader>> fai_status =
+      IndexedFastaReader::FromFile(fasta, StrCat(fasta, ".fai"), options);
+  NUCLEUS_CHECK_OK(fai_status.status());
+  return std::move(fai_status.ValueOrDie());
+}
+
 // Test with cache disabled.
 INSTANTIATE_TEST_CASE_P(GRT1, GenomeReferenceTest,
                         ::testing::Values(make_pair(&JustLoadFai, 0)));
@@ -242,6 +252,11 @@ INSTANTIATE_TEST_CASE_P(GRT1, GenomeReferenceTest,
 INSTANTIATE_TEST_CASE_P(GRT3, GenomeReferenceTest,
                         ::testing::Values(make_pair(&JustLoadFai, 64 * 1024)));
 
+// Test with one or two whole contigs cached.
+INSTANTIATE_TEST_CASE_P(GRT4, GenomeReferenceTest,
+                        ::testing::Values(make_pair(&LoadWithContigCache, 1),
+                                          make_pair(&LoadWithContigCache, 2)));
+
 TEST(StatusOrLoadFromFile, ReturnsBadStatusIfFaiIsMissing) {
   StatusOr<std::unique_ptr<IndexedFastaReader>> result =
       IndexedFastaReader::FromFile(GetTestData("unindexed.fasta"),
@@ -274,6 +289,63 @@ TEST(IndexedFastaReaderTest, TestTrueCase) {
       r.second);
 }
 
+TEST(IndexedFastaReaderTest, GetBasesViewNeedsContigCache) {
+  auto reader = JustLoadFai(TestFastaPath());
+  EXPECT_THAT(reader->GetBasesView(MakeRange("chrM", 0, 10)),
+              IsNotOKWithCodeAndMessage(absl::StatusCode::kFailedPrecondition,
+                                        "max_cached_contigs"));
+}
+
+TEST(IndexedFastaReaderTest, GetBasesViewFromContigCache) {
+  auto reader = LoadWithContigCache(TestFastaPath(), 2);
+  absl::string_view chrm = reader->GetBasesView(MakeRange("chrM", 90, 100))
+                               .ValueOrDie();
+  EXPECT_EQ(chrm, "CGAGACGCTG");
+  EXPECT_EQ(reader->GetBasesView(MakeRange("chr1", 0, 5)).ValueOrDie(),
+            "ACCAC");
+  EXPECT_EQ(reader->GetBases(MakeRange("chrM", 0, 4)).ValueOrDie(), "GATC");
+  // chrM was used more recently than chr1, so querying chr2 evicts chr1 and
+  // the chrM view is still valid.
+  EXPECT_EQ(reader->GetBasesView(MakeRange("chr2", 0, 5)).ValueOrDie(),
+            "CGCTN");
+  EXPECT_EQ(chrm, "CGAGACGCTG");
+  EXPECT_THAT(reader->GetBasesView(MakeRange("chrM", 90, 101)),
+              IsNotOKWithCodeAndMessage(absl::StatusCode::kInvalidArgument,
+                                        "Invalid interval"));
+}
+
+TEST(IndexedFastaReaderTest, GetBasesViewOrCopy) {
+  string storage;
+  auto cached = LoadWithContigCache(TestFastaPath(), 1);
+  EXPECT_EQ(cached->GetBasesViewOrCopy(MakeRange("chrM", 0, 4), &storage)
+                .ValueOrDie(),
+            "GATC");
+  // The view points into the contig cache, so nothing is copied.
+  EXPECT_TRUE(storage.empty());
+
+  auto uncached = JustLoadFai(TestFastaPath());
+  EXPECT_EQ(uncached->GetBasesViewOrCopy(MakeRange("chrM", 0, 4), &storage)
+                .ValueOrDie(),
+            "GATC");
+  EXPECT_EQ(storage, "GATC");
+  EXPECT_THAT(uncached->GetBasesViewOrCopy(MakeRange("chrM", 90, 101),
+                                           &storage),
+              IsNotOKWithCodeAndMessage(absl::StatusCode::kInvalidArgument,
+                                        "Invalid interval"));
+}
+
+TEST(IndexedFastaReaderTest, ContigCacheKeepsTrueCase) {
+  nucleus::genomics::v1::FastaReaderOptions options;
+  options.set_keep_true_case(true);
+  options.set_max_cached_contigs(1);
+  auto reader = std::move(
+      IndexedFastaReader::FromFile(TestFastaPath(),
+                                   StrCat(TestFastaPath(), ".fai"), options)
+          .ValueOrDie());
+  EXPECT_EQ(reader->GetBasesView(MakeRange("chrM", 20, 28)).ValueOrDie(),
+            "ATTaaCCA");
+}
+
 TEST(IndexedFastaReaderTest, TestIterate) {
   auto reader = JustLoadFai(TestFastaPath());
   auto iterator = reader->Iterate().ValueOrDie();
@@ -435,4 +507,18 @@ TEST(InMemoryFastaReaderTest, TestIterate) {
   EXPECT_FALSE(status.ValueOrDie());
 }
 
+TEST(InMemoryFastaReaderTest, TestGetBasesView) {
+  std::vector<genomics::v1::ContigInfo> contigs(2);
+  std::vector<genomics::v1::ReferenceSequence> seqs(2);
+  CreateTestSeq(&contigs, &seqs, "Chr1", 0, 0, 4, "ACGT");
+  CreateTestSeq(&contigs, &seqs, "Chr2", 1, 2, 7, "AATTC");
+
+  std::unique_ptr<InMemoryFastaReader> reader =
+      std::move(InMemoryFastaReader::Create(contigs, seqs).ValueOrDie());
+  EXPECT_EQ(reader->GetBasesView(MakeRange("Chr1", 1, 3)).ValueOrDie(), "CG");
+  EXPECT_EQ(reader->GetBasesView(MakeRange("Chr2", 2, 5)).ValueOrDie(), "AAT");
+  EXPECT_THAT(reader->GetBasesView(MakeRange("Chr2", 0, 3)),
+              IsNotOKWithMessage("Cannot query range"));
+}
+
 }  // namespace nucleus
@@ -249,6 +249,22 @@ class NativeSamReader(genomics_reader.GenomicsReader):
     """Returns an iterator for going through the reads in the region."""
     return self._reader.query(region)
 
+  def compressed_bytes_per_window(self, region, window_size):
+    """Estimates the compressed read bytes in each window of region.
+
+    The estimate comes from the file's index alone, so no reads are decoded.
+    CRAM indices carry no such information and always report 0.
+
+    Args:
+      region: nucleus.genomics.v1.Range. The region to split into windows.
+      window_size: int > 0. The width of each window, in bp. The last window
+        is truncated at region.end.
+
+    Returns:
+      list[int]. The estimated compressed bytes of each window, in order.
+    """
+    return self._reader.compressed_bytes_per_window(region, window_size)
+
   def __exit__(self, exit_type, exit_value, exit_traceback):
     self._reader.__exit__(exit_type, exit_value, exit_traceback)
 
@@ -270,7 +286,12 @@ class NativeSamWriter(genomics_writer.GenomicsWriter):
   files or TFRecords files, based on the output filename's extensions.
   """
 
-  def __init__(self, output_path, header, ref_path=None, embed_ref=False):
+  def __init__(self,
+               output_path,
+               header,
+               ref_path=None,
+               embed_ref=False,
+               thread_pool=None):
     """Initializer for NativeSamWriter.
 
     Args:
@@ -280,16 +301,26 @@ class NativeSamWriter(genomics_writer.GenomicsWriter):
         Default is False.
       header: A nucleus.SamHeader proto.  The header is used both for writing
         the header, and to control the sorting applied to the rest of the file.
+      thread_pool: hts_thread_pool.HtsThreadPool. If provided, BGZF compressed
+        output is compressed on this pool, which may be shared across writers.
     """
     super(NativeSamWriter, self).__init__()
-    self._writer = sam_writer.SamWriter.to_file(
+    args = [
         output_path,
         ref_path.encode('utf8') if ref_path is not None else '', embed_ref,
-        header)
+        header
+    ]
+    if thread_pool is not None:
+      args.append(thread_pool)
+    self._writer = sam_writer.SamWriter.to_file(*args)
 
   def write(self, proto):
     self._writer.write(proto)
 
+  def stats(self):
+    """Returns the HtsWriterStats counters of the underlying writer."""
+    return self._writer.stats()
+
   def __exit__(self, exit_type, exit_value, exit_traceback):
     self._writer.__exit__(exit_type, exit_value, exit_traceback)
 
@@ -232,6 +232,28 @@ bool ReadSatisfiesRequirements(
          (!read.has_alignment() || read.alignment().mapping_quality() >=
                                        requirements.min_mapping_quality());
 }
+
+bool ReadSatisfiesRequirements(
+    const SamRecordView& record,
+    const nucleus::genomics::v1::ReadRequirements& requirements) {
+  // Mirrors the Read version above, including IsReadProperlyPlaced, on the
+  // fields of the htslib record.
+  const bool properly_placed =
+      record.number_reads() < 2 || record.proper_placement() ||
+      !record.has_next_mate_position() || !record.has_alignment() ||
+      record.reference_name() == record.next_mate_reference_name();
+  return (requirements.keep_duplicates() || !record.duplicate_fragment()) &&
+         (requirements.keep_failed_vendor_quality_checks() ||
+          !record.failed_vendor_quality_checks()) &&
+         (requirements.keep_secondary_alignments() ||
+          !record.secondary_alignment()) &&
+         (requirements.keep_supplementary_alignments() ||
+          !record.supplementary_alignment()) &&
+         (requirements.keep_unaligned() || record.has_alignment()) &&
+         (requirements.keep_improperly_placed() || properly_placed) &&
+         (!record.has_alignment() ||
+          record.mapping_quality() >= requirements.min_mapping_quality());
+}
 }  // namespace sam_reader_internal
 
 // -----------------------------------------------------------------------------
@@ -617,14 +639,16 @@ static inline bool StartsWith(const string& query, const char prefix[],
 }
 
 // Base class for SamFullFileIterable and SamQueryIterable.
-// This class implements common functionality.
-class SamIterableBase : public SamIterable {
+// This class implements common functionality. Record is either a Read proto or
+// a SamRecordView of the current htslib record.
+template <class Record>
+class SamIterableBase : public Iterable<Record> {
  protected:
   virtual int next_sam_record() = 0;
 
  public:
   // Advance to the next record.
-  StatusOr<bool> Next(nucleus::genomics::v1::Read* out) override;
+  StatusOr<bool> Next(Record* out) override;
 
   // Base class constructor. Intializes common attrubutes.
   SamIterableBase(const SamReader* reader, htsFile* fp, bam_hdr_t* header);
@@ -637,9 +661,10 @@ class SamIterableBase : public SamIterable {
 };
 
 // Iterable class for traversing all BAM records in the file.
-class SamFullFileIterable : public SamIterableBase {
+template <class Record>
+class SamFullFileIterable : public SamIterableBase<Record> {
  protected:
-  virtual int next_sam_record();
+  int next_sam_record() override;
 
  public:
   // Constructor is invoked via SamReader::Iterate.
@@ -647,9 +672,10 @@ class SamFullFileIterable : public SamIterableBase {
 };
 
 // Iterable class for traversing BAM records returned in a query window.
-class SamQueryIterable : public SamIterableBase {
+template <class Record>
+class SamQueryIterable : public SamIterableBase<Record> {
  protected:
-  virtual int next_sam_record();
+  int next_sam_record() override;
 
  public:
   // Constructor will be invoked via SamReader::Query.
@@ -662,12 +688,15 @@ class SamQueryIterable : public SamIterableBase {
   hts_itr_t* iter_;
 };
 
-SamReader::SamReader(const string& reads_path, const SamReaderOptions& options,
-                     htsFile* fp, bam_hdr_t* header, hts_idx_t* idx)
-    : options_(options),
+SamReader::SamReader(const string& reads_path, const string& ref_path,
+                     const SamReaderOptions& options, htsFile* fp,
+                     bam_hdr_t* header, std::shared_ptr<hts_idx_t> idx)
+    : reads_path_(reads_path),
+      ref_path_(ref_path),
+      options_(options),
       fp_(fp),
       header_(header),
-      idx_(idx),
+      idx_(std::move(idx)),
       sampler_(options.downsample_fraction(), options.random_seed()) {
   CHECK(fp != nullptr) << "pointer to SAM/BAM cannot be null";
   CHECK(header_ != nullptr) << "pointer to header cannot be null";
@@ -722,6 +751,19 @@ SamReader::SamReader(const string& reads_path, const SamReaderOptions& options,
 StatusOr<std::unique_ptr<SamReader>> SamReader::FromFile(
     const string& reads_path, const string& ref_path,
     const SamReaderOptions& options) {
+  return Open(reads_path, ref_path, options, nullptr);
+}
+
+StatusOr<std::unique_ptr<SamReader>> SamReader::Clone() const {
+  if (fp_ == nullptr)
+    return ::nucleus::FailedPrecondition("Cannot Clone a closed SamReader.");
+  return Open(reads_path_, ref_path_, options_,
+              fp_->format.format == bam ? idx_ : nullptr);
+}
+
+StatusOr<std::unique_ptr<SamReader>> SamReader::Open(
+    const string& reads_path, const string& ref_path,
+    const SamReaderOptions& options, std::shared_ptr<hts_idx_t> shared_idx) {
   // Validate that we support the requested read requirements.
   if (options.has_read_requirements() &&
       options.read_requirements().min_base_quality_mode() !=
@@ -757,11 +799,14 @@ StatusOr<std::unique_ptr<SamReader>> SamReader::FromFile(
         absl::StrCat("Could not parse file with ", errmsg));
   }
 
-  hts_idx_t* idx = nullptr;
-  if (FileTypeIsIndexable(fp->format)) {
+  std::shared_ptr<hts_idx_t> idx = std::move(shared_idx);
+  if (idx == nullptr && FileTypeIsIndexable(fp->format)) {
     // TODO: use hts_idx_load after htslib upgrade.
     // This call may return null, which we will look for at Query time.
-    idx = sam_index_load(fp, fp->fn);
+    hts_idx_t* loaded_idx = sam_index_load(fp, fp->fn);
+    if (loaded_idx != nullptr) {
+      idx.reset(loaded_idx, hts_idx_destroy);
+    }
   }
 
   // If we are decoding a CRAM file and the user wants to override the path to
@@ -782,7 +827,8 @@ StatusOr<std::unique_ptr<SamReader>> SamReader::FromFile(
   }
 
   return std::unique_ptr<SamReader>(
-      new SamReader(reads_path, options, fp, header, idx));
+      new SamReader(reads_path, ref_path, options, fp, header,
+                    std::move(idx)));
 }
 
 SamReader::~SamReader() {
@@ -807,15 +853,75 @@ bool SamReader::KeepRead(const nucleus::genomics::v1::Read& read) const {
          (options_.downsample_fraction() == 0.0 || sampler_.Keep());
 }
 
+bool SamReader::KeepRead(const SamRecordView& record) const {
+  return (!options_.has_read_requirements() ||
+          sam_reader_internal::ReadSatisfiesRequirements(
+              record, options_.read_requirements())) &&
+         (options_.downsample_fraction() == 0.0 || sampler_.Keep());
+}
+
 StatusOr<std::shared_ptr<SamIterable>> SamReader::Iterate() const {
   if (fp_ == nullptr)
     return ::nucleus::FailedPrecondition("Cannot Iterate a closed SamReader.");
   return StatusOr<std::shared_ptr<SamIterable>>(
-      MakeIterable<SamFullFileIterable>(this, fp_, header_));
+      MakeIterable<SamFullFileIterable<Read>>(this, fp_, header_));
 }
 
 StatusOr<std::shared_ptr<SamIterable>> SamReader::Query(
     const Range& region) const {
+  StatusOr<hts_itr_t*> iter = QueryIterator(region);
+  NUCLEUS_RETURN_IF_ERROR(iter.status());
+  return StatusOr<std::shared_ptr<SamIterable>>(
+      MakeIterable<SamQueryIterable<Read>>(this, fp_, header_,
+                                           iter.ValueOrDie()));
+}
+
+StatusOr<std::shared_ptr<SamRecordViewIterable>> SamReader::IterateViews()
+    const {
+  if (fp_ == nullptr)
+    return ::nucleus::FailedPrecondition("Cannot Iterate a closed SamReader.");
+  return StatusOr<std::shared_ptr<SamRecordViewIterable>>(
+      MakeIterable<SamFullFileIterable<SamRecordView>>(this, fp_, header_));
+}
+
+StatusOr<std::shared_ptr<SamRecordViewIterable>> SamReader::QueryViews(
+    const Range& region) const {
+  StatusOr<hts_itr_t*> iter = QueryIterator(region);
+  NUCLEUS_RETURN_IF_ERROR(iter.status());
+  return StatusOr<std::shared_ptr<SamRecordViewIterable>>(
+      MakeIterable<SamQueryIterable<SamRecordView>>(this, fp_, header_,
+                                                    iter.ValueOrDie()));
+}
+
+StatusOr<std::vector<int64_t>> SamReader::CompressedBytesPerWindow(
+    const Range& region, int64_t window_size) const {
+  if (window_size <= 0) {
+    return ::nucleus::InvalidArgument(
+        absl::StrCat("window_size must be positive, got ", window_size));
+  }
+  std::vector<int64_t> bytes_per_window;
+  Range window;
+  window.set_reference_name(region.reference_name());
+  for (int64_t start = region.start(); start < region.end();
+       start += window_size) {
+    window.set_start(start);
+    window.set_end(std::min(region.end(), start + window_size));
+    StatusOr<hts_itr_t*> iter = QueryIterator(window);
+    NUCLEUS_RETURN_IF_ERROR(iter.status());
+    int64_t bytes = 0;
+    for (int i = 0; i < iter.ValueOrDie()->n_off; ++i) {
+      // The upper 48 bits of a BGZF virtual offset are the offset of its
+      // compressed block in the file.
+      bytes += (iter.ValueOrDie()->off[i].v >> 16) -
+               (iter.ValueOrDie()->off[i].u >> 16);
+    }
+    hts_itr_destroy(iter.ValueOrDie());
+    bytes_per_window.push_back(bytes);
+  }
+  return bytes_per_window;
+}
+
+StatusOr<hts_itr_t*> SamReader::QueryIterator(const Range& region) const {
   if (fp_ == nullptr)
     return ::nucleus::FailedPrecondition("Cannot Query a closed SamReader.");
   if (!HasIndex()) {
@@ -830,23 +936,20 @@ StatusOr<std::shared_ptr<SamIterable>> SamReader::Query(
 
   // Note that query is 0-based inclusive on start and exclusive on end,
   // matching exactly the logic of our Range.
-  hts_itr_t* iter = sam_itr_queryi(idx_, tid, region.start(), region.end());
+  hts_itr_t* iter =
+      sam_itr_queryi(idx_.get(), tid, region.start(), region.end());
   if (iter == nullptr) {
     // The region isn't valid according to sam_itr_query(), blow up.
     return ::nucleus::NotFound(
         absl::StrCat("region '", region.ShortDebugString(),
                      "' specifies an unknown reference interval"));
   }
-
-  return StatusOr<std::shared_ptr<SamIterable>>(
-      MakeIterable<SamQueryIterable>(this, fp_, header_, iter));
+  return iter;
 }
 
 ::nucleus::Status SamReader::Close() {
-  if (HasIndex()) {
-    hts_idx_destroy(idx_);
-    idx_ = nullptr;
-  }
+  // The index is destroyed with the last reader sharing it.
+  idx_.reset();
   bam_hdr_destroy(header_);
   header_ = nullptr;
   int retval = hts_close(fp_);
@@ -860,7 +963,8 @@ StatusOr<std::shared_ptr<SamIterable>> SamReader::Query(
 
 // Iterable class definitions.
 
-StatusOr<bool> SamIterableBase::Next(Read* out) {
+template <>
+StatusOr<bool> SamIterableBase<Read>::Next(Read* out) {
   NUCLEUS_RETURN_IF_ERROR(CheckIsAlive());
   // Keep reading until "reader_->KeepRead(.)"
   const SamReader* sam_reader = static_cast<const SamReader*>(reader_);
@@ -883,31 +987,65 @@ StatusOr<bool> SamIterableBase::Next(Read* out) {
   return true;
 }
 
-SamIterableBase::SamIterableBase(const SamReader* reader, htsFile* fp,
-                                 bam_hdr_t* header)
-    : Iterable(reader), fp_(fp), header_(header), bam1_(bam_init1()) {}
+template <>
+StatusOr<bool> SamIterableBase<SamRecordView>::Next(SamRecordView* out) {
+  NUCLEUS_RETURN_IF_ERROR(CheckIsAlive());
+  const SamReader* sam_reader = static_cast<const SamReader*>(reader_);
+  do {
+    int code = next_sam_record();
+    if (code == -1) {
+      return false;
+    } else if (code < -1) {
+      return ::nucleus::DataLoss("Failed to parse SAM record");
+    }
+    *out = SamRecordView(
+        header_, bam1_,
+        sam_reader->options().use_original_base_quality_scores());
+  } while (!sam_reader->KeepRead(*out));
+  return true;
+}
+
+template <class Record>
+SamIterableBase<Record>::SamIterableBase(const SamReader* reader, htsFile* fp,
+                                         bam_hdr_t* header)
+    : Iterable<Record>(reader),
+      fp_(fp),
+      header_(header),
+      bam1_(bam_init1()) {}
 
-SamIterableBase::~SamIterableBase() { bam_destroy1(bam1_); }
+template <class Record>
+SamIterableBase<Record>::~SamIterableBase() {
+  bam_destroy1(bam1_);
+}
 
-int SamFullFileIterable::next_sam_record() {
+template <class Record>
+int SamFullFileIterable<Record>::next_sam_record() {
   // sam_read1 docs say: >= 0 on successfully reading a new record,
   // -1 on end of stream, < -1 on error.
   // Get next from file; return false if no more records to be had.
-  return sam_read1(fp_, header_, bam1_);
+  return sam_read1(this->fp_, this->header_, this->bam1_);
 }
 
-SamFullFileIterable::SamFullFileIterable(const SamReader* reader, htsFile* fp,
-                                         bam_hdr_t* header)
-    : SamIterableBase(reader, fp, header) {}
+template <class Record>
+SamFullFileIterable<Record>::SamFullFileIterable(const SamReader* reader,
+                                                 htsFile* fp,
+                                                 bam_hdr_t* header)
+    : SamIterableBase<Record>(reader, fp, header) {}
 
-int SamQueryIterable::next_sam_record() {
-  return sam_itr_next(fp_, iter_, bam1_);
+template <class Record>
+int SamQueryIterable<Record>::next_sam_record() {
+  return sam_itr_next(this->fp_, iter_, this->bam1_);
 }
 
-SamQueryIterable::~SamQueryIterable() { hts_itr_destroy(iter_); }
+template <class Record>
+SamQueryIterable<Record>::~SamQueryIterable() {
+  hts_itr_destroy(iter_);
+}
 
-SamQueryIterable::SamQueryIterable(const SamReader* reader, htsFile* fp,
-                                   bam_hdr_t* header, hts_itr_t* iter)
-    : SamIterableBase(reader, fp, header), iter_(iter) {}
+template <class Record>
+SamQueryIterable<Record>::SamQueryIterable(const SamReader* reader,
+                                           htsFile* fp, bam_hdr_t* header,
+                                           hts_itr_t* iter)
+    : SamIterableBase<Record>(reader, fp, header), iter_(iter) {}
 
 }  // namespace nucleus
@@ -33,12 +33,15 @@
 #ifndef THIRD_PARTY_NUCLEUS_IO_SAM_READER_H_
 #define THIRD_PARTY_NUCLEUS_IO_SAM_READER_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "htslib/hts.h"
 #include "htslib/sam.h"
 #include "third_party/nucleus/io/reader_base.h"
+#include "third_party/nucleus/io/sam_record_view.h"
 #include "third_party/nucleus/platform/types.h"
 #include "third_party/nucleus/protos/range.pb.h"
 #include "third_party/nucleus/protos/reads.pb.h"
@@ -52,6 +55,9 @@ namespace nucleus {
 // Alias for the abstract base class for SAM record iterables.
 using SamIterable = Iterable<nucleus::genomics::v1::Read>;
 
+// Alias for the abstract base class for iterables over SamRecordViews.
+using SamRecordViewIterable = Iterable<SamRecordView>;
+
 // A SAM/BAM/CRAM reader.
 //
 // SAM/BAM/CRAM files store information about next-generation DNA sequencing
@@ -110,6 +116,14 @@ class SamReader : public Reader {
     return FromFile(reads_path, "", options);
   }
 
+  // Opens another SamReader on the file of this reader, with the same options,
+  // for use by another thread. The new reader has its own file handle and
+  // downsampling state. The BAM index is shared with this reader instead of
+  // being loaded again; it is only read by queries, so readers sharing it can
+  // be used concurrently. CRAM indexes are bound to their file handle and are
+  // loaded again.
+  StatusOr<std::unique_ptr<SamReader>> Clone() const;
+
   ~SamReader();
 
   // Disable assignment/copy operations
@@ -144,6 +158,26 @@ class SamReader : public Reader {
   StatusOr<std::shared_ptr<SamIterable>> Query(
       const nucleus::genomics::v1::Range& region) const;
 
+  // Same as Iterate() and Query(), but the records are returned as
+  // SamRecordViews of the htslib records instead of Read protos.
+  //
+  // Read requirements and downsampling are applied to the htslib record, so
+  // no Read is ever built for the reads that are filtered out. A returned view
+  // is only valid until the iterable is advanced.
+  StatusOr<std::shared_ptr<SamRecordViewIterable>> IterateViews() const;
+  StatusOr<std::shared_ptr<SamRecordViewIterable>> QueryViews(
+      const nucleus::genomics::v1::Range& region) const;
+
+  // Estimates how much of the file overlaps each window_size bp window of
+  // region, from the index alone. Returns, for each window, the compressed
+  // size in bytes of the index chunks that a Query() of the window would read.
+  // Reads overlapping several windows are counted in each of them. Indexes
+  // without chunks, such as CRAM indexes, give 0 for every window.
+  //
+  // Requires an index, as Query() does.
+  StatusOr<std::vector<int64_t>> CompressedBytesPerWindow(
+      const nucleus::genomics::v1::Range& region, int64_t window_size) const;
+
   // Returns True if this SamReader loaded an index file.
   bool HasIndex() const { return idx_ != nullptr; }
 
@@ -156,6 +190,7 @@ class SamReader : public Reader {
   ::nucleus::Status PythonEnter() const { return ::nucleus::Status(); }
 
   bool KeepRead(const nucleus::genomics::v1::Read& read) const;
+  bool KeepRead(const SamRecordView& record) const;
 
   const nucleus::genomics::v1::SamReaderOptions& options() const {
     return options_;
@@ -167,9 +202,25 @@ class SamReader : public Reader {
  private:
   // Private constructor; use FromFile to safely create a SamReader from a
   // file.
-  SamReader(const string& reads_path,
+  SamReader(const string& reads_path, const string& ref_path,
             const nucleus::genomics::v1::SamReaderOptions& options, htsFile* fp,
-            bam_hdr_t* header, hts_idx_t* idx);
+            bam_hdr_t* header, std::shared_ptr<hts_idx_t> idx);
+
+  // Shared by FromFile() and Clone(). Loads the index of reads_path unless
+  // shared_idx is given.
+  static StatusOr<std::unique_ptr<SamReader>> Open(
+      const string& reads_path, const string& ref_path,
+      const nucleus::genomics::v1::SamReaderOptions& options,
+      std::shared_ptr<hts_idx_t> shared_idx);
+
+  // Creates the htslib iterator over the records overlapping region, shared
+  // by Query() and QueryViews().
+  StatusOr<hts_itr_t*> QueryIterator(
+      const nucleus::genomics::v1::Range& region) const;
+
+  // The paths given to FromFile(), used by Clone().
+  const string reads_path_;
+  const string ref_path_;
 
   // Our options that control the behavior of this class.
   const nucleus::genomics::v1::SamReaderOptions options_;
@@ -181,8 +232,8 @@ class SamReader : public Reader {
   bam_hdr_t* header_;
 
   // The htslib index data structure for our indexed BAM file. May be NULL if no
-  // index was loaded.
-  hts_idx_t* idx_;
+  // index was loaded. Shared with the readers returned by Clone().
+  std::shared_ptr<hts_idx_t> idx_;
 
   // The sam.proto SamHeader message representing the structured header
   // information.
@@ -199,6 +250,11 @@ bool ReadSatisfiesRequirements(
     const nucleus::genomics::v1::Read& read,
     const nucleus::genomics::v1::ReadRequirements& requirements);
 
+// Same as above for an htslib record, without converting it to a Read.
+bool ReadSatisfiesRequirements(
+    const SamRecordView& record,
+    const nucleus::genomics::v1::ReadRequirements& requirements);
+
 }  // namespace sam_reader_internal
 
 }  // namespace nucleus
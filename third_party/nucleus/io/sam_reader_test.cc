@@ -59,6 +59,9 @@ using nucleus::genomics::v1::SamReaderOptions;
 using nucleus::proto::IgnoringFieldPaths;
 using nucleus::proto::Partially;
 using std::vector;
+using ::testing::Each;
+using ::testing::ElementsAre;
+using ::testing::Gt;
 using ::testing::IsEmpty;
 using ::testing::Key;
 using ::testing::Pointwise;
@@ -71,6 +74,17 @@ constexpr char kSamOqTestFilename[] = "test_oq.sam";
 constexpr char kBamTestFilename[] = "test.bam";
 constexpr char kSamGoldStandardFilename[] = "test.sam.golden.tfrecord";
 
+// Materializes the views returned by iterable as Reads.
+vector<Read> ViewsAsReads(
+    const StatusOr<std::shared_ptr<SamRecordViewIterable>>& iterable) {
+  NUCLEUS_CHECK_OK(iterable.status());
+  vector<Read> reads;
+  for (const StatusOr<SamRecordView*> view : iterable.ValueOrDie()) {
+    view.ValueOrDie()->ToRead(&reads.emplace_back());
+  }
+  return reads;
+}
+
 // Checks if the result of converting a test sam file matches the gold standard
 // record io files for SamHeader and Read. This is representative of a real life
 // file conversion.
@@ -92,6 +106,28 @@ TEST(SamReaderTest, TestIteration) {
   EXPECT_THAT(as_vector(reader->Iterate()), SizeIs(6));
 }
 
+TEST(SamReaderTest, TestIterateViewsMatchesIterate) {
+  std::unique_ptr<SamReader> reader = std::move(
+      SamReader::FromFile(GetTestData(kSamTestFilename), SamReaderOptions())
+          .ValueOrDie());
+  const vector<Read> reads = as_vector(reader->Iterate());
+  EXPECT_THAT(ViewsAsReads(reader->IterateViews()),
+              Pointwise(EqualsProto(), reads));
+}
+
+TEST(SamReaderTest, TestIterateViewsUsesOriginalQualities) {
+  SamReaderOptions options;
+  options.set_use_original_base_quality_scores(true);
+  options.set_aux_field_handling(SamReaderOptions::PARSE_ALL_AUX_FIELDS);
+  std::unique_ptr<SamReader> reader = std::move(
+      SamReader::FromFile(GetTestData(kSamOqTestFilename), options)
+          .ValueOrDie());
+  const vector<Read> reads = as_vector(reader->Iterate());
+  // Views leave the aux fields in the record.
+  EXPECT_THAT(ViewsAsReads(reader->IterateViews()),
+              Pointwise(IgnoringFieldPaths({"info"}, EqualsProto()), reads));
+}
+
 // test_oq.sam is used for this test where original scores all set to 'C'
 // The test checks that if use_original_base_quality_scores is set alignment
 // quality scores are taken from OQ tag and all the scores properly calculated.
@@ -416,12 +452,72 @@ TEST_F(SamReaderQueryTest, QueriedRespectsReadRequirements) {
   EXPECT_THAT(as_vector(reader_->Query(range)), SizeIs(104));
 }
 
+TEST_F(SamReaderQueryTest, QueriedViewsMatchQueriedReads) {
+  Range range = MakeRange("chr20", 9999999, 10000100);
+  EXPECT_THAT(ViewsAsReads(reader_->QueryViews(range)),
+              Pointwise(EqualsProto(), as_vector(reader_->Query(range))));
+
+  // Read requirements are applied to the views just like to the reads. See
+  // QueriedRespectsReadRequirements for the number of reads each one keeps.
+  options_.mutable_read_requirements();
+  RecreateReader();
+  EXPECT_THAT(ViewsAsReads(reader_->QueryViews(range)), SizeIs(105));
+
+  options_.mutable_read_requirements()->set_keep_unaligned(true);
+  RecreateReader();
+  EXPECT_THAT(ViewsAsReads(reader_->QueryViews(range)), SizeIs(106));
+
+  options_.mutable_read_requirements()->set_keep_unaligned(false);
+  options_.mutable_read_requirements()->set_min_mapping_quality(38);
+  RecreateReader();
+  EXPECT_THAT(ViewsAsReads(reader_->QueryViews(range)),
+              Pointwise(EqualsProto(), as_vector(reader_->Query(range))));
+  EXPECT_THAT(ViewsAsReads(reader_->QueryViews(range)), SizeIs(104));
+}
+
+TEST_F(SamReaderQueryTest, ClonesQueryLikeTheirReader) {
+  std::unique_ptr<SamReader> clone = std::move(reader_->Clone().ValueOrDie());
+  EXPECT_TRUE(clone->HasIndex());
+  EXPECT_THAT(clone->Header(), EqualsProto(reader_->Header()));
+  const Range range = MakeRange("chr20", 9999999, 10000100);
+  EXPECT_THAT(as_vector(clone->Query(range)),
+              Pointwise(EqualsProto(), as_vector(reader_->Query(range))));
+
+  // The clone keeps working with the shared index after reader_ is closed.
+  ASSERT_THAT(reader_->Close(), IsOK());
+  EXPECT_THAT(as_vector(clone->Query(range)), SizeIs(106));
+  EXPECT_THAT(reader_->Clone(),
+              IsNotOKWithMessage("Cannot Clone a closed SamReader."));
+}
+
+TEST_F(SamReaderQueryTest, CompressedBytesPerWindow) {
+  std::vector<int64_t> bytes =
+      reader_->CompressedBytesPerWindow(MakeRange("chr20", 9999999, 10001000),
+                                        500)
+          .ValueOrDie();
+  EXPECT_THAT(bytes, SizeIs(3));
+  EXPECT_THAT(bytes, Each(Gt(0)));
+  // No reads are that far from 10mb.
+  EXPECT_THAT(reader_
+                  ->CompressedBytesPerWindow(
+                      MakeRange("chr20", 1000000, 1001000), 1000)
+                  .ValueOrDie(),
+              ElementsAre(0));
+  EXPECT_THAT(reader_->CompressedBytesPerWindow(
+                  MakeRange("chr20", 9999999, 10001000), 0),
+              IsNotOKWithMessage("window_size must be positive, got 0"));
+}
+
 TEST_F(SamReaderQueryTest, ReadAfterClose) {
   ASSERT_THAT(reader_->Close(), IsOK());
   EXPECT_THAT(reader_->Iterate(),
               IsNotOKWithMessage("Cannot Iterate a closed SamReader."));
   EXPECT_THAT(reader_->Query(MakeRange("chr20", 9999999, 10000000)),
               IsNotOKWithMessage("Cannot Query a closed SamReader."));
+  EXPECT_THAT(reader_->IterateViews(),
+              IsNotOKWithMessage("Cannot Iterate a closed SamReader."));
+  EXPECT_THAT(reader_->QueryViews(MakeRange("chr20", 9999999, 10000000)),
+              IsNotOKWithMessage("Cannot Query a closed SamReader."));
 }
 
 TEST_F(SamReaderQueryTest, NextFailsOnReleasedIterable) {
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Implementation of sam_record_view.h
+#include "third_party/nucleus/io/sam_record_view.h"
+
+#include <cstring>
+
+#include "third_party/nucleus/io/sam_utils.h"
+#include "third_party/nucleus/protos/position.pb.h"
+
+namespace nucleus {
+
+using absl::string_view;
+using nucleus::genomics::v1::CigarUnit;
+using nucleus::genomics::v1::Read;
+
+namespace {
+
+// The aux tag holding the original base qualities.
+constexpr char kOQ[] = "OQ";
+
+// Offset of the phred+33 encoded qualities stored in the "OQ" tag.
+constexpr int kOriginalQualityOffset = 33;
+
+}  // namespace
+
+SamRecordView::SamRecordView(const bam_hdr_t* header, const bam1_t* record,
+                             bool use_original_base_quality_scores)
+    : header_(header), record_(record) {
+  if (use_original_base_quality_scores) {
+    const uint8_t* oq = bam_aux_get(record, kOQ);
+    if (oq != nullptr && *oq == 'Z') {
+      quality_ = oq + 1;
+      quality_length_ = strlen(reinterpret_cast<const char*>(quality_));
+      quality_offset_ = kOriginalQualityOffset;
+    }
+  } else if (record->core.l_qseq) {
+    const uint8_t* quals = bam_get_qual(record);
+    if (quals[0] != 0xff) {  // Not missing
+      quality_ = quals;
+      quality_length_ = record->core.l_qseq;
+    }
+  }
+}
+
+string_view SamRecordView::fragment_name() const {
+  // l_qname counts the NUL terminator and the extra NULs htslib pads the name
+  // with to align the CIGAR.
+  return string_view(bam_get_qname(record_), record_->core.l_qname -
+                                                 record_->core.l_extranul - 1);
+}
+
+string_view SamRecordView::reference_name() const {
+  const int32_t tid = record_->core.tid;
+  return tid >= 0 ? string_view(header_->target_name[tid]) : string_view();
+}
+
+bool SamRecordView::has_next_mate_position() const {
+  // htslib sets mtid to -1 if RNEXT is '*', in which case the mate is treated
+  // as unmapped even if the flag says otherwise.
+  return (flag() & BAM_FPAIRED) && !(flag() & BAM_FMUNMAP) &&
+         record_->core.mtid >= 0;
+}
+
+string_view SamRecordView::next_mate_reference_name() const {
+  return has_next_mate_position()
+             ? string_view(header_->target_name[record_->core.mtid])
+             : string_view();
+}
+
+void SamRecordView::DecodeSequence(int offset, int len,
+                                   std::string* bases) const {
+  const uint8_t* seq = bam_get_seq(record_);
+  bases->resize(len);
+  for (int i = 0; i < len; ++i) {
+    (*bases)[i] = seq_nt16_str[bam_seqi(seq, offset + i)];
+  }
+}
+
+CigarUnit::Operation SamRecordView::CigarOperation(uint32_t op) {
+  return kHtslibCigarToProto[bam_cigar_op(op)];
+}
+
+const uint8_t* SamRecordView::FindAux(string_view tag) const {
+  if (tag.size() != 2) return nullptr;
+  const char tag_chars[2] = {tag[0], tag[1]};
+  return bam_aux_get(record_, tag_chars);
+}
+
+bool SamRecordView::GetAuxInt(string_view tag, int64_t* value) const {
+  const uint8_t* s = FindAux(tag);
+  if (s == nullptr) return false;
+  switch (*s) {
+    case 'c':
+    case 'C':
+    case 's':
+    case 'S':
+    case 'i':
+    case 'I':
+      *value = bam_aux2i(s);
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool SamRecordView::GetAuxString(string_view tag, string_view* value) const {
+  const uint8_t* s = FindAux(tag);
+  if (s == nullptr || (*s != 'Z' && *s != 'H')) return false;
+  *value = string_view(reinterpret_cast<const char*>(s + 1));
+  return true;
+}
+
+void SamRecordView::ToRead(Read* read) const {
+  read->Clear();
+  read->set_fragment_name(fragment_name().data(), fragment_name().size());
+  read->set_fragment_length(fragment_length());
+  read->set_proper_placement(proper_placement());
+  read->set_duplicate_fragment(duplicate_fragment());
+  read->set_failed_vendor_quality_checks(failed_vendor_quality_checks());
+  read->set_secondary_alignment(secondary_alignment());
+  read->set_supplementary_alignment(supplementary_alignment());
+  read->set_read_number(read_number());
+  read->set_number_reads(number_reads());
+
+  if (sequence_length()) {
+    DecodeSequence(read->mutable_aligned_sequence());
+  }
+
+  if (has_alignment()) {
+    auto* linear_alignment = read->mutable_alignment();
+    linear_alignment->set_mapping_quality(mapping_quality());
+    for (uint32_t op : cigar()) {
+      CigarUnit* cigar_unit = linear_alignment->add_cigar();
+      cigar_unit->set_operation(CigarOperation(op));
+      cigar_unit->set_operation_length(CigarLength(op));
+    }
+    if (record_->core.tid >= 0) {
+      auto* position = linear_alignment->mutable_position();
+      position->set_reference_name(reference_name().data(),
+                                   reference_name().size());
+      position->set_position(this->position());
+      position->set_reverse_strand(reverse_strand());
+    }
+  }
+
+  if (has_next_mate_position()) {
+    auto* mate_position = read->mutable_next_mate_position();
+    mate_position->set_reference_name(next_mate_reference_name().data(),
+                                      next_mate_reference_name().size());
+    mate_position->set_position(next_mate_position());
+    mate_position->set_reverse_strand(next_mate_reverse_strand());
+  }
+
+  if (has_quality()) {
+    auto* aligned_quality = read->mutable_aligned_quality();
+    aligned_quality->Reserve(quality_length());
+    for (int i = 0; i < quality_length(); ++i) {
+      aligned_quality->Add(quality(i));
+    }
+  }
+}
+
+}  // namespace nucleus
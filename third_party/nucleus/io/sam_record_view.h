@@ -0,0 +1,154 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef THIRD_PARTY_NUCLEUS_IO_SAM_RECORD_VIEW_H_
+#define THIRD_PARTY_NUCLEUS_IO_SAM_RECORD_VIEW_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "htslib/sam.h"
+#include "third_party/nucleus/protos/cigar.pb.h"
+#include "third_party/nucleus/protos/reads.pb.h"
+
+namespace nucleus {
+
+// A read-only view of an htslib BAM record.
+//
+// SamRecordView exposes the fields of a bam1_t in place, without converting
+// the record into a nucleus.genomics.v1.Read proto. The 4-bit encoded bases
+// are decoded on demand, the CIGAR is a span over the packed htslib
+// operations and aux fields are looked up lazily by tag.
+//
+// A view doesn't own the record or the header it points to. Views returned by
+// SamReader::IterateViews() and SamReader::QueryViews() are only valid until
+// the iterable advances to the next record; call ToRead() to keep a copy.
+class SamRecordView {
+ public:
+  // Creates an empty view. valid() is false for a default-constructed view.
+  SamRecordView() = default;
+
+  // Creates a view of record, whose reference ids are resolved with header.
+  // If use_original_base_quality_scores is true, quality() reads the
+  // phred+33 encoded "OQ" aux tag instead of the QUAL field.
+  SamRecordView(const bam_hdr_t* header, const bam1_t* record,
+                bool use_original_base_quality_scores = false);
+
+  bool valid() const { return record_ != nullptr; }
+  const bam1_t* record() const { return record_; }
+  const bam_hdr_t* header() const { return header_; }
+
+  // Read-level fields. These mirror the Read proto fields of the same name.
+  absl::string_view fragment_name() const;
+  int read_number() const {
+    return flag() & BAM_FREAD1 || !(flag() & BAM_FPAIRED) ? 0 : 1;
+  }
+  int number_reads() const { return flag() & BAM_FPAIRED ? 2 : 1; }
+  int64_t fragment_length() const { return record_->core.isize; }
+  bool proper_placement() const { return flag() & BAM_FPROPER_PAIR; }
+  bool duplicate_fragment() const { return flag() & BAM_FDUP; }
+  bool failed_vendor_quality_checks() const { return flag() & BAM_FQCFAIL; }
+  bool secondary_alignment() const { return flag() & BAM_FSECONDARY; }
+  bool supplementary_alignment() const { return flag() & BAM_FSUPPLEMENTARY; }
+
+  // Alignment fields. has_alignment() is false for unmapped records, in which
+  // case the remaining alignment accessors shouldn't be used.
+  bool has_alignment() const { return !(flag() & BAM_FUNMAP); }
+  int mapping_quality() const { return record_->core.qual; }
+  // Name of the contig the record is aligned to, or "" if it has none.
+  absl::string_view reference_name() const;
+  int64_t position() const { return record_->core.pos; }
+  bool reverse_strand() const { return bam_is_rev(record_); }
+
+  // Mate fields. has_next_mate_position() follows the same rules as the
+  // next_mate_position field filled in by SamReader.
+  bool has_next_mate_position() const;
+  absl::string_view next_mate_reference_name() const;
+  int64_t next_mate_position() const { return record_->core.mpos; }
+  bool next_mate_reverse_strand() const { return bam_is_mrev(record_); }
+
+  // Bases. base(i) decodes a single base; DecodeSequence decodes len bases
+  // starting at offset into *bases, reusing its capacity.
+  int sequence_length() const { return record_->core.l_qseq; }
+  char base(int i) const {
+    return seq_nt16_str[bam_seqi(bam_get_seq(record_), i)];
+  }
+  void DecodeSequence(int offset, int len, std::string* bases) const;
+  void DecodeSequence(std::string* bases) const {
+    DecodeSequence(0, sequence_length(), bases);
+  }
+
+  // Base qualities. has_quality() is false if the record has no base
+  // qualities (or no "OQ" tag when original qualities were requested).
+  bool has_quality() const { return quality_ != nullptr; }
+  int quality_length() const { return quality_length_; }
+  int quality(int i) const { return quality_[i] - quality_offset_; }
+
+  // The packed htslib CIGAR operations. Use CigarOperation and CigarLength to
+  // unpack an element.
+  absl::Span<const uint32_t> cigar() const {
+    return absl::Span<const uint32_t>(bam_get_cigar(record_),
+                                      record_->core.n_cigar);
+  }
+  static genomics::v1::CigarUnit::Operation CigarOperation(uint32_t op);
+  static int CigarLength(uint32_t op) { return bam_cigar_oplen(op); }
+
+  // Aux fields. Returns a pointer to the htslib encoded value of tag, or
+  // nullptr if the record doesn't have it.
+  const uint8_t* FindAux(absl::string_view tag) const;
+  // Stores the value of the integer aux field tag in *value. Returns false if
+  // the tag is missing or isn't an integer.
+  bool GetAuxInt(absl::string_view tag, int64_t* value) const;
+  // Points *value at the string aux field tag. Returns false if the tag is
+  // missing or isn't a string.
+  bool GetAuxString(absl::string_view tag, absl::string_view* value) const;
+
+  // Materializes the record as a Read proto. All fields are filled the same
+  // way SamReader fills them, except the info map: aux fields stay in the
+  // record and are available through FindAux.
+  void ToRead(genomics::v1::Read* read) const;
+
+ private:
+  uint16_t flag() const { return record_->core.flag; }
+
+  const bam_hdr_t* header_ = nullptr;
+  const bam1_t* record_ = nullptr;
+  // Base qualities, stored as quality_[i] - quality_offset_.
+  const uint8_t* quality_ = nullptr;
+  int quality_length_ = 0;
+  int quality_offset_ = 0;
+};
+
+}  // namespace nucleus
+
+#endif  // THIRD_PARTY_NUCLEUS_IO_SAM_RECORD_VIEW_H_
@@ -36,6 +36,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <chrono>  // NOLINT
 #include <memory>
 #include <utility>
 
@@ -566,7 +567,8 @@ StatusOr<std::unique_ptr<SamWriter>> SamWriter::ToFile(
 
 StatusOr<std::unique_ptr<SamWriter>> SamWriter::ToFile(
     const string& sam_path, const string& ref_path, bool embed_ref,
-    const genomics::v1::SamHeader& sam_header) {
+    const genomics::v1::SamHeader& sam_header,
+    std::shared_ptr<HtsThreadPool> thread_pool) {
   htsFormat fmt;
   fmt.specific = nullptr;
 
@@ -595,6 +597,9 @@ StatusOr<std::unique_ptr<SamWriter>> SamWriter::ToFile(
   }
 
   auto native_file = std::make_unique<NativeFile>(fp);
+  if (thread_pool) {
+    NUCLEUS_RETURN_IF_ERROR(thread_pool->Attach(fp));
+  }
   auto native_header = std::make_unique<NativeHeader>(bam_hdr_init());
   NUCLEUS_RETURN_IF_ERROR(PopulateNativeHeader(
       sam_header, fp->format.format == cram, native_header->value()));
@@ -603,12 +608,16 @@ StatusOr<std::unique_ptr<SamWriter>> SamWriter::ToFile(
     return ::nucleus::Unknown("Writing header to file failed");
   }
   return absl::WrapUnique<SamWriter>(
-      new SamWriter(std::move(native_file), std::move(native_header)));
+      new SamWriter(std::move(native_file), std::move(native_header),
+                    std::move(thread_pool)));
 }
 
 SamWriter::SamWriter(std::unique_ptr<NativeFile> file,
-                     std::unique_ptr<NativeHeader> header)
-    : native_file_(std::move(file)), native_header_(std::move(header)) {}
+                     std::unique_ptr<NativeHeader> header,
+                     std::shared_ptr<HtsThreadPool> thread_pool)
+    : native_file_(std::move(file)),
+      native_header_(std::move(header)),
+      thread_pool_(std::move(thread_pool)) {}
 
 SamWriter::~SamWriter() {
   if (native_file_) {
@@ -619,8 +628,16 @@ SamWriter::~SamWriter() {
 }
 
 ::nucleus::Status SamWriter::Close() {
+  const auto close_start = std::chrono::steady_clock::now();
+  if (native_file_) {
+    stats_.compressed_bytes = FlushAndGetCompressedSize(native_file_->value());
+  }
   native_file_.reset();
+  stats_.write_seconds += std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - close_start)
+                              .count();
   native_header_ = nullptr;
+  thread_pool_ = nullptr;
   return ::nucleus::Status();
 }
 
@@ -631,10 +648,22 @@ SamWriter::~SamWriter() {
   if (!status.ok()) {
     return status;
   }
+  const auto write_start = std::chrono::steady_clock::now();
   if (sam_write1(native_file_->value(), native_header_->value(),
                  body->value()) < 0) {
     return ::nucleus::Unknown("Cannot add record");
   }
+  stats_.write_seconds += std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - write_start)
+                              .count();
+  ++stats_.records;
+  if (native_file_->value()->format.format == sam) {
+    // sam_write1 formats the record into the file's line buffer.
+    stats_.uncompressed_bytes += native_file_->value()->line.l;
+  } else {
+    // The BAM encoding: block size, fixed fields and variable length data.
+    stats_.uncompressed_bytes += 4 + 32 + body->value()->l_data;
+  }
   return ::nucleus::Status();
 }
 
@@ -37,6 +37,7 @@
 
 #include "htslib/hts.h"
 #include "htslib/sam.h"
+#include "third_party/nucleus/io/hts_thread_pool.h"
 #include "third_party/nucleus/platform/types.h"
 #include "third_party/nucleus/protos/reads.pb.h"
 #include "third_party/nucleus/util/proto_ptr.h"
@@ -71,12 +72,14 @@ class SamWriter {
   // Creates a new SamWriter writing to the file at |sam_path|, which is
   // opened and created if needed. |ref_path|, which points to an external
   // reference FASTA file, cannot be empty for CRAM files. If |embed_ref|, the
-  // CRAM output file will embed the references in the output file. Returns
-  // either a unique_ptr to the SamWriter or a Status indicating why an error
-  // occurred.
+  // CRAM output file will embed the references in the output file. If
+  // |thread_pool| is not null, the output is compressed on it, and it may be
+  // shared with other writers. Returns either a unique_ptr to the SamWriter or
+  // a Status indicating why an error occurred.
   static StatusOr<std::unique_ptr<SamWriter>> ToFile(
       const string& sam_path, const string& ref_path, bool embed_ref,
-      const nucleus::genomics::v1::SamHeader& sam_header);
+      const nucleus::genomics::v1::SamHeader& sam_header,
+      std::shared_ptr<HtsThreadPool> thread_pool = nullptr);
 
   ~SamWriter();
 
@@ -102,19 +105,29 @@ class SamWriter {
   // not use it!
   void PythonEnter() const {}
 
+  // Counters of the records written so far. compressed_bytes is set by
+  // Close().
+  const HtsWriterStats& Stats() const { return stats_; }
+
  private:
   class NativeHeader;
   class NativeFile;
   class NativeBody;
   // Private constructor; use ToFile to safely create a SamWriter.
   SamWriter(std::unique_ptr<NativeFile> file,
-            std::unique_ptr<NativeHeader> header);
+            std::unique_ptr<NativeHeader> header,
+            std::shared_ptr<HtsThreadPool> thread_pool);
 
   // A pointer to the htslib file used to access the SAM/BAM/CRAM data.
   std::unique_ptr<NativeFile> native_file_;
 
   // A htslib header data structure obtained by parsing the header of this file.
   std::unique_ptr<NativeHeader> native_header_;
+
+  // The pool compressing the output, if any. Must outlive native_file_.
+  std::shared_ptr<HtsThreadPool> thread_pool_;
+
+  HtsWriterStats stats_;
 };
 
 }  // namespace nucleus
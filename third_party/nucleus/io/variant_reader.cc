@@ -32,15 +32,155 @@
 
 #include "third_party/nucleus/io/variant_reader.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <deque>
 #include <memory>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
 
-#include "absl/log/check.h"
 #include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "third_party/nucleus/core/status.h"
+#include "third_party/nucleus/core/statusor.h"
 #include "third_party/nucleus/io/tfrecord_reader.h"
 
 namespace nucleus {
 
+namespace {
+
+// Number of records a prefetching thread decodes from a shard at a time.
+constexpr int kPrefetchBatchSize = 256;
+
+// A shard is not read further while this many of its records are waiting to
+// be consumed.
+constexpr int kMaxPrefetchedRecords = 4 * kPrefetchBatchSize;
+
+}  // namespace
+
+// Reads and parses records from a set of VariantReaders on a pool of threads,
+// keeping up to kMaxPrefetchedRecords decoded records per reader. Each reader
+// is used by at most one thread at a time, and its records are returned in
+// file order.
+class VariantShardPrefetcher {
+ public:
+  VariantShardPrefetcher(const std::vector<VariantReader*>& readers,
+                         int num_threads)
+      : shards_(readers.size()) {
+    for (size_t i = 0; i < readers.size(); ++i) {
+      shards_[i].reader = readers[i];
+    }
+    num_threads = std::min<int>(num_threads, readers.size());
+    for (int i = 0; i < num_threads; ++i) {
+      threads_.emplace_back(&VariantShardPrefetcher::Work, this);
+    }
+  }
+
+  ~VariantShardPrefetcher() {
+    {
+      absl::MutexLock lock(&mutex_);
+      stopping_ = true;
+    }
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Moves the next record of reader `shard_idx` into `variant`, waiting for it
+  // to be decoded if needed. Returns false once all records have been read,
+  // and the reader's error once all records before it have been returned.
+  StatusOr<bool> Next(uint32_t shard_idx, IndexedVariant* variant) {
+    Shard& shard = shards_[shard_idx];
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(
+        +[](Shard* shard) { return !shard->ready.empty() || shard->done; },
+        &shard));
+    if (shard.ready.empty()) {
+      NUCLEUS_RETURN_IF_ERROR(shard.status);
+      return false;
+    }
+    *variant = std::move(shard.ready.front());
+    shard.ready.pop_front();
+    return true;
+  }
+
+ private:
+  struct Shard {
+    VariantReader* reader = nullptr;
+    std::deque<IndexedVariant> ready;
+    // True once the reader returned its last record or failed.
+    bool done = false;
+    // The error of the record that could not be read, if any.
+    Status status;
+    // True while a thread is decoding records from the reader.
+    bool busy = false;
+  };
+
+  // Returns the shard that most needs records, or nullptr if no shard can be
+  // read now. Requires mutex_ to be held.
+  Shard* NextShardToRead() {
+    Shard* next = nullptr;
+    for (Shard& shard : shards_) {
+      if (!shard.done && !shard.busy &&
+          shard.ready.size() < kMaxPrefetchedRecords &&
+          (next == nullptr || shard.ready.size() < next->ready.size())) {
+        next = &shard;
+      }
+    }
+    return next;
+  }
+
+  // Requires mutex_ to be held.
+  bool HasWork() { return stopping_ || NextShardToRead() != nullptr; }
+
+  void Work() {
+    std::vector<IndexedVariant> batch;
+    mutex_.Lock();
+    while (true) {
+      mutex_.Await(absl::Condition(this, &VariantShardPrefetcher::HasWork));
+      if (stopping_) {
+        break;
+      }
+      Shard* shard = NextShardToRead();
+      shard->busy = true;
+      mutex_.Unlock();
+
+      bool done = false;
+      Status status;
+      while (batch.size() < kPrefetchBatchSize) {
+        if (!shard->reader->GetNext()) {
+          done = true;
+          break;
+        }
+        StatusOr<IndexedVariant> variant = shard->reader->ReadRecord();
+        if (!variant.ok()) {
+          status = variant.status();
+          done = true;
+          break;
+        }
+        batch.push_back(variant.ConsumeValueOrDie());
+      }
+
+      mutex_.Lock();
+      for (IndexedVariant& variant : batch) {
+        shard->ready.push_back(std::move(variant));
+      }
+      batch.clear();
+      shard->done = done;
+      shard->status = status;
+      shard->busy = false;
+    }
+    mutex_.Unlock();
+  }
+
+  absl::Mutex mutex_;
+  std::vector<Shard> shards_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
 bool IndexedVariant::operator>(const IndexedVariant& other) const {
   if (contig_map_index > other.contig_map_index) {
     return true;
@@ -66,13 +206,13 @@ IndexedVariant EmptyIndexedVariant() {
 
 VariantReader::VariantReader(
     std::unique_ptr<TFRecordReader> internal_reader,
-    absl::flat_hash_map<std::string, uint32_t>& contig_index_map)
+    const absl::flat_hash_map<std::string, uint32_t>& contig_index_map)
     : internal_reader_(std::move(internal_reader)),
       contig_index_map_(contig_index_map) {}
 
 std::unique_ptr<VariantReader> VariantReader::Open(
     const std::string& filename, std::string_view compression_type,
-    absl::flat_hash_map<std::string, uint32_t>& contig_index_map) {
+    const absl::flat_hash_map<std::string, uint32_t>& contig_index_map) {
   std::string compression(compression_type);
   if (compression_type == kAutoDetectCompression) {
     compression = "";
@@ -89,34 +229,57 @@ bool VariantReader::GetNext() { return internal_reader_->GetNext(); }
 
 // Return the current record contents.  Only valid after GetNext()
 // has returned true.
-IndexedVariant VariantReader::ReadRecord() {
+StatusOr<IndexedVariant> VariantReader::ReadRecord() {
   tensorflow::tstring data = internal_reader_->record();
   std::unique_ptr<Variant> proto = std::make_unique<Variant>();
-  CHECK(proto->ParseFromArray(data.data(), data.length()))
-      << "Failed to parse proto";
-  uint32_t contig_index = contig_index_map_[proto->reference_name()];
-  return {.variant = std::move(proto), .contig_map_index = contig_index};
+  if (!proto->ParseFromArray(data.data(), data.length())) {
+    return DataLoss("Failed to parse Variant proto");
+  }
+  const auto contig = contig_index_map_.find(proto->reference_name());
+  if (contig == contig_index_map_.end()) {
+    return NotFound(absl::StrCat("Variant on unknown contig \"",
+                                 proto->reference_name(), "\""));
+  }
+  return IndexedVariant{.variant = std::move(proto),
+                        .contig_map_index = contig->second};
 }
 
 IndexedVariant VariantReader::GetAndReadNext() {
   if (GetNext()) {
-    return ReadRecord();
+    StatusOr<IndexedVariant> variant = ReadRecord();
+    NUCLEUS_QCHECK_OK(variant.status());
+    return variant.ConsumeValueOrDie();
   }
   return EmptyIndexedVariant();
 }
 
 ShardedVariantReader::ShardedVariantReader(
     std::vector<std::unique_ptr<VariantReader>> shard_readers)
+    : ShardedVariantReader(std::move(shard_readers), /*num_threads=*/1) {}
+
+ShardedVariantReader::ShardedVariantReader(
+    std::vector<std::unique_ptr<VariantReader>> shard_readers, int num_threads)
     : shard_readers_(std::move(shard_readers)) {
+  if (num_threads > 1 && !shard_readers_.empty()) {
+    std::vector<VariantReader*> readers;
+    for (const auto& reader : shard_readers_) {
+      readers.push_back(reader.get());
+    }
+    prefetcher_ =
+        std::make_unique<VariantShardPrefetcher>(readers, num_threads);
+  }
   // Prime all readers and 'next_elems_'
   for (uint32_t i = 0; i < shard_readers_.size(); i++) {
     ReadNextFromShard(i);
   }
 }
 
+ShardedVariantReader::~ShardedVariantReader() = default;
+
 std::unique_ptr<ShardedVariantReader> ShardedVariantReader::Open(
     const std::vector<std::string>& shard_paths,
-    absl::flat_hash_map<std::string, uint32_t>& contig_index_map) {
+    const absl::flat_hash_map<std::string, uint32_t>& contig_index_map,
+    int num_threads) {
   std::vector<std::unique_ptr<VariantReader>> shard_readers;
   shard_readers.reserve(shard_paths.size());
   for (const auto& path : shard_paths) {
@@ -124,7 +287,8 @@ std::unique_ptr<ShardedVariantReader> ShardedVariantReader::Open(
         VariantReader::Open(path, kAutoDetectCompression, contig_index_map));
   }
 
-  return std::make_unique<ShardedVariantReader>(std::move(shard_readers));
+  return std::make_unique<ShardedVariantReader>(std::move(shard_readers),
+                                                num_threads);
 }
 
 // All shards are sorted internally, but not with respect to each other.
@@ -151,11 +315,26 @@ IndexedVariant ShardedVariantReader::GetAndReadNext() {
 
 void ShardedVariantReader::ReadNextFromShard(uint32_t shard_idx) {
   // Advance the reader which was used, and remove if fully consumed
-  if (shard_readers_[shard_idx]->GetNext()) {
-    IndexedVariant variant = shard_readers_[shard_idx]->ReadRecord();
-    next_elems_.push(
-        {.variant = std::move(variant), .reader_shard_index = shard_idx});
+  IndexedVariant variant;
+  if (prefetcher_ != nullptr) {
+    StatusOr<bool> has_next = prefetcher_->Next(shard_idx, &variant);
+    NUCLEUS_QCHECK_OK(has_next.status());
+    if (!has_next.ValueOrDie()) {
+      return;
+    }
+  } else if (shard_readers_[shard_idx]->GetNext()) {
+    StatusOr<IndexedVariant> next = shard_readers_[shard_idx]->ReadRecord();
+    NUCLEUS_QCHECK_OK(next.status());
+    variant = next.ConsumeValueOrDie();
+  } else {
+    return;
   }
+  const int64_t start = variant.variant->start();
+  const int64_t end = variant.variant->end();
+  next_elems_.push({.variant = std::move(variant),
+                    .reader_shard_index = shard_idx,
+                    .start = start,
+                    .end = end});
 }
 
 }  // namespace nucleus
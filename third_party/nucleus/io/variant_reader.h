@@ -40,6 +40,7 @@
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
+#include "third_party/nucleus/core/statusor.h"
 #include "third_party/nucleus/io/tfrecord_reader.h"
 #include "third_party/nucleus/protos/variants.pb.h"
 
@@ -70,8 +71,9 @@ IndexedVariant EmptyIndexedVariant();
 class VariantReader {
  public:
   // Internal constructor, `Open` should generally be used instead.
-  VariantReader(std::unique_ptr<TFRecordReader> internal_reader,
-                absl::flat_hash_map<std::string, uint32_t>& contig_index_map);
+  VariantReader(
+      std::unique_ptr<TFRecordReader> internal_reader,
+      const absl::flat_hash_map<std::string, uint32_t>& contig_index_map);
 
   // Creates a reader for the given file.
   // `compression_type` can be either "" (for no compression), "GZIP", or "AUTO"
@@ -80,20 +82,26 @@ class VariantReader {
   // their index within the sorted contigs.
   static std::unique_ptr<VariantReader> Open(
       const std::string& filename, std::string_view compression_type,
-      absl::flat_hash_map<std::string, uint32_t>& contig_index_map);
+      const absl::flat_hash_map<std::string, uint32_t>& contig_index_map);
 
+  // Reads and returns the next record, or an empty IndexedVariant at the end
+  // of the file. Dies if the record cannot be returned by ReadRecord().
   IndexedVariant GetAndReadNext();
 
   // Reads the next record if available.
   bool GetNext();
 
   // Returns the current Variant and contig index.
-  // Only valid after GetNext() has returned true.
-  IndexedVariant ReadRecord();
+  // Only valid after GetNext() has returned true. Returns a DataLoss error if
+  // the record is not a Variant, and a NotFound error if its reference name is
+  // not in the contig index map.
+  StatusOr<IndexedVariant> ReadRecord();
 
  private:
   std::unique_ptr<TFRecordReader> internal_reader_;
-  absl::flat_hash_map<std::string, uint32_t> contig_index_map_;
+  // Only read after construction, so that readers can be used from several
+  // threads.
+  const absl::flat_hash_map<std::string, uint32_t> contig_index_map_;
 };
 
 struct VariantFromShard {
@@ -104,16 +112,31 @@ struct VariantFromShard {
   // invalid data).
   mutable IndexedVariant variant;
   uint32_t reader_shard_index;
+  // Copies of the variant's sort key, so that heap operations compare
+  // integers instead of reading the protos.
+  int64_t start;
+  int64_t end;
 };
 
 // Ranking function for priority_queue. Using a > b allows it to act as a
-// min_heap and not like a max_heap as it would by default.
+// min_heap and not like a max_heap as it would by default. Orders like
+// IndexedVariant::operator>.
 struct CompareVariantFromShard {
   bool operator()(const VariantFromShard& a, const VariantFromShard& b) const {
-    return a.variant > b.variant;
+    if (a.variant.contig_map_index != b.variant.contig_map_index) {
+      return a.variant.contig_map_index > b.variant.contig_map_index;
+    }
+    if (a.start != b.start) {
+      return a.start > b.start;
+    }
+    return a.end > b.end;
   }
 };
 
+// Decodes the records of several VariantReaders on background threads.
+// Defined in variant_reader.cc.
+class VariantShardPrefetcher;
+
 // Reads Variant proto records from sharded TFRecord file paths in sorted order.
 //
 // The input TFRecord file must have each shard already in sorted order (but
@@ -131,14 +154,28 @@ class ShardedVariantReader {
   ShardedVariantReader(
       std::vector<std::unique_ptr<VariantReader>> shard_readers);
 
+  // Same as above, but if `num_threads` is greater than 1, records are read and
+  // parsed ahead of time by up to `num_threads` threads, a batch at a time per
+  // shard. Records are returned in the same order either way.
+  ShardedVariantReader(
+      std::vector<std::unique_ptr<VariantReader>> shard_readers,
+      int num_threads);
+
+  ~ShardedVariantReader();
+
   // Creates a reader for the given file paths.
   // `compression_type` can be either "" (for no compression), "GZIP", or "AUTO"
   // (for auto detection by filename suffix). `contig_index_map` should be a
   // mapping between reference names and their index within the sorted contigs.
+  // See the constructor for `num_threads`.
   static std::unique_ptr<ShardedVariantReader> Open(
       const std::vector<std::string>& shard_paths,
-      absl::flat_hash_map<std::string, uint32_t>& contig_index_map);
+      const absl::flat_hash_map<std::string, uint32_t>& contig_index_map,
+      int num_threads = 1);
 
+  // Returns the next record across all shards, or an empty IndexedVariant once
+  // all shards are consumed. Dies if a shard has a record that its
+  // VariantReader::ReadRecord() cannot return.
   IndexedVariant GetAndReadNext();
 
  private:
@@ -151,6 +188,8 @@ class ShardedVariantReader {
                       CompareVariantFromShard>
       next_elems_;
   std::vector<std::unique_ptr<VariantReader>> shard_readers_;
+  // Set if records are decoded on background threads.
+  std::unique_ptr<VariantShardPrefetcher> prefetcher_;
 };
 
 }  // namespace nucleus
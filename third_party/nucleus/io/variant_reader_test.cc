@@ -33,13 +33,16 @@
 #include "third_party/nucleus/io/variant_reader.h"
 
 #include <string>
+#include <vector>
 
 #include <gmock/gmock-generated-matchers.h>
 #include <gmock/gmock-matchers.h>
 #include <gmock/gmock-more-matchers.h>
 
 #include "tensorflow/core/platform/test.h"
+#include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
+#include "third_party/nucleus/core/status_matchers.h"
 #include "third_party/nucleus/io/tfrecord_writer.h"
 #include "third_party/nucleus/protos/variants.pb.h"
 #include "third_party/nucleus/testing/protocol-buffer-matchers.h"
@@ -47,6 +50,7 @@
 namespace {
 
 using nucleus::EqualsProto;
+using nucleus::IsNotOKWithCodeAndMessage;
 using testing::Pointee;
 
 nucleus::genomics::v1::Variant VariantProto(const std::string& ref_name,
@@ -197,4 +201,79 @@ TEST(IndexedReaderTest, ReturnsContigIndex) {
   EXPECT_THAT(reader->GetAndReadNext().contig_map_index, 2);
 }
 
+TEST(IndexedReaderTest, UnknownContigIsNotFound) {
+  std::string path_a = absl::StrCat(getenv("TEST_TMPDIR"), "/", "unknown");
+  auto writer_a = nucleus::TFRecordWriter::New(path_a, "");
+  writer_a->WriteRecord(VariantStr("ref_a", 1));
+  writer_a->WriteRecord(VariantStr("ref_z", 2));
+  writer_a->Close();
+
+  const absl::flat_hash_map<std::string, uint32_t> contig_index_map = {
+      {"ref_a", 0}};
+  auto reader = nucleus::VariantReader::Open(path_a, "", contig_index_map);
+  ASSERT_TRUE(reader->GetNext());
+  EXPECT_THAT(reader->ReadRecord().ValueOrDie().variant,
+              Pointee(EqualsProto(VariantProto("ref_a", 1))));
+  ASSERT_TRUE(reader->GetNext());
+  EXPECT_THAT(reader->ReadRecord(),
+              IsNotOKWithCodeAndMessage(absl::StatusCode::kNotFound, "ref_z"));
+}
+
+TEST(IndexedReaderTest, PrefetchingDiesOnUnknownContig) {
+  std::string path_a = absl::StrCat(getenv("TEST_TMPDIR"), "/", "unknown.gz");
+  auto writer_a = nucleus::TFRecordWriter::New(path_a, "GZIP");
+  writer_a->WriteRecord(VariantStr("ref_z", 1));
+  writer_a->Close();
+
+  const absl::flat_hash_map<std::string, uint32_t> contig_index_map = {
+      {"ref_a", 0}};
+  EXPECT_DEATH(nucleus::ShardedVariantReader::Open({path_a, path_a},
+                                                   contig_index_map,
+                                                   /*num_threads=*/2),
+               "unknown contig \"ref_z\"");
+}
+
+TEST(IndexedReaderTest, PrefetchingMatchesSerialOrder) {
+  // Shards with interleaved records, including records with the same key in
+  // several shards, which are told apart by their names.
+  constexpr int kNumShards = 7;
+  std::vector<std::string> paths;
+  for (int shard = 0; shard < kNumShards; ++shard) {
+    paths.push_back(
+        absl::StrCat(getenv("TEST_TMPDIR"), "/", "prefetch-", shard, ".gz"));
+    auto writer = nucleus::TFRecordWriter::New(paths.back(), "GZIP");
+    for (const std::string ref_name : {"ref_a", "ref_b"}) {
+      for (int i = 0; i < 3000; ++i) {
+        if ((i * 7 + shard) % 5 < 2) continue;
+        const int start = i / 2;
+        nucleus::genomics::v1::Variant v =
+            VariantProto(ref_name, start, start + 1 + i % 3);
+        v.add_names(absl::StrCat(shard, "-", i));
+        writer->WriteRecord(v.SerializeAsString());
+      }
+    }
+    writer->Close();
+  }
+
+  absl::flat_hash_map<std::string, uint32_t> contig_index_map = {{"ref_a", 0},
+                                                                 {"ref_b", 1}};
+  auto serial = nucleus::ShardedVariantReader::Open(paths, contig_index_map);
+  auto prefetching = nucleus::ShardedVariantReader::Open(
+      paths, contig_index_map, /*num_threads=*/3);
+  int num_records = 0;
+  while (true) {
+    nucleus::IndexedVariant expected = serial->GetAndReadNext();
+    nucleus::IndexedVariant actual = prefetching->GetAndReadNext();
+    if (expected.variant == nullptr) {
+      EXPECT_EQ(actual.variant, nullptr);
+      break;
+    }
+    ASSERT_NE(actual.variant, nullptr);
+    ASSERT_THAT(*actual.variant, EqualsProto(*expected.variant));
+    EXPECT_EQ(actual.contig_map_index, expected.contig_map_index);
+    ++num_records;
+  }
+  EXPECT_EQ(num_records, kNumShards * 2 * 3000 * 3 / 5);
+}
+
 }  // namespace
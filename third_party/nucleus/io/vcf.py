@@ -253,7 +253,8 @@ class NativeVcfWriter(genomics_writer.GenomicsWriter):
                excluded_info_fields=None,
                excluded_format_fields=None,
                retrieve_gl_and_pl_from_info_map=False,
-               exclude_header=False):
+               exclude_header=False,
+               thread_pool=None):
     """Initializer for NativeVcfWriter.
 
     Args:
@@ -272,6 +273,8 @@ class NativeVcfWriter(genomics_writer.GenomicsWriter):
         fields are retrieved from the VariantCall.info map rather than from the
         top-level value in the VariantCall.genotype_likelihood field.
       exclude_header: bool. If True, write a headerless VCF.
+      thread_pool: hts_thread_pool.HtsThreadPool. If provided, BGZF compressed
+        output is compressed on this pool, which may be shared across writers.
     """
     super(NativeVcfWriter, self).__init__()
 
@@ -284,8 +287,12 @@ class NativeVcfWriter(genomics_writer.GenomicsWriter):
         retrieve_gl_and_pl_from_info_map=retrieve_gl_and_pl_from_info_map,
         exclude_header=exclude_header,
     )
-    self._writer = vcf_writer.VcfWriter.to_file(output_path, header,
-                                                writer_options)
+    if thread_pool is None:
+      self._writer = vcf_writer.VcfWriter.to_file(output_path, header,
+                                                  writer_options)
+    else:
+      self._writer = vcf_writer.VcfWriter.to_file(output_path, header,
+                                                  writer_options, thread_pool)
     self.field_access_cache = VcfHeaderCache(header)
 
   def write(self, proto):
@@ -294,6 +301,10 @@ class NativeVcfWriter(genomics_writer.GenomicsWriter):
   def write_somatic(self, proto):
     self._writer.write_somatic(proto)
 
+  def stats(self):
+    """Returns the HtsWriterStats counters of the underlying writer."""
+    return self._writer.stats()
+
   def __exit__(self, exit_type, exit_value, exit_traceback):
     self._writer.__exit__(exit_type, exit_value, exit_traceback)
 
@@ -46,6 +46,8 @@
 #include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/substitute.h"
+#include "htslib/hts_endian.h"
+#include "htslib/kstring.h"
 #include "third_party/nucleus/platform/types.h"
 #include "third_party/nucleus/util/math.h"
 #include "third_party/nucleus/util/utils.h"
@@ -462,6 +464,88 @@ template <>
   return ::nucleus::Status();
 }
 
+// Fills gts, of size calls * ploidy, with the htslib encoding of the genotypes
+// of variant_message, padding genotypes shorter than ploidy with vector ends.
+::nucleus::Status EncodeGenotypes(
+    const nucleus::genomics::v1::Variant& variant_message, const bcf_hdr_t& h,
+    int ploidy, int32* gts) {
+  for (int c = 0; c < variant_message.calls_size(); c++) {
+    const nucleus::genomics::v1::VariantCall& vc = variant_message.calls(c);
+
+    if (vc.genotype_size() > ploidy)
+      return ::nucleus::FailedPrecondition(
+          "Too many genotypes given the ploidy");
+    if (vc.call_set_name() != h.samples[c])
+      return ::nucleus::FailedPrecondition(absl::StrCat(
+          "Out-of-order call set names, or unrecognized call set name, "
+          "with respect to samples declared in VCF header. Variant has ",
+          vc.call_set_name(), " at position ", c,
+          " while the VCF header expected a sample named ", h.samples[c],
+          " at this position"));
+
+    const bool isPhased = vc.is_phased();
+    int a = 0;
+    for (; a < vc.genotype_size(); a++) {
+      gts[c * ploidy + a] = vcfEncodeAllele(vc.genotype(a), isPhased);
+    }
+    for (; a < ploidy; a++) {
+      gts[c * ploidy + a] = bcf_int32_vector_end;
+    }
+  }
+  return ::nucleus::Status();
+}
+
+// Lays out the values of one FORMAT field of n_samples samples in `values` as
+// EncodeFormatValues does, where size_of(s) is the number of values of sample
+// s and fill(s, out) writes them to out. Returns the number of values per
+// sample, which is 0 if no sample has any value.
+template <class ValueType, class SizeFn, class FillFn>
+StatusOr<int> FlattenFormatValues(int n_samples, SizeFn size_of, FillFn fill,
+                                  std::vector<ValueType>* values) {
+  using VT = VcfType<ValueType>;
+  int values_per_sample = 0;
+  for (int s = 0; s < n_samples; s++) {
+    values_per_sample = std::max(values_per_sample, size_of(s));
+  }
+  values->resize(static_cast<size_t>(n_samples) * values_per_sample);
+  ValueType* out = values->data();
+  for (int s = 0; s < n_samples && values_per_sample > 0; s++) {
+    const int size = size_of(s);
+    if (size == 0) {
+      VT::SetMissing(&out[0]);
+      for (int j = 1; j < values_per_sample; j++) {
+        VT::SetVectorEnd(&out[j]);
+      }
+    } else if (size != values_per_sample) {
+      return ::nucleus::FailedPrecondition(
+          "values[s].size() != values_per_sample");
+    } else {
+      fill(s, out);
+    }
+    out += values_per_sample;
+  }
+  return values_per_sample;
+}
+
+// Appends a FORMAT field to the BCF-encoded per-sample data s, byte for byte
+// as bcf_update_format* encodes it: the key, then the typed values.
+void AppendFormatField(int id, std::vector<int32>* values,
+                       int values_per_sample, kstring_t* s) {
+  bcf_enc_int1(s, id);
+  bcf_enc_vint(s, values->size(), values->data(), values_per_sample);
+}
+
+void AppendFormatField(int id, std::vector<float>* values,
+                       int values_per_sample, kstring_t* s) {
+  bcf_enc_int1(s, id);
+  bcf_enc_size(s, values_per_sample, BCF_BT_FLOAT);
+  ks_resize(s, s->l + sizeof(float) * values->size());
+  for (float value : *values) {
+    float_to_le(value, reinterpret_cast<uint8_t*>(s->s + s->l));
+    s->l += sizeof(float);
+  }
+}
+
 // Returns the hrec that contains information or nullptr if none does.
 const bcf_hrec_t* GetPopulatedHrec(const bcf_idpair_t& idPair) {
   for (int i = 0; i < 3; i++) {
@@ -1142,32 +1226,15 @@ char* uppercase_allele(char* s) {
     ploidy = std::max(ploidy, variant_message.calls(c).genotype_size());
   }
 
+  if (nCalls > 0 && gt_id_ >= 0 && v->n_fmt == 0) {
+    return EncodeFormatDirect(variant_message, h, ploidy, v);
+  }
+
   if (nCalls > 0) {
     // Write genotypes.
     auto gts = std::make_unique<int32[]>(nCalls * ploidy);
-    for (int c = 0; c < nCalls; c++) {
-      const nucleus::genomics::v1::VariantCall& vc = variant_message.calls(c);
-
-      if (vc.genotype_size() > ploidy)
-        return ::nucleus::FailedPrecondition(
-            "Too many genotypes given the ploidy");
-      if (vc.call_set_name() != h.samples[c])
-        return ::nucleus::FailedPrecondition(absl::StrCat(
-            "Out-of-order call set names, or unrecognized call set name, "
-            "with respect to samples declared in VCF header. Variant has ",
-            vc.call_set_name(), " at position ", c,
-            " while the VCF header expected a sample named ", h.samples[c],
-            " at this position"));
-
-      const bool isPhased = vc.is_phased();
-      int a = 0;
-      for (; a < vc.genotype_size(); a++) {
-        gts.get()[c * ploidy + a] = vcfEncodeAllele(vc.genotype(a), isPhased);
-      }
-      for (; a < ploidy; a++) {
-        gts.get()[c * ploidy + a] = bcf_int32_vector_end;
-      }
-    }
+    NUCLEUS_RETURN_IF_ERROR(
+        EncodeGenotypes(variant_message, h, ploidy, gts.get()));
     if (bcf_update_genotypes(&h, v, gts.get(), nCalls * ploidy) < 0) {
       return ::nucleus::Unknown("Failure to write genotypes to VCF record");
     }
@@ -1240,4 +1307,140 @@ char* uppercase_allele(char* s) {
   return ::nucleus::Status();
 }
 
+bool VcfRecordConverter::EnableDirectFormatEncoding(const bcf_hdr_t& h) {
+  auto resolve = [&h](const string& tag) {
+    const int id = bcf_hdr_id2int(&h, BCF_DT_ID, tag.c_str());
+    return bcf_hdr_idinfo_exists(&h, BCF_HL_FMT, id) ? id : -1;
+  };
+  const int gt_id = resolve("GT");
+  if (gt_id < 0) return false;
+
+  // Same fields, in the same order, as the bcf_update_format* path.
+  std::vector<DirectFormatField> fields;
+  for (const VcfFormatFieldAdapter& adapter : format_adapters_) {
+    const int id = resolve(adapter.field_name());
+    if (id < 0 || (adapter.vcf_type() != BCF_HT_INT &&
+                   adapter.vcf_type() != BCF_HT_REAL)) {
+      return false;
+    }
+    fields.push_back({id, adapter.vcf_type(), DirectFormatField::kInfoMap,
+                      adapter.field_name()});
+  }
+  if (!gl_and_pl_in_info_map_) {
+    if (want_gl_) {
+      const int id = resolve("GL");
+      if (id < 0) return false;
+      fields.push_back(
+          {id, BCF_HT_REAL, DirectFormatField::kGenotypeLikelihood, "GL"});
+    }
+    if (want_pl_) {
+      const int id = resolve("PL");
+      if (id < 0) return false;
+      fields.push_back(
+          {id, BCF_HT_INT, DirectFormatField::kPhredScaledLikelihood, "PL"});
+    }
+  }
+
+  gt_id_ = gt_id;
+  direct_format_fields_ = std::move(fields);
+  return true;
+}
+
+::nucleus::Status VcfRecordConverter::EncodeFormatDirect(
+    const nucleus::genomics::v1::Variant& variant_message, const bcf_hdr_t& h,
+    int ploidy, bcf1_t* v) const {
+  const int n_calls = variant_message.calls_size();
+  const auto& calls = variant_message.calls();
+  kstring_t* indiv = &v->indiv;
+  int n_fmt = 0;
+
+  int_buffer_.resize(static_cast<size_t>(n_calls) * ploidy);
+  NUCLEUS_RETURN_IF_ERROR(
+      EncodeGenotypes(variant_message, h, ploidy, int_buffer_.data()));
+  if (!int_buffer_.empty()) {
+    AppendFormatField(gt_id_, &int_buffer_, ploidy, indiv);
+    n_fmt++;
+  }
+
+  for (const DirectFormatField& field : direct_format_fields_) {
+    StatusOr<int> values_per_sample = 0;
+    switch (field.source) {
+      case DirectFormatField::kInfoMap: {
+        list_buffer_.assign(n_calls, nullptr);
+        for (int c = 0; c < n_calls; c++) {
+          auto found = calls[c].info().find(field.tag);
+          if (found != calls[c].info().end()) {
+            list_buffer_[c] = &found->second;
+          }
+        }
+        auto size_of = [this](int c) {
+          return list_buffer_[c] ? list_buffer_[c]->values_size() : 0;
+        };
+        if (field.vcf_type == BCF_HT_INT) {
+          values_per_sample = FlattenFormatValues(
+              n_calls, size_of,
+              [this](int c, int32* out) {
+                for (const auto& value : list_buffer_[c]->values()) {
+                  *out++ = value.int_value();
+                }
+              },
+              &int_buffer_);
+        } else {
+          values_per_sample = FlattenFormatValues(
+              n_calls, size_of,
+              [this](int c, float* out) {
+                for (const auto& value : list_buffer_[c]->values()) {
+                  *out++ = static_cast<float>(value.number_value());
+                }
+              },
+              &float_buffer_);
+        }
+        break;
+      }
+      case DirectFormatField::kGenotypeLikelihood:
+        values_per_sample = FlattenFormatValues(
+            n_calls,
+            [&calls](int c) { return calls[c].genotype_likelihood_size(); },
+            [&calls](int c, float* out) {
+              for (double ll : calls[c].genotype_likelihood()) {
+                *out++ = static_cast<float>(ll);
+              }
+            },
+            &float_buffer_);
+        break;
+      case DirectFormatField::kPhredScaledLikelihood:
+        values_per_sample = FlattenFormatValues(
+            n_calls,
+            [&calls](int c) { return calls[c].genotype_likelihood_size(); },
+            [&calls](int c, int32* out) {
+              const auto& lls = calls[c].genotype_likelihood();
+              const double max_ll = *std::max_element(lls.begin(), lls.end());
+              for (double ll : lls) {
+                *out++ = static_cast<int32>(Log10PErrorToPhred(ll - max_ll));
+              }
+            },
+            &int_buffer_);
+        break;
+    }
+    NUCLEUS_RETURN_IF_ERROR(values_per_sample.status());
+    if (values_per_sample.ValueOrDie() == 0) continue;
+    if (field.vcf_type == BCF_HT_INT) {
+      AppendFormatField(field.id, &int_buffer_, values_per_sample.ValueOrDie(),
+                        indiv);
+    } else {
+      AppendFormatField(field.id, &float_buffer_,
+                        values_per_sample.ValueOrDie(), indiv);
+    }
+    n_fmt++;
+  }
+
+  // The record now holds its FORMAT fields only in BCF form; htslib decodes
+  // them from there when formatting VCF text.
+  v->n_sample = bcf_hdr_nsamples(&h);
+  v->n_fmt = n_fmt;
+  v->unpacked &= ~BCF_UN_FMT;
+  v->d.indiv_dirty = 0;
+  return ::nucleus::Status();
+}
+
 }  // namespace nucleus
@@ -199,6 +199,9 @@ class VcfFormatFieldAdapter {
                                  const bcf1_t *bcf_record,
                                  nucleus::genomics::v1::Variant *variant) const;
 
+  const string &field_name() const { return field_name_; }
+  int vcf_type() const { return vcf_type_; }
+
  private:  // Non-API methods
   template <class T>
   ::nucleus::Status EncodeValues(const nucleus::genomics::v1::Variant &variant,
@@ -294,7 +297,39 @@ class VcfRecordConverter {
       const nucleus::genomics::v1::Variant &variant_message, const bcf_hdr_t &h,
       bcf1_t *v) const;
 
+  // Resolves the FORMAT field IDs of `h`, the header later passed to
+  // ConvertFromPb, so that ConvertFromPb encodes the FORMAT values of new
+  // records straight into their BCF representation, reusing the same value
+  // buffers across records. This skips the per-field tag lookups and
+  // allocations of bcf_update_format* and yields the same records. Returns
+  // false and leaves the converter unchanged if a FORMAT field to write is
+  // not of Integer or Float type, as with the DeepVariant schema (GT, GQ, DP,
+  // MIN_DP, AD, VAF, PL). Once enabled, ConvertFromPb must not be called
+  // concurrently.
+  bool EnableDirectFormatEncoding(const bcf_hdr_t &h);
+
  private:
+  // A FORMAT field written by the direct encoding, in output order after GT.
+  struct DirectFormatField {
+    enum Source {
+      // Values come from the VariantCall.info map.
+      kInfoMap,
+      // GL or PL computed from VariantCall.genotype_likelihood.
+      kGenotypeLikelihood,
+      kPhredScaledLikelihood,
+    };
+    int id;
+    int vcf_type;
+    Source source;
+    string tag;
+  };
+
+  // Encodes the FORMAT fields of variant_message into v->indiv. v must not
+  // have FORMAT fields yet.
+  ::nucleus::Status EncodeFormatDirect(
+      const nucleus::genomics::v1::Variant &variant_message, const bcf_hdr_t &h,
+      int ploidy, bcf1_t *v) const;
+
   // Lookup table for variant INFO fields adapters by VCF tag name.
   // The order of adapter definitions here determines the order of the fields
   // in a written VCF.
@@ -315,6 +350,13 @@ class VcfRecordConverter {
   // the info map with other FORMAT fields, rather than being special-cased as
   // first-class members of the proto.
   bool gl_and_pl_in_info_map_;
+
+  // State of the direct FORMAT encoding; gt_id_ is -1 while it is disabled.
+  int gt_id_ = -1;
+  std::vector<DirectFormatField> direct_format_fields_;
+  mutable std::vector<int32> int_buffer_;
+  mutable std::vector<float> float_buffer_;
+  mutable std::vector<const nucleus::genomics::v1::ListValue *> list_buffer_;
 };
 
 }  // namespace nucleus
@@ -34,6 +34,7 @@
 #include "third_party/nucleus/io/vcf_writer.h"
 
 #include <array>
+#include <chrono>  // NOLINT
 #include <cmath>
 #include <string>
 #include <utility>
@@ -89,7 +90,8 @@ class BCFRecord {
 
 StatusOr<std::unique_ptr<VcfWriter>> VcfWriter::ToFile(
     const string& variants_path, const nucleus::genomics::v1::VcfHeader& header,
-    const nucleus::genomics::v1::VcfWriterOptions& options) {
+    const nucleus::genomics::v1::VcfWriterOptions& options,
+    std::shared_ptr<HtsThreadPool> thread_pool) {
   const char* const open_mode = GetOpenMode(variants_path);
   htsFile* fp = hts_open_x(variants_path, open_mode);
   if (fp == nullptr) {
@@ -97,15 +99,20 @@ StatusOr<std::unique_ptr<VcfWriter>> VcfWriter::ToFile(
         absl ::StrCat("Could not open variants_path: ", variants_path));
   }
 
-  auto writer = absl::WrapUnique(new VcfWriter(header, options, fp));
+  auto writer = absl::WrapUnique(
+      new VcfWriter(header, options, fp, std::move(thread_pool)));
+  if (writer->thread_pool_) {
+    NUCLEUS_RETURN_IF_ERROR(writer->thread_pool_->Attach(fp));
+  }
   NUCLEUS_RETURN_IF_ERROR(writer->WriteHeader());
   return std::move(writer);
 }
 
 VcfWriter::VcfWriter(const nucleus::genomics::v1::VcfHeader& header,
                      const nucleus::genomics::v1::VcfWriterOptions& options,
-                     htsFile* fp)
+                     htsFile* fp, std::shared_ptr<HtsThreadPool> thread_pool)
     : fp_(fp),
+      thread_pool_(std::move(thread_pool)),
       options_(options),
       vcf_header_(header),
       record_converter_(
@@ -118,6 +125,9 @@ VcfWriter::VcfWriter(const nucleus::genomics::v1::VcfHeader& header,
   CHECK(fp != nullptr);
 
   NUCLEUS_CHECK_OK(VcfHeaderConverter::ConvertFromPb(vcf_header_, &header_));
+  if (!options_.disable_direct_format_encoding()) {
+    record_converter_.EnableDirectFormatEncoding(*header_);
+  }
 }
 
 ::nucleus::Status VcfWriter::WriteHeader() {
@@ -190,9 +200,23 @@ void SetVariantGenotype(const std::array<int, 2> genotype,
     double rounded_quality = floor(variant_message.quality() * 10 + 0.5) / 10;
     v.get_bcf1()->qual = rounded_quality;
   }
+  const auto write_start = std::chrono::steady_clock::now();
   if (bcf_write(fp_, header_, v.get_bcf1()) != 0) {
     return ::nucleus::Unknown("bcf_write call failed");
   }
+  stats_.write_seconds += std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - write_start)
+                              .count();
+  ++stats_.records;
+  if (fp_->format.format == bcf) {
+    // bcf_write writes a 32 byte fixed part, then the shared and per-sample
+    // data.
+    stats_.uncompressed_bytes +=
+        32 + v.get_bcf1()->shared.l + v.get_bcf1()->indiv.l;
+  } else {
+    // vcf_write formats the record into fp_->line.
+    stats_.uncompressed_bytes += fp_->line.l;
+  }
   return ::nucleus::Status();
 }
 
@@ -200,8 +224,14 @@ void SetVariantGenotype(const std::array<int, 2> genotype,
   if (fp_ == nullptr)
     return ::nucleus::FailedPrecondition(
         "Cannot close an already closed VcfWriter");
+  const auto close_start = std::chrono::steady_clock::now();
+  stats_.compressed_bytes = FlushAndGetCompressedSize(fp_);
   if (hts_close(fp_) < 0) return ::nucleus::Unknown("hts_close call failed");
   fp_ = nullptr;
+  stats_.write_seconds += std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - close_start)
+                              .count();
+  thread_pool_ = nullptr;
   bcf_hdr_destroy(header_);
   header_ = nullptr;
   return ::nucleus::Status();
@@ -39,6 +39,7 @@
 #include "htslib/hts.h"
 #include "htslib/sam.h"
 #include "htslib/vcf.h"
+#include "third_party/nucleus/io/hts_thread_pool.h"
 #include "third_party/nucleus/io/vcf_conversion.h"
 #include "third_party/nucleus/platform/types.h"
 #include "third_party/nucleus/protos/range.pb.h"
@@ -55,10 +56,14 @@ class VcfWriter {
   // Creates a new VcfWriter writing to the file at variants_path, which is
   // opened and created if needed. Returns either a unique_ptr to the VcfWriter
   // or a Status indicating why an error occurred.
+  //
+  // If the output is BGZF compressed and thread_pool is not null, the output
+  // is compressed on thread_pool, which may be shared with other writers.
   static StatusOr<std::unique_ptr<VcfWriter>> ToFile(
       const string& variants_path,
       const nucleus::genomics::v1::VcfHeader& header,
-      const nucleus::genomics::v1::VcfWriterOptions& options);
+      const nucleus::genomics::v1::VcfWriterOptions& options,
+      std::shared_ptr<HtsThreadPool> thread_pool = nullptr);
   ~VcfWriter();
 
   // Disable copy or assignment
@@ -97,6 +102,10 @@ class VcfWriter {
     return record_converter_;
   }
 
+  // Counters of the records written so far. compressed_bytes is set by
+  // Close().
+  const HtsWriterStats& Stats() const { return stats_; }
+
   // Infers htsFile open mode from the given file path.
   // Returns one of the following.
   //  "wb"  for compressed BCF if path ends with .bcf.gz;
@@ -109,13 +118,18 @@ class VcfWriter {
  private:
   VcfWriter(const nucleus::genomics::v1::VcfHeader& header,
             const nucleus::genomics::v1::VcfWriterOptions& options,
-            htsFile* fp);
+            htsFile* fp, std::shared_ptr<HtsThreadPool> thread_pool);
 
   ::nucleus::Status WriteHeader();
 
   // A pointer to the htslib file used to write the VCF data.
   htsFile* fp_;
 
+  // The pool compressing the output, if any. Must outlive fp_.
+  std::shared_ptr<HtsThreadPool> thread_pool_;
+
+  HtsWriterStats stats_;
+
   // The options controlling the behavior of this VcfWriter.
   const nucleus::genomics::v1::VcfWriterOptions options_;
 
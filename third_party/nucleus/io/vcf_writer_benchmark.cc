@@ -0,0 +1,175 @@
+/*
+ * Copyright 2024 Google LLC.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Throughput of VcfWriter on DeepVariant gVCF output: mostly reference blocks,
+// with a variant every 20 records, written to a bgzipped gVCF with and without
+// the direct FORMAT encoding. Each configuration writes 100M records.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "third_party/nucleus/io/vcf_writer.h"
+#include "third_party/nucleus/protos/variants.pb.h"
+#include "third_party/nucleus/testing/test_utils.h"
+#include "third_party/nucleus/util/utils.h"
+
+namespace nucleus {
+namespace {
+
+using genomics::v1::Variant;
+using genomics::v1::VariantCall;
+
+constexpr int kRecordsPerIteration = 1000000;
+constexpr int kIterations = 100;
+constexpr int kContigLength = 250000000;
+
+void AddFormat(const std::string& id, const std::string& number,
+               const std::string& type, genomics::v1::VcfHeader* header) {
+  auto* format = header->add_formats();
+  format->set_id(id);
+  format->set_number(number);
+  format->set_type(type);
+  format->set_description(id);
+}
+
+// The header postprocess_variants writes for a single sample gVCF.
+genomics::v1::VcfHeader GvcfHeader() {
+  genomics::v1::VcfHeader header;
+  auto* filter = header.add_filters();
+  filter->set_id("RefCall");
+  filter->set_description("Genotyping model thinks this site is reference.");
+  auto* end = header.add_infos();
+  end->set_id("END");
+  end->set_number("1");
+  end->set_type("Integer");
+  end->set_description("End position");
+  AddFormat("GT", "1", "String", &header);
+  AddFormat("GQ", "1", "Integer", &header);
+  AddFormat("DP", "1", "Integer", &header);
+  AddFormat("MIN_DP", "1", "Integer", &header);
+  AddFormat("AD", "R", "Integer", &header);
+  AddFormat("VAF", "A", "Float", &header);
+  AddFormat("PL", "G", "Integer", &header);
+  auto* contig = header.add_contigs();
+  contig->set_name("chr1");
+  contig->set_n_bases(kContigLength);
+  header.add_sample_names("NA12878");
+  return header;
+}
+
+// Sets the call of a 0/0 reference block over [start, start + length).
+void MakeReferenceBlock(int64_t start, int length, int depth, Variant* v) {
+  v->Clear();
+  v->set_reference_name("chr1");
+  v->set_start(start);
+  v->set_end(start + length);
+  v->set_reference_bases("A");
+  v->add_alternate_bases("<*>");
+  v->set_quality(0);
+  v->add_filter("RefCall");
+  VariantCall* call = v->add_calls();
+  call->set_call_set_name("NA12878");
+  call->add_genotype(0);
+  call->add_genotype(0);
+  call->add_genotype_likelihood(0);
+  call->add_genotype_likelihood(-1.5);
+  call->add_genotype_likelihood(-3.2);
+  SetInfoField("GQ", std::vector<int>{depth}, call);
+  SetInfoField("MIN_DP", std::vector<int>{depth}, call);
+}
+
+// Sets a heterozygous SNP at start.
+void MakeSnp(int64_t start, int depth, Variant* v) {
+  v->Clear();
+  v->set_reference_name("chr1");
+  v->set_start(start);
+  v->set_end(start + 1);
+  v->set_reference_bases("C");
+  v->add_alternate_bases("T");
+  v->add_alternate_bases("<*>");
+  v->set_quality(42.7);
+  v->add_filter("PASS");
+  VariantCall* call = v->add_calls();
+  call->set_call_set_name("NA12878");
+  call->add_genotype(0);
+  call->add_genotype(1);
+  for (double gl : {-4.1, -0.01, -6.5, -5.0, -7.0, -9.0}) {
+    call->add_genotype_likelihood(gl);
+  }
+  SetInfoField("GQ", std::vector<int>{41}, call);
+  SetInfoField("DP", std::vector<int>{depth}, call);
+  SetInfoField("AD", std::vector<int>{depth / 2, depth - depth / 2, 0}, call);
+  SetInfoField("VAF", std::vector<float>{0.5, 0}, call);
+}
+
+void BM_WriteGvcfRecords(benchmark::State& state) {
+  const bool direct = state.range(0);
+  genomics::v1::VcfWriterOptions options;
+  options.set_round_qual_values(true);
+  options.set_disable_direct_format_encoding(!direct);
+  std::unique_ptr<VcfWriter> writer =
+      std::move(VcfWriter::ToFile(MakeTempFile("benchmark.g.vcf.gz"),
+                                  GvcfHeader(), options)
+                    .ValueOrDie());
+
+  Variant v;
+  int64_t position = 0;
+  for (auto _ : state) {
+    for (int i = 0; i < kRecordsPerIteration; ++i) {
+      if (position + 100 >= kContigLength) position = 0;
+      if (i % 20 == 0) {
+        MakeSnp(position, 30 + i % 7, &v);
+        position += 1;
+      } else {
+        MakeReferenceBlock(position, 1 + i % 13, 20 + i % 11, &v);
+        position = v.end();
+      }
+      NUCLEUS_CHECK_OK(writer->Write(v));
+    }
+  }
+  NUCLEUS_CHECK_OK(writer->Close());
+  state.SetLabel(direct ? "direct" : "bcf_update_format");
+  state.SetItemsProcessed(state.iterations() * kRecordsPerIteration);
+  state.counters["bytes_in"] = writer->Stats().uncompressed_bytes;
+  state.counters["bytes_out"] = writer->Stats().compressed_bytes;
+}
+BENCHMARK(BM_WriteGvcfRecords)
+    ->Arg(0)
+    ->Arg(1)
+    ->Iterations(kIterations)
+    ->Unit(benchmark::kSecond);
+
+}  // namespace
+}  // namespace nucleus
@@ -43,7 +43,9 @@
 #include <gmock/gmock-more-matchers.h>
 
 #include "tensorflow/core/platform/test.h"
+#include "absl/strings/str_cat.h"
 #include "third_party/nucleus/core/status_matchers.h"
+#include "third_party/nucleus/io/hts_thread_pool.h"
 #include "third_party/nucleus/platform/types.h"
 #include "third_party/nucleus/protos/reference.pb.h"
 #include "third_party/nucleus/protos/variants.pb.h"
@@ -108,7 +110,9 @@ std::unique_ptr<VcfWriter> MakeDogVcfWriter(
     const string& fname, const bool round_qual, const bool include_gl = true,
     const std::vector<string>& excluded_infos = {},
     const std::vector<string>& excluded_formats = {},
-    bool exclude_header = false) {
+    bool exclude_header = false,
+    std::shared_ptr<HtsThreadPool> thread_pool = nullptr,
+    bool direct_format_encoding = true) {
   nucleus::genomics::v1::VcfHeader header;
   // FILTERs. Note that the PASS filter automatically gets added even though it
   // is not present here.
@@ -232,9 +236,11 @@ std::unique_ptr<VcfWriter> MakeDogVcfWriter(
   }
 
   writer_options.set_exclude_header(exclude_header);
+  writer_options.set_disable_direct_format_encoding(!direct_format_encoding);
 
   return std::move(
-      VcfWriter::ToFile(fname, header, writer_options).ValueOrDie());
+      VcfWriter::ToFile(fname, header, writer_options, std::move(thread_pool))
+          .ValueOrDie());
 }
 
 constexpr char kExpectedSomaticHeaderFmt[] =
@@ -701,6 +707,137 @@ TEST(VcfWriterTest, WritesGzippedVCF) {
               "VCF writer should be able to writed gzipped output");
 }
 
+TEST(VcfWriterTest, CompressesOnSharedThreadPool) {
+  std::shared_ptr<HtsThreadPool> thread_pool =
+      HtsThreadPool::Create(/*num_threads=*/3, /*queue_size=*/4).ValueOrDie();
+  const std::vector<string> filenames = {
+      MakeTempFile("single_threaded.vcf.gz"),
+      MakeTempFile("thread_pool_1.vcf.gz"),
+      MakeTempFile("thread_pool_2.vcf.gz")};
+  std::vector<std::unique_ptr<VcfWriter>> writers;
+  for (int i = 0; i < filenames.size(); ++i) {
+    writers.push_back(MakeDogVcfWriter(filenames[i], false, true, {}, {},
+                                       false, i > 0 ? thread_pool : nullptr));
+  }
+
+  // Enough records to fill many BGZF blocks.
+  constexpr int kNumRecords = 20000;
+  for (int i = 0; i < kNumRecords; ++i) {
+    Variant v = MakeVariant({absl::StrCat("DogSNP", i)}, "Chr1", i % 50,
+                            i % 50 + 1, "A", {"T"});
+    *v.add_calls() = MakeVariantCall("Fido", {0, 1});
+    *v.add_calls() = MakeVariantCall("Spot", {0, 0});
+    for (auto& writer : writers) {
+      ASSERT_THAT(writer->Write(v), IsOK());
+    }
+  }
+  for (auto& writer : writers) {
+    ASSERT_THAT(writer->Close(), IsOK());
+  }
+
+  string expected_contents;
+  TF_CHECK_OK(tensorflow::ReadFileToString(
+      tensorflow::Env::Default(), filenames[0], &expected_contents));
+  for (int i = 0; i < filenames.size(); ++i) {
+    string contents;
+    TF_CHECK_OK(tensorflow::ReadFileToString(tensorflow::Env::Default(),
+                                             filenames[i], &contents));
+    EXPECT_EQ(contents, expected_contents) << filenames[i];
+
+    const HtsWriterStats& stats = writers[i]->Stats();
+    EXPECT_EQ(stats.records, kNumRecords);
+    EXPECT_EQ(stats.uncompressed_bytes, writers[0]->Stats().uncompressed_bytes);
+    // Each record line is at least 36 characters long.
+    EXPECT_GE(stats.uncompressed_bytes, kNumRecords * 36);
+    // Only the 28 byte EOF marker is missing from the count.
+    EXPECT_EQ(stats.compressed_bytes + 28, contents.size());
+    EXPECT_LT(stats.compressed_bytes, stats.uncompressed_bytes);
+    EXPECT_GT(stats.write_seconds, 0);
+  }
+}
+
+TEST(VcfWriterTest, EncodesFormatFieldsDirectly) {
+  std::vector<Variant> variants;
+  // A SNP with every FORMAT field, missing AD for Spot and wide AD values.
+  Variant snp = MakeVariant({"DogSNP"}, "Chr1", 10, 11, "A", {"T"});
+  snp.set_quality(25.25);
+  snp.add_filter("PASS");
+  VariantCall* fido = snp.add_calls();
+  *fido = MakeVariantCall("Fido", {0, 1});
+  fido->mutable_genotype_likelihood()->Add(-3.5);
+  fido->mutable_genotype_likelihood()->Add(-0.01);
+  fido->mutable_genotype_likelihood()->Add(-7.25);
+  SetInfoField("GQ", std::vector<int>{35}, fido);
+  SetInfoField("DP", std::vector<int>{70012}, fido);
+  SetInfoField("AD", std::vector<int>{35000, 35012}, fido);
+  SetInfoField("VAF", std::vector<float>{0.5001}, fido);
+  VariantCall* spot = snp.add_calls();
+  *spot = MakeVariantCall("Spot", {0, 0});
+  spot->mutable_genotype_likelihood()->Add(0);
+  spot->mutable_genotype_likelihood()->Add(-2);
+  spot->mutable_genotype_likelihood()->Add(-4);
+  SetInfoField("GQ", std::vector<int>{20}, spot);
+  SetInfoField("DP", std::vector<int>{12}, spot);
+  variants.push_back(snp);
+
+  // A gVCF reference block; Spot has no likelihoods and a shorter genotype.
+  Variant block = MakeVariant({}, "Chr1", 20, 30, "C", {"<*>"});
+  block.set_quality(0);
+  block.add_filter("RefCall");
+  fido = block.add_calls();
+  *fido = MakeVariantCall("Fido", {0, 0});
+  fido->mutable_genotype_likelihood()->Add(0);
+  fido->mutable_genotype_likelihood()->Add(-1.5);
+  fido->mutable_genotype_likelihood()->Add(-3);
+  SetInfoField("GQ", std::vector<int>{15}, fido);
+  SetInfoField("MIN_DP", std::vector<int>{8}, fido);
+  spot = block.add_calls();
+  *spot = MakeVariantCall("Spot", {0});
+  SetInfoField("MIN_DP", std::vector<int>{3}, spot);
+  variants.push_back(block);
+
+  // A multi-allelic site with a phased genotype.
+  Variant multi = MakeVariant({}, "Chr2", 5, 7, "GA", {"G", "GAA"});
+  fido = multi.add_calls();
+  *fido = MakeVariantCall("Fido", {1, 2});
+  fido->set_is_phased(true);
+  SetInfoField("AD", std::vector<int>{1, 10, 11}, fido);
+  SetInfoField("VAF", std::vector<float>{0.4545, 0.5}, fido);
+  spot = multi.add_calls();
+  *spot = MakeVariantCall("Spot", {-1, -1});
+  variants.push_back(multi);
+
+  // A site without genotypes or FORMAT values.
+  Variant bare = MakeVariant({}, "Chr2", 12, 13, "T", {"C"});
+  *bare.add_calls() = MakeVariantCall("Fido", {});
+  *bare.add_calls() = MakeVariantCall("Spot", {});
+  variants.push_back(bare);
+
+  for (const string& suffix : {".vcf", ".bcf"}) {
+    std::vector<string> contents(2);
+    for (const bool direct : {false, true}) {
+      const string filename =
+          MakeTempFile(absl::StrCat(direct ? "direct" : "generic", suffix));
+      std::unique_ptr<VcfWriter> writer = MakeDogVcfWriter(
+          filename, false, true, {}, {}, false, nullptr, direct);
+      for (const Variant& v : variants) {
+        ASSERT_THAT(writer->Write(v), IsOK());
+      }
+      ASSERT_THAT(writer->Close(), IsOK());
+      TF_CHECK_OK(tensorflow::ReadFileToString(tensorflow::Env::Default(),
+                                               filename, &contents[direct]));
+    }
+    EXPECT_EQ(contents[true], contents[false]) << suffix;
+  }
+
+  // Ragged values are rejected as with bcf_update_format*.
+  std::unique_ptr<VcfWriter> writer =
+      MakeDogVcfWriter(MakeTempFile("ragged.vcf"), false);
+  Variant ragged = snp;
+  SetInfoField("AD", std::vector<int>{1, 2, 3}, ragged.mutable_calls(1));
+  EXPECT_THAT(writer->Write(ragged), IsNotOKWithMessage("values_per_sample"));
+}
+
 TEST(VcfWriterTest, HandlesRedefinedPL) {
   string output_filename = MakeTempFile("redefined_pl.vcf");
   nucleus::genomics::v1::VcfHeader header;